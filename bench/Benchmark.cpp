@@ -0,0 +1,94 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+
+Benchmark::Benchmark(const std::string &filter)
+: filter(filter) {
+
+}
+
+/**
+    Returns whether the benchmark with the given name is to be run, so that the caller can skip
+    preparing data for benchmarks that are not.
+*/
+bool Benchmark::selected(const std::string &name) const {
+    return name.find(filter) != std::string::npos;
+}
+
+/**
+    Calibrates the number of iterations of the given benchmark, runs its repetitions, and records
+    the median and fastest time per iteration. The result is also reported on stderr as it is
+    measured, since the whole run may take minutes.
+*/
+void Benchmark::run(const std::string &name, const std::vector<std::pair<std::string, uint64_t>> &params,
+    const BenchmarkFunction &function, uint64_t bytesPerIteration, uint64_t maxIterations) {
+    if (!selected(name)) {
+        return;
+    }
+
+    // Grow the iterations until a repetition is long enough to time reliably:
+    uint64_t iterations = 1;
+    uint64_t nanos = function(iterations);
+    while (nanos < BENCH_MIN_REPETITION_NS && iterations < maxIterations) {
+        uint64_t target = nanos == 0 ? iterations * 100 : (uint64_t)((double)iterations * BENCH_MIN_REPETITION_NS * 1.2 / (double)nanos);
+        iterations = std::min(maxIterations, std::max(iterations + 1, std::min(target, iterations * 100)));
+        nanos = function(iterations);
+    }
+
+    const int repetitions = nanos / iterations > 1000000000ULL ? BENCH_SLOW_REPETITIONS : BENCH_REPETITIONS;
+    std::vector<double> perIteration;
+    perIteration.push_back((double)nanos / (double)iterations);
+    for (int i = 1; i < repetitions; ++i) {
+        perIteration.push_back((double)function(iterations) / (double)iterations);
+    }
+    std::sort(perIteration.begin(), perIteration.end());
+
+    BenchmarkResult result { name, params, iterations, perIteration[perIteration.size() / 2], perIteration[0], bytesPerIteration };
+    results.push_back(result);
+
+    std::cerr << std::left << std::setw(28) << name;
+    for (const std::pair<std::string, uint64_t> &param : params) {
+        std::cerr << " " << param.first << "=" << param.second;
+    }
+    std::cerr << ": " << std::fixed << std::setprecision(1) << result.medianNs << " ns/op";
+    if (bytesPerIteration > 0) {
+        std::cerr << " (" << std::setprecision(1) << (double)bytesPerIteration / result.medianNs * 1e9 / (1 << 20) << " MiB/s)";
+    }
+    std::cerr << std::endl;
+}
+
+/**
+    Writes the results as one JSON object of the following form, from which the results of two
+    releases can be compared by name and params:
+
+    {"benchmarks": [{"name": ..., "params": {...}, "iterations": ..., "median_ns": ..., "min_ns": ...,
+        "bytes_per_second": ... (only if the benchmark has a throughput)}, ...]}
+*/
+void Benchmark::writeJson(std::ostream &outputStream) const {
+    outputStream << std::fixed << std::setprecision(1) << "{\"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkResult &result = results[i];
+        outputStream << (i == 0 ? "\n" : ",\n") << "  {\"name\": \"" << result.name << "\", \"params\": {";
+        for (size_t j = 0; j < result.params.size(); ++j) {
+            outputStream << (j == 0 ? "" : ", ") << "\"" << result.params[j].first << "\": " << result.params[j].second;
+        }
+        outputStream << "}, \"iterations\": " << result.iterations << ", \"median_ns\": " << result.medianNs
+            << ", \"min_ns\": " << result.minNs;
+        if (result.bytesPerIteration > 0) {
+            outputStream << ", \"bytes_per_second\": " << (double)result.bytesPerIteration / result.medianNs * 1e9;
+        }
+        outputStream << "}";
+    }
+    outputStream << "\n]}" << std::endl;
+}
+
+/**
+    Returns how long the given function takes to run, in nanoseconds.
+*/
+uint64_t Benchmark::timeNanos(const std::function<void()> &function) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    function();
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
@@ -0,0 +1,51 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <functional>
+#include <iostream>
+#include <cstdint>
+
+#define BENCH_MIN_REPETITION_NS 20000000ULL // iterations are added to a repetition until it takes this long
+#define BENCH_REPETITIONS 5 // repetitions of each benchmark, of which the median and the fastest are reported
+#define BENCH_SLOW_REPETITIONS 3 // repetitions of benchmarks whose single iteration takes over a second
+#define BENCH_MAX_ITERATIONS (1ULL << 30)
+
+/**
+    Runs 'iterations' iterations of the measured operation, and returns how long they took in
+    nanoseconds. Setup that must not be measured is done by the function itself, outside of the
+    time it returns (see Benchmark::timeNanos).
+*/
+typedef std::function<uint64_t(uint64_t iterations)> BenchmarkFunction;
+
+// The measurements of one benchmark:
+struct BenchmarkResult {
+    std::string name;
+    std::vector<std::pair<std::string, uint64_t>> params; // e.g. ("bytes", 1024) or ("accounts", 1000)
+    uint64_t iterations; // per repetition
+    double medianNs; // per iteration, over the repetitions
+    double minNs;
+    uint64_t bytesPerIteration; // 0 if the benchmark has no meaningful throughput
+};
+
+/**
+    Runs benchmarks and collects their results. The number of iterations of each benchmark is
+    raised until one repetition takes at least BENCH_MIN_REPETITION_NS (or maxIterations is
+    reached), and the repetitions are then run with that number of iterations.
+*/
+class Benchmark {
+public:
+    Benchmark(const std::string &filter);
+    bool selected(const std::string &name) const;
+    void run(const std::string &name, const std::vector<std::pair<std::string, uint64_t>> &params,
+        const BenchmarkFunction &function, uint64_t bytesPerIteration = 0, uint64_t maxIterations = BENCH_MAX_ITERATIONS);
+    void writeJson(std::ostream &outputStream) const;
+    static uint64_t timeNanos(const std::function<void()> &function);
+private:
+    std::string filter; // only benchmarks whose names contain this are run
+    std::vector<BenchmarkResult> results;
+};
+
+#endif
@@ -0,0 +1,105 @@
+#include "VaultGenerator.h"
+#include "Vault.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+
+static const char *services[] = {
+    "gmail", "outlook", "github", "gitlab", "aws", "azure", "slack", "zoom", "dropbox", "netflix",
+    "spotify", "amazon", "ebay", "paypal", "chase", "wellsfargo", "facebook", "twitter", "linkedin", "reddit",
+};
+
+static const char *groups[] = { "", "", "Email/", "Work/", "Work/Infra/", "Banking/", "Social/", "Shopping/" };
+
+static const char *domains[] = { "gmail.com", "outlook.com", "example.com", "corp.example.com", "proton.me" };
+
+static const std::string lowercase = "abcdefghijklmnopqrstuvwxyz";
+static const std::string printable = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789!@#$%^&*()-_=+[]{};:,.<>/?";
+static const std::string text = "abcdefghijklmnopqrstuvwxyz      0123456789.,";
+
+VaultGenerator::VaultGenerator(uint64_t seed)
+: random(seed), accountNumber(0) {
+    for (int i = 0; i < GENERATOR_SHARED_USERNAMES; ++i) {
+        sharedUsernames.push_back(randomEmail());
+    }
+}
+
+/**
+    Generates the next account. Tags are a service name with a unique number, often within a group
+    (e.g. Work/Infra/aws-1234). Most usernames are shared emails, passwords are 12 to 32 random
+    printable characters, and most accounts have no note.
+*/
+Account VaultGenerator::nextAccount() {
+    // Each random number is drawn in its own statement, so that the order in which they are drawn is defined:
+    std::string tag = groups[random() % (sizeof(groups) / sizeof(groups[0]))];
+    tag += services[random() % (sizeof(services) / sizeof(services[0]))];
+    tag += "-" + std::to_string(accountNumber++);
+    std::string username = (int)(random() % 100) < GENERATOR_SHARED_USERNAME_PERCENT
+        ? sharedUsernames[random() % sharedUsernames.size()] : randomEmail();
+    Account account(tag, username, randomString(12, 32, printable));
+
+    int noteKind = (int)(random() % 100);
+    if (noteKind < GENERATOR_LONG_NOTE_PERCENT) {
+        account.setNote(randomString(200, 2000, text));
+    } else if (noteKind < GENERATOR_LONG_NOTE_PERCENT + GENERATOR_SHORT_NOTE_PERCENT) {
+        account.setNote(randomString(10, 80, text));
+    }
+    return account;
+}
+
+/**
+    Writes a vault of numAccounts generated accounts to vaultDir/vaultName (replacing any vault
+    there), and returns the tags of its accounts in the order in which they were generated.
+*/
+std::vector<std::string> VaultGenerator::generateVault(const std::string &vaultDir, const std::string &vaultName, size_t numAccounts) {
+    std::remove((vaultDir + vaultName).c_str());
+    std::remove((vaultDir + JOURNAL_DIR + vaultName).c_str());
+    Result<std::unique_ptr<Vault>> vault = Vault::open(vaultDir, vaultName, unlock(), vaultDir + GENERATOR_LOCK_FILE_NAME);
+    if (!vault) {
+        std::cerr << "Error: " << clam_status_message(vault.error()) << std::endl;
+        exit(1);
+    }
+
+    std::vector<std::string> tags;
+    tags.reserve(numAccounts);
+    for (size_t i = 0; i < numAccounts; ++i) {
+        Account account = nextAccount();
+        tags.push_back(account.getTag());
+        (*vault)->addAccount(account.view());
+        account.wipeSensitiveData();
+    }
+
+    ClamStatus status = (*vault)->writeVault();
+    if (status != CLAM_OK) {
+        std::cerr << "Error: " << clam_status_message(status) << std::endl;
+        exit(1);
+    }
+    return tags;
+}
+
+/**
+    Returns a context for the key of generated vaults. The key is derived with a single PBKDF2
+    iteration, since benchmarks of vault operations should not measure the KDF.
+*/
+std::unique_ptr<CryptoContext> VaultGenerator::unlock() {
+    static const unsigned char salt[SKEY_LENGTH] = { 0 };
+    Result<std::unique_ptr<CryptoContext>> crypto = CryptoContext::create(GENERATOR_VAULT_KEY, salt, KdfParams { KDF_PBKDF2_SHA256, 1, 0, 0 });
+    if (!crypto) {
+        std::cerr << "Error: " << clam_status_message(crypto.error()) << std::endl;
+        exit(1);
+    }
+    return std::move(*crypto);
+}
+
+std::string VaultGenerator::randomString(size_t minSize, size_t maxSize, const std::string &alphabet) {
+    std::string result(minSize + random() % (maxSize - minSize + 1), ' ');
+    for (char &c : result) {
+        c = alphabet[random() % alphabet.size()];
+    }
+    return result;
+}
+
+std::string VaultGenerator::randomEmail() {
+    return randomString(4, 16, lowercase) + "@" + domains[random() % (sizeof(domains) / sizeof(domains[0]))];
+}
@@ -0,0 +1,40 @@
+#ifndef VAULT_GENERATOR_H
+#define VAULT_GENERATOR_H
+
+#include "Account.h"
+#include "CryptoContext.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <random>
+#include <cstdint>
+
+#define GENERATOR_SHARED_USERNAMES 200 // usernames (e.g. personal and work emails) that many accounts share
+#define GENERATOR_SHARED_USERNAME_PERCENT 60
+#define GENERATOR_SHORT_NOTE_PERCENT 25 // e.g. security questions; the rest have no note...
+#define GENERATOR_LONG_NOTE_PERCENT 5 // ...or a long one (e.g. recovery codes)
+#define GENERATOR_VAULT_KEY "clam-bench-key"
+#define GENERATOR_LOCK_FILE_NAME ".lock" // write lock of the generated vaults, in their directory (vault names
+                                         // cannot begin with '.')
+
+/**
+    Generates synthetic accounts with a realistic distribution of field sizes, and vaults of them.
+    The accounts generated from the same seed are always the same, so that benchmark runs of
+    different releases measure the same vaults.
+*/
+class VaultGenerator {
+public:
+    VaultGenerator(uint64_t seed);
+    Account nextAccount();
+    std::vector<std::string> generateVault(const std::string &vaultDir, const std::string &vaultName, size_t numAccounts);
+    static std::unique_ptr<CryptoContext> unlock();
+private:
+    std::string randomString(size_t minSize, size_t maxSize, const std::string &alphabet);
+    std::string randomEmail();
+    std::mt19937_64 random;
+    std::vector<std::string> sharedUsernames;
+    uint64_t accountNumber; // keeps generated tags unique
+};
+
+#endif
@@ -0,0 +1,313 @@
+#include "Benchmark.h"
+#include "VaultGenerator.h"
+#include "Vault.h"
+#include "Utils.h"
+
+#include <filesystem>
+#include <algorithm>
+#include <random>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstdio>
+
+/*
+    clam_bench: microbenchmarks of the crypto, serialization and vault I/O of libclam. Progress is
+    reported on stderr, and the results are printed to stdout as JSON (see Benchmark::writeJson),
+    so that the results of two releases can be compared.
+
+    Usage:
+        clam_bench [--filter <substring>] [--max-accounts <n>] [--dir <scratch-dir>]
+
+    Options:
+        --filter=substring          Only run the benchmarks whose names contain the substring.
+        --max-accounts=n            Skip vault benchmarks of vaults with more than n accounts (default: 1000000).
+        --dir=scratch-dir           Directory in which generated vaults are written (default: a new directory in /tmp).
+*/
+
+#define BENCH_SEED 64 // seed of the generated accounts and vaults
+#define BENCH_SAMPLE_ACCOUNTS 1024 // accounts that serialization and parsing benchmarks cycle through
+
+static const uint64_t hashSizes[] = { 32, 1 << 10, 1 << 20 };
+static const uint64_t cipherSizes[] = { 1 << 10, 16 << 10, 256 << 10, 4 << 20, 64 << 20 };
+static const uint64_t vaultSizes[] = { 10, 1000, 100000, 1000000 };
+static const CipherSuite cipherSuites[] = { CIPHER_SUITE_TWOFISH_CTR, CIPHER_SUITE_AES_256_GCM, CIPHER_SUITE_CHACHA20_POLY1305 };
+
+void benchHashing(Benchmark &benchmark);
+void benchCiphers(Benchmark &benchmark);
+void benchAccounts(Benchmark &benchmark);
+void benchVaults(Benchmark &benchmark, const std::string &vaultDir, uint64_t maxAccounts);
+std::unique_ptr<Vault> openVault(const std::string &vaultDir, const std::string &vaultName);
+void check(bool succeeded, const std::string &operation);
+void handleInvalidArguments(const std::string &errorDetails);
+
+int main(int argc, char *argv[]) {
+    std::string filter;
+    uint64_t maxAccounts = vaultSizes[sizeof(vaultSizes) / sizeof(vaultSizes[0]) - 1];
+    std::string scratchDir;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 == argc) {
+            handleInvalidArguments(arg + " requires a value.");
+        } else if (arg == "--filter") {
+            filter = argv[++i];
+        } else if (arg == "--max-accounts") {
+            char *end;
+            maxAccounts = std::strtoull(argv[++i], &end, 10);
+            if (*end != '\0') {
+                handleInvalidArguments("--max-accounts must be a number.");
+            }
+        } else if (arg == "--dir") {
+            scratchDir = argv[++i];
+        } else {
+            handleInvalidArguments("Unknown option " + arg + ".");
+        }
+    }
+
+    bool removeScratchDir = scratchDir.empty();
+    if (removeScratchDir) {
+        char dirTemplate[] = "/tmp/clam_bench.XXXXXX";
+        check(mkdtemp(dirTemplate) != nullptr, "create a scratch directory");
+        scratchDir = dirTemplate;
+    }
+    const std::string vaultDir = scratchDir + "/vaults/";
+    std::filesystem::create_directories(vaultDir);
+
+    Benchmark benchmark(filter);
+    benchHashing(benchmark);
+    benchCiphers(benchmark);
+    benchAccounts(benchmark);
+    benchVaults(benchmark, vaultDir, maxAccounts);
+    benchmark.writeJson(std::cout);
+
+    if (removeScratchDir) {
+        std::filesystem::remove_all(scratchDir);
+    }
+}
+
+/**
+    Benchmarks Utils::sha256 and verifying a vault key against its stored hash.
+*/
+void benchHashing(Benchmark &benchmark) {
+    for (uint64_t size : hashSizes) {
+        std::vector<unsigned char> input(size, 'x');
+        unsigned char hash[SKEY_LENGTH];
+        benchmark.run("sha256", { { "bytes", size } }, [&](uint64_t iterations) {
+            return Benchmark::timeNanos([&]() {
+                for (uint64_t i = 0; i < iterations; ++i) {
+                    Utils::sha256(hash, input.data(), (unsigned long)input.size());
+                }
+            });
+        }, size);
+    }
+
+    if (benchmark.selected("verify_key")) {
+        std::unique_ptr<CryptoContext> crypto = VaultGenerator::unlock();
+        unsigned char salt[SKEY_LENGTH] = { 1 };
+        unsigned char keyHash[SKEY_LENGTH];
+        crypto->computeKeyHash(salt, keyHash);
+        benchmark.run("verify_key", {}, [&](uint64_t iterations) {
+            return Benchmark::timeNanos([&]() {
+                for (uint64_t i = 0; i < iterations; ++i) {
+                    check(crypto->verifyKey(salt, keyHash), "verify the key");
+                }
+            });
+        });
+    }
+}
+
+/**
+    Benchmarks encrypting and decrypting buffers of 1 KiB to 64 MiB with each cipher suite.
+    Decryption includes verifying the tag of authenticated suites.
+*/
+void benchCiphers(Benchmark &benchmark) {
+    std::unique_ptr<CryptoContext> crypto = VaultGenerator::unlock();
+    for (CipherSuite suite : cipherSuites) {
+        const std::string suiteName = CryptoContext::cipherSuiteName(suite);
+        if (!benchmark.selected("encrypt/" + suiteName) && !benchmark.selected("decrypt/" + suiteName)) {
+            continue;
+        }
+        check(crypto->setCipherSuite(suite), "set the cipher suite");
+
+        for (uint64_t size : cipherSizes) {
+            std::vector<unsigned char> plaintext(size, 'x');
+            std::vector<unsigned char> ciphertext(size + crypto->getOverhead());
+            unsigned char iv[SKEY_LENGTH];
+            benchmark.run("encrypt/" + suiteName, { { "bytes", size } }, [&](uint64_t iterations) {
+                return Benchmark::timeNanos([&]() {
+                    for (uint64_t i = 0; i < iterations; ++i) {
+                        check(crypto->encrypt(plaintext.data(), ciphertext.data(), size, iv), "encrypt");
+                    }
+                });
+            }, size);
+
+            check(crypto->encrypt(plaintext.data(), ciphertext.data(), size, iv), "encrypt");
+            benchmark.run("decrypt/" + suiteName, { { "bytes", size } }, [&](uint64_t iterations) {
+                return Benchmark::timeNanos([&]() {
+                    for (uint64_t i = 0; i < iterations; ++i) {
+                        check(crypto->decrypt(ciphertext.data(), plaintext.data(), ciphertext.size(), iv), "decrypt");
+                    }
+                });
+            }, size);
+        }
+    }
+}
+
+/**
+    Benchmarks serializing accounts, parsing serialized accounts into views, and materializing
+    Accounts from those views, cycling through a sample of generated accounts.
+*/
+void benchAccounts(Benchmark &benchmark) {
+    VaultGenerator generator(BENCH_SEED);
+    std::vector<Account> accounts;
+    std::vector<std::vector<uint8_t>> serializedAccounts;
+    uint64_t totalSize = 0;
+    for (int i = 0; i < BENCH_SAMPLE_ACCOUNTS; ++i) {
+        accounts.push_back(generator.nextAccount());
+        serializedAccounts.push_back(accounts.back().serialize());
+        totalSize += serializedAccounts.back().size();
+    }
+    const uint64_t averageSize = totalSize / BENCH_SAMPLE_ACCOUNTS;
+
+    benchmark.run("account_serialize", {}, [&](uint64_t iterations) {
+        return Benchmark::timeNanos([&]() {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                std::vector<uint8_t> serialized = accounts[i % BENCH_SAMPLE_ACCOUNTS].serialize();
+                check(!serialized.empty(), "serialize an account");
+            }
+        });
+    }, averageSize);
+
+    benchmark.run("account_parse", {}, [&](uint64_t iterations) {
+        return Benchmark::timeNanos([&]() {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                const std::vector<uint8_t> &serialized = serializedAccounts[i % BENCH_SAMPLE_ACCOUNTS];
+                const unsigned char *iter = serialized.data();
+                AccountView view;
+                check(AccountView::parse(&iter, serialized.data() + serialized.size(), view), "parse an account");
+            }
+        });
+    }, averageSize);
+
+    benchmark.run("account_materialize", {}, [&](uint64_t iterations) {
+        return Benchmark::timeNanos([&]() {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                const std::vector<uint8_t> &serialized = serializedAccounts[i % BENCH_SAMPLE_ACCOUNTS];
+                const unsigned char *iter = serialized.data();
+                AccountView view;
+                AccountView::parse(&iter, serialized.data() + serialized.size(), view);
+                Account account(view);
+                check(!account.getTag().empty(), "materialize an account");
+            }
+        });
+    }, averageSize);
+}
+
+/**
+    Benchmarks loading generated vaults of 10 to maxAccounts accounts, getting accounts from a loaded
+    vault (each of which is decrypted for the first time), writing one changed account (which appends
+    it to the journal), and compacting the whole vault into a new vault file.
+*/
+void benchVaults(Benchmark &benchmark, const std::string &vaultDir, uint64_t maxAccounts) {
+    if (!benchmark.selected("vault_load") && !benchmark.selected("vault_get_account")
+        && !benchmark.selected("vault_write") && !benchmark.selected("vault_compact")) {
+        return;
+    }
+
+    for (uint64_t numAccounts : vaultSizes) {
+        if (numAccounts > maxAccounts) {
+            break;
+        }
+        const std::string vaultName = "vault" + std::to_string(numAccounts);
+        const std::string journalFilePath = vaultDir + JOURNAL_DIR + vaultName;
+        std::cerr << "Generating a vault of " << numAccounts << " accounts..." << std::endl;
+        VaultGenerator generator(BENCH_SEED);
+        std::vector<std::string> tags = generator.generateVault(vaultDir, vaultName, numAccounts);
+
+        // The tags are visited in a random (but fixed) order, so that records are not read sequentially:
+        std::vector<std::string> shuffledTags = tags;
+        std::shuffle(shuffledTags.begin(), shuffledTags.end(), std::mt19937_64(BENCH_SEED));
+
+        benchmark.run("vault_load", { { "accounts", numAccounts } }, [&](uint64_t iterations) {
+            uint64_t nanos = 0;
+            for (uint64_t i = 0; i < iterations; ++i) {
+                // Deriving the key and wiping the vault afterwards are not part of loading it:
+                std::unique_ptr<CryptoContext> crypto = VaultGenerator::unlock();
+                std::unique_ptr<Vault> vault;
+                nanos += Benchmark::timeNanos([&]() {
+                    Result<std::unique_ptr<Vault>> loadedVault = Vault::open(vaultDir, vaultName, std::move(crypto), vaultDir + GENERATOR_LOCK_FILE_NAME);
+                    check(loadedVault.has_value(), "load the vault");
+                    vault = std::move(*loadedVault);
+                });
+            }
+            return nanos;
+        });
+
+        // Every account is only decrypted by its first get, so a vault serves at most numAccounts iterations:
+        benchmark.run("vault_get_account", { { "accounts", numAccounts } }, [&](uint64_t iterations) {
+            std::unique_ptr<Vault> vault = openVault(vaultDir, vaultName);
+            return Benchmark::timeNanos([&]() {
+                for (uint64_t i = 0; i < iterations; ++i) {
+                    check(vault->getAccountView(shuffledTags[i]).has_value(), "get an account");
+                }
+            });
+        }, 0, numAccounts);
+
+        // The journal is folded into the vault file once it has JOURNAL_COMPACTION_ENTRIES entries, so
+        // each run starts without a journal, and stops before it would be compacted:
+        benchmark.run("vault_write", { { "accounts", numAccounts } }, [&](uint64_t iterations) {
+            std::remove(journalFilePath.c_str());
+            std::unique_ptr<Vault> vault = openVault(vaultDir, vaultName);
+            uint64_t nanos = 0;
+            for (uint64_t i = 0; i < iterations; ++i) {
+                Result<AccountView> view = vault->getAccountView(shuffledTags[i % numAccounts]);
+                check(view.has_value(), "get an account");
+                Account account(*view);
+                account.setPassword("new-password-" + std::to_string(i));
+                check(vault->updateAccount(account.view()) == CLAM_OK, "update an account");
+                nanos += Benchmark::timeNanos([&]() {
+                    check(vault->writeVault() == CLAM_OK, "write the vault");
+                });
+            }
+            std::remove(journalFilePath.c_str());
+            return nanos;
+        }, 0, JOURNAL_COMPACTION_ENTRIES - 1);
+
+        benchmark.run("vault_compact", { { "accounts", numAccounts } }, [&](uint64_t iterations) {
+            std::unique_ptr<Vault> vault = openVault(vaultDir, vaultName);
+            return Benchmark::timeNanos([&]() {
+                for (uint64_t i = 0; i < iterations; ++i) {
+                    check(vault->compact() == CLAM_OK, "compact the vault");
+                }
+            });
+        });
+
+        std::remove((vaultDir + vaultName).c_str());
+    }
+}
+
+/**
+    Opens the generated vault with the given name.
+*/
+std::unique_ptr<Vault> openVault(const std::string &vaultDir, const std::string &vaultName) {
+    Result<std::unique_ptr<Vault>> vault = Vault::open(vaultDir, vaultName, VaultGenerator::unlock(), vaultDir + GENERATOR_LOCK_FILE_NAME);
+    check(vault.has_value(), "load the vault");
+    return std::move(*vault);
+}
+
+/**
+    Exits if an operation that is benchmarked failed, since its measurements would be meaningless.
+*/
+void check(bool succeeded, const std::string &operation) {
+    if (!succeeded) {
+        std::cerr << "Error: Failed to " << operation << "." << std::endl;
+        exit(1);
+    }
+}
+
+void handleInvalidArguments(const std::string &errorDetails) {
+    std::cerr << "Error: " << errorDetails << std::endl
+        << "Usage: clam_bench [--filter <substring>] [--max-accounts <n>] [--dir <scratch-dir>]" << std::endl;
+    exit(1);
+}
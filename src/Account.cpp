@@ -1,5 +1,6 @@
 #include "Account.h"
 #include "Utils.h"
+#include "Stats.h"
 
 #include <cstring>
 #include <fstream>
@@ -21,65 +22,23 @@ Account::Account(const std::string &tag, const std::string &un, const std::strin
 }
 
 /**
-    Constructs an Account from a serialized Account.
-    The provided pointer will be moved to point to the end
-    of the loaded Account.
+    Materializes an Account from a view of a serialized Account by copying each of its fields.
 */
-Account::Account(unsigned char **serializedAccount) {
-    uint32_t size = **(uint32_t **)serializedAccount;
-    *serializedAccount += 4; // advance past tag size
-    tag.reserve(size);
-    for (uint32_t i = 0; i < size; ++i) {
-        tag += (*serializedAccount)[i];
-    }
-    *serializedAccount += size; // advance past tag
-
-    size = **(uint32_t **)serializedAccount;
-    *serializedAccount += 4; // advance past username size
-    username.reserve(size);
-    for (uint32_t i = 0; i < size; ++i) {
-        username += (*serializedAccount)[i];
-    }
-    *serializedAccount += size; // advance username tag
-
-    size = **(uint32_t **)serializedAccount;
-    *serializedAccount += 4; // advance past password size
-    password.reserve(size);
-    for (uint32_t i = 0; i < size; ++i) {
-        password += (*serializedAccount)[i];
-    }
-    *serializedAccount += size; // advance password tag
-
-    size = **(uint32_t **)serializedAccount;
-    *serializedAccount += 4; // advance past note size
-    note.reserve(size);
-    for (uint32_t i = 0; i < size; ++i) {
-        note += (*serializedAccount)[i];
-    }
-    *serializedAccount += size; // advance past note
+Account::Account(const AccountView &view)
+: tag(view.tag), username(view.username), password(view.password), note(view.note) {
+    Stats::count(STATS_PLAINTEXT_COPIED, tag.size() + username.size() + password.size() + note.size());
 }
 
 /**
-    Reads a new account with the given tag from the given unencrypted file.
-    Returns true if an account was successfully parsed from the specified
-    file and false otherwise.
+    Reads a new account with the given tag from the given unencrypted file: its username on the
+    first line, its password on the second and its note on the rest. Returns CLAM_ERROR_READ if
+    the file cannot be read or holds no username and password.
 */
-bool Account::loadFromFile(const std::string &filePath) {
+ClamStatus Account::loadFromFile(const std::string &filePath) {
     std::ifstream fileStream(filePath);
 
-    if (!fileStream) {
-        std::cout << "Error: Failed to load account from file." << std::endl;
-        return false;
-    }
-
-    if (!getline(fileStream, username)) {
-        std::cout << "Error: Failed to load account from file." << std::endl;
-        return false;
-    }
-
-    if (!getline(fileStream, password)) {
-        std::cout << "Error: Failed to load account from file." << std::endl;
-        return false;
+    if (!fileStream || !getline(fileStream, username) || !getline(fileStream, password)) {
+        return CLAM_ERROR_READ;
     }
 
     std::string nextLine;
@@ -87,31 +46,39 @@ bool Account::loadFromFile(const std::string &filePath) {
         note += nextLine + '\n';
     }
 
-    note.erase(note.size() - 1); // remove the trailing newline character
+    if (!note.empty()) {
+        note.erase(note.size() - 1); // remove the trailing newline character
+    }
 
     fileStream.close();
 
-    return true;
+    return CLAM_OK;
 }
 
-std::string Account::getTag() const {
+/**
+    Returns a view of this Account's fields, which is valid until the Account is modified or destroyed.
+*/
+AccountView Account::view() const {
+    return AccountView { tag, username, password, note };
+}
+
+const std::string &Account::getTag() const {
     return tag;
 }
 
-std::string Account::getUsername() const {
+const std::string &Account::getUsername() const {
     return username;
 }
 
-std::string Account::getPassword() const {
+const std::string &Account::getPassword() const {
     return password;
 }
 
-std::string Account::getNote() const {
+const std::string &Account::getNote() const {
     return note;
 }
 
 void Account::setUsername(const std::string &un) {
-    std::cout << "un: " << un << std::endl;
     username = un;
 }
 
@@ -127,20 +94,7 @@ void Account::setNote(const std::string &n) {
     Stores and returns a serialized version of this object as a byte vector.
 */
 std::vector<uint8_t> Account::serialize() const {
-    std::vector<uint8_t> serialized;
-    uint32_t tagSize = (uint32_t)tag.size(),
-        usernameSize = (uint32_t)username.size(),
-        passwordSize = (uint32_t)password.size(),
-        noteSize = (uint32_t)note.size();
-    serialized.insert(serialized.end(), (char *)&tagSize, (char *)&tagSize + sizeof(tagSize));
-    serialized.insert(serialized.end(), tag.c_str(), tag.c_str() + tagSize);
-    serialized.insert(serialized.end(), (char *)&usernameSize, (char *)&usernameSize + sizeof(usernameSize));
-    serialized.insert(serialized.end(), username.c_str(), username.c_str() + usernameSize);
-    serialized.insert(serialized.end(), (char *)&passwordSize, (char *)&passwordSize + sizeof(passwordSize));
-    serialized.insert(serialized.end(), password.c_str(), password.c_str() + passwordSize);
-    serialized.insert(serialized.end(), (char *)&noteSize, (char *)&noteSize + sizeof(noteSize));
-    serialized.insert(serialized.end(), note.c_str(), note.c_str() + noteSize);
-    return serialized;
+    return view().serialize();
 }
 
 /**
@@ -152,3 +106,83 @@ void Account::wipeSensitiveData() {
     Utils::clearString(password);
     Utils::clearString(note);
 }
+
+/**
+    Reads one length-prefixed field of a serialized Account into 'field' and advances the provided
+    pointer past it. Returns false if the field does not fit between the pointer and 'end'.
+*/
+static bool parseField(const unsigned char **serializedAccount, const unsigned char *end, std::string_view &field) {
+    uint32_t size;
+    if ((size_t)(end - *serializedAccount) < sizeof(size)) {
+        return false;
+    }
+    std::memcpy(&size, *serializedAccount, sizeof(size)); // the size may not be aligned
+    *serializedAccount += sizeof(size);
+
+    if ((size_t)(end - *serializedAccount) < size) {
+        return false;
+    }
+    field = std::string_view((const char *)*serializedAccount, size);
+    *serializedAccount += size;
+    return true;
+}
+
+/**
+    Parses a serialized Account (as produced by Account::serialize) into a view whose fields point
+    into the serialized buffer. The provided pointer will be moved to point to the end of the
+    parsed Account. Returns false if the serialized Account would extend past 'end'.
+*/
+bool AccountView::parse(const unsigned char **serializedAccount, const unsigned char *end, AccountView &view) {
+    return parseField(serializedAccount, end, view.tag)
+        && parseField(serializedAccount, end, view.username)
+        && parseField(serializedAccount, end, view.password)
+        && parseField(serializedAccount, end, view.note);
+}
+
+/**
+    Returns whether the viewed Accounts have the same tag, username, password and note.
+*/
+bool AccountView::operator==(const AccountView &other) const {
+    return tag == other.tag && username == other.username && password == other.password && note == other.note;
+}
+
+bool AccountView::operator!=(const AccountView &other) const {
+    return !(*this == other);
+}
+
+/**
+    Returns the size (in bytes) of the serialized version of the viewed Account.
+*/
+size_t AccountView::serializedSize() const {
+    return 4 * sizeof(uint32_t) + tag.size() + username.size() + password.size() + note.size();
+}
+
+/**
+    Stores a serialized version of the viewed Account in the given buffer, which must hold
+    serializedSize() bytes. The serialized Account is of the following format:
+
+    <repeated for the tag, username, password, and note>:
+        uint32: s = size of the field (in bytes)
+        s bytes: field
+*/
+void AccountView::serializeTo(unsigned char *serialized) const {
+    ScopedTimer timer(STATS_SERIALIZE);
+    unsigned char *serializedIter = serialized;
+    for (const std::string_view &field : { tag, username, password, note }) {
+        uint32_t fieldSize = (uint32_t)field.size();
+        std::memcpy(serializedIter, &fieldSize, sizeof(fieldSize));
+        serializedIter += sizeof(fieldSize);
+        std::memcpy(serializedIter, field.data(), fieldSize);
+        serializedIter += fieldSize;
+    }
+    Stats::count(STATS_PLAINTEXT_COPIED, serializedIter - serialized);
+}
+
+/**
+    Stores and returns a serialized version of the viewed Account (see serializeTo) as a byte vector.
+*/
+std::vector<uint8_t> AccountView::serialize() const {
+    std::vector<uint8_t> serialized(serializedSize());
+    serializeTo(serialized.data());
+    return serialized;
+}
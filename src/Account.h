@@ -2,18 +2,41 @@
 #define ACCOUNT_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "Status.h"
+
+/**
+    A read-only view of a serialized Account whose fields point directly into the buffer it was
+    parsed from (typically a Vault's decrypted plaintext), so that no field is copied. A view is
+    only valid for as long as the memory it points into.
+*/
+struct AccountView {
+    std::string_view tag;
+    std::string_view username;
+    std::string_view password;
+    std::string_view note;
+
+    bool operator==(const AccountView &other) const;
+    bool operator!=(const AccountView &other) const;
+    size_t serializedSize() const;
+    void serializeTo(unsigned char *serialized) const;
+    std::vector<uint8_t> serialize() const;
+    static bool parse(const unsigned char **serializedAccount, const unsigned char *end, AccountView &view);
+};
+
 class Account {
 public:
     Account(const std::string &tag);
     Account(const std::string &tag, const std::string &un, const std::string &pw);
-    Account(unsigned char **serializedAccount);
-    bool loadFromFile(const std::string &filePath);
-    std::string getTag() const;
-    std::string getUsername() const;
-    std::string getPassword() const;
-    std::string getNote() const;
+    Account(const AccountView &view);
+    ClamStatus loadFromFile(const std::string &filePath);
+    AccountView view() const;
+    const std::string &getTag() const;
+    const std::string &getUsername() const;
+    const std::string &getPassword() const;
+    const std::string &getNote() const;
     void setUsername(const std::string &un);
     void setPassword(const std::string &pw);
     void setNote(const std::string &n);
@@ -0,0 +1,529 @@
+#include "AccountStream.h"
+#include "Utils.h"
+
+#include <cctype>
+
+// Names of the account fields, in the order in which they are exported:
+static const char *const ACCOUNT_FIELD_NAMES[] = { "tag", "username", "password", "note" };
+static const int ACCOUNT_FIELD_COUNT = 4;
+
+/**
+    Returns the index of the account field with the given name, or -1 if there is none.
+*/
+static int findField(const std::string &name) {
+    for (int field = 0; field < ACCOUNT_FIELD_COUNT; ++field) {
+        if (name == ACCOUNT_FIELD_NAMES[field]) {
+            return field;
+        }
+    }
+    return -1;
+}
+
+/**
+    Creates an Account from its field values, wiping the values.
+*/
+static Account makeAccount(std::string values[ACCOUNT_FIELD_COUNT]) {
+    Account account(values[0], values[1], values[2]);
+    account.setNote(values[3]);
+    for (int field = 0; field < ACCOUNT_FIELD_COUNT; ++field) {
+        Utils::clearString(values[field]);
+    }
+    return account;
+}
+
+AccountReader::AccountReader(std::istream &input, AccountFormat format)
+: input(input.rdbuf()), format(format), started(false), finished(false), recordNumber(0) {
+
+}
+
+/**
+    Returns the next account of the stream, or std::nullopt once the stream has
+    ended or is malformed (in which case failed returns true).
+*/
+std::optional<Account> AccountReader::next() {
+    if (finished || failed()) {
+        return std::nullopt;
+    }
+    return format == FORMAT_CSV ? nextCsv() : nextJson();
+}
+
+/**
+    Returns whether the stream is malformed, as described by getError.
+*/
+bool AccountReader::failed() const {
+    return !error.empty();
+}
+
+const std::string &AccountReader::getError() const {
+    return error;
+}
+
+/**
+    Returns the format with the given name (csv or json), if there is one.
+*/
+std::optional<AccountFormat> AccountReader::findFormat(const std::string &name) {
+    if (name == "csv") {
+        return FORMAT_CSV;
+    } else if (name == "json") {
+        return FORMAT_JSON;
+    }
+    return std::nullopt;
+}
+
+/**
+    Records the given error, and returns false.
+*/
+bool AccountReader::fail(const std::string &message) {
+    if (error.empty()) {
+        error = message;
+    }
+    return false;
+}
+
+/**
+    Reads the next record (which may span lines within quoted fields) into 'fields.'
+    Returns false at the end of the stream, or if the record is malformed.
+*/
+bool AccountReader::readCsvRecord(std::vector<std::string> &fields) {
+    for (std::string &field : fields) {
+        Utils::clearString(field);
+    }
+    fields.assign(1, "");
+
+    int c = input->sbumpc();
+    if (c == EOF) {
+        return false;
+    }
+
+    bool quoted = false;
+    bool fieldStart = true;
+    for (; c != EOF; c = input->sbumpc()) {
+        if (quoted) {
+            if (c != '"') {
+                fields.back() += (char)c;
+            } else if (input->sgetc() == '"') {
+                fields.back() += '"';
+                input->sbumpc();
+            } else {
+                quoted = false;
+            }
+        } else if (c == '"' && fieldStart) {
+            quoted = true;
+        } else if (c == ',') {
+            fields.emplace_back();
+            fieldStart = true;
+            continue;
+        } else if (c == '\n') {
+            return true;
+        } else if (c == '\r' && input->sgetc() == '\n') {
+            input->sbumpc();
+            return true;
+        } else {
+            fields.back() += (char)c;
+        }
+        fieldStart = false;
+    }
+
+    if (quoted) {
+        return fail("Record " + std::to_string(recordNumber + 1) + " has an unterminated quoted field.");
+    }
+    return true;
+}
+
+/**
+    Returns the account of the next non-empty CSV record, reading the header row first.
+*/
+std::optional<Account> AccountReader::nextCsv() {
+    std::vector<std::string> fields;
+    if (!started) {
+        started = true;
+        if (!readCsvRecord(fields)) {
+            fail("The CSV file has no header row.");
+            return std::nullopt;
+        }
+        if (fields[0].compare(0, 3, "\xEF\xBB\xBF") == 0) {
+            fields[0].erase(0, 3); // byte order mark
+        }
+        bool hasTag = false;
+        for (std::string &name : fields) {
+            for (char &c : name) {
+                c = (char)std::tolower((unsigned char)c);
+            }
+            csvColumns.push_back(findField(name));
+            hasTag = hasTag || csvColumns.back() == 0;
+        }
+        if (!hasTag) {
+            fail("The CSV header has no tag column.");
+            return std::nullopt;
+        }
+    }
+
+    while (readCsvRecord(fields)) {
+        ++recordNumber;
+        if (fields.size() == 1 && fields[0].empty()) {
+            continue; // empty line
+        }
+        if (fields.size() > csvColumns.size()) {
+            fail("Record " + std::to_string(recordNumber) + " has more fields than the header.");
+            return std::nullopt;
+        }
+
+        std::string values[ACCOUNT_FIELD_COUNT];
+        for (size_t column = 0; column < fields.size(); ++column) {
+            if (csvColumns[column] >= 0) {
+                values[csvColumns[column]].swap(fields[column]);
+            }
+        }
+        if (values[0].empty()) {
+            fail("Record " + std::to_string(recordNumber) + " has no tag.");
+            return std::nullopt;
+        }
+        return makeAccount(values);
+    }
+
+    finished = !failed();
+    return std::nullopt;
+}
+
+/**
+    Returns the next character of the stream that is not JSON whitespace, without consuming it.
+*/
+int AccountReader::skipJsonWhitespace() {
+    int c = input->sgetc();
+    while (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        input->sbumpc();
+        c = input->sgetc();
+    }
+    return c;
+}
+
+/**
+    Returns the account of the next element of the JSON array, reading the array's opening bracket first.
+*/
+std::optional<Account> AccountReader::nextJson() {
+    int c = skipJsonWhitespace();
+    if (!started) {
+        started = true;
+        if (c != '[') {
+            fail("The JSON file must contain an array of accounts.");
+            return std::nullopt;
+        }
+        input->sbumpc();
+        c = skipJsonWhitespace();
+        if (c == ']') {
+            return endJson();
+        }
+    } else if (c == ',') {
+        input->sbumpc();
+        c = skipJsonWhitespace();
+    } else if (c == ']') {
+        return endJson();
+    } else {
+        fail("Expected ',' or ']' after account " + std::to_string(recordNumber) + ".");
+        return std::nullopt;
+    }
+
+    const std::string account = "account " + std::to_string(++recordNumber);
+    if (c != '{') {
+        fail("The " + account + " is not an object.");
+        return std::nullopt;
+    }
+    input->sbumpc();
+
+    std::string values[ACCOUNT_FIELD_COUNT];
+    std::string name;
+    if (skipJsonWhitespace() == '}') {
+        input->sbumpc();
+    } else {
+        while (true) {
+            if (skipJsonWhitespace() != '"' || !parseJsonString(name)) {
+                fail("Expected a member name in " + account + ".");
+                return std::nullopt;
+            }
+            if (skipJsonWhitespace() != ':') {
+                fail("Expected ':' after member " + name + " of " + account + ".");
+                return std::nullopt;
+            }
+            input->sbumpc();
+
+            int field = findField(name);
+            c = skipJsonWhitespace();
+            if (field < 0) {
+                if (!skipJsonValue(0)) {
+                    fail("The member " + name + " of " + account + " is invalid.");
+                    return std::nullopt;
+                }
+            } else if (c == 'n' ? !parseJsonLiteral("null") : (c != '"' || !parseJsonString(values[field]))) {
+                fail("The member " + name + " of " + account + " must be a string.");
+                return std::nullopt;
+            }
+
+            c = skipJsonWhitespace();
+            input->sbumpc();
+            if (c == '}') {
+                break;
+            } else if (c != ',') {
+                fail("Expected ',' or '}' in " + account + ".");
+                return std::nullopt;
+            }
+        }
+    }
+
+    if (values[0].empty()) {
+        fail("The " + account + " has no tag.");
+        return std::nullopt;
+    }
+    return makeAccount(values);
+}
+
+/**
+    Ends the stream at the closing bracket of the JSON array, which must only be followed by whitespace.
+*/
+std::optional<Account> AccountReader::endJson() {
+    input->sbumpc();
+    if (skipJsonWhitespace() != EOF) {
+        fail("Unexpected data after the array of accounts.");
+        return std::nullopt;
+    }
+    finished = true;
+    return std::nullopt;
+}
+
+/**
+    Parses the JSON string at the current position of the stream (which must be its opening quote)
+    into 'value,' decoding its escape sequences to UTF-8. Returns false if the string is malformed.
+*/
+bool AccountReader::parseJsonString(std::string &value) {
+    Utils::clearString(value);
+    value.clear();
+    input->sbumpc();
+    while (true) {
+        int c = input->sbumpc();
+        if (c == EOF || c < 0x20) {
+            return false;
+        } else if (c == '"') {
+            return true;
+        } else if (c != '\\') {
+            value += (char)c;
+            continue;
+        }
+
+        c = input->sbumpc();
+        switch (c) {
+        case '"': value += '"'; break;
+        case '\\': value += '\\'; break;
+        case '/': value += '/'; break;
+        case 'b': value += '\b'; break;
+        case 'f': value += '\f'; break;
+        case 'n': value += '\n'; break;
+        case 'r': value += '\r'; break;
+        case 't': value += '\t'; break;
+        case 'u': {
+            uint32_t codePoint = 0;
+            for (int unit = 0; unit < 2; ++unit) {
+                uint32_t codeUnit = 0;
+                for (int i = 0; i < 4; ++i) {
+                    c = input->sbumpc();
+                    if (!std::isxdigit(c)) {
+                        return false;
+                    }
+                    codeUnit = codeUnit * 16 + (uint32_t)(std::isdigit(c) ? c - '0' : std::tolower(c) - 'a' + 10);
+                }
+                if (unit == 0 && codeUnit >= 0xD800 && codeUnit <= 0xDBFF) {
+                    // High surrogate, which must be followed by an escaped low surrogate:
+                    codePoint = codeUnit;
+                    if (input->sbumpc() != '\\' || input->sbumpc() != 'u') {
+                        return false;
+                    }
+                } else if (unit == 1) {
+                    if (codeUnit < 0xDC00 || codeUnit > 0xDFFF) {
+                        return false;
+                    }
+                    codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (codeUnit - 0xDC00);
+                    break;
+                } else if (codeUnit >= 0xDC00 && codeUnit <= 0xDFFF) {
+                    return false;
+                } else {
+                    codePoint = codeUnit;
+                    break;
+                }
+            }
+
+            if (codePoint < 0x80) {
+                value += (char)codePoint;
+            } else if (codePoint < 0x800) {
+                value += (char)(0xC0 | (codePoint >> 6));
+                value += (char)(0x80 | (codePoint & 0x3F));
+            } else if (codePoint < 0x10000) {
+                value += (char)(0xE0 | (codePoint >> 12));
+                value += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+                value += (char)(0x80 | (codePoint & 0x3F));
+            } else {
+                value += (char)(0xF0 | (codePoint >> 18));
+                value += (char)(0x80 | ((codePoint >> 12) & 0x3F));
+                value += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+                value += (char)(0x80 | (codePoint & 0x3F));
+            }
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+}
+
+/**
+    Consumes the given literal (true, false or null) from the stream, and returns false if it is not there.
+*/
+bool AccountReader::parseJsonLiteral(const char *literal) {
+    for (; *literal != '\0'; ++literal) {
+        if (input->sbumpc() != *literal) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+    Consumes the JSON value at the current position of the stream, and returns false if it is malformed.
+*/
+bool AccountReader::skipJsonValue(unsigned int depth) {
+    std::string ignored;
+    int c = skipJsonWhitespace();
+    if (c == '"') {
+        return parseJsonString(ignored);
+    } else if (c == 't') {
+        return parseJsonLiteral("true");
+    } else if (c == 'f') {
+        return parseJsonLiteral("false");
+    } else if (c == 'n') {
+        return parseJsonLiteral("null");
+    } else if (c == '-' || std::isdigit(c)) {
+        while (c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E' || std::isdigit(c)) {
+            input->sbumpc();
+            c = input->sgetc();
+        }
+        return true;
+    } else if ((c != '[' && c != '{') || depth >= ACCOUNT_JSON_MAX_DEPTH) {
+        return false;
+    }
+
+    const int close = c == '[' ? ']' : '}';
+    input->sbumpc();
+    if (skipJsonWhitespace() == close) {
+        input->sbumpc();
+        return true;
+    }
+    while (true) {
+        if (close == '}') {
+            if (skipJsonWhitespace() != '"' || !parseJsonString(ignored) || skipJsonWhitespace() != ':') {
+                return false;
+            }
+            input->sbumpc();
+        }
+        if (!skipJsonValue(depth + 1)) {
+            return false;
+        }
+        c = skipJsonWhitespace();
+        input->sbumpc();
+        if (c == close) {
+            return true;
+        } else if (c != ',') {
+            return false;
+        }
+    }
+}
+
+/**
+    Creates a writer for the given stream, writing the CSV header row or the opening bracket of the JSON array.
+*/
+AccountWriter::AccountWriter(std::ostream &output, AccountFormat format)
+: output(output), format(format), accountsWritten(0) {
+    if (format == FORMAT_CSV) {
+        output << ACCOUNT_CSV_HEADER << '\n';
+    } else {
+        output << '[';
+    }
+}
+
+/**
+    Writes one account to the stream.
+*/
+void AccountWriter::write(const AccountView &account) {
+    const std::string_view fields[ACCOUNT_FIELD_COUNT] = { account.tag, account.username, account.password, account.note };
+    if (format == FORMAT_CSV) {
+        for (int field = 0; field < ACCOUNT_FIELD_COUNT; ++field) {
+            if (field > 0) {
+                output << ',';
+            }
+            writeCsvField(fields[field]);
+        }
+        output << '\n';
+    } else {
+        output << (accountsWritten > 0 ? ",\n  {" : "\n  {");
+        for (int field = 0; field < ACCOUNT_FIELD_COUNT; ++field) {
+            if (field > 0) {
+                output << ", ";
+            }
+            output << '"' << ACCOUNT_FIELD_NAMES[field] << "\": ";
+            writeJsonString(fields[field]);
+        }
+        output << '}';
+    }
+    ++accountsWritten;
+}
+
+/**
+    Ends the stream (closing the JSON array) and flushes it.
+*/
+void AccountWriter::finish() {
+    if (format == FORMAT_JSON) {
+        output << (accountsWritten > 0 ? "\n]\n" : "]\n");
+    }
+    output.flush();
+}
+
+/**
+    Writes one CSV field, quoting it if it contains a delimiter, a quote, or a line break.
+*/
+void AccountWriter::writeCsvField(std::string_view field) {
+    if (field.find_first_of(",\"\r\n") == std::string_view::npos) {
+        output << field;
+        return;
+    }
+
+    output << '"';
+    for (char c : field) {
+        if (c == '"') {
+            output << '"';
+        }
+        output << c;
+    }
+    output << '"';
+}
+
+/**
+    Writes one JSON string, escaping quotes, backslashes and control characters.
+*/
+void AccountWriter::writeJsonString(std::string_view field) {
+    static const char hexDigits[] = "0123456789abcdef";
+    output << '"';
+    for (char c : field) {
+        switch (c) {
+        case '"': output << "\\\""; break;
+        case '\\': output << "\\\\"; break;
+        case '\n': output << "\\n"; break;
+        case '\r': output << "\\r"; break;
+        case '\t': output << "\\t"; break;
+        case '\b': output << "\\b"; break;
+        case '\f': output << "\\f"; break;
+        default:
+            if ((unsigned char)c < 0x20) {
+                output << "\\u00" << hexDigits[(unsigned char)c >> 4] << hexDigits[c & 0xF];
+            } else {
+                output << c;
+            }
+        }
+    }
+    output << '"';
+}
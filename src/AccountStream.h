@@ -0,0 +1,67 @@
+#ifndef ACCOUNT_STREAM_H
+#define ACCOUNT_STREAM_H
+
+#include "Account.h"
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <optional>
+
+#define ACCOUNT_CSV_HEADER "tag,username,password,note"
+#define ACCOUNT_JSON_MAX_DEPTH 64 // nesting limit of the (ignored) values of unknown JSON keys
+
+// Plaintext formats in which accounts are imported and exported:
+enum AccountFormat {
+    FORMAT_CSV, // RFC 4180, with a header row naming the columns (tag, username, password and note)
+    FORMAT_JSON, // an array of objects with the string members tag, username, password and note
+};
+
+/**
+    Parses accounts from a CSV or JSON stream one at a time, so that at most one parsed
+    account is held outside the vault. Columns and members other than the account's
+    fields are ignored.
+*/
+class AccountReader {
+public:
+    AccountReader(std::istream &input, AccountFormat format);
+    std::optional<Account> next();
+    bool failed() const;
+    const std::string &getError() const;
+    static std::optional<AccountFormat> findFormat(const std::string &name);
+private:
+    bool readCsvRecord(std::vector<std::string> &fields);
+    std::optional<Account> nextCsv();
+    std::optional<Account> nextJson();
+    std::optional<Account> endJson();
+    bool skipJsonValue(unsigned int depth);
+    bool parseJsonString(std::string &value);
+    bool parseJsonLiteral(const char *literal);
+    int skipJsonWhitespace();
+    bool fail(const std::string &message);
+    std::streambuf *input;
+    const AccountFormat format;
+    bool started;
+    bool finished;
+    size_t recordNumber;
+    std::vector<int> csvColumns; // the account field (0 to 3) of each CSV column, or -1 if it is ignored
+    std::string error;
+};
+
+/**
+    Writes accounts to a CSV or JSON stream as they are visited.
+*/
+class AccountWriter {
+public:
+    AccountWriter(std::ostream &output, AccountFormat format);
+    void write(const AccountView &account);
+    void finish();
+private:
+    void writeCsvField(std::string_view field);
+    void writeJsonString(std::string_view field);
+    std::ostream &output;
+    const AccountFormat format;
+    size_t accountsWritten;
+};
+
+#endif
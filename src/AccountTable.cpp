@@ -0,0 +1,441 @@
+#include "AccountTable.h"
+#include "Utils.h"
+#include "Stats.h"
+
+#include <cstring>
+#include <algorithm>
+
+AccountTable::AccountTable()
+: poolSize(0), supersededSize(0), usernameIndexKey(nullptr) {
+
+}
+
+/**
+    Clears the username index before destroying this table. The fields held by the pool are wiped
+    all at once when it is destroyed.
+*/
+AccountTable::~AccountTable() {
+    std::memset(usernameIndex.data(), 0, usernameIndex.size() * sizeof(uint32_t));
+}
+
+size_t AccountTable::size() const {
+    return flags.size();
+}
+
+/**
+    Reserves space for the given number of rows (e.g. the records of a vault file being loaded).
+*/
+void AccountTable::reserve(size_t rows) {
+    tagData.reserve(rows);
+    tagSizes.reserve(rows);
+    recordOffsets.reserve(rows);
+    recordSizes.reserve(rows);
+    accountRows.reserve(rows);
+    flags.reserve(rows);
+}
+
+/**
+    Removes every row, wiping the fields and usernames held by the pool (e.g. before the vault is
+    loaded again).
+*/
+void AccountTable::clear() {
+    std::memset(usernameIndex.data(), 0, usernameIndex.size() * sizeof(uint32_t));
+    usernameIndex.clear();
+    usernames.clear();
+    usernameRefs.clear();
+    usernameIndexKey = nullptr;
+    tagData.clear();
+    tagSizes.clear();
+    recordOffsets.clear();
+    recordSizes.clear();
+    accountRows.clear();
+    flags.clear();
+    usernameIds.clear();
+    passwordData.clear();
+    passwordSizes.clear();
+    noteData.clear();
+    noteSizes.clear();
+    pool.rewind(SecureArena::Mark { 0, 0 }); // the start of the pool
+    poolSize = 0;
+    supersededSize = 0;
+}
+
+/**
+    Appends a row for an account that is still a record in the vault file. The tag must remain
+    valid for as long as the table, since it is not copied. Returns the index of the new row.
+*/
+size_t AccountTable::appendRecord(std::string_view tag, uint64_t recordOffset, uint32_t recordSize) {
+    return appendRow(tag, recordOffset, recordSize, ROW_HAS_RECORD);
+}
+
+/**
+    Appends a row for an account that has no record, copying its fields into the table.
+    Returns the index of the new row.
+*/
+size_t AccountTable::appendAccount(const AccountView &account) {
+    Stats::count(STATS_PLAINTEXT_COPIED, account.tag.size());
+    poolSize += account.tag.size();
+    size_t row = appendRow(pool.copy(account.tag), 0, 0, 0);
+    setAccount(row, account);
+    return row;
+}
+
+/**
+    Replaces the username, password and note of the account in the given row (which supersede its
+    record, if it has one) with copies of the given account's, wiping the fields they replace. The
+    account must have the row's tag. Views of the row's previous fields are invalid afterwards.
+*/
+void AccountTable::setAccount(size_t row, const AccountView &account) {
+    Stats::count(STATS_PLAINTEXT_COPIED, account.username.size() + account.password.size() + account.note.size());
+    // The new username is interned before the old one is released, so that an unchanged one stays interned:
+    uint32_t usernameId = internUsername(account.username);
+
+    if (accountRows[row] == ACCOUNT_TABLE_NONE) {
+        std::string_view password = pool.copy(account.password);
+        std::string_view note = pool.copy(account.note);
+        poolSize += password.size() + note.size();
+        accountRows[row] = (uint32_t)usernameIds.size();
+        usernameIds.push_back(usernameId);
+        passwordData.push_back(password.data());
+        passwordSizes.push_back((uint32_t)password.size());
+        noteData.push_back(note.data());
+        noteSizes.push_back((uint32_t)note.size());
+    } else {
+        uint32_t accountRow = accountRows[row];
+        releaseUsername(usernameIds[accountRow]);
+        usernameIds[accountRow] = usernameId;
+        std::string_view password = replaceField(passwordData[accountRow], passwordSizes[accountRow], account.password);
+        passwordData[accountRow] = password.data();
+        passwordSizes[accountRow] = (uint32_t)password.size();
+        std::string_view note = replaceField(noteData[accountRow], noteSizes[accountRow], account.note);
+        noteData[accountRow] = note.data();
+        noteSizes[accountRow] = (uint32_t)note.size();
+    }
+}
+
+/**
+    Moves the fields that the table holds to the start of the pool, once at least half of it (and at
+    least ACCOUNT_TABLE_COMPACTION_MIN_SIZE bytes) is superseded fields, so that the pool of a table
+    that is changed over and over (e.g. by an agent) does not grow without bound. The fields of removed
+    accounts, and the usernames that no account has, are dropped. Returns whether the table was
+    compacted, in which case every view of its fields (and of the tags it holds) is invalid.
+*/
+bool AccountTable::compact() {
+    if (supersededSize < ACCOUNT_TABLE_COMPACTION_MIN_SIZE || supersededSize * 2 < poolSize) {
+        return false;
+    }
+
+    std::vector<uint32_t> newUsernameIds(usernames.size(), ACCOUNT_TABLE_NONE);
+    std::vector<std::string_view> newUsernames;
+    std::vector<uint32_t> newUsernameRefs;
+    for (uint32_t id = 0; id < usernames.size(); ++id) {
+        if (usernameRefs[id] != 0) {
+            newUsernameIds[id] = (uint32_t)newUsernames.size();
+            newUsernames.push_back(usernames[id]);
+            newUsernameRefs.push_back(usernameRefs[id]);
+        }
+    }
+    usernames.swap(newUsernames);
+    usernameRefs.swap(newUsernameRefs);
+
+    std::vector<uint32_t> newIds;
+    std::vector<const char *> newPasswordData;
+    std::vector<uint32_t> newPasswordSizes;
+    std::vector<const char *> newNoteData;
+    std::vector<uint32_t> newNoteSizes;
+    for (size_t row = 0; row < size(); ++row) {
+        if (isRemoved(row)) {
+            // Only the tag of a removed account was still needed, until its removal was written:
+            if (!hasRecord(row)) {
+                tagData[row] = nullptr;
+                tagSizes[row] = 0;
+            }
+            accountRows[row] = ACCOUNT_TABLE_NONE;
+        }
+        uint32_t accountRow = accountRows[row];
+        if (accountRow == ACCOUNT_TABLE_NONE) {
+            continue;
+        }
+        accountRows[row] = (uint32_t)newIds.size();
+        newIds.push_back(newUsernameIds[usernameIds[accountRow]]);
+        newPasswordData.push_back(passwordData[accountRow]);
+        newPasswordSizes.push_back(passwordSizes[accountRow]);
+        newNoteData.push_back(noteData[accountRow]);
+        newNoteSizes.push_back(noteSizes[accountRow]);
+    }
+    usernameIds.swap(newIds);
+    passwordData.swap(newPasswordData);
+    passwordSizes.swap(newPasswordSizes);
+    noteData.swap(newNoteData);
+    noteSizes.swap(newNoteSizes);
+
+    // The pool can only be released as a whole, so the fields are moved out of it and back (and the
+    // scratch arena wipes its copies when it is destroyed):
+    SecureArena scratch;
+    relocate(scratch);
+    pool.rewind(SecureArena::Mark { 0, 0 });
+    relocate(pool);
+    supersededSize = 0;
+
+    size_t capacity = USERNAME_INDEX_MIN_CAPACITY;
+    while (usernames.size() * 2 > capacity) {
+        capacity *= 2;
+    }
+    std::memset(usernameIndex.data(), 0, usernameIndex.size() * sizeof(uint32_t));
+    usernameIndex.assign(capacity, 0);
+    for (uint32_t id = 0; id < usernames.size(); ++id) {
+        indexUsername(id);
+    }
+    return true;
+}
+
+std::string_view AccountTable::tag(size_t row) const {
+    return std::string_view(tagData[row], tagSizes[row]);
+}
+
+/**
+    Returns whether the table holds the fields of the account in the given row.
+*/
+bool AccountTable::hasAccount(size_t row) const {
+    return accountRows[row] != ACCOUNT_TABLE_NONE;
+}
+
+/**
+    Returns a view of the account in the given row, whose fields are held by the table (see hasAccount).
+    The view is valid until the account is changed or removed, or the table is compacted (see compact).
+*/
+AccountView AccountTable::account(size_t row) const {
+    uint32_t accountRow = accountRows[row];
+    return AccountView {
+        tag(row),
+        usernames[usernameIds[accountRow]],
+        std::string_view(passwordData[accountRow], passwordSizes[accountRow]),
+        std::string_view(noteData[accountRow], noteSizes[accountRow]),
+    };
+}
+
+bool AccountTable::hasRecord(size_t row) const {
+    return (flags[row] & ROW_HAS_RECORD) != 0;
+}
+
+uint64_t AccountTable::recordOffset(size_t row) const {
+    return recordOffsets[row];
+}
+
+uint32_t AccountTable::recordSize(size_t row) const {
+    return recordSizes[row];
+}
+
+bool AccountTable::isDecrypted(size_t row) const {
+    return (flags[row] & ROW_DECRYPTED) != 0;
+}
+
+void AccountTable::setDecrypted(size_t row) {
+    flags[row] |= ROW_DECRYPTED;
+}
+
+bool AccountTable::isVerified(size_t row) const {
+    return (flags[row] & ROW_VERIFIED) != 0;
+}
+
+void AccountTable::setVerified(size_t row) {
+    flags[row] |= ROW_VERIFIED;
+}
+
+bool AccountTable::isRemoved(size_t row) const {
+    return (flags[row] & ROW_REMOVED) != 0;
+}
+
+/**
+    Marks the account in the given row as removed, wiping the fields that the table holds for it
+    (but not its tag, which the removal is written with).
+*/
+void AccountTable::setRemoved(size_t row) {
+    flags[row] |= ROW_REMOVED;
+    uint32_t accountRow = accountRows[row];
+    if (accountRow != ACCOUNT_TABLE_NONE) {
+        releaseUsername(usernameIds[accountRow]);
+        wipe(passwordData[accountRow], passwordSizes[accountRow]);
+        passwordSizes[accountRow] = 0;
+        wipe(noteData[accountRow], noteSizes[accountRow]);
+        noteSizes[accountRow] = 0;
+    }
+}
+
+bool AccountTable::isModified(size_t row) const {
+    return (flags[row] & ROW_MODIFIED) != 0;
+}
+
+void AccountTable::setModified(size_t row, bool modified) {
+    flags[row] = modified ? flags[row] | ROW_MODIFIED : flags[row] & ~ROW_MODIFIED;
+}
+
+/**
+    Returns the number of distinct usernames held by the table.
+*/
+size_t AccountTable::numUsernames() const {
+    return usernames.size();
+}
+
+size_t AccountTable::appendRow(std::string_view tag, uint64_t recordOffset, uint32_t recordSize, uint8_t rowFlags) {
+    tagData.push_back(tag.data());
+    tagSizes.push_back((uint32_t)tag.size());
+    recordOffsets.push_back(recordOffset);
+    recordSizes.push_back(recordSize);
+    accountRows.push_back(ACCOUNT_TABLE_NONE);
+    flags.push_back(rowFlags);
+    return flags.size() - 1;
+}
+
+/**
+    Returns the id of the given username, copying it into the pool if the table does not hold it yet,
+    and counts one more account with it. The index is doubled (and rebuilt) first if it would become
+    more than half full.
+*/
+uint32_t AccountTable::internUsername(std::string_view username) {
+    if (usernameIndexKey == nullptr) {
+        // The index is never stored, so its key only needs to be unpredictable, not derived from the vault
+        // key. It is only created with the first username, so that tables of records never touch the pool
+        // (if no random bytes can be had, the zeroed key only makes the probe sequences predictable):
+        usernameIndexKey = pool.allocate(USERNAME_INDEX_KEY_LENGTH);
+        Utils::genRand(usernameIndexKey, USERNAME_INDEX_KEY_LENGTH);
+    }
+    if (!usernameIndex.empty()) {
+        const size_t mask = usernameIndex.size() - 1;
+        for (size_t bucket = usernameHash(username) & mask; usernameIndex[bucket] != 0; bucket = (bucket + 1) & mask) {
+            if (usernames[usernameIndex[bucket] - 1] == username) {
+                ++usernameRefs[usernameIndex[bucket] - 1];
+                return usernameIndex[bucket] - 1;
+            }
+        }
+    }
+
+    uint32_t id = (uint32_t)usernames.size();
+    usernames.push_back(pool.copy(username));
+    usernameRefs.push_back(1);
+    poolSize += username.size();
+    if (usernames.size() * 2 > usernameIndex.size()) {
+        size_t capacity = std::max((size_t)USERNAME_INDEX_MIN_CAPACITY, usernameIndex.size() * 2);
+        std::memset(usernameIndex.data(), 0, usernameIndex.size() * sizeof(uint32_t));
+        usernameIndex.assign(capacity, 0);
+        for (uint32_t i = 0; i < usernames.size(); ++i) {
+            if (usernameRefs[i] != 0) {
+                indexUsername(i);
+            }
+        }
+    } else {
+        indexUsername(id);
+    }
+    return id;
+}
+
+/**
+    Counts one account fewer with the given username, which is wiped (and removed from the index) once
+    no account has it.
+*/
+void AccountTable::releaseUsername(uint32_t id) {
+    if (--usernameRefs[id] == 0) {
+        unindexUsername(id);
+        wipe(usernames[id].data(), usernames[id].size());
+        usernames[id] = std::string_view();
+    }
+}
+
+/**
+    Inserts the given username into the first empty bucket of its probe sequence.
+*/
+void AccountTable::indexUsername(uint32_t id) {
+    const size_t mask = usernameIndex.size() - 1;
+    size_t bucket = usernameHash(usernames[id]) & mask;
+    while (usernameIndex[bucket] != 0) {
+        bucket = (bucket + 1) & mask;
+    }
+    usernameIndex[bucket] = id + 1;
+}
+
+/**
+    Removes the given username from the index. The entries after it in its cluster are moved back
+    where their probe sequences allow, so that every username left is still found before an empty bucket.
+*/
+void AccountTable::unindexUsername(uint32_t id) {
+    const size_t mask = usernameIndex.size() - 1;
+    size_t hole = usernameHash(usernames[id]) & mask;
+    while (usernameIndex[hole] != id + 1) {
+        hole = (hole + 1) & mask;
+    }
+    for (size_t bucket = (hole + 1) & mask; usernameIndex[bucket] != 0; bucket = (bucket + 1) & mask) {
+        size_t home = usernameHash(usernames[usernameIndex[bucket] - 1]) & mask;
+        if (((bucket - home) & mask) >= ((bucket - hole) & mask)) {
+            usernameIndex[hole] = usernameIndex[bucket];
+            hole = bucket;
+        }
+    }
+    usernameIndex[hole] = 0;
+}
+
+/**
+    Returns where a field of 'size' bytes at 'data' is replaced by the given value: the field's own
+    space if the value fits in it (wiping the rest of it), or else a copy in the pool (wiping all of it).
+*/
+std::string_view AccountTable::replaceField(const char *data, uint32_t size, std::string_view field) {
+    if (field.size() <= size && size != 0) {
+        std::memmove(const_cast<char *>(data), field.data(), field.size());
+        wipe(data + field.size(), size - field.size());
+        return std::string_view(data, field.size());
+    }
+    std::string_view copy = pool.copy(field);
+    poolSize += copy.size();
+    wipe(data, size);
+    return copy;
+}
+
+/**
+    Wipes the given bytes of the pool (whose memory is writable, although the table only hands out
+    read-only views of it), which no field holds any more.
+*/
+void AccountTable::wipe(const char *data, size_t size) {
+    explicit_bzero(const_cast<char *>(data), size);
+    supersededSize += size;
+}
+
+/**
+    Copies every field that the table holds (and the key of the username index) into the given arena,
+    and points the table at the copies.
+*/
+void AccountTable::relocate(SecureArena &target) {
+    auto copy = [&](const char *&data, size_t size) {
+        if (size != 0) {
+            data = target.copy(std::string_view(data, size)).data();
+            if (&target == &pool) {
+                poolSize += size;
+            }
+        }
+    };
+    if (&target == &pool) {
+        poolSize = 0;
+    }
+
+    for (size_t row = 0; row < size(); ++row) {
+        if (!hasRecord(row)) {
+            copy(tagData[row], tagSizes[row]);
+        }
+    }
+    for (size_t accountRow = 0; accountRow < usernameIds.size(); ++accountRow) {
+        copy(passwordData[accountRow], passwordSizes[accountRow]);
+        copy(noteData[accountRow], noteSizes[accountRow]);
+    }
+    for (std::string_view &username : usernames) {
+        const char *data = username.data();
+        copy(data, username.size());
+        username = std::string_view(data, username.size());
+    }
+    if (usernameIndexKey != nullptr) {
+        unsigned char *key = target.allocate(USERNAME_INDEX_KEY_LENGTH);
+        std::memcpy(key, usernameIndexKey, USERNAME_INDEX_KEY_LENGTH);
+        usernameIndexKey = key;
+    }
+}
+
+uint64_t AccountTable::usernameHash(std::string_view username) const {
+    return Utils::keyedHash64(usernameIndexKey, USERNAME_INDEX_KEY_LENGTH, (const unsigned char *)username.data(), (unsigned long)username.size());
+}
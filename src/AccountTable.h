@@ -0,0 +1,103 @@
+#ifndef ACCOUNT_TABLE_H
+#define ACCOUNT_TABLE_H
+
+#include "Account.h"
+#include "SecureArena.h"
+
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+#define ACCOUNT_TABLE_NONE UINT32_MAX // marks a row whose account's fields are not held by the table
+#define USERNAME_INDEX_MIN_CAPACITY 16 // must be a power of two
+#define USERNAME_INDEX_KEY_LENGTH 16
+#define ACCOUNT_TABLE_COMPACTION_MIN_SIZE (16 * 1024) // the pool is compacted once it holds this many bytes of
+                                                      // superseded fields, and they are at least half of it
+
+/**
+    The in-memory table of a vault's accounts, stored column by column rather than as one object
+    per account, so that scanning one field (e.g. listing the tags) touches only that field's column.
+    Each row is one account, which is either still a record in the vault file (whose tag is a view
+    into the decrypted tag index), or whose fields are held by the table (e.g. after it was added or
+    changed). Those fields are copied into one secure byte pool, and usernames, which many accounts
+    share, are interned, so that each distinct username is stored once.
+
+    The fields that an account's new fields (or its removal) supersede are wiped at once. A new field
+    that fits in the space of the one it replaces takes its place, and otherwise the superseded space
+    is only reclaimed when the pool is compacted (see compact).
+*/
+class AccountTable {
+public:
+    AccountTable();
+    ~AccountTable();
+    AccountTable(const AccountTable &) = delete;
+    AccountTable &operator=(const AccountTable &) = delete;
+    size_t size() const;
+    void reserve(size_t rows);
+    void clear();
+    size_t appendRecord(std::string_view tag, uint64_t recordOffset, uint32_t recordSize);
+    size_t appendAccount(const AccountView &account);
+    void setAccount(size_t row, const AccountView &account);
+    bool compact();
+    std::string_view tag(size_t row) const;
+    bool hasAccount(size_t row) const;
+    AccountView account(size_t row) const;
+    bool hasRecord(size_t row) const;
+    uint64_t recordOffset(size_t row) const;
+    uint32_t recordSize(size_t row) const;
+    bool isDecrypted(size_t row) const;
+    void setDecrypted(size_t row);
+    bool isVerified(size_t row) const;
+    void setVerified(size_t row);
+    bool isRemoved(size_t row) const;
+    void setRemoved(size_t row);
+    bool isModified(size_t row) const;
+    void setModified(size_t row, bool modified);
+    size_t numUsernames() const;
+private:
+    // Bits of a row's flags:
+    enum RowFlags : uint8_t {
+        ROW_HAS_RECORD = 1, // the account has a record in the vault file
+        ROW_DECRYPTED = 2, // the record has been decrypted in place (whether or not it was authentic)
+        ROW_REMOVED = 4, // the account has been deleted
+        ROW_MODIFIED = 8, // the account has changed since the vault was last written
+        ROW_VERIFIED = 16, // the decrypted record was authenticated and parsed as an account with the row's tag
+    };
+
+    size_t appendRow(std::string_view tag, uint64_t recordOffset, uint32_t recordSize, uint8_t rowFlags);
+    uint32_t internUsername(std::string_view username);
+    void releaseUsername(uint32_t id);
+    void indexUsername(uint32_t id);
+    void unindexUsername(uint32_t id);
+    std::string_view replaceField(const char *data, uint32_t size, std::string_view field);
+    void wipe(const char *data, size_t size);
+    void relocate(SecureArena &target);
+    uint64_t usernameHash(std::string_view username) const;
+    SecureArena pool; // holds the fields of the accounts held by the table, and the key of the username index
+    size_t poolSize; // bytes of fields copied into the pool since it was last cleared or compacted
+    size_t supersededSize; // bytes of them that were wiped since
+
+    // One entry per row:
+    std::vector<const char *> tagData;
+    std::vector<uint32_t> tagSizes;
+    std::vector<uint64_t> recordOffsets; // offset of the record's IV from the start of the record section
+    std::vector<uint32_t> recordSizes; // size of the record's ciphertext (excluding its IV, including any authentication tag)
+    std::vector<uint32_t> accountRows; // index into the account columns, or ACCOUNT_TABLE_NONE
+    std::vector<uint8_t> flags; // see RowFlags
+
+    // One entry per account held by the table (which supersedes its row's record, if any):
+    std::vector<uint32_t> usernameIds;
+    std::vector<const char *> passwordData;
+    std::vector<uint32_t> passwordSizes;
+    std::vector<const char *> noteData;
+    std::vector<uint32_t> noteSizes;
+
+    // Interned usernames, and an open-addressing table of (id + 1), 0 marking an empty bucket, which
+    // is probed by their keyed hash (so that its layout reveals nothing about the usernames):
+    std::vector<std::string_view> usernames; // empty once no account has the username
+    std::vector<uint32_t> usernameRefs; // number of accounts with each username
+    std::vector<uint32_t> usernameIndex;
+    unsigned char *usernameIndexKey;
+};
+
+#endif
@@ -0,0 +1,349 @@
+#include "Agent.h"
+#include "Utils.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int) {
+    stopRequested = 1;
+}
+
+Agent::Agent(Vault &vault, unsigned int timeoutSeconds)
+: vault(vault), timeoutSeconds(timeoutSeconds) {
+
+}
+
+/**
+    Creates the agent's socket in a new private directory, prints the shell commands that point
+    clients at it (like ssh-agent does), and forks. The agent serves requests in the background
+    child, which exits once it has been idle for its timeout or is terminated; the foreground
+    process returns.
+*/
+void Agent::run() {
+    const char *tmpDir = getenv("TMPDIR");
+    std::string dirPath = std::string(tmpDir != NULL && tmpDir[0] != '\0' ? tmpDir : "/tmp") + "/" + AGENT_SOCKET_DIR_TEMPLATE;
+    if (mkdtemp(&dirPath[0]) == NULL) { // the directory is only accessible to this user
+        std::cout << "Error: Failed to create the agent's socket directory." << std::endl;
+        exit(1);
+    }
+    socketDir = dirPath;
+    socketPath = socketDir + "/" + AGENT_SOCKET_NAME;
+
+    struct sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        rmdir(socketDir.c_str());
+        std::cout << "Error: The agent's socket path is too long." << std::endl;
+        exit(1);
+    }
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+
+    // Create the socket with permissions for this user only:
+    int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    mode_t oldMask = umask(0177);
+    bool listening = listenFd != -1
+        && bind(listenFd, (struct sockaddr *)&address, sizeof(address)) == 0
+        && listen(listenFd, SOMAXCONN) == 0;
+    umask(oldMask);
+    if (!listening) {
+        unlink(socketPath.c_str());
+        rmdir(socketDir.c_str());
+        std::cout << "Error: Failed to create the agent's socket." << std::endl;
+        exit(1);
+    }
+
+    std::cout << std::flush;
+    pid_t pid = fork();
+    if (pid == -1) {
+        unlink(socketPath.c_str());
+        rmdir(socketDir.c_str());
+        std::cout << "Error: Failed to start the agent." << std::endl;
+        exit(1);
+    }
+    if (pid > 0) {
+        close(listenFd);
+        std::cout << AGENT_SOCKET_ENV << "=" << socketPath << "; export " << AGENT_SOCKET_ENV << ";\n"
+            << AGENT_PID_ENV << "=" << pid << "; export " << AGENT_PID_ENV << ";\n"
+            << "echo Agent pid " << pid << ";" << std::endl;
+        return;
+    }
+
+    // Detach from the terminal, and keep the unlocked vault out of swap and core dumps:
+    setsid();
+    int devNull = open("/dev/null", O_RDWR);
+    if (devNull != -1) {
+        dup2(devNull, STDIN_FILENO);
+        dup2(devNull, STDOUT_FILENO);
+        dup2(devNull, STDERR_FILENO);
+        close(devNull);
+    }
+    mlockall(MCL_CURRENT); // best effort, like Utils::lockMemory (it fails beyond RLIMIT_MEMLOCK)
+    prctl(PR_SET_DUMPABLE, 0);
+
+    struct sigaction stopAction;
+    std::memset(&stopAction, 0, sizeof(stopAction));
+    stopAction.sa_handler = requestStop; // without SA_RESTART, so that poll returns when signaled
+    sigaction(SIGTERM, &stopAction, NULL);
+    sigaction(SIGINT, &stopAction, NULL);
+    sigaction(SIGHUP, &stopAction, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    serve(listenFd);
+
+    close(listenFd);
+    unlink(socketPath.c_str());
+    rmdir(socketDir.c_str());
+    exit(0);
+}
+
+/**
+    Accepts and serves connections, one at a time, until the agent has been idle for its timeout or a
+    stop has been requested. Only connections from processes of the agent's own user are served.
+*/
+void Agent::serve(int listenFd) {
+    struct pollfd pollFd = { listenFd, POLLIN, 0 };
+    while (!stopRequested) {
+        int ready = poll(&pollFd, 1, (int)(timeoutSeconds * 1000));
+        if (ready == 0) {
+            break; // idle for the timeout
+        } else if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        int fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1) {
+            continue;
+        }
+        struct ucred credentials;
+        socklen_t credentialsSize = sizeof(credentials);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &credentialsSize) == 0 && credentials.uid == geteuid()) {
+            // Do not let a stalled client block the agent:
+            struct timeval ioTimeout = { AGENT_IO_TIMEOUT, 0 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &ioTimeout, sizeof(ioTimeout));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &ioTimeout, sizeof(ioTimeout));
+            serveConnection(fd);
+        }
+        close(fd);
+    }
+}
+
+/**
+    Answers the requests sent over the given connection until the client closes it.
+*/
+void Agent::serveConnection(int fd) {
+    uint8_t request;
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> reply;
+    while (!stopRequested && receiveMessage(fd, request, payload)) {
+        reply.clear();
+        uint8_t status = handleRequest(request, payload, reply);
+        if (status != AGENT_OK && status != AGENT_FAILED) {
+            reply.clear();
+        }
+        bool sent = sendMessage(fd, status, reply);
+
+        // Wipe the accounts that passed through the buffers:
+        std::fill(payload.begin(), payload.end(), 0);
+        std::fill(reply.begin(), reply.end(), 0);
+        if (!sent) {
+            break;
+        }
+    }
+}
+
+/**
+    Parses a payload that holds exactly one serialized account into 'view.'
+*/
+static bool parseAccount(const std::vector<uint8_t> &payload, AccountView &view) {
+    const unsigned char *payloadIter = payload.data();
+    const unsigned char *payloadEnd = payload.data() + payload.size();
+    return AccountView::parse(&payloadIter, payloadEnd, view) && payloadIter == payloadEnd;
+}
+
+/**
+    Stores the given status of a failed vault operation in 'reply,' and returns AGENT_FAILED.
+*/
+static uint8_t failure(ClamStatus status, std::vector<uint8_t> &reply) {
+    uint32_t code = (uint32_t)status;
+    reply.assign((uint8_t *)&code, (uint8_t *)&code + sizeof(code));
+    return AGENT_FAILED;
+}
+
+/**
+    Applies one request to the vault, storing the reply's payload in 'reply,' and returns the reply's
+    status. Requests that change the vault are written to it before they are answered.
+*/
+uint8_t Agent::handleRequest(uint8_t request, const std::vector<uint8_t> &payload, std::vector<uint8_t> &reply) {
+    std::ostringstream listing;
+    std::string listingText;
+    AccountView view;
+    ClamStatus status;
+    switch (request) {
+    case AGENT_GET: {
+        std::string tag(payload.begin(), payload.end());
+        if (!vault.containsAccount(tag)) {
+            return AGENT_NOT_FOUND;
+        }
+        Result<AccountView> account = vault.getAccountView(tag);
+        if (!account) {
+            return failure(account.error(), reply);
+        }
+        reply = account->serialize();
+        return AGENT_OK;
+    }
+    case AGENT_LIST_TAGS:
+        vault.printTags(listing);
+        listingText = listing.str();
+        reply.assign(listingText.begin(), listingText.end());
+        std::fill(listingText.begin(), listingText.end(), 0);
+        return AGENT_OK;
+    case AGENT_LIST_ACCOUNTS:
+        status = vault.printInfo(listing);
+        listingText = listing.str();
+        if (status == CLAM_OK) {
+            reply.assign(listingText.begin(), listingText.end());
+        }
+        std::fill(listingText.begin(), listingText.end(), 0);
+        if (status != CLAM_OK) {
+            return failure(status, reply);
+        }
+        return AGENT_OK;
+    case AGENT_SEARCH: {
+        uint32_t limit;
+        if (payload.size() < sizeof(limit)) {
+            return AGENT_BAD_REQUEST;
+        }
+        std::memcpy(&limit, payload.data(), sizeof(limit));
+        std::string pattern(payload.begin() + sizeof(limit), payload.end());
+        for (const TagMatch &match : vault.searchTags(pattern, limit)) {
+            uint32_t tagSize = (uint32_t)match.tag.size();
+            reply.insert(reply.end(), (const uint8_t *)&match.distance, (const uint8_t *)&match.distance + sizeof(match.distance));
+            reply.insert(reply.end(), (uint8_t *)&tagSize, (uint8_t *)&tagSize + sizeof(tagSize));
+            reply.insert(reply.end(), match.tag.begin(), match.tag.end());
+        }
+        return AGENT_OK;
+    }
+    case AGENT_ADD:
+        if (!parseAccount(payload, view)) {
+            return AGENT_BAD_REQUEST;
+        }
+        if (vault.containsAccount(std::string(view.tag))) {
+            return AGENT_EXISTS;
+        }
+        vault.addAccount(view);
+        status = vault.writeVault();
+        if (status != CLAM_OK) {
+            return failure(status, reply);
+        }
+        return AGENT_OK;
+    case AGENT_UPDATE:
+        if (!parseAccount(payload, view)) {
+            return AGENT_BAD_REQUEST;
+        }
+        if (!vault.containsAccount(std::string(view.tag))) {
+            return AGENT_NOT_FOUND;
+        }
+        vault.updateAccount(view);
+        status = vault.writeVault();
+        if (status != CLAM_OK) {
+            return failure(status, reply);
+        }
+        return AGENT_OK;
+    case AGENT_DELETE: {
+        std::string tag(payload.begin(), payload.end());
+        if (!vault.containsAccount(tag)) {
+            return AGENT_NOT_FOUND;
+        }
+        vault.removeAccount(tag);
+        status = vault.writeVault();
+        if (status != CLAM_OK) {
+            return failure(status, reply);
+        }
+        return AGENT_OK;
+    }
+    }
+    return AGENT_BAD_REQUEST;
+}
+
+/**
+    Reads exactly 'size' bytes from the given socket into 'buffer,' and returns false if it
+    is closed, fails or times out first.
+*/
+static bool readFully(int fd, unsigned char *buffer, size_t size) {
+    while (size > 0) {
+        ssize_t received = recv(fd, buffer, size, 0);
+        if (received == -1 && errno == EINTR) {
+            continue;
+        } else if (received <= 0) {
+            return false;
+        }
+        buffer += received;
+        size -= (size_t)received;
+    }
+    return true;
+}
+
+/**
+    Writes all 'size' bytes of 'buffer' to the given socket, and returns false if it fails first.
+*/
+static bool writeFully(int fd, const unsigned char *buffer, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, buffer, size, MSG_NOSIGNAL);
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        } else if (sent <= 0) {
+            return false;
+        }
+        buffer += sent;
+        size -= (size_t)sent;
+    }
+    return true;
+}
+
+/**
+    Sends one message of the given type (a request or a reply status) and payload over the given socket.
+*/
+bool Agent::sendMessage(int fd, uint8_t type, const std::vector<uint8_t> &payload) {
+    unsigned char header[1 + sizeof(uint32_t)];
+    uint32_t payloadSize = (uint32_t)payload.size();
+    header[0] = type;
+    std::memcpy(header + 1, &payloadSize, sizeof(payloadSize));
+    return writeFully(fd, header, sizeof(header)) && writeFully(fd, payload.data(), payload.size());
+}
+
+/**
+    Receives one message from the given socket, and returns false if the socket is closed or
+    fails first, or if the message is larger than AGENT_MAX_MESSAGE_SIZE.
+*/
+bool Agent::receiveMessage(int fd, uint8_t &type, std::vector<uint8_t> &payload) {
+    unsigned char header[1 + sizeof(uint32_t)];
+    uint32_t payloadSize;
+    if (!readFully(fd, header, sizeof(header))) {
+        return false;
+    }
+    type = header[0];
+    std::memcpy(&payloadSize, header + 1, sizeof(payloadSize));
+    if (payloadSize > AGENT_MAX_MESSAGE_SIZE) {
+        return false;
+    }
+    payload.resize(payloadSize);
+    return readFully(fd, payload.data(), payloadSize);
+}
@@ -0,0 +1,68 @@
+#ifndef AGENT_H
+#define AGENT_H
+
+#include "Vault.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#define AGENT_SOCKET_ENV "CLAM_AGENT_SOCK" // path of the agent's socket, through which commands are served when set
+#define AGENT_PID_ENV "CLAM_AGENT_PID"
+#define AGENT_SOCKET_DIR_TEMPLATE "clam-XXXXXX" // private directory (in $TMPDIR or /tmp) holding the agent's socket
+#define AGENT_SOCKET_NAME "agent.sock"
+#define AGENT_DEFAULT_TIMEOUT 900 // seconds without a request after which the agent exits
+#define AGENT_IO_TIMEOUT 5 // seconds that a connected client may stall within a message
+#define AGENT_MAX_MESSAGE_SIZE (64 << 20)
+
+/*
+    Every request and reply is a message of the following format:
+
+    uint8: type = request type (AgentRequest) or reply status (AgentStatus)
+    uint32: s = size of the payload (in bytes)
+    s bytes: payload
+
+    A client may send any number of requests over one connection, and each is answered in order.
+*/
+
+// Types of requests, and their payloads:
+enum AgentRequest : uint8_t {
+    AGENT_GET = 1, // tag -> serialized account
+    AGENT_LIST_TAGS = 2, // (empty) -> the tags, as printed by Vault::printTags
+    AGENT_LIST_ACCOUNTS = 3, // (empty) -> the account info, as printed by Vault::printInfo
+    AGENT_SEARCH = 4, // uint32 limit, pattern -> matching tags, each preceded by its uint32 distance and uint32 size
+    AGENT_ADD = 5, // serialized account -> (empty)
+    AGENT_UPDATE = 6, // serialized account, which replaces the account with its tag -> (empty)
+    AGENT_DELETE = 7, // tag -> (empty)
+};
+
+// Statuses of replies (only AGENT_OK and AGENT_FAILED replies carry a payload):
+enum AgentStatus : uint8_t {
+    AGENT_OK = 0,
+    AGENT_NOT_FOUND = 1, // no account has the requested tag
+    AGENT_EXISTS = 2, // an account with the added tag already exists
+    AGENT_BAD_REQUEST = 3,
+    AGENT_FAILED = 4, // the vault could not be read or written; the payload is the uint32 ClamStatus
+};
+
+/**
+    Keeps one unlocked vault in locked memory and serves requests for its accounts over a Unix
+    domain socket that only its own user may connect to, until it has been idle for its timeout.
+*/
+class Agent {
+public:
+    Agent(Vault &vault, unsigned int timeoutSeconds);
+    void run();
+    static bool sendMessage(int fd, uint8_t type, const std::vector<uint8_t> &payload);
+    static bool receiveMessage(int fd, uint8_t &type, std::vector<uint8_t> &payload);
+private:
+    void serve(int listenFd);
+    void serveConnection(int fd);
+    uint8_t handleRequest(uint8_t request, const std::vector<uint8_t> &payload, std::vector<uint8_t> &reply);
+    Vault &vault;
+    const unsigned int timeoutSeconds;
+    std::string socketDir;
+    std::string socketPath;
+};
+
+#endif
@@ -0,0 +1,181 @@
+#include "AgentClient.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstring>
+#include <algorithm>
+
+/**
+    Connects to the agent listening on the given socket, or prints an error and exits if there is none.
+*/
+AgentClient::AgentClient(const std::string &socketPath)
+: fd(-1), socketPath(socketPath) {
+    struct sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() < sizeof(address.sun_path)) {
+        std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    }
+    if (fd == -1 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        std::cout << "Error: Failed to connect to the agent at " << socketPath
+            << " (unset " << AGENT_SOCKET_ENV << " to use the vault key instead)." << std::endl;
+        exit(1);
+    }
+}
+
+AgentClient::~AgentClient() {
+    std::fill(reply.begin(), reply.end(), 0);
+    close(fd);
+}
+
+/**
+    Print all Account tags, separated by newlines, to the output stream.
+*/
+void AgentClient::printTags(std::ostream &outputStream) {
+    request(AGENT_LIST_TAGS, std::vector<uint8_t>());
+    outputStream.write((const char *)reply.data(), reply.size());
+}
+
+/**
+    Print all nicely formatted Account info to the output stream, or return an error if the agent
+    could not read the vault.
+*/
+ClamStatus AgentClient::printInfo(std::ostream &outputStream) {
+    uint8_t status = request(AGENT_LIST_ACCOUNTS, std::vector<uint8_t>());
+    if (status != AGENT_OK) {
+        return replyStatus(status);
+    }
+    outputStream.write((const char *)reply.data(), reply.size());
+    return CLAM_OK;
+}
+
+/**
+    Returns a read-only view of the Account labeled 'tag,' or returns CLAM_ERROR_ACCOUNT_NOT_FOUND if
+    an account with the given tag does not exist. The view is valid until the next request.
+*/
+Result<AccountView> AgentClient::getAccountView(const std::string &tag) {
+    uint8_t status = request(AGENT_GET, std::vector<uint8_t>(tag.begin(), tag.end()));
+    if (status != AGENT_OK) {
+        return replyStatus(status);
+    }
+
+    AccountView view;
+    const unsigned char *replyIter = reply.data();
+    if (!AccountView::parse(&replyIter, reply.data() + reply.size(), view)) {
+        std::cout << "Error: The agent sent a corrupt reply." << std::endl;
+        exit(1);
+    }
+    return view;
+}
+
+/**
+    Returns up to 'limit' tags that begin with, or nearly begin with, the given pattern, ranked by
+    how closely they match it. The returned tags are valid until the next request.
+*/
+std::vector<TagMatch> AgentClient::searchTags(const std::string &pattern, size_t limit) {
+    std::vector<uint8_t> payload(sizeof(uint32_t));
+    uint32_t requestLimit = (uint32_t)std::min(limit, (size_t)UINT32_MAX);
+    std::memcpy(payload.data(), &requestLimit, sizeof(requestLimit));
+    payload.insert(payload.end(), pattern.begin(), pattern.end());
+    request(AGENT_SEARCH, payload);
+
+    std::vector<TagMatch> matches;
+    size_t offset = 0;
+    while (reply.size() - offset >= 2 * sizeof(uint32_t)) {
+        uint32_t distance;
+        uint32_t tagSize;
+        std::memcpy(&distance, reply.data() + offset, sizeof(distance));
+        std::memcpy(&tagSize, reply.data() + offset + sizeof(distance), sizeof(tagSize));
+        offset += 2 * sizeof(uint32_t);
+        if (tagSize > reply.size() - offset) {
+            break;
+        }
+        matches.push_back(TagMatch { std::string_view((const char *)reply.data() + offset, tagSize), distance });
+        offset += tagSize;
+    }
+    if (offset != reply.size()) {
+        std::cout << "Error: The agent sent a corrupt reply." << std::endl;
+        exit(1);
+    }
+    return matches;
+}
+
+/**
+    Adds the given Account to the agent's vault, or returns CLAM_ERROR_ACCOUNT_EXISTS
+    if an account with the given tag already exists.
+*/
+ClamStatus AgentClient::addAccount(const AccountView &account) {
+    std::vector<uint8_t> payload = account.serialize();
+    uint8_t status = request(AGENT_ADD, payload);
+    std::fill(payload.begin(), payload.end(), 0);
+    return replyStatus(status);
+}
+
+/**
+    Replaces the username, password and note of the account with the given account's tag in the
+    agent's vault, or returns CLAM_ERROR_ACCOUNT_NOT_FOUND if it does not exist.
+*/
+ClamStatus AgentClient::updateAccount(const AccountView &account) {
+    std::vector<uint8_t> payload = account.serialize();
+    uint8_t status = request(AGENT_UPDATE, payload);
+    std::fill(payload.begin(), payload.end(), 0);
+    return replyStatus(status);
+}
+
+/**
+    Removes the account with the given tag from the agent's vault, or
+    returns CLAM_ERROR_ACCOUNT_NOT_FOUND if it does not exist.
+*/
+ClamStatus AgentClient::removeAccount(const std::string &tag) {
+    return replyStatus(request(AGENT_DELETE, std::vector<uint8_t>(tag.begin(), tag.end())));
+}
+
+/**
+    Does nothing, since every change has already been written to the vault by the agent.
+*/
+ClamStatus AgentClient::writeVault() {
+    return CLAM_OK;
+}
+
+/**
+    Sends one request to the agent and stores the payload of its reply, and returns the reply's
+    status. Prints an error and exits if the agent does not answer or rejects the request.
+*/
+uint8_t AgentClient::request(AgentRequest type, const std::vector<uint8_t> &payload) {
+    uint8_t status;
+    std::fill(reply.begin(), reply.end(), 0);
+    if (!Agent::sendMessage(fd, type, payload) || !Agent::receiveMessage(fd, status, reply)) {
+        std::cout << "Error: The agent at " << socketPath << " did not respond." << std::endl;
+        exit(1);
+    }
+    if (status == AGENT_BAD_REQUEST) {
+        std::cout << "Error: The agent rejected the request." << std::endl;
+        exit(1);
+    }
+    return status;
+}
+
+/**
+    Returns the ClamStatus that corresponds to the status of the last reply.
+*/
+ClamStatus AgentClient::replyStatus(uint8_t status) const {
+    uint32_t code;
+    switch (status) {
+    case AGENT_OK:
+        return CLAM_OK;
+    case AGENT_NOT_FOUND:
+        return CLAM_ERROR_ACCOUNT_NOT_FOUND;
+    case AGENT_EXISTS:
+        return CLAM_ERROR_ACCOUNT_EXISTS;
+    case AGENT_FAILED:
+        if (reply.size() == sizeof(code)) {
+            std::memcpy(&code, reply.data(), sizeof(code));
+            return (ClamStatus)code;
+        }
+        break;
+    }
+    std::cout << "Error: The agent sent a corrupt reply." << std::endl;
+    exit(1);
+}
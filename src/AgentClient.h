@@ -0,0 +1,35 @@
+#ifndef AGENT_CLIENT_H
+#define AGENT_CLIENT_H
+
+#include "Agent.h"
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <optional>
+
+/**
+    Serves account commands through a running Agent instead of unlocking the vault. Mirrors
+    the parts of the Vault interface that account commands use, so that they can run on either.
+*/
+class AgentClient {
+public:
+    AgentClient(const std::string &socketPath);
+    ~AgentClient();
+    void printTags(std::ostream &outputStream);
+    ClamStatus printInfo(std::ostream &outputStream);
+    Result<AccountView> getAccountView(const std::string &tag);
+    std::vector<TagMatch> searchTags(const std::string &pattern, size_t limit);
+    ClamStatus addAccount(const AccountView &account);
+    ClamStatus updateAccount(const AccountView &account);
+    ClamStatus removeAccount(const std::string &tag);
+    ClamStatus writeVault();
+private:
+    uint8_t request(AgentRequest type, const std::vector<uint8_t> &payload);
+    ClamStatus replyStatus(uint8_t status) const;
+    int fd;
+    const std::string socketPath;
+    std::vector<uint8_t> reply; // payload of the last reply, which backs the views returned from it
+};
+
+#endif
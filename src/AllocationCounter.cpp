@@ -0,0 +1,28 @@
+#include "Stats.h"
+
+#include <cstdlib>
+#include <new>
+
+/*
+    Replacements of the global allocation functions that count the heap allocations of the clam
+    executable for --stats. They are not part of libclam, whose users may replace them themselves.
+    The array and nothrow forms of operator new (and their operator deletes) call these.
+*/
+
+void *operator new(std::size_t size) {
+    Stats::count(STATS_ALLOCATIONS, 1);
+    Stats::count(STATS_ALLOCATED_BYTES, size);
+    void *pointer = std::malloc(size == 0 ? 1 : size);
+    if (pointer == nullptr) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void operator delete(void *pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
@@ -0,0 +1,244 @@
+#include "Batch.h"
+#include "Utils.h"
+
+#include <cstring>
+
+Batch::Batch(Vault &vault)
+: vault(vault), binary(false) {
+
+}
+
+/**
+    Applies the commands read from 'input' to the vault in order, writing the reply to each command
+    to 'output.' Returns true if every command succeeded, and false after replying to the first
+    command that failed, in which case the vault must not be written.
+*/
+bool Batch::run(std::istream &input, std::ostream &output) {
+    binary = input.peek() == '\0';
+    if (binary) {
+        char magic[BATCH_BINARY_MAGIC_LENGTH];
+        if (!input.read(magic, BATCH_BINARY_MAGIC_LENGTH) || std::memcmp(magic, BATCH_BINARY_MAGIC, BATCH_BINARY_MAGIC_LENGTH) != 0) {
+            writeReply(output, { "error", "The batch is neither text nor binary." });
+            return false;
+        }
+    }
+
+    std::vector<std::string> command;
+    std::vector<std::string> reply;
+    std::string parseError;
+    size_t commandNumber = 0;
+    while (readCommand(input, command, parseError)) {
+        ++commandNumber;
+        reply.clear();
+        std::optional<std::string> error = parseError.empty() ? apply(command, reply) : parseError;
+        for (std::string &field : command) {
+            Utils::clearString(field);
+        }
+        if (error.has_value()) {
+            writeReply(output, { "error", "Command " + std::to_string(commandNumber) + ": " + error.value() });
+            output.flush();
+            return false;
+        }
+        writeReply(output, reply);
+        for (std::string &field : reply) {
+            Utils::clearString(field);
+        }
+    }
+
+    output.flush();
+    return true;
+}
+
+/**
+    Reads the next command of the batch into 'fields,' and returns false once the batch has ended.
+    If the command is malformed, returns true with a description of the problem in 'parseError.'
+    Empty lines and lines that begin with '#' are skipped in the text form.
+*/
+bool Batch::readCommand(std::istream &input, std::vector<std::string> &fields, std::string &parseError) {
+    if (binary) {
+        uint32_t fieldCount;
+        if (!input.read((char *)&fieldCount, sizeof(fieldCount))) {
+            if (input.gcount() == 0) {
+                return false;
+            }
+            parseError = "The batch is truncated.";
+            return true;
+        }
+        if (fieldCount == 0 || fieldCount > BATCH_MAX_FIELDS) {
+            parseError = "Invalid number of fields.";
+            return true;
+        }
+        fields.assign(fieldCount, "");
+        for (std::string &field : fields) {
+            uint32_t fieldSize;
+            if (!input.read((char *)&fieldSize, sizeof(fieldSize))) {
+                parseError = "The batch is truncated.";
+                return true;
+            }
+            if (fieldSize > BATCH_MAX_FIELD_SIZE) {
+                parseError = "Field too large.";
+                return true;
+            }
+            field.resize(fieldSize);
+            if (!input.read(&field[0], fieldSize)) {
+                parseError = "The batch is truncated.";
+                return true;
+            }
+        }
+        return true;
+    }
+
+    std::string line;
+    while (std::getline(input, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        fields.assign(1, "");
+        for (size_t i = 0; i < line.size() && parseError.empty(); ++i) {
+            if (line[i] == '\t') {
+                fields.emplace_back();
+            } else if (line[i] != '\\') {
+                fields.back() += line[i];
+            } else if (i + 1 < line.size() && line[i + 1] == 't') {
+                fields.back() += '\t';
+                ++i;
+            } else if (i + 1 < line.size() && line[i + 1] == 'n') {
+                fields.back() += '\n';
+                ++i;
+            } else if (i + 1 < line.size() && line[i + 1] == '\\') {
+                fields.back() += '\\';
+                ++i;
+            } else {
+                parseError = "Invalid escape sequence.";
+            }
+        }
+        Utils::clearString(line);
+        return true;
+    }
+    return false;
+}
+
+/**
+    Writes one reply, in the form of the batch, to the output stream.
+*/
+void Batch::writeReply(std::ostream &output, const std::vector<std::string> &fields) const {
+    if (binary) {
+        uint32_t fieldCount = (uint32_t)fields.size();
+        output.write((const char *)&fieldCount, sizeof(fieldCount));
+        for (const std::string &field : fields) {
+            uint32_t fieldSize = (uint32_t)field.size();
+            output.write((const char *)&fieldSize, sizeof(fieldSize));
+            output.write(field.data(), field.size());
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < fields.size(); ++i) {
+        if (i > 0) {
+            output << '\t';
+        }
+        for (char c : fields[i]) {
+            if (c == '\t') {
+                output << "\\t";
+            } else if (c == '\n') {
+                output << "\\n";
+            } else if (c == '\\') {
+                output << "\\\\";
+            } else {
+                output << c;
+            }
+        }
+    }
+    output << '\n';
+}
+
+/**
+    Applies one command to the vault in memory, storing its reply in 'reply.' Returns an error
+    message if the command is invalid or cannot be applied, in which case the vault is unchanged.
+*/
+std::optional<std::string> Batch::apply(const std::vector<std::string> &command, std::vector<std::string> &reply) {
+    const std::string &name = command[0];
+    if (command.size() < 2) {
+        return "No account name provided.";
+    }
+    const std::string &tag = command[1];
+
+    if (name == "add") {
+        if (command.size() != 2 && command.size() != 4 && command.size() != 5) {
+            return "Usage: add <tag> [<username> <password> [<note>]]";
+        }
+        if (vault.containsAccount(tag)) {
+            return "There already exists an account with the specified name.";
+        }
+        Account account = command.size() == 2 ? Account(tag) : Account(tag, command[2], command[3]);
+        if (command.size() == 5) {
+            account.setNote(command[4]);
+        }
+        vault.addAccount(account.view());
+        account.wipeSensitiveData();
+        reply.push_back("ok");
+        return std::nullopt;
+    }
+
+    if (name != "update" && name != "delete" && name != "print") {
+        return "Unknown command: " + name;
+    }
+    if (!vault.containsAccount(tag)) {
+        return "The specified account does not exist.";
+    }
+
+    if (name == "update") {
+        if (command.size() != 4 || (command[2] != "username" && command[2] != "password" && command[2] != "note")) {
+            return "Usage: update <tag> (username | password | note) <value>";
+        }
+        Result<AccountView> view = vault.getAccountView(tag);
+        if (!view) {
+            return std::string(clam_status_message(view.error()));
+        }
+        Account account(*view);
+        if (command[2] == "username") {
+            account.setUsername(command[3]);
+        } else if (command[2] == "password") {
+            account.setPassword(command[3]);
+        } else {
+            account.setNote(command[3]);
+        }
+        ClamStatus status = vault.updateAccount(account.view());
+        account.wipeSensitiveData();
+        if (status != CLAM_OK) {
+            return std::string(clam_status_message(status));
+        }
+    } else if (name == "delete") {
+        if (command.size() != 2) {
+            return "Usage: delete <tag>";
+        }
+        vault.removeAccount(tag);
+    } else {
+        if (command.size() > 3 || (command.size() == 3 && command[2] != "username" && command[2] != "password" && command[2] != "note")) {
+            return "Usage: print <tag> [username | password | note]";
+        }
+        Result<AccountView> view = vault.getAccountView(tag);
+        if (!view) {
+            return std::string(clam_status_message(view.error()));
+        }
+        const AccountView &account = *view;
+        reply.push_back("ok");
+        if (command.size() == 2 || command[2] == "username") {
+            reply.emplace_back(account.username);
+        }
+        if (command.size() == 2 || command[2] == "password") {
+            reply.emplace_back(account.password);
+        }
+        if (command.size() == 2 || command[2] == "note") {
+            reply.emplace_back(account.note);
+        }
+        return std::nullopt;
+    }
+
+    reply.push_back("ok");
+    return std::nullopt;
+}
@@ -0,0 +1,49 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "Vault.h"
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <optional>
+
+#define BATCH_BINARY_MAGIC "\0clam-batch" // a batch in the binary form begins with this (a text batch cannot begin with NUL)
+#define BATCH_BINARY_MAGIC_LENGTH 11
+#define BATCH_MAX_FIELDS 8
+#define BATCH_MAX_FIELD_SIZE (16 << 20)
+
+/*
+    A batch is a stream of commands, each of which is a list of fields:
+
+    add <tag> [<username> <password> [<note>]]
+    update <tag> (username | password | note) <value>
+    delete <tag>
+    print <tag> [username | password | note]
+
+    In the text form, each command is one line whose fields are separated by tabs, and tabs, newlines and
+    backslashes within fields are escaped as \t, \n and \\. In the binary form, the stream begins with
+    BATCH_BINARY_MAGIC, and each command is a uint32 field count followed by the fields, each preceded by
+    its uint32 size.
+
+    Every command is answered in the same form with the fields "ok" (followed by the printed values of a
+    print command) or "error" and a message. The batch stops at the first error.
+*/
+
+/**
+    Applies a batch of account commands to one unlocked vault. The commands only change the vault in
+    memory, so that the caller writes the vault once if the whole batch succeeded, and not at all otherwise.
+*/
+class Batch {
+public:
+    Batch(Vault &vault);
+    bool run(std::istream &input, std::ostream &output);
+private:
+    bool readCommand(std::istream &input, std::vector<std::string> &fields, std::string &parseError);
+    void writeReply(std::ostream &output, const std::vector<std::string> &fields) const;
+    std::optional<std::string> apply(const std::vector<std::string> &command, std::vector<std::string> &reply);
+    Vault &vault;
+    bool binary;
+};
+
+#endif
@@ -27,6 +27,20 @@ CommandLineParser::CommandLineParser(int argc, char **argv) {
         {"delete",    no_argument, 0, CommandLineOptions::DELETE_OPTION},
         {"add",    required_argument, 0, CommandLineOptions::ADD_OPTION},
         {"info",    no_argument, 0, CommandLineOptions::INFO_OPTION},
+        {"search",    required_argument, 0, CommandLineOptions::SEARCH_OPTION},
+        {"limit",    required_argument, 0, CommandLineOptions::LIMIT_OPTION},
+        {"cipher",    required_argument, 0, CommandLineOptions::CIPHER_OPTION},
+        {"kdf",    required_argument, 0, CommandLineOptions::KDF_OPTION},
+        {"agent",    no_argument, 0, CommandLineOptions::AGENT_OPTION},
+        {"timeout",    required_argument, 0, CommandLineOptions::TIMEOUT_OPTION},
+        {"batch",    no_argument, 0, CommandLineOptions::BATCH_OPTION},
+        {"import",    required_argument, 0, CommandLineOptions::IMPORT_OPTION},
+        {"export",    no_argument, 0, CommandLineOptions::EXPORT_OPTION},
+        {"format",    required_argument, 0, CommandLineOptions::FORMAT_OPTION},
+        {"import-kdbx",    required_argument, 0, CommandLineOptions::IMPORT_KDBX_OPTION},
+        {"kdbx-key",    required_argument, 0, CommandLineOptions::KDBX_KEY_OPTION},
+        {"stats",    optional_argument, 0, CommandLineOptions::STATS_OPTION},
+        {"data-dir",    required_argument, 0, CommandLineOptions::DATA_DIR_OPTION},
         {"help",    no_argument, 0, CommandLineOptions::HELP_OPTION},
         {0, 0, 0, 0}
     };
@@ -38,7 +52,7 @@ CommandLineParser::CommandLineParser(int argc, char **argv) {
         /* getopt_long stores the option index here. */
         int option_index = 0;
 
-        c = getopt_long(argc, argv, "v:k:n:c:p:u:f:a:dih",
+        c = getopt_long(argc, argv, "v:k:n:c:p:u:f:a:s:dih",
                        long_options, &option_index);
 
         /* Detect the end of the options. */
@@ -136,6 +150,64 @@ CommandLineParser::CommandLineParser(int argc, char **argv) {
             optMap.insert(std::pair<CommandLineOptions, std::string>(CommandLineOptions::INFO_OPTION, ""));
             break;
 
+        case CommandLineOptions::SEARCH_OPTION:
+            optMap.insert(std::pair<CommandLineOptions, std::string>(CommandLineOptions::SEARCH_OPTION, optarg));
+            break;
+
+        case CommandLineOptions::LIMIT_OPTION:
+            optMap.insert(std::pair<CommandLineOptions, std::string>(CommandLineOptions::LIMIT_OPTION, optarg));
+            break;
+
+        case CommandLineOptions::CIPHER_OPTION:
+            optMap.insert(std::pair<CommandLineOptions, std::string>(CommandLineOptions::CIPHER_OPTION, optarg));
+            break;
+
+        case CommandLineOptions::KDF_OPTION:
+            optMap.insert(std::pair<CommandLineOptions, std::string>(CommandLineOptions::KDF_OPTION, optarg));
+            break;
+
+        case CommandLineOptions::AGENT_OPTION:
+            optMap.insert(std::pair<CommandLineOptions, std::string>(CommandLineOptions::AGENT_OPTION, ""));
+            break;
+
+        case CommandLineOptions::TIMEOUT_OPTION:
+            optMap.insert(std::pair<CommandLineOptions, std::string>(CommandLineOptions::TIMEOUT_OPTION, optarg));
+            break;
+
+        case CommandLineOptions::BATCH_OPTION:
+            optMap.insert(std::pair<CommandLineOptions, std::string>(CommandLineOptions::BATCH_OPTION, ""));
+            break;
+
+        case CommandLineOptions::IMPORT_OPTION:
+            optMap.insert(std::pair<CommandLineOptions, std::string>(CommandLineOptions::IMPORT_OPTION, optarg));
+            break;
+
+        case CommandLineOptions::EXPORT_OPTION:
+            optMap.insert(std::pair<CommandLineOptions, std::string>(CommandLineOptions::EXPORT_OPTION, ""));
+            break;
+
+        case CommandLineOptions::FORMAT_OPTION:
+            optMap.insert(std::pair<CommandLineOptions, std::string>(CommandLineOptions::FORMAT_OPTION, optarg));
+            break;
+
+        case CommandLineOptions::IMPORT_KDBX_OPTION:
+            optMap.insert(std::pair<CommandLineOptions, std::string>(CommandLineOptions::IMPORT_KDBX_OPTION, optarg));
+            break;
+
+        case CommandLineOptions::KDBX_KEY_OPTION:
+            optMap.insert(std::pair<CommandLineOptions, std::string>(CommandLineOptions::KDBX_KEY_OPTION, optarg));
+            break;
+
+        case CommandLineOptions::STATS_OPTION:
+            // Unlike the account field options, the format may only be given as --stats=format, so that
+            // --stats never takes the argument that follows it:
+            optMap.insert(std::pair<CommandLineOptions, std::string>(CommandLineOptions::STATS_OPTION, optarg ? optarg : ""));
+            break;
+
+        case CommandLineOptions::DATA_DIR_OPTION:
+            optMap.insert(std::pair<CommandLineOptions, std::string>(CommandLineOptions::DATA_DIR_OPTION, optarg));
+            break;
+
         case CommandLineOptions::HELP_OPTION:
             optMap.insert(std::pair<CommandLineOptions, std::string>(CommandLineOptions::HELP_OPTION, ""));
             break;
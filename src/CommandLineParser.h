@@ -19,6 +19,20 @@ enum CommandLineOptions {
     DELETE_OPTION = 'd', // -d or --delete
     ADD_OPTION = 'a', // -a or --add
     INFO_OPTION = 'i', // -i or --info
+    SEARCH_OPTION = 's', // -s or --search
+    LIMIT_OPTION = 'z' + 1004, // --limit
+    CIPHER_OPTION = 'z' + 1005, // --cipher
+    KDF_OPTION = 'z' + 1006, // --kdf
+    AGENT_OPTION = 'z' + 1007, // --agent
+    TIMEOUT_OPTION = 'z' + 1008, // --timeout
+    BATCH_OPTION = 'z' + 1009, // --batch
+    IMPORT_OPTION = 'z' + 1010, // --import
+    EXPORT_OPTION = 'z' + 1011, // --export
+    FORMAT_OPTION = 'z' + 1012, // --format
+    IMPORT_KDBX_OPTION = 'z' + 1013, // --import-kdbx
+    KDBX_KEY_OPTION = 'z' + 1014, // --kdbx-key
+    STATS_OPTION = 'z' + 1015, // --stats
+    DATA_DIR_OPTION = 'z' + 1016, // --data-dir
     HELP_OPTION = 'h',
 };
 
@@ -0,0 +1,418 @@
+#include "CryptoContext.h"
+#include "Utils.h"
+#include "Stats.h"
+
+#include <tomcrypt.h>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+// The secret state of a CryptoContext:
+struct CryptoContext::Secrets {
+    unsigned char skey[SKEY_LENGTH];
+    symmetric_CTR ctr; // CTR state with the key schedule of skey, from which every Twofish operation starts
+};
+
+// The registry of supported cipher suites:
+struct CipherSuiteInfo {
+    CipherSuite suite;
+    const char *name; // name by which the suite is selected on the command line
+};
+
+static const CipherSuiteInfo cipherSuites[] = {
+    { CIPHER_SUITE_TWOFISH_CTR, "twofish-ctr" },
+    { CIPHER_SUITE_AES_256_GCM, "aes-256-gcm" },
+    { CIPHER_SUITE_CHACHA20_POLY1305, "chacha20-poly1305" },
+};
+
+CryptoContext::CryptoContext()
+: secrets(nullptr), suite(CIPHER_SUITE_TWOFISH_CTR), cipher(-1), blockSize(0) {
+}
+
+/**
+    Derives the symmetric key from the given vault key and SKEY_LENGTH byte salt with the given KDF
+    parameters and prepares the default cipher suite, storing all secret state in memory that is
+    locked and excluded from core dumps. Returns an error if the memory cannot be allocated or the
+    key cannot be derived.
+*/
+Result<std::unique_ptr<CryptoContext>> CryptoContext::create(const std::string &vaultKey, const unsigned char *salt, const KdfParams &kdfParams) {
+    ScopedTimer timer(STATS_KDF);
+    Result<std::unique_ptr<CryptoContext>> crypto = allocate();
+    if (!crypto) {
+        return crypto;
+    }
+
+    // Derive skey from the vault key:
+    if (!Kdf::deriveKey(vaultKey, salt, kdfParams, (*crypto)->secrets->skey) || !(*crypto)->setCipherSuite(defaultCipherSuite())) {
+        return CLAM_ERROR_CRYPTO;
+    }
+
+    return crypto;
+}
+
+/**
+    Creates a context for a new random data key, with the default cipher suite.
+    Returns an error if the memory cannot be allocated, or the key or cipher cannot be prepared.
+*/
+Result<std::unique_ptr<CryptoContext>> CryptoContext::generate() {
+    Result<std::unique_ptr<CryptoContext>> crypto = allocate();
+    if (!crypto) {
+        return crypto;
+    }
+    if (!Utils::genRand((*crypto)->secrets->skey, SKEY_LENGTH) || !(*crypto)->setCipherSuite(defaultCipherSuite())) {
+        return CLAM_ERROR_CRYPTO;
+    }
+    return crypto;
+}
+
+/**
+    Creates a context whose secrets are allocated (zeroed) in an arena of their own, so that locking
+    them locks nothing else.
+*/
+Result<std::unique_ptr<CryptoContext>> CryptoContext::allocate() {
+    std::unique_ptr<CryptoContext> crypto(new CryptoContext());
+    try {
+        crypto->secrets = (Secrets *)crypto->arena.allocate(sizeof(Secrets), alignof(Secrets));
+    } catch (const std::bad_alloc &) {
+        return CLAM_ERROR_OUT_OF_MEMORY;
+    }
+    return crypto;
+}
+
+/**
+    Selects the cipher suite used by all following operations, registering its cipher with libtomcrypt and,
+    for Twofish, computing the key schedule of the CTR state from which every operation starts.
+    Returns false if libtomcrypt fails to prepare the cipher.
+*/
+bool CryptoContext::setCipherSuite(CipherSuite newSuite) {
+    suite = newSuite;
+    cipher = -1;
+    blockSize = 0;
+
+    if (suite == CIPHER_SUITE_TWOFISH_CTR || suite == CIPHER_SUITE_AES_256_GCM) {
+        const ltc_cipher_descriptor &descriptor = suite == CIPHER_SUITE_TWOFISH_CTR ? twofish_desc : aes_desc;
+        if (register_cipher(&descriptor) == -1) {
+            return false;
+        }
+        cipher = find_cipher(descriptor.name);
+        blockSize = cipher_descriptor[cipher].block_length;
+    }
+
+    if (suite == CIPHER_SUITE_TWOFISH_CTR) {
+        // Initialize CTR cipher (the IV is replaced by each operation):
+        int err;
+        unsigned char iv[MAXBLOCKSIZE] = { 0 };
+        zeromem(&secrets->ctr, sizeof(secrets->ctr));
+        if ((err = ctr_start(
+            cipher, /* index of desired cipher */
+            iv, /* the initial vector */
+            secrets->skey, /* the secret key */
+            SKEY_LENGTH, /* length of secret key */
+            0, /* 0 == default # of rounds */
+            CTR_COUNTER_LITTLE_ENDIAN, /* Little endian counter */
+            &secrets->ctr) /* where to store the CTR state */
+            ) != CRYPT_OK) {
+                return false;
+        }
+    }
+    return true;
+}
+
+CipherSuite CryptoContext::getCipherSuite() const {
+    return suite;
+}
+
+/**
+    Returns the number of bytes by which a ciphertext produced by encrypt exceeds its plaintext.
+*/
+size_t CryptoContext::getOverhead() const {
+    return suite == CIPHER_SUITE_TWOFISH_CTR ? 0 : AEAD_TAG_LENGTH;
+}
+
+/**
+    Returns the symmetric key, which is SKEY_LENGTH bytes long.
+*/
+const unsigned char *CryptoContext::getSkey() const {
+    return secrets->skey;
+}
+
+/**
+    Computes the salted hash by which the vault key is verified, sha256(skey || salt),
+    and stores it in keyHash. Both salt and keyHash are SKEY_LENGTH bytes long.
+*/
+void CryptoContext::computeKeyHash(const unsigned char *salt, unsigned char *keyHash) const {
+    unsigned char concatBuffer[SKEY_LENGTH * 2];
+    Utils::concatArr(secrets->skey, salt, SKEY_LENGTH, SKEY_LENGTH, concatBuffer);
+    Utils::sha256(keyHash, concatBuffer, SKEY_LENGTH * 2);
+    zeromem(concatBuffer, sizeof(concatBuffer));
+}
+
+/**
+    Returns true if this context's vault key hashes to correctHash with the given salt.
+*/
+bool CryptoContext::verifyKey(const unsigned char *salt, const unsigned char *correctHash) const {
+    ScopedTimer timer(STATS_KDF);
+    unsigned char providedKeyHash[SKEY_LENGTH];
+    computeKeyHash(salt, providedKeyHash);
+
+    return Utils::contentsEqual(providedKeyHash, correctHash, SKEY_LENGTH);
+}
+
+/**
+    Encrypts the key of the given context with this context's key, always with ChaCha20-Poly1305 (whatever
+    the suite in use), so that it can be stored. Generates and stores the nonce in 'iv', which must be
+    SKEY_LENGTH bytes long, and stores the WRAPPED_KEY_LENGTH byte result in 'wrappedKey'.
+    Returns false if no nonce can be generated or libtomcrypt fails to encrypt.
+*/
+bool CryptoContext::wrapKey(const CryptoContext &keyToWrap, unsigned char *iv, unsigned char *wrappedKey) const {
+    if (!Utils::genRand(iv, SKEY_LENGTH)) {
+        return false;
+    }
+    unsigned long tagSize = AEAD_TAG_LENGTH;
+    int err = chacha20poly1305_memory(secrets->skey, SKEY_LENGTH, iv, AEAD_NONCE_LENGTH, nullptr, 0,
+        keyToWrap.secrets->skey, SKEY_LENGTH, wrappedKey, wrappedKey + SKEY_LENGTH, &tagSize, CHACHA20POLY1305_ENCRYPT);
+    if (err != CRYPT_OK) {
+        return false;
+    }
+    return true;
+}
+
+/**
+    Decrypts a key wrapped by wrapKey with this context's key, and returns a context for it with the
+    default cipher suite. The key is decrypted straight into the new context's secrets. Returns
+    CLAM_ERROR_META_CORRUPT if the wrapped key does not verify.
+*/
+Result<std::unique_ptr<CryptoContext>> CryptoContext::unwrapKey(const unsigned char *iv, const unsigned char *wrappedKey) const {
+    Result<std::unique_ptr<CryptoContext>> crypto = allocate();
+    if (!crypto) {
+        return crypto;
+    }
+
+    unsigned char tag[AEAD_TAG_LENGTH];
+    unsigned long tagSize = AEAD_TAG_LENGTH;
+    int err = chacha20poly1305_memory(secrets->skey, SKEY_LENGTH, iv, AEAD_NONCE_LENGTH, nullptr, 0,
+        wrappedKey, SKEY_LENGTH, (*crypto)->secrets->skey, tag, &tagSize, CHACHA20POLY1305_DECRYPT);
+    if (err != CRYPT_OK) {
+        return CLAM_ERROR_CRYPTO;
+    }
+    if (mem_neq(tag, wrappedKey + SKEY_LENGTH, AEAD_TAG_LENGTH) != 0) {
+        return CLAM_ERROR_META_CORRUPT;
+    }
+    if (!(*crypto)->setCipherSuite(defaultCipherSuite())) {
+        return CLAM_ERROR_CRYPTO;
+    }
+    return crypto;
+}
+
+/**
+  Encrypts the contents of the 'plaintext' array of size 'plaintextSize' and stores the result in
+  'ciphertext,' which must be getOverhead() bytes larger than the plaintext (authenticated suites
+  append their tag). Generates and stores the nonce/IV used to encrypt the plaintext in the 'iv'
+  array, which must be SKEY_LENGTH bytes long. Returns false if no IV can be generated or libtomcrypt
+  fails to encrypt.
+*/
+bool CryptoContext::encrypt(const unsigned char *plaintext, unsigned char *ciphertext, size_t plaintextSize, unsigned char *iv) const {
+    ScopedTimer timer(STATS_ENCRYPT);
+
+    // Generate an IV for the cipher from the CSPRNG. The authenticated suites use its first 96 bits as
+    // the nonce, which must never repeat under one key, so they must be uniformly random (a repeat is
+    // only expected after about 2^48 encryptions):
+    if (!Utils::genRand(iv, SKEY_LENGTH)) {
+        return false;
+    }
+
+    int err = CRYPT_OK;
+    unsigned long tagSize = AEAD_TAG_LENGTH;
+    switch (suite) {
+    case CIPHER_SUITE_TWOFISH_CTR:
+        return ctrCrypt(plaintext, ciphertext, plaintextSize, iv);
+    case CIPHER_SUITE_AES_256_GCM:
+        err = gcm_memory(cipher, secrets->skey, SKEY_LENGTH, iv, AEAD_NONCE_LENGTH, nullptr, 0,
+            (unsigned char *)plaintext, plaintextSize, ciphertext, ciphertext + plaintextSize, &tagSize, GCM_ENCRYPT);
+        break;
+    case CIPHER_SUITE_CHACHA20_POLY1305:
+        err = chacha20poly1305_memory(secrets->skey, SKEY_LENGTH, iv, AEAD_NONCE_LENGTH, nullptr, 0,
+            plaintext, plaintextSize, ciphertext, ciphertext + plaintextSize, &tagSize, CHACHA20POLY1305_ENCRYPT);
+        break;
+    }
+
+    if (err != CRYPT_OK) {
+        return false;
+    }
+    return true;
+}
+
+/**
+  Decrypts the contents of the 'ciphertext' array of size 'ciphertextSize' using the provided nonce/IV
+  and stores the result in 'plaintext,' which is getOverhead() bytes smaller than the ciphertext (and may
+  be the ciphertext array itself). Returns false if the ciphertext is too short or, for authenticated
+  suites, if its tag does not verify (or libtomcrypt fails to decrypt), in which case the contents of 'plaintext' must not be used.
+*/
+bool CryptoContext::decrypt(const unsigned char *ciphertext, unsigned char *plaintext, size_t ciphertextSize, const unsigned char *iv) const {
+    ScopedTimer timer(STATS_DECRYPT);
+    if (ciphertextSize < getOverhead()) {
+        return false;
+    }
+    const size_t plaintextSize = ciphertextSize - getOverhead();
+
+    int err = CRYPT_OK;
+    unsigned char tag[AEAD_TAG_LENGTH];
+    unsigned long tagSize = AEAD_TAG_LENGTH;
+    switch (suite) {
+    case CIPHER_SUITE_TWOFISH_CTR:
+        return ctrCrypt(ciphertext, plaintext, plaintextSize, iv);
+    case CIPHER_SUITE_AES_256_GCM:
+        // The expected tag is computed, and must be compared with the stored one:
+        err = gcm_memory(cipher, secrets->skey, SKEY_LENGTH, iv, AEAD_NONCE_LENGTH, nullptr, 0,
+            plaintext, plaintextSize, (unsigned char *)ciphertext, tag, &tagSize, GCM_DECRYPT);
+        break;
+    case CIPHER_SUITE_CHACHA20_POLY1305:
+        err = chacha20poly1305_memory(secrets->skey, SKEY_LENGTH, iv, AEAD_NONCE_LENGTH, nullptr, 0,
+            ciphertext, plaintextSize, plaintext, tag, &tagSize, CHACHA20POLY1305_DECRYPT);
+        break;
+    }
+
+    if (err != CRYPT_OK) {
+        return false;
+    }
+    return mem_neq(tag, ciphertext + plaintextSize, AEAD_TAG_LENGTH) == 0;
+}
+
+/**
+    Returns the cipher suite with which new vaults are encrypted: the fastest authenticated suite
+    available. libtomcrypt implements both AES and ChaCha20 in portable C (it does not use AES-NI),
+    and on every host its ChaCha20-Poly1305 is faster than its table-based AES-GCM.
+*/
+CipherSuite CryptoContext::defaultCipherSuite() {
+    return CIPHER_SUITE_CHACHA20_POLY1305;
+}
+
+/**
+    Returns true if the given value (e.g. read from a vault file) identifies a supported cipher suite.
+*/
+bool CryptoContext::isCipherSuite(uint32_t suite) {
+    for (const CipherSuiteInfo &info : cipherSuites) {
+        if (info.suite == suite) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+    Returns the cipher suite with the given name, or std::nullopt if there is none.
+*/
+std::optional<CipherSuite> CryptoContext::findCipherSuite(const std::string &name) {
+    for (const CipherSuiteInfo &info : cipherSuites) {
+        if (name == info.name) {
+            return info.suite;
+        }
+    }
+    return std::nullopt;
+}
+
+/**
+    Returns the name of the given cipher suite.
+*/
+const char *CryptoContext::cipherSuiteName(CipherSuite suite) {
+    for (const CipherSuiteInfo &info : cipherSuites) {
+        if (info.suite == suite) {
+            return info.name;
+        }
+    }
+    return "unknown";
+}
+
+/**
+    Returns the names of all cipher suites, separated by commas.
+*/
+std::string CryptoContext::cipherSuiteNames() {
+    std::string names;
+    for (const CipherSuiteInfo &info : cipherSuites) {
+        names += (names.empty() ? "" : ", ") + std::string(info.name);
+    }
+    return names;
+}
+
+/**
+  XORs the 'size' bytes of 'input' with the Twofish CTR keystream for the given IV, and stores the result in
+  'output' (CTR encryption and decryption are the same operation). Since the keystream block at any
+  position can be computed from the IV alone, large buffers are split into block-aligned chunks that
+  are processed in parallel, which produces exactly the same output as processing the buffer sequentially.
+  Returns false if libtomcrypt fails to process any chunk.
+*/
+bool CryptoContext::ctrCrypt(const unsigned char *input, unsigned char *output, size_t size, const unsigned char *iv) const {
+    size_t numWorkers = 1;
+    if (size >= CTR_PARALLEL_THRESHOLD) {
+        numWorkers = std::min({ (size_t)std::max(1u, std::thread::hardware_concurrency()), (size_t)CTR_MAX_WORKERS,
+            size / CTR_MIN_CHUNK_SIZE });
+    }
+
+    int err;
+    if (numWorkers <= 1) {
+        err = ctrCryptChunk(input, output, size, iv, 0);
+    } else {
+        // Divide the buffer into one block-aligned chunk per worker (the last chunk takes the remainder):
+        const size_t chunkSize = (size / numWorkers) / blockSize * blockSize;
+        std::vector<int> workerErrs(numWorkers, CRYPT_OK);
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < numWorkers; ++i) {
+            size_t chunkOffset = i * chunkSize;
+            size_t thisChunkSize = (i == numWorkers - 1) ? size - chunkOffset : chunkSize;
+            workers.emplace_back([=, &workerErrs]() {
+                workerErrs[i] = ctrCryptChunk(input + chunkOffset, output + chunkOffset, thisChunkSize, iv, chunkOffset / blockSize);
+            });
+        }
+        workerErrs[0] = ctrCryptChunk(input, output, chunkSize, iv, 0);
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+
+        err = CRYPT_OK;
+        for (int workerErr : workerErrs) {
+            if (workerErr != CRYPT_OK) {
+                err = workerErr;
+            }
+        }
+    }
+
+    if (err != CRYPT_OK) {
+        return false;
+    }
+    return true;
+}
+
+/**
+  Processes one chunk of a CTR mode buffer, which begins at block number 'firstBlock' of the keystream
+  for the given IV. The counter block for that position is the IV plus 'firstBlock,' since the counter
+  is the whole (little endian) block. The chunk is processed with a copy of the cached CTR state, so the
+  key schedule is not recomputed. Returns a libtomcrypt error code.
+*/
+int CryptoContext::ctrCryptChunk(const unsigned char *input, unsigned char *output, size_t size, const unsigned char *iv, uint64_t firstBlock) const {
+    // Compute the counter block of the chunk's first block:
+    unsigned char counter[MAXBLOCKSIZE];
+    std::memcpy(counter, iv, blockSize);
+    uint64_t carry = firstBlock;
+    for (int i = 0; i < blockSize && carry != 0; ++i) {
+        carry += counter[i];
+        counter[i] = (unsigned char)(carry & 0xFF);
+        carry >>= 8;
+    }
+
+    // Start from the cached CTR state, positioned at the chunk's counter block:
+    int err;
+    symmetric_CTR ctr = secrets->ctr;
+    if ((err = ctr_setiv(counter, (unsigned long)blockSize, &ctr)) == CRYPT_OK) {
+        // Encrypt (or decrypt) the chunk using CTR cipher:
+        err = ctr_encrypt(input, /* plaintext */
+            output, /* ciphertext */
+            size, /* length of plaintext pt */
+            &ctr); /* CTR state */
+    }
+
+    zeromem(&ctr, sizeof(ctr));
+    zeromem(counter, sizeof(counter));
+    return err;
+}
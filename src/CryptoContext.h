@@ -0,0 +1,72 @@
+#ifndef CRYPTO_CONTEXT_H
+#define CRYPTO_CONTEXT_H
+
+#include "Kdf.h"
+#include "Status.h"
+#include "SecureArena.h"
+
+#include <string>
+#include <optional>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#define SKEY_LENGTH 32 // symmetric key length in bytes (256 bits)
+
+#define CTR_PARALLEL_THRESHOLD (1 << 20) // buffers smaller than this (in bytes) are encrypted on the calling thread
+#define CTR_MIN_CHUNK_SIZE (1 << 18) // smallest share of a buffer (in bytes) handed to one worker thread
+#define CTR_MAX_WORKERS 8
+
+#define AEAD_NONCE_LENGTH 12 // authenticated suites use the first 12 bytes of each (SKEY_LENGTH byte) iv as the nonce
+#define AEAD_TAG_LENGTH 16 // authenticated suites append a 16 byte tag to each ciphertext
+#define WRAPPED_KEY_LENGTH (SKEY_LENGTH + AEAD_TAG_LENGTH) // a key wrapped with ChaCha20-Poly1305, followed by its tag
+
+// Cipher suites with which a vault may be encrypted (the values are stored in vault files):
+enum CipherSuite : uint32_t {
+    CIPHER_SUITE_TWOFISH_CTR = 1, // unauthenticated; the only suite of version 1 and 2 vaults
+    CIPHER_SUITE_AES_256_GCM = 2,
+    CIPHER_SUITE_CHACHA20_POLY1305 = 3,
+};
+
+/**
+    Holds everything needed to encrypt and decrypt with one symmetric key (skey): the key itself, the cipher
+    suite in use, and (for Twofish) a CTR state whose key schedule has already been computed. The key is
+    either derived from a vault key (skey = KDF(vaultKey, salt)), in which case it wraps the vault's data
+    key, or it is a random data key with which a vault is encrypted. It is created once per unlock and
+    shared by everything that encrypts with that key.
+*/
+class CryptoContext {
+public:
+    static Result<std::unique_ptr<CryptoContext>> create(const std::string &vaultKey, const unsigned char *salt, const KdfParams &kdfParams);
+    static Result<std::unique_ptr<CryptoContext>> generate();
+    CryptoContext(const CryptoContext &) = delete;
+    CryptoContext &operator=(const CryptoContext &) = delete;
+    bool setCipherSuite(CipherSuite suite);
+    CipherSuite getCipherSuite() const;
+    size_t getOverhead() const;
+    const unsigned char *getSkey() const;
+    void computeKeyHash(const unsigned char *salt, unsigned char *keyHash) const;
+    bool verifyKey(const unsigned char *salt, const unsigned char *correctHash) const;
+    bool wrapKey(const CryptoContext &keyToWrap, unsigned char *iv, unsigned char *wrappedKey) const;
+    Result<std::unique_ptr<CryptoContext>> unwrapKey(const unsigned char *iv, const unsigned char *wrappedKey) const;
+    bool encrypt(const unsigned char *plaintext, unsigned char *ciphertext, size_t plaintextSize, unsigned char *iv) const;
+    bool decrypt(const unsigned char *ciphertext, unsigned char *plaintext, size_t ciphertextSize, const unsigned char *iv) const;
+    static CipherSuite defaultCipherSuite();
+    static bool isCipherSuite(uint32_t suite);
+    static std::optional<CipherSuite> findCipherSuite(const std::string &name);
+    static const char *cipherSuiteName(CipherSuite suite);
+    static std::string cipherSuiteNames();
+private:
+    struct Secrets; // defined with the libtomcrypt types in CryptoContext.cpp
+    CryptoContext();
+    static Result<std::unique_ptr<CryptoContext>> allocate();
+    bool ctrCrypt(const unsigned char *input, unsigned char *output, size_t size, const unsigned char *iv) const;
+    int ctrCryptChunk(const unsigned char *input, unsigned char *output, size_t size, const unsigned char *iv, uint64_t firstBlock) const;
+    SecureArena arena; // holds the secrets, and is wiped when the context is destroyed
+    Secrets *secrets;
+    CipherSuite suite;
+    int cipher; // libtomcrypt index of the suite's block cipher, if it has one
+    int blockSize;
+};
+
+#endif
@@ -0,0 +1,66 @@
+#include "FileLock.h"
+
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <thread>
+
+FileLock::FileLock(int fd)
+: fd(fd) {
+
+}
+
+FileLock::FileLock(FileLock &&other)
+: fd(other.fd) {
+    other.fd = -1;
+}
+
+FileLock::~FileLock() {
+    if (fd >= 0) {
+        close(fd); // releases the lock
+    }
+}
+
+/**
+    Takes the exclusive lock of the given lock file (which is created if it does not exist), waiting up to
+    timeoutMillis milliseconds for the process that holds it to release it. Returns CLAM_ERROR_LOCK_TIMEOUT
+    if it is still held by then, or CLAM_ERROR_WRITE if the lock file cannot be opened.
+*/
+Result<FileLock> FileLock::acquire(const std::string &lockFilePath, uint32_t timeoutMillis) {
+    int fd = ::open(lockFilePath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return CLAM_ERROR_WRITE;
+    }
+
+    // Poll rather than block, so that the wait is bounded (without relying on signals to interrupt flock):
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMillis);
+    uint32_t pollMillis = WRITE_LOCK_POLL_MS;
+    while (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        bool held = errno == EWOULDBLOCK || errno == EINTR;
+        if (!held || std::chrono::steady_clock::now() >= deadline) {
+            close(fd);
+            return held ? CLAM_ERROR_LOCK_TIMEOUT : CLAM_ERROR_WRITE;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(pollMillis));
+        pollMillis = std::min(pollMillis * 2, (uint32_t)WRITE_LOCK_MAX_POLL_MS);
+    }
+    return FileLock(fd);
+}
+
+/**
+    Returns whether some process holds the lock of the given lock file (e.g. a writer that is in the
+    middle of changing a file that readers are reading).
+*/
+bool FileLock::isHeld(const std::string &lockFilePath) {
+    int fd = ::open(lockFilePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool held = flock(fd, LOCK_SH | LOCK_NB) != 0 && errno == EWOULDBLOCK;
+    close(fd);
+    return held;
+}
@@ -0,0 +1,31 @@
+#ifndef FILE_LOCK_H
+#define FILE_LOCK_H
+
+#include "Status.h"
+
+#include <string>
+
+#define WRITE_LOCK_TIMEOUT_MS 10000 // how long a writer waits for other writers before giving up
+#define WRITE_LOCK_POLL_MS 2 // how long a waiting writer sleeps between attempts to take the lock (at first;
+                             // the sleep doubles after each attempt, up to WRITE_LOCK_MAX_POLL_MS)
+#define WRITE_LOCK_MAX_POLL_MS 50
+
+/**
+    An exclusive flock of a lock file, which serializes the processes that write to a data directory.
+    The lock is released when the FileLock is destroyed (or when its process exits, even if it crashes),
+    and readers never take it.
+*/
+class FileLock {
+public:
+    static Result<FileLock> acquire(const std::string &lockFilePath, uint32_t timeoutMillis);
+    static bool isHeld(const std::string &lockFilePath);
+    FileLock(FileLock &&other);
+    ~FileLock();
+    FileLock(const FileLock &) = delete;
+    FileLock &operator=(const FileLock &) = delete;
+private:
+    explicit FileLock(int fd);
+    int fd;
+};
+
+#endif
@@ -0,0 +1,966 @@
+#include "Kdbx.h"
+#include "Kdf.h"
+#include "Utils.h"
+
+#include <cstring>
+#include <map>
+#include <initializer_list>
+#include <algorithm>
+
+// Identifiers of the outer header fields:
+#define KDBX_HEADER_END 0
+#define KDBX_HEADER_CIPHER_ID 2
+#define KDBX_HEADER_COMPRESSION 3
+#define KDBX_HEADER_MASTER_SEED 4
+#define KDBX_HEADER_ENCRYPTION_IV 7
+#define KDBX_HEADER_KDF_PARAMETERS 11
+
+// Identifiers of the inner header fields:
+#define KDBX_INNER_HEADER_END 0
+#define KDBX_INNER_STREAM_ID 1
+#define KDBX_INNER_STREAM_KEY 2
+#define KDBX_INNER_STREAM_CHACHA20 3 // the only inner stream cipher that KDBX 4 writers use
+
+// UUIDs of the payload ciphers and key derivation functions:
+static const unsigned char AES_256_CBC_UUID[16] = {
+    0x31, 0xc1, 0xf2, 0xe6, 0xbf, 0x71, 0x43, 0x50, 0xbe, 0x58, 0x05, 0x21, 0x6a, 0xfc, 0x5a, 0xff };
+static const unsigned char CHACHA20_UUID[16] = {
+    0xd6, 0x03, 0x8a, 0x2b, 0x8b, 0x6f, 0x4c, 0xb5, 0xa5, 0x24, 0x33, 0x9a, 0x31, 0xdb, 0xb5, 0x9a };
+static const unsigned char ARGON2D_UUID[16] = {
+    0xef, 0x63, 0x6d, 0xdf, 0x8c, 0x29, 0x44, 0x4b, 0x91, 0xf7, 0xa9, 0xa4, 0x03, 0xe3, 0x0a, 0x0c };
+static const unsigned char ARGON2ID_UUID[16] = {
+    0x9e, 0x29, 0x8b, 0x19, 0x56, 0xdb, 0x47, 0x73, 0xb2, 0x3d, 0xfc, 0x3e, 0xc6, 0xf0, 0xa1, 0xe6 };
+static const unsigned char AES_KDF_UUID[16] = {
+    0xc9, 0xd9, 0xf3, 0x9a, 0x62, 0x8a, 0x44, 0x60, 0xbf, 0x74, 0x0d, 0x08, 0xc1, 0x8a, 0x4f, 0xea };
+
+// Names of the entry strings that are imported, in the order of KdbxReader::fields:
+static const char *const ENTRY_FIELD_KEYS[] = { "Title", "UserName", "Password", "Notes" };
+
+static uint32_t loadUint32(const unsigned char *in) {
+    uint32_t value;
+    std::memcpy(&value, in, sizeof(value)); // KDBX is little-endian, as vault files assume the host is
+    return value;
+}
+
+static uint64_t loadUint64(const unsigned char *in) {
+    uint64_t value;
+    std::memcpy(&value, in, sizeof(value));
+    return value;
+}
+
+/**
+    Computes the SHA-512 hash of the concatenation of the given buffers.
+*/
+static void sha512(unsigned char *result, std::initializer_list<std::pair<const unsigned char *, size_t>> inputs) {
+    hash_state md;
+    sha512_init(&md);
+    for (const auto &input : inputs) {
+        sha512_process(&md, input.first, (unsigned long)input.second);
+    }
+    sha512_done(&md, result);
+    zeromem(&md, sizeof(md));
+}
+
+/**
+    Computes the key of the HMAC of the block with the given index (or of the header), sha512(index || hmacKey).
+*/
+static void blockHmacKey(unsigned char *result, uint64_t index, const unsigned char *hmacKey) {
+    sha512(result, { { (const unsigned char *)&index, sizeof(index) }, { hmacKey, 64 } });
+}
+
+/**
+    Decodes the base64 string 'in' into 'out,' ignoring whitespace. Returns false if it is invalid.
+*/
+static bool decodeBase64(const std::string &in, std::string &out) {
+    out.clear();
+    uint32_t bits = 0;
+    int bitCount = 0;
+    bool padded = false;
+    for (char c : in) {
+        int value;
+        if (c >= 'A' && c <= 'Z') {
+            value = c - 'A';
+        } else if (c >= 'a' && c <= 'z') {
+            value = c - 'a' + 26;
+        } else if (c >= '0' && c <= '9') {
+            value = c - '0' + 52;
+        } else if (c == '+') {
+            value = 62;
+        } else if (c == '/') {
+            value = 63;
+        } else if (c == '=') {
+            padded = true;
+            continue;
+        } else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            continue;
+        } else {
+            return false;
+        }
+        if (padded) {
+            return false;
+        }
+        bits = (bits << 6) | (uint32_t)value;
+        bitCount += 6;
+        if (bitCount >= 8) {
+            bitCount -= 8;
+            out += (char)((bits >> bitCount) & 0xFF);
+        }
+    }
+    return true;
+}
+
+/**
+    Appends the UTF-8 encoding of the given code point to 'out.'
+*/
+static void appendUtf8(std::string &out, uint32_t codePoint) {
+    if (codePoint < 0x80) {
+        out += (char)codePoint;
+    } else if (codePoint < 0x800) {
+        out += (char)(0xC0 | (codePoint >> 6));
+        out += (char)(0x80 | (codePoint & 0x3F));
+    } else if (codePoint < 0x10000) {
+        out += (char)(0xE0 | (codePoint >> 12));
+        out += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+        out += (char)(0x80 | (codePoint & 0x3F));
+    } else {
+        out += (char)(0xF0 | (codePoint >> 18));
+        out += (char)(0x80 | ((codePoint >> 12) & 0x3F));
+        out += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+        out += (char)(0x80 | (codePoint & 0x3F));
+    }
+}
+
+KdbxPayload::KdbxPayload(std::istream &input)
+: input(input), cipher(KDBX_CIPHER_CHACHA20), compressed(false), finished(true), inflateEnded(false), blockIndex(0),
+    inflaterStarted(false), blockOffset(0), output(KDBX_INFLATE_CHUNK) {
+    zeromem(hmacKey, sizeof(hmacKey));
+    zeromem(&cbc, sizeof(cbc));
+    zeromem(&chacha, sizeof(chacha));
+    setg(output.data(), output.data(), output.data());
+}
+
+KdbxPayload::~KdbxPayload() {
+    if (inflaterStarted) {
+        inflateEnd(&inflater);
+    }
+    zeromem(hmacKey, sizeof(hmacKey));
+    zeromem(&cbc, sizeof(cbc));
+    zeromem(&chacha, sizeof(chacha));
+    zeromem(block.data(), block.size());
+    zeromem(heldBack.data(), heldBack.size());
+    zeromem(output.data(), output.size());
+}
+
+/**
+    Starts decrypting the blocks that follow the header of the input with the given keys.
+*/
+void KdbxPayload::start(KdbxCipher newCipher, const unsigned char *encryptionKey, const std::vector<unsigned char> &iv,
+    const unsigned char *newHmacKey, bool newCompressed) {
+    int err;
+    cipher = newCipher;
+    compressed = newCompressed;
+    std::memcpy(hmacKey, newHmacKey, sizeof(hmacKey));
+
+    if (cipher == KDBX_CIPHER_AES_256_CBC) {
+        if (register_cipher(&aes_desc) == -1) {
+            std::cout << "Error registering cipher.\n" << std::endl;
+            exit(1);
+        }
+        if ((err = cbc_start(find_cipher(aes_desc.name), iv.data(), encryptionKey, KDBX_KEY_LENGTH, 0, &cbc)) != CRYPT_OK) {
+            std::cout << "cbc_start error: " << error_to_string(err) << std::endl;
+            exit(1);
+        }
+    } else {
+        if ((err = chacha_setup(&chacha, encryptionKey, KDBX_KEY_LENGTH, 20)) != CRYPT_OK
+            || (err = chacha_ivctr32(&chacha, iv.data(), (unsigned long)iv.size(), 0)) != CRYPT_OK) {
+            std::cout << "chacha_setup error: " << error_to_string(err) << std::endl;
+            exit(1);
+        }
+    }
+
+    if (compressed) {
+        std::memset(&inflater, 0, sizeof(inflater));
+        if (inflateInit2(&inflater, 16 + MAX_WBITS) != Z_OK) { // expect a gzip header
+            std::cout << "Error initializing zlib." << std::endl;
+            exit(1);
+        }
+        inflaterStarted = true;
+    }
+    finished = false;
+}
+
+/**
+    Returns whether the payload is corrupt or truncated, as described by getError.
+*/
+bool KdbxPayload::failed() const {
+    return !error.empty();
+}
+
+const std::string &KdbxPayload::getError() const {
+    return error;
+}
+
+bool KdbxPayload::fail(const std::string &message) {
+    if (error.empty()) {
+        error = message;
+    }
+    return false;
+}
+
+/**
+    Refills the get area with the next decrypted (and inflated) bytes of the payload.
+*/
+KdbxPayload::int_type KdbxPayload::underflow() {
+    while (!failed()) {
+        if (compressed && inflateEnded) {
+            blockOffset = block.size(); // anything after the gzip stream is only authenticated
+        } else if (compressed) {
+            inflater.next_in = block.data() + blockOffset;
+            inflater.avail_in = (uInt)(block.size() - blockOffset);
+            inflater.next_out = (Bytef *)output.data();
+            inflater.avail_out = (uInt)output.size();
+            int status = inflate(&inflater, Z_NO_FLUSH);
+            blockOffset = block.size() - inflater.avail_in;
+            if (status == Z_STREAM_END) {
+                inflateEnded = true;
+            } else if (status != Z_OK && status != Z_BUF_ERROR) {
+                fail("The KDBX payload is not valid gzip data.");
+                break;
+            }
+            const size_t produced = output.size() - inflater.avail_out;
+            if (produced > 0) {
+                setg(output.data(), output.data(), output.data() + produced);
+                return traits_type::to_int_type(output[0]);
+            }
+        } else if (blockOffset < block.size()) {
+            const size_t produced = std::min(output.size(), block.size() - blockOffset);
+            std::memcpy(output.data(), block.data() + blockOffset, produced);
+            blockOffset += produced;
+            setg(output.data(), output.data(), output.data() + produced);
+            return traits_type::to_int_type(output[0]);
+        }
+
+        // The current block is used up:
+        if (finished) {
+            if (compressed && !inflateEnded) {
+                fail("The KDBX payload is truncated.");
+            }
+            break;
+        }
+        readBlock();
+    }
+    return traits_type::eof();
+}
+
+/**
+    Reads, authenticates and decrypts the next block of the payload into 'block.' The payload
+    ends with an empty block, after which 'finished' is set. Returns false if the block is corrupt.
+*/
+bool KdbxPayload::readBlock() {
+    unsigned char mac[32];
+    unsigned char sizeBytes[sizeof(uint32_t)];
+    if (!input.read((char *)mac, sizeof(mac)) || !input.read((char *)sizeBytes, sizeof(sizeBytes))) {
+        return fail("The KDBX file is truncated.");
+    }
+    const uint32_t size = loadUint32(sizeBytes);
+    if (size > KDBX_MAX_BLOCK_SIZE || (cipher == KDBX_CIPHER_AES_256_CBC && size % 16 != 0)) {
+        return fail("Block " + std::to_string(blockIndex) + " of the KDBX file is corrupt.");
+    }
+
+    // Authenticate index || size || data:
+    zeromem(block.data(), block.size());
+    block.resize(sizeof(blockIndex) + sizeof(sizeBytes) + size);
+    std::memcpy(block.data(), &blockIndex, sizeof(blockIndex));
+    std::memcpy(block.data() + sizeof(blockIndex), sizeBytes, sizeof(sizeBytes));
+    blockOffset = sizeof(blockIndex) + sizeof(sizeBytes);
+    if (!input.read((char *)block.data() + blockOffset, size)) {
+        return fail("The KDBX file is truncated.");
+    }
+    unsigned char key[64];
+    unsigned char expectedMac[32];
+    blockHmacKey(key, blockIndex, hmacKey);
+    bool computed = Utils::hmacSha256(expectedMac, key, sizeof(key), block.data(), (unsigned long)block.size());
+    zeromem(key, sizeof(key));
+    if (!computed || mem_neq(mac, expectedMac, sizeof(mac))) {
+        return fail("Block " + std::to_string(blockIndex) + " of the KDBX file is corrupt.");
+    }
+    ++blockIndex;
+
+    int err;
+    if (cipher == KDBX_CIPHER_CHACHA20) {
+        if ((err = chacha_crypt(&chacha, block.data() + blockOffset, size, block.data() + blockOffset)) != CRYPT_OK) {
+            std::cout << "chacha_crypt error: " << error_to_string(err) << std::endl;
+            exit(1);
+        }
+        finished = size == 0;
+        return true;
+    }
+
+    // CBC plaintext ends with PKCS #7 padding, so the last AES block is held back until the payload ends:
+    if ((err = cbc_decrypt(block.data() + blockOffset, block.data() + blockOffset, size, &cbc)) != CRYPT_OK) {
+        std::cout << "cbc_decrypt error: " << error_to_string(err) << std::endl;
+        exit(1);
+    }
+    if (size > 0) {
+        block.insert(block.begin() + blockOffset, heldBack.begin(), heldBack.end());
+        zeromem(heldBack.data(), heldBack.size());
+        heldBack.assign(block.end() - 16, block.end());
+        zeromem(&block[block.size() - 16], 16);
+        block.resize(block.size() - 16);
+        return true;
+    }
+
+    finished = true;
+    const unsigned char padding = heldBack.empty() ? 0 : heldBack.back();
+    if (padding == 0 || padding > 16 || std::count(heldBack.end() - padding, heldBack.end(), padding) != padding) {
+        return fail("The KDBX payload has invalid padding.");
+    }
+    block.assign(heldBack.begin(), heldBack.end() - padding);
+    blockOffset = 0;
+    zeromem(heldBack.data(), heldBack.size());
+    return true;
+}
+
+KdbxReader::KdbxReader(std::istream &input, const std::string &password)
+: input(input), password(password), payload(input), started(false), finished(false), textProtected(false), entryDepth(0) {
+    zeromem(&innerStream, sizeof(innerStream));
+}
+
+KdbxReader::~KdbxReader() {
+    Utils::clearString(password);
+    Utils::clearString(text);
+    for (std::string &field : fields) {
+        Utils::clearString(field);
+    }
+    zeromem(&innerStream, sizeof(innerStream));
+}
+
+/**
+    Returns the next entry of the database as an Account, or std::nullopt once the database
+    has ended or cannot be read (in which case failed returns true).
+*/
+std::optional<Account> KdbxReader::next() {
+    if (finished || failed()) {
+        return std::nullopt;
+    }
+    if (!started) {
+        started = true;
+        if (!readHeader() || !readInnerHeader()) {
+            return std::nullopt;
+        }
+    }
+
+    std::string name;
+    while (!parsedEntry.has_value()) {
+        const int c = payload.sgetc();
+        if (c == EOF) {
+            fail(payload.failed() ? payload.getError() : "The KDBX document is truncated.");
+            return std::nullopt;
+        }
+        if (c != '<') {
+            if (!readXmlText()) {
+                return std::nullopt;
+            }
+            continue;
+        }
+
+        bool closing;
+        bool selfClosing;
+        bool isProtected;
+        if (!readXmlTag(name, closing, selfClosing, isProtected)) {
+            return std::nullopt;
+        }
+        if (name.empty()) {
+            continue; // a comment, processing instruction or CDATA section
+        }
+        if (closing) {
+            if (!endXmlElement(name)) {
+                return std::nullopt;
+            }
+            if (finished) {
+                // Read the rest of the payload, so that the blocks up to the final one are authenticated:
+                while (payload.sbumpc() != EOF) {
+                }
+                if (payload.failed()) {
+                    fail(payload.getError());
+                }
+                return std::nullopt;
+            }
+            continue;
+        }
+
+        // Start an element:
+        const std::string parent = elements.empty() ? "" : elements.back();
+        if (elements.empty() && name != "KeePassFile") {
+            fail("The KDBX payload is not a KeePass document.");
+            return std::nullopt;
+        }
+        if (elements.size() >= KDBX_MAX_XML_DEPTH) {
+            fail("The KDBX document is nested too deeply.");
+            return std::nullopt;
+        }
+        elements.push_back(name);
+        Utils::clearString(text);
+        text.clear();
+        textProtected = isProtected;
+        if (name == "Group" && (parent == "Root" || parent == "Group")) {
+            groups.push_back({ "", !groups.empty() && groups.back().recycled });
+        } else if (name == "Entry" && parent == "Group") { // entries within an entry's History are not imported
+            entryDepth = elements.size();
+        }
+        if (selfClosing && !endXmlElement(name)) {
+            return std::nullopt;
+        }
+    }
+
+    std::optional<Account> account(*parsedEntry);
+    parsedEntry->wipeSensitiveData();
+    parsedEntry.reset();
+    return account;
+}
+
+/**
+    Returns whether the database cannot be read, as described by getError.
+*/
+bool KdbxReader::failed() const {
+    return !error.empty();
+}
+
+const std::string &KdbxReader::getError() const {
+    return error;
+}
+
+bool KdbxReader::fail(const std::string &message) {
+    if (error.empty()) {
+        error = message;
+    }
+    return false;
+}
+
+/**
+    Reads and verifies the outer header, derives the keys of the database from the password,
+    and starts decrypting the payload that follows the header.
+*/
+bool KdbxReader::readHeader() {
+    std::vector<unsigned char> headerBytes(3 * sizeof(uint32_t));
+    if (!input.read((char *)headerBytes.data(), headerBytes.size())
+        || loadUint32(&headerBytes[0]) != KDBX_SIGNATURE_1 || loadUint32(&headerBytes[4]) != KDBX_SIGNATURE_2) {
+        return fail("The file is not a KeePass database.");
+    }
+    const uint32_t majorVersion = loadUint32(&headerBytes[8]) >> 16;
+    if (majorVersion != KDBX_MAJOR_VERSION) {
+        return fail("Only KDBX 4 databases can be imported (this is KDBX " + std::to_string(majorVersion)
+            + "; save it with a recent version of KeePass first).");
+    }
+
+    std::optional<KdbxCipher> cipher;
+    bool compressed = false;
+    std::vector<unsigned char> masterSeed;
+    std::vector<unsigned char> iv;
+    std::vector<unsigned char> kdfParameters;
+    while (true) {
+        unsigned char fieldHeader[1 + sizeof(uint32_t)];
+        if (!input.read((char *)fieldHeader, sizeof(fieldHeader))) {
+            return fail("The KDBX header is truncated.");
+        }
+        const uint32_t size = loadUint32(fieldHeader + 1);
+        if (size > KDBX_MAX_HEADER_FIELD_SIZE) {
+            return fail("The KDBX header is corrupt.");
+        }
+        std::vector<unsigned char> value(size);
+        if (!input.read((char *)value.data(), size)) {
+            return fail("The KDBX header is truncated.");
+        }
+        headerBytes.insert(headerBytes.end(), fieldHeader, fieldHeader + sizeof(fieldHeader));
+        headerBytes.insert(headerBytes.end(), value.begin(), value.end());
+
+        if (fieldHeader[0] == KDBX_HEADER_END) {
+            break;
+        } else if (fieldHeader[0] == KDBX_HEADER_CIPHER_ID) {
+            if (size == 16 && std::memcmp(value.data(), AES_256_CBC_UUID, 16) == 0) {
+                cipher = KDBX_CIPHER_AES_256_CBC;
+            } else if (size == 16 && std::memcmp(value.data(), CHACHA20_UUID, 16) == 0) {
+                cipher = KDBX_CIPHER_CHACHA20;
+            } else {
+                return fail("The KDBX database is encrypted with an unsupported cipher (only AES-256 and ChaCha20 are supported).");
+            }
+        } else if (fieldHeader[0] == KDBX_HEADER_COMPRESSION) {
+            if (size != sizeof(uint32_t) || loadUint32(value.data()) > 1) {
+                return fail("The KDBX database uses an unsupported compression algorithm.");
+            }
+            compressed = loadUint32(value.data()) == 1;
+        } else if (fieldHeader[0] == KDBX_HEADER_MASTER_SEED) {
+            masterSeed = value;
+        } else if (fieldHeader[0] == KDBX_HEADER_ENCRYPTION_IV) {
+            iv = value;
+        } else if (fieldHeader[0] == KDBX_HEADER_KDF_PARAMETERS) {
+            kdfParameters = value;
+        }
+    }
+    if (!cipher.has_value() || masterSeed.size() != 32 || kdfParameters.empty()
+        || iv.size() != (cipher == KDBX_CIPHER_AES_256_CBC ? 16 : 12)) {
+        return fail("The KDBX header is incomplete.");
+    }
+
+    // The header is followed by its SHA-256 hash, and then its HMAC, which verifies the password:
+    unsigned char hash[32];
+    unsigned char mac[32];
+    if (!input.read((char *)hash, sizeof(hash)) || !input.read((char *)mac, sizeof(mac))) {
+        return fail("The KDBX header is truncated.");
+    }
+    unsigned char expectedHash[32];
+    Utils::sha256(expectedHash, headerBytes.data(), (unsigned long)headerBytes.size());
+    if (mem_neq(hash, expectedHash, sizeof(hash))) {
+        return fail("The KDBX header is corrupt.");
+    }
+
+    unsigned char encryptionKey[KDBX_KEY_LENGTH];
+    unsigned char hmacKey[64];
+    if (!deriveKeys(kdfParameters, masterSeed, encryptionKey, hmacKey)) {
+        return false;
+    }
+    unsigned char headerKey[64];
+    unsigned char expectedMac[32];
+    blockHmacKey(headerKey, KDBX_HEADER_HMAC_INDEX, hmacKey);
+    bool computed = Utils::hmacSha256(expectedMac, headerKey, sizeof(headerKey), headerBytes.data(), (unsigned long)headerBytes.size());
+    zeromem(headerKey, sizeof(headerKey));
+    if (!computed || mem_neq(mac, expectedMac, sizeof(mac))) {
+        zeromem(encryptionKey, sizeof(encryptionKey));
+        zeromem(hmacKey, sizeof(hmacKey));
+        return fail("The KDBX password is incorrect.");
+    }
+
+    payload.start(cipher.value(), encryptionKey, iv, hmacKey, compressed);
+    zeromem(encryptionKey, sizeof(encryptionKey));
+    zeromem(hmacKey, sizeof(hmacKey));
+    zeromem(masterSeed.data(), masterSeed.size());
+    return true;
+}
+
+/**
+    Derives the key that encrypts the payload, sha256(masterSeed || transformedKey), and the key
+    from which the HMAC keys of the blocks are derived, sha512(masterSeed || transformedKey || 1),
+    where the transformed key is derived from the composite key sha256(sha256(password)) by the
+    KDF (Argon2 or AES-KDF) that the KDF parameters describe.
+*/
+bool KdbxReader::deriveKeys(const std::vector<unsigned char> &kdfParameters, const std::vector<unsigned char> &masterSeed,
+    unsigned char *encryptionKey, unsigned char *hmacKey) {
+    // The KDF parameters are a variant dictionary: a uint16 version, then entries of
+    // (uint8 type, int32 name size, name, int32 value size, value), ending with type 0:
+    std::map<std::string, std::vector<unsigned char>> parameters;
+    const unsigned char *position = kdfParameters.data();
+    const unsigned char *end = position + kdfParameters.size();
+    if (end - position < 2 || position[1] > 1) {
+        return fail("The KDBX database has unsupported KDF parameters.");
+    }
+    position += 2;
+
+    // Reads a size-prefixed name or value, and advances the position past it:
+    auto readSized = [&](const unsigned char *&data, uint32_t &size) {
+        if (end - position < 4 || loadUint32(position) > (uint64_t)(end - position - 4)) {
+            return false;
+        }
+        size = loadUint32(position);
+        data = position + 4;
+        position += 4 + size;
+        return true;
+    };
+    while (position != end && *position != 0) {
+        ++position; // the type of the value, which is implied by its size
+        const unsigned char *name;
+        const unsigned char *value;
+        uint32_t nameSize;
+        uint32_t valueSize;
+        if (!readSized(name, nameSize) || !readSized(value, valueSize)) {
+            return fail("The KDF parameters of the KDBX database are corrupt.");
+        }
+        parameters[std::string((const char *)name, nameSize)].assign(value, value + valueSize);
+    }
+    if (position == end) {
+        return fail("The KDF parameters of the KDBX database are corrupt.");
+    }
+    auto getInteger = [&](const std::string &name) -> std::optional<uint64_t> {
+        const auto parameter = parameters.find(name);
+        if (parameter == parameters.end()) {
+            return std::nullopt;
+        }
+        if (parameter->second.size() == sizeof(uint32_t)) {
+            return loadUint32(parameter->second.data());
+        }
+        if (parameter->second.size() == sizeof(uint64_t)) {
+            return loadUint64(parameter->second.data());
+        }
+        return std::nullopt;
+    };
+
+    unsigned char compositeKey[32];
+    Utils::sha256(compositeKey, (const unsigned char *)password.c_str(), (unsigned long)password.size());
+    Utils::sha256(compositeKey, compositeKey, sizeof(compositeKey));
+
+    unsigned char transformedKey[32];
+    const std::vector<unsigned char> &uuid = parameters["$UUID"];
+    const std::vector<unsigned char> &salt = parameters["S"];
+    const bool isArgon2d = uuid.size() == 16 && std::memcmp(uuid.data(), ARGON2D_UUID, 16) == 0;
+    const bool isArgon2id = uuid.size() == 16 && std::memcmp(uuid.data(), ARGON2ID_UUID, 16) == 0;
+    if (isArgon2d || isArgon2id) {
+        const std::optional<uint64_t> lanes = getInteger("P");
+        const std::optional<uint64_t> memory = getInteger("M"); // in bytes
+        const std::optional<uint64_t> passes = getInteger("I");
+        const std::optional<uint64_t> version = getInteger("V");
+        if (!lanes || !memory || !passes || !version || salt.size() < 8
+            || *lanes == 0 || *lanes > 0xFFFFFF || *passes == 0 || *passes > UINT32_MAX
+            || (*version != 0x10 && *version != 0x13) || !parameters["K"].empty() || !parameters["A"].empty()) {
+            zeromem(compositeKey, sizeof(compositeKey));
+            return fail("The KDBX database has unsupported Argon2 parameters.");
+        }
+        if (*memory / 1024 > KDBX_MAX_ARGON2_MEMORY) {
+            zeromem(compositeKey, sizeof(compositeKey));
+            return fail("The Argon2 memory of the KDBX database exceeds " + std::to_string(KDBX_MAX_ARGON2_MEMORY / 1024) + " MiB.");
+        }
+        Kdf::argon2(isArgon2d ? ARGON2_D : ARGON2_ID, (uint32_t)*version, compositeKey, sizeof(compositeKey),
+            salt.data(), (uint32_t)salt.size(), (uint32_t)*passes, (uint32_t)(*memory / 1024), (uint32_t)*lanes,
+            transformedKey, sizeof(transformedKey));
+    } else if (uuid.size() == 16 && std::memcmp(uuid.data(), AES_KDF_UUID, 16) == 0) {
+        const std::optional<uint64_t> rounds = getInteger("R");
+        if (!rounds || salt.size() != 32) {
+            zeromem(compositeKey, sizeof(compositeKey));
+            return fail("The KDBX database has unsupported AES-KDF parameters.");
+        }
+        // Encrypt each half of the composite key 'rounds' times with AES-256 keyed with the seed:
+        int err;
+        symmetric_key aesKey;
+        if (register_cipher(&aes_desc) == -1) {
+            std::cout << "Error registering cipher.\n" << std::endl;
+            exit(1);
+        }
+        const ltc_cipher_descriptor &aes = cipher_descriptor[find_cipher(aes_desc.name)];
+        if ((err = aes.setup(salt.data(), (int)salt.size(), 0, &aesKey)) != CRYPT_OK) {
+            std::cout << "Cipher setup error: " << error_to_string(err) << std::endl;
+            exit(1);
+        }
+        for (uint64_t round = 0; round < *rounds; ++round) {
+            aes.ecb_encrypt(compositeKey, compositeKey, &aesKey);
+            aes.ecb_encrypt(compositeKey + 16, compositeKey + 16, &aesKey);
+        }
+        zeromem(&aesKey, sizeof(aesKey));
+        Utils::sha256(transformedKey, compositeKey, sizeof(compositeKey));
+    } else {
+        zeromem(compositeKey, sizeof(compositeKey));
+        return fail("The KDBX database uses an unsupported KDF.");
+    }
+    zeromem(compositeKey, sizeof(compositeKey));
+
+    unsigned char seededKey[32 + sizeof(transformedKey) + 1];
+    std::memcpy(seededKey, masterSeed.data(), 32);
+    std::memcpy(seededKey + 32, transformedKey, sizeof(transformedKey));
+    seededKey[sizeof(seededKey) - 1] = 1;
+    Utils::sha256(encryptionKey, seededKey, sizeof(seededKey) - 1);
+    sha512(hmacKey, { { seededKey, sizeof(seededKey) } });
+    zeromem(seededKey, sizeof(seededKey));
+    zeromem(transformedKey, sizeof(transformedKey));
+    return true;
+}
+
+/**
+    Reads the inner header at the start of the payload, which holds the key of the stream cipher
+    that protects values (such as passwords) within the XML document. Attachments are skipped.
+*/
+bool KdbxReader::readInnerHeader() {
+    std::vector<unsigned char> streamKey;
+    uint32_t streamId = 0;
+    while (true) {
+        unsigned char fieldHeader[1 + sizeof(uint32_t)];
+        if (payload.sgetn((char *)fieldHeader, sizeof(fieldHeader)) != sizeof(fieldHeader)) {
+            return fail(payload.failed() ? payload.getError() : "The KDBX payload is truncated.");
+        }
+        uint32_t size = loadUint32(fieldHeader + 1);
+        if (fieldHeader[0] == KDBX_INNER_STREAM_ID || fieldHeader[0] == KDBX_INNER_STREAM_KEY) {
+            if (size > KDBX_MAX_HEADER_FIELD_SIZE) {
+                return fail("The inner header of the KDBX database is corrupt.");
+            }
+            std::vector<unsigned char> value(size);
+            if (payload.sgetn((char *)value.data(), size) != size) {
+                return fail(payload.failed() ? payload.getError() : "The KDBX payload is truncated.");
+            }
+            if (fieldHeader[0] == KDBX_INNER_STREAM_ID) {
+                streamId = size == sizeof(uint32_t) ? loadUint32(value.data()) : 0;
+            } else {
+                streamKey.swap(value);
+            }
+            continue;
+        }
+
+        // Skip the field (an attachment, which may be large) without holding it:
+        char discarded[4096];
+        while (size > 0) {
+            const std::streamsize chunk = std::min<uint32_t>(size, sizeof(discarded));
+            if (payload.sgetn(discarded, chunk) != chunk) {
+                return fail(payload.failed() ? payload.getError() : "The KDBX payload is truncated.");
+            }
+            size -= (uint32_t)chunk;
+        }
+        zeromem(discarded, sizeof(discarded));
+        if (fieldHeader[0] == KDBX_INNER_HEADER_END) {
+            break;
+        }
+    }
+    if (streamId != KDBX_INNER_STREAM_CHACHA20 || streamKey.empty()) {
+        return fail("The KDBX database protects its values with an unsupported stream cipher.");
+    }
+
+    // The ChaCha20 key and nonce are the first 32 and the following 12 bytes of sha512(streamKey):
+    int err;
+    unsigned char keyHash[64];
+    sha512(keyHash, { { streamKey.data(), streamKey.size() } });
+    if ((err = chacha_setup(&innerStream, keyHash, 32, 20)) != CRYPT_OK
+        || (err = chacha_ivctr32(&innerStream, keyHash + 32, 12, 0)) != CRYPT_OK) {
+        std::cout << "chacha_setup error: " << error_to_string(err) << std::endl;
+        exit(1);
+    }
+    zeromem(keyHash, sizeof(keyHash));
+    zeromem(streamKey.data(), streamKey.size());
+    return true;
+}
+
+/**
+    Reads an XML tag from the payload, storing the element's name in 'name.' The name is empty for
+    comments, processing instructions and declarations, and the text of a CDATA section is appended
+    to the element's text. Only the Protected attribute is kept, in 'isProtected.'
+*/
+bool KdbxReader::readXmlTag(std::string &name, bool &closing, bool &selfClosing, bool &isProtected) {
+    name.clear();
+    closing = false;
+    selfClosing = false;
+    isProtected = false;
+    payload.sbumpc(); // '<'
+
+    // Skips the payload up to and including the given terminator:
+    auto skipPast = [&](const char *terminator, std::string *skipped) {
+        const size_t length = std::strlen(terminator);
+        size_t matched = 0;
+        while (matched < length) {
+            const int c = payload.sbumpc();
+            if (c == EOF) {
+                return fail(payload.failed() ? payload.getError() : "The KDBX document is truncated.");
+            }
+            if (skipped != nullptr) {
+                if (skipped->size() >= KDBX_MAX_XML_VALUE_SIZE) {
+                    return fail("A value in the KDBX document is too large.");
+                }
+                *skipped += (char)c;
+            }
+            matched = c == terminator[matched] ? matched + 1 : (c == terminator[0] ? 1 : 0);
+        }
+        if (skipped != nullptr) {
+            skipped->resize(skipped->size() - length);
+        }
+        return true;
+    };
+
+    int c = payload.sgetc();
+    if (c == '?') {
+        return skipPast("?>", nullptr);
+    }
+    if (c == '!') {
+        payload.sbumpc();
+        if (payload.sgetc() == '-') {
+            return skipPast("-->", nullptr);
+        }
+        if (payload.sgetc() == '[') {
+            return skipPast("[", nullptr) && skipPast("[", nullptr) && skipPast("]]>", &text);
+        }
+        return skipPast(">", nullptr);
+    }
+    if (c == '/') {
+        closing = true;
+        payload.sbumpc();
+    }
+
+    auto isNameChar = [](int c) {
+        return c != EOF && c != '>' && c != '/' && c != '=' && c != ' ' && c != '\t' && c != '\r' && c != '\n';
+    };
+    auto skipWhitespace = [&]() {
+        for (c = payload.sgetc(); c == ' ' || c == '\t' || c == '\r' || c == '\n'; c = payload.sgetc()) {
+            payload.sbumpc();
+        }
+    };
+    for (c = payload.sgetc(); isNameChar(c) && name.size() < 256; c = payload.sgetc()) {
+        name += (char)payload.sbumpc();
+    }
+    if (name.empty()) {
+        return fail("The KDBX document has a malformed tag.");
+    }
+
+    std::string attribute;
+    std::string value;
+    while (true) {
+        skipWhitespace();
+        if (c == '>') {
+            payload.sbumpc();
+            return true;
+        }
+        if (c == '/' && !closing) {
+            payload.sbumpc();
+            if (payload.sbumpc() != '>') {
+                break;
+            }
+            selfClosing = true;
+            return true;
+        }
+        if (closing || !isNameChar(c)) {
+            break;
+        }
+
+        // Read an attribute, name="value" (or 'value'):
+        attribute.clear();
+        for (; isNameChar(c) && attribute.size() < 256; c = payload.sgetc()) {
+            attribute += (char)payload.sbumpc();
+        }
+        skipWhitespace();
+        if (payload.sbumpc() != '=') {
+            break;
+        }
+        skipWhitespace();
+        const int quote = payload.sbumpc();
+        if (quote != '"' && quote != '\'') {
+            break;
+        }
+        value.clear();
+        for (c = payload.sbumpc(); c != quote && c != EOF && value.size() < 256; c = payload.sbumpc()) {
+            value += (char)c;
+        }
+        if (c != quote) {
+            break;
+        }
+        if (attribute == "Protected" && value == "True") {
+            isProtected = true;
+        }
+    }
+    return fail(payload.failed() ? payload.getError() : "The KDBX document has a malformed <" + name + "> tag.");
+}
+
+/**
+    Reads the text up to the next tag, decoding its character references, and appends it to the
+    current element's text.
+*/
+bool KdbxReader::readXmlText() {
+    for (int c = payload.sgetc(); c != '<' && c != EOF; c = payload.sgetc()) {
+        if (text.size() >= KDBX_MAX_XML_VALUE_SIZE) {
+            return fail("A value in the KDBX document is too large.");
+        }
+        payload.sbumpc();
+        if (c != '&') {
+            text += (char)c;
+            continue;
+        }
+
+        std::string reference;
+        for (c = payload.sbumpc(); c != ';' && c != EOF && reference.size() < 10; c = payload.sbumpc()) {
+            reference += (char)c;
+        }
+        if (reference == "lt") {
+            text += '<';
+        } else if (reference == "gt") {
+            text += '>';
+        } else if (reference == "amp") {
+            text += '&';
+        } else if (reference == "quot") {
+            text += '"';
+        } else if (reference == "apos") {
+            text += '\'';
+        } else if (c == ';' && reference.size() > 1 && reference[0] == '#') {
+            const bool hex = reference[1] == 'x';
+            const std::string digits = reference.substr(hex ? 2 : 1);
+            if (digits.empty() || digits.find_first_not_of(hex ? "0123456789abcdefABCDEF" : "0123456789") != std::string::npos) {
+                return fail("The KDBX document has an invalid character reference.");
+            }
+            const unsigned long codePoint = std::stoul(digits, nullptr, hex ? 16 : 10);
+            if (codePoint == 0 || codePoint > 0x10FFFF) {
+                return fail("The KDBX document has an invalid character reference.");
+            }
+            appendUtf8(text, (uint32_t)codePoint);
+        } else {
+            return fail("The KDBX document has an invalid character reference.");
+        }
+    }
+    return true;
+}
+
+/**
+    Ends the innermost element, which must have the given name, and applies its text to the group,
+    entry or metadata it belongs to. Once an entry ends, it is stored in 'parsedEntry.'
+*/
+bool KdbxReader::endXmlElement(const std::string &name) {
+    if (elements.empty() || elements.back() != name) {
+        return fail("The KDBX document has a mismatched </" + name + "> tag.");
+    }
+    if (textProtected && !unprotectValue()) {
+        return false;
+    }
+
+    const size_t depth = elements.size();
+    const std::string &parent = depth >= 2 ? elements[depth - 2] : "";
+    if (name == "RecycleBinUUID" && parent == "Meta") {
+        recycleBinUuid = text;
+    } else if (parent == "Group" && !groups.empty() && name == "Name") {
+        groups.back().name = text;
+    } else if (parent == "Group" && !groups.empty() && name == "UUID") {
+        groups.back().recycled = groups.back().recycled || (!recycleBinUuid.empty() && text == recycleBinUuid);
+    } else if (entryDepth != 0 && depth == entryDepth + 2 && parent == "String" && name == "Key") {
+        stringKey = text;
+    } else if (entryDepth != 0 && depth == entryDepth + 2 && parent == "String" && name == "Value") {
+        for (size_t field = 0; field < sizeof(fields) / sizeof(fields[0]); ++field) {
+            if (stringKey == ENTRY_FIELD_KEYS[field]) {
+                Utils::clearString(fields[field]);
+                fields[field] = text;
+            }
+        }
+    } else if (name == "Entry" && depth == entryDepth) {
+        if (!groups.back().recycled) {
+            // The root group stands for the database itself, so the tag begins with the path below it:
+            std::string tag;
+            for (size_t group = 1; group < groups.size(); ++group) {
+                tag += groups[group].name + "/";
+            }
+            tag += fields[0].empty() ? "(untitled)" : fields[0];
+            parsedEntry.emplace(tag, fields[1], fields[2]);
+            parsedEntry->setNote(fields[3]);
+            Utils::clearString(tag);
+        }
+        for (std::string &field : fields) {
+            Utils::clearString(field);
+            field.clear();
+        }
+        entryDepth = 0;
+    } else if (name == "Group" && (parent == "Root" || parent == "Group")) {
+        groups.pop_back();
+    }
+
+    elements.pop_back();
+    finished = elements.empty();
+    Utils::clearString(text);
+    text.clear();
+    textProtected = false;
+    return true;
+}
+
+/**
+    Replaces the current element's text, a protected value, with the base64-decoded text XORed
+    with the next bytes of the inner stream cipher.
+*/
+bool KdbxReader::unprotectValue() {
+    std::string value;
+    if (!decodeBase64(text, value)) {
+        return fail("The KDBX document has an invalid protected value.");
+    }
+    int err;
+    if ((err = chacha_crypt(&innerStream, (const unsigned char *)value.data(), (unsigned long)value.size(),
+        (unsigned char *)&value[0])) != CRYPT_OK) {
+        std::cout << "chacha_crypt error: " << error_to_string(err) << std::endl;
+        exit(1);
+    }
+    Utils::clearString(text);
+    text.swap(value);
+    Utils::clearString(value);
+    return true;
+}
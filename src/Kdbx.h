@@ -0,0 +1,121 @@
+#ifndef KDBX_H
+#define KDBX_H
+
+#include "Account.h"
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <optional>
+#include <cstdint>
+
+#include <tomcrypt.h>
+#include <zlib.h>
+
+#define KDBX_SIGNATURE_1 0x9AA2D903
+#define KDBX_SIGNATURE_2 0xB54BFB67
+#define KDBX_MAJOR_VERSION 4 // only KDBX 4 (KeePass 2.35 and later, KeePassXC 2.7 and later) is supported
+#define KDBX_HEADER_HMAC_INDEX UINT64_MAX // the block index whose HMAC key authenticates the header
+#define KDBX_KEY_LENGTH 32
+#define KDBX_MAX_HEADER_FIELD_SIZE (1 << 20)
+#define KDBX_MAX_BLOCK_SIZE (64 << 20) // KeePass writes 1 MiB blocks
+#define KDBX_MAX_ARGON2_MEMORY (4 * 1024 * 1024) // in KiB
+#define KDBX_MAX_XML_DEPTH 64
+#define KDBX_MAX_XML_VALUE_SIZE (16 << 20)
+#define KDBX_INFLATE_CHUNK (64 << 10)
+
+// The ciphers with which a KDBX payload may be encrypted:
+enum KdbxCipher {
+    KDBX_CIPHER_AES_256_CBC,
+    KDBX_CIPHER_CHACHA20,
+};
+
+/*
+    A KDBX 4 file is an unencrypted header, its SHA-256 hash and HMAC-SHA-256, and then the payload
+    in blocks of (HMAC-SHA-256, uint32 size, data), ending with an empty block. The decrypted payload
+    is optionally gzipped, and consists of an inner header (which holds the key of the stream cipher
+    that protects password values) followed by the XML document of groups and entries.
+*/
+
+/**
+    The decrypted and decompressed payload of a KDBX 4 file, which is authenticated, decrypted
+    and inflated one block at a time as it is read.
+*/
+class KdbxPayload : public std::streambuf {
+public:
+    KdbxPayload(std::istream &input);
+    ~KdbxPayload();
+    void start(KdbxCipher cipher, const unsigned char *encryptionKey, const std::vector<unsigned char> &iv,
+        const unsigned char *hmacKey, bool compressed);
+    bool failed() const;
+    const std::string &getError() const;
+protected:
+    int_type underflow() override;
+private:
+    bool readBlock();
+    bool fail(const std::string &message);
+    std::istream &input;
+    KdbxCipher cipher;
+    bool compressed;
+    bool finished; // whether the last (empty) block has been read
+    bool inflateEnded; // whether the end of the gzip stream has been inflated
+    uint64_t blockIndex;
+    unsigned char hmacKey[64];
+    symmetric_CBC cbc;
+    chacha_state chacha;
+    z_stream inflater;
+    bool inflaterStarted;
+    std::vector<unsigned char> block; // the current block, decrypted
+    size_t blockOffset; // the part of 'block' that remains to be inflated (or returned)
+    std::vector<unsigned char> heldBack; // the last AES block, which holds the padding once the payload ends
+    std::vector<char> output;
+    std::string error;
+};
+
+/**
+    Decrypts a KeePass KDBX 4 database protected by a password, and parses its entries one at a time
+    as Accounts (title, username, password and notes), whose tags are their titles prefixed with the
+    path of their group. Entries in the recycle bin and the history of entries are skipped.
+*/
+class KdbxReader {
+public:
+    KdbxReader(std::istream &input, const std::string &password);
+    ~KdbxReader();
+    std::optional<Account> next();
+    bool failed() const;
+    const std::string &getError() const;
+private:
+    // A group on the path from the root to the element being parsed:
+    struct Group {
+        std::string name;
+        bool recycled; // whether it is (or is within) the recycle bin
+    };
+
+    bool readHeader();
+    bool deriveKeys(const std::vector<unsigned char> &kdfParameters, const std::vector<unsigned char> &masterSeed,
+        unsigned char *encryptionKey, unsigned char *hmacKey);
+    bool readInnerHeader();
+    bool readXmlTag(std::string &name, bool &closing, bool &selfClosing, bool &isProtected);
+    bool readXmlText();
+    bool endXmlElement(const std::string &name);
+    bool unprotectValue();
+    bool fail(const std::string &message);
+    std::istream &input;
+    std::string password;
+    KdbxPayload payload;
+    bool started;
+    bool finished;
+    chacha_state innerStream; // XORed with protected values in the order in which they appear
+    std::vector<std::string> elements; // names of the XML elements that enclose the current position
+    std::vector<Group> groups;
+    std::string recycleBinUuid;
+    std::string text; // text of the current element, which is only kept for elements without children
+    bool textProtected;
+    size_t entryDepth; // depth of the entry being parsed, or 0 outside entries (or within their history)
+    std::string stringKey; // key of the entry string whose value is being parsed
+    std::string fields[4]; // title, username, password and notes of the entry being parsed
+    std::optional<Account> parsedEntry;
+    std::string error;
+};
+
+#endif
@@ -0,0 +1,478 @@
+#include "Kdf.h"
+#include "CryptoContext.h"
+#include "Utils.h"
+
+#include <tomcrypt.h>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#define ARGON2_BLOCK_WORDS 128 // 1 KiB blocks of 64-bit words
+#define ARGON2_SYNC_POINTS 4 // slices per pass, after which all lanes synchronize
+#define ARGON2_VERSION_10 0x10 // the version before which later passes overwrote blocks instead of XORing into them
+
+// The registry of selectable key derivation functions:
+struct KdfAlgorithmInfo {
+    KdfAlgorithm algorithm;
+    const char *name; // name by which the algorithm is selected on the command line
+};
+
+static const KdfAlgorithmInfo kdfAlgorithms[] = {
+    { KDF_PBKDF2_SHA256, "pbkdf2-sha256" },
+    { KDF_ARGON2ID, "argon2id" },
+};
+
+/**
+    Stores the 32-bit 'value' at 'out' in little-endian order.
+*/
+static void storeLength(unsigned char *out, uint32_t value) {
+    std::memcpy(out, &value, sizeof(value)); // vault files and the meta file assume a little-endian host as well
+}
+
+/**
+    Computes the variable-length BLAKE2b hash H' of Argon2 (RFC 9106, section 3.3), which
+    chains BLAKE2b-512 to produce outputs longer than 64 bytes.
+*/
+static void blake2bLong(unsigned char *out, uint32_t outSize, const unsigned char *in, size_t inSize) {
+    hash_state md;
+    unsigned char outSizeBytes[sizeof(uint32_t)];
+    storeLength(outSizeBytes, outSize);
+
+    if (outSize <= 64) {
+        blake2b_init(&md, outSize, nullptr, 0);
+        blake2b_process(&md, outSizeBytes, sizeof(outSizeBytes));
+        blake2b_process(&md, in, (unsigned long)inSize);
+        blake2b_done(&md, out);
+        return;
+    }
+
+    // Output the first half of each 64-byte hash in the chain, and the whole of the last one:
+    unsigned char v[64];
+    blake2b_init(&md, 64, nullptr, 0);
+    blake2b_process(&md, outSizeBytes, sizeof(outSizeBytes));
+    blake2b_process(&md, in, (unsigned long)inSize);
+    blake2b_done(&md, v);
+    std::memcpy(out, v, 32);
+    out += 32;
+    uint32_t remaining = outSize - 32;
+    while (remaining > 64) {
+        blake2b_init(&md, 64, nullptr, 0);
+        blake2b_process(&md, v, sizeof(v));
+        blake2b_done(&md, v);
+        std::memcpy(out, v, 32);
+        out += 32;
+        remaining -= 32;
+    }
+    blake2b_init(&md, remaining, nullptr, 0);
+    blake2b_process(&md, v, sizeof(v));
+    blake2b_done(&md, out);
+    zeromem(v, sizeof(v));
+}
+
+/**
+    The multiplication-hardened addition of Argon2's permutation, a + b + 2 * lo(a) * lo(b).
+*/
+static inline uint64_t blaMka(uint64_t a, uint64_t b) {
+    return a + b + 2 * (uint64_t)(uint32_t)a * (uint32_t)b;
+}
+
+static inline uint64_t rotr64(uint64_t x, unsigned int n) {
+    return (x >> n) | (x << (64 - n));
+}
+
+static inline void mix(uint64_t &a, uint64_t &b, uint64_t &c, uint64_t &d) {
+    a = blaMka(a, b);
+    d = rotr64(d ^ a, 32);
+    c = blaMka(c, d);
+    b = rotr64(b ^ c, 24);
+    a = blaMka(a, b);
+    d = rotr64(d ^ a, 16);
+    c = blaMka(c, d);
+    b = rotr64(b ^ c, 63);
+}
+
+/**
+    Applies the BLAKE2b-based permutation P of Argon2 to the 16 words of 'block' at the given indices.
+*/
+static void permute(uint64_t *block, const size_t (&index)[16]) {
+    uint64_t v[16];
+    for (size_t i = 0; i < 16; ++i) {
+        v[i] = block[index[i]];
+    }
+    mix(v[0], v[4], v[8], v[12]);
+    mix(v[1], v[5], v[9], v[13]);
+    mix(v[2], v[6], v[10], v[14]);
+    mix(v[3], v[7], v[11], v[15]);
+    mix(v[0], v[5], v[10], v[15]);
+    mix(v[1], v[6], v[11], v[12]);
+    mix(v[2], v[7], v[8], v[13]);
+    mix(v[3], v[4], v[9], v[14]);
+    for (size_t i = 0; i < 16; ++i) {
+        block[index[i]] = v[i];
+    }
+}
+
+/**
+    Computes Argon2's compression function G(prev, ref) and stores the result in 'next,' or XORs
+    it into 'next' if 'withXor' is true (as passes after the first one do).
+*/
+static void compress(const uint64_t *prev, const uint64_t *ref, uint64_t *next, bool withXor) {
+    uint64_t r[ARGON2_BLOCK_WORDS];
+    uint64_t result[ARGON2_BLOCK_WORDS];
+    for (size_t i = 0; i < ARGON2_BLOCK_WORDS; ++i) {
+        r[i] = prev[i] ^ ref[i];
+        result[i] = withXor ? r[i] ^ next[i] : r[i];
+    }
+
+    // Permute each row of 16 words, then each column of 16 words (pairs of adjacent words from every row):
+    for (size_t row = 0; row < 8; ++row) {
+        size_t index[16];
+        for (size_t i = 0; i < 16; ++i) {
+            index[i] = 16 * row + i;
+        }
+        permute(r, index);
+    }
+    for (size_t column = 0; column < 8; ++column) {
+        size_t index[16];
+        for (size_t i = 0; i < 8; ++i) {
+            index[2 * i] = 2 * column + 16 * i;
+            index[2 * i + 1] = 2 * column + 16 * i + 1;
+        }
+        permute(r, index);
+    }
+
+    for (size_t i = 0; i < ARGON2_BLOCK_WORDS; ++i) {
+        next[i] = result[i] ^ r[i];
+    }
+}
+
+// The shape of the memory filled by one Argon2 derivation:
+struct Argon2Instance {
+    uint64_t *memory; // lanes * laneLength blocks
+    Argon2Type type;
+    uint32_t version;
+    uint32_t passes;
+    uint32_t lanes;
+    uint32_t laneLength; // blocks per lane
+    uint32_t segmentLength; // blocks per lane per slice
+    uint32_t blockCount;
+};
+
+/**
+    Fills one segment (the blocks of one lane within one slice) of one pass, following RFC 9106,
+    section 3.4. Argon2id uses data-independent addressing in the first half of the first pass and
+    data-dependent addressing in the rest, whereas Argon2d uses data-dependent addressing throughout.
+*/
+static void fillSegment(const Argon2Instance &instance, uint32_t pass, uint32_t lane, uint32_t slice) {
+    const bool independentAddressing = instance.type == ARGON2_ID && pass == 0 && slice < ARGON2_SYNC_POINTS / 2;
+    uint64_t zeroBlock[ARGON2_BLOCK_WORDS] = { 0 };
+    uint64_t inputBlock[ARGON2_BLOCK_WORDS] = { 0 };
+    uint64_t addressBlock[ARGON2_BLOCK_WORDS] = { 0 };
+    inputBlock[0] = pass;
+    inputBlock[1] = lane;
+    inputBlock[2] = slice;
+    inputBlock[3] = instance.blockCount;
+    inputBlock[4] = instance.passes;
+    inputBlock[5] = instance.type;
+
+    // Computes the next block of 128 pseudo-random reference addresses:
+    auto nextAddresses = [&]() {
+        ++inputBlock[6];
+        compress(zeroBlock, inputBlock, addressBlock, false);
+        compress(zeroBlock, addressBlock, addressBlock, false);
+    };
+
+    // The first two blocks of each lane are computed from the initial hash:
+    uint32_t startIndex = 0;
+    if (pass == 0 && slice == 0) {
+        startIndex = 2;
+        if (independentAddressing) {
+            nextAddresses();
+        }
+    }
+
+    uint64_t currOffset = (uint64_t)lane * instance.laneLength + slice * instance.segmentLength + startIndex;
+    uint64_t prevOffset = currOffset % instance.laneLength == 0 ? currOffset + instance.laneLength - 1 : currOffset - 1;
+    for (uint32_t i = startIndex; i < instance.segmentLength; ++i, ++currOffset, ++prevOffset) {
+        if (currOffset % instance.laneLength == 1) {
+            prevOffset = currOffset - 1;
+        }
+
+        uint64_t pseudoRand;
+        if (independentAddressing) {
+            if (i % ARGON2_BLOCK_WORDS == 0) {
+                nextAddresses();
+            }
+            pseudoRand = addressBlock[i % ARGON2_BLOCK_WORDS];
+        } else {
+            pseudoRand = instance.memory[prevOffset * ARGON2_BLOCK_WORDS];
+        }
+
+        // Pick the lane of the reference block (the first slice of the first pass may only use its own lane):
+        uint32_t refLane = (uint32_t)((pseudoRand >> 32) % instance.lanes);
+        if (pass == 0 && slice == 0) {
+            refLane = lane;
+        }
+        const bool sameLane = refLane == lane;
+
+        // Pick the reference block among those that are already computed and not in other lanes' current segments:
+        uint32_t areaSize;
+        if (pass == 0) {
+            if (slice == 0) {
+                areaSize = i - 1;
+            } else if (sameLane) {
+                areaSize = slice * instance.segmentLength + i - 1;
+            } else {
+                areaSize = slice * instance.segmentLength - (i == 0 ? 1 : 0);
+            }
+        } else if (sameLane) {
+            areaSize = instance.laneLength - instance.segmentLength + i - 1;
+        } else {
+            areaSize = instance.laneLength - instance.segmentLength - (i == 0 ? 1 : 0);
+        }
+        uint64_t relativePosition = pseudoRand & 0xFFFFFFFF;
+        relativePosition = (relativePosition * relativePosition) >> 32;
+        relativePosition = areaSize - 1 - (((uint64_t)areaSize * relativePosition) >> 32);
+        uint32_t startPosition = 0;
+        if (pass != 0 && slice != ARGON2_SYNC_POINTS - 1) {
+            startPosition = (slice + 1) * instance.segmentLength;
+        }
+        uint64_t refIndex = (startPosition + relativePosition) % instance.laneLength;
+
+        const uint64_t *refBlock = instance.memory + ((uint64_t)refLane * instance.laneLength + refIndex) * ARGON2_BLOCK_WORDS;
+        compress(instance.memory + prevOffset * ARGON2_BLOCK_WORDS, refBlock,
+            instance.memory + currOffset * ARGON2_BLOCK_WORDS, pass != 0 && instance.version != ARGON2_VERSION_10);
+    }
+
+    zeromem(addressBlock, sizeof(addressBlock));
+}
+
+/**
+    Computes Argon2 (RFC 9106) of the given type and version (0x13, or the older 0x10) with the given
+    password, salt and parameters, and stores the 'outSize' byte tag in 'out.' Within each slice, the
+    lanes are filled in parallel.
+*/
+void Kdf::argon2(Argon2Type type, uint32_t version, const unsigned char *password, uint32_t passwordSize,
+    const unsigned char *salt, uint32_t saltSize, uint32_t passes, uint32_t memoryCost, uint32_t lanes,
+    unsigned char *out, uint32_t outSize) {
+    // Compute the initial hash H0 of all the inputs:
+    hash_state md;
+    unsigned char h0[64 + 2 * sizeof(uint32_t)];
+    unsigned char value[sizeof(uint32_t)];
+    blake2b_init(&md, 64, nullptr, 0);
+    for (uint32_t field : { lanes, outSize, memoryCost, passes, version, (uint32_t)type }) {
+        storeLength(value, field);
+        blake2b_process(&md, value, sizeof(value));
+    }
+    storeLength(value, passwordSize);
+    blake2b_process(&md, value, sizeof(value));
+    blake2b_process(&md, password, passwordSize);
+    storeLength(value, saltSize);
+    blake2b_process(&md, value, sizeof(value));
+    blake2b_process(&md, salt, saltSize);
+    storeLength(value, 0); // no secret
+    blake2b_process(&md, value, sizeof(value));
+    storeLength(value, 0); // no associated data
+    blake2b_process(&md, value, sizeof(value));
+    blake2b_done(&md, h0);
+
+    // Round the memory down to a whole number of segments (of at least two blocks) in every lane:
+    Argon2Instance instance;
+    instance.type = type;
+    instance.version = version;
+    instance.passes = passes;
+    instance.lanes = lanes;
+    uint32_t blockCount = std::max(memoryCost, 2 * ARGON2_SYNC_POINTS * lanes);
+    instance.segmentLength = blockCount / (lanes * ARGON2_SYNC_POINTS);
+    instance.laneLength = instance.segmentLength * ARGON2_SYNC_POINTS;
+    instance.blockCount = instance.laneLength * lanes;
+    std::vector<uint64_t> memory((size_t)instance.blockCount * ARGON2_BLOCK_WORDS);
+    instance.memory = memory.data();
+
+    // Compute the first two blocks of each lane:
+    for (uint32_t lane = 0; lane < instance.lanes; ++lane) {
+        for (uint32_t block = 0; block < 2; ++block) {
+            storeLength(h0 + 64, block);
+            storeLength(h0 + 64 + sizeof(uint32_t), lane);
+            blake2bLong((unsigned char *)(instance.memory + ((uint64_t)lane * instance.laneLength + block) * ARGON2_BLOCK_WORDS),
+                ARGON2_BLOCK_WORDS * sizeof(uint64_t), h0, sizeof(h0));
+        }
+    }
+
+    // Fill the memory one slice at a time, with one thread per additional lane:
+    for (uint32_t pass = 0; pass < instance.passes; ++pass) {
+        for (uint32_t slice = 0; slice < ARGON2_SYNC_POINTS; ++slice) {
+            std::vector<std::thread> workers;
+            for (uint32_t lane = 1; lane < instance.lanes; ++lane) {
+                workers.emplace_back(fillSegment, std::cref(instance), pass, lane, slice);
+            }
+            fillSegment(instance, pass, 0, slice);
+            for (std::thread &worker : workers) {
+                worker.join();
+            }
+        }
+    }
+
+    // Hash the XOR of the last block of every lane:
+    uint64_t finalBlock[ARGON2_BLOCK_WORDS];
+    std::memcpy(finalBlock, instance.memory + ((uint64_t)instance.laneLength - 1) * ARGON2_BLOCK_WORDS, sizeof(finalBlock));
+    for (uint32_t lane = 1; lane < instance.lanes; ++lane) {
+        const uint64_t *lastBlock = instance.memory + ((uint64_t)lane * instance.laneLength + instance.laneLength - 1) * ARGON2_BLOCK_WORDS;
+        for (size_t i = 0; i < ARGON2_BLOCK_WORDS; ++i) {
+            finalBlock[i] ^= lastBlock[i];
+        }
+    }
+    blake2bLong(out, outSize, (const unsigned char *)finalBlock, sizeof(finalBlock));
+
+    zeromem(finalBlock, sizeof(finalBlock));
+    zeromem(h0, sizeof(h0));
+    zeromem(memory.data(), memory.size() * sizeof(uint64_t));
+}
+
+/**
+    Derives the SKEY_LENGTH byte key of a vault from its vault key and SKEY_LENGTH byte salt
+    using the given parameters, and stores it in 'key.' Returns false if libtomcrypt fails to derive it.
+*/
+bool Kdf::deriveKey(const std::string &vaultKey, const unsigned char *salt, const KdfParams &params, unsigned char *key) {
+    int err;
+    unsigned long keySize = SKEY_LENGTH;
+    switch (params.algorithm) {
+    case KDF_SHA256:
+        Utils::sha256(key, (const unsigned char *)vaultKey.c_str(), (unsigned long)vaultKey.size());
+        break;
+    case KDF_PBKDF2_SHA256:
+        // Register sha256 hash:
+        if (register_hash(&sha256_desc) == -1) {
+            return false;
+        }
+        if ((err = pkcs_5_alg2((const unsigned char *)vaultKey.c_str(), (unsigned long)vaultKey.size(), salt, SKEY_LENGTH,
+            (int)params.timeCost, find_hash("sha256"), key, &keySize)) != CRYPT_OK) {
+            return false;
+        }
+        break;
+    case KDF_ARGON2ID:
+        argon2(ARGON2_ID, KDF_ARGON2_VERSION, (const unsigned char *)vaultKey.c_str(), (uint32_t)vaultKey.size(), salt, SKEY_LENGTH,
+            params.timeCost, params.memoryCost, params.lanes, key, SKEY_LENGTH);
+        break;
+    }
+    return true;
+}
+
+/**
+    Returns the time (in milliseconds) that deriving a key with the given parameters takes.
+*/
+static double timeDerivation(const KdfParams &params) {
+    unsigned char salt[SKEY_LENGTH] = { 0 };
+    unsigned char key[SKEY_LENGTH];
+    auto start = std::chrono::steady_clock::now();
+    Kdf::deriveKey("calibration", salt, params, key);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+/**
+    Picks the parameters of the given algorithm with which deriving a key takes about 'unlockMillis'
+    milliseconds on this machine. A cheap derivation is timed (its cost is doubled until it takes long
+    enough to measure), and its cost is then scaled to the target. Argon2 spends the time on memory
+    first, and on additional passes only once memory is at its maximum.
+*/
+KdfParams Kdf::calibrate(KdfAlgorithm algorithm, uint32_t unlockMillis) {
+    KdfParams params = { algorithm, 0, 0, 0 };
+    double elapsed;
+    switch (algorithm) {
+    case KDF_SHA256:
+        break;
+    case KDF_PBKDF2_SHA256:
+        params.timeCost = KDF_PBKDF2_MIN_ITERATIONS;
+        while ((elapsed = timeDerivation(params)) < KDF_CALIBRATION_MIN_MS) {
+            params.timeCost *= 2;
+        }
+        params.timeCost = (uint32_t)std::clamp((uint64_t)params.timeCost * unlockMillis / elapsed,
+            (double)KDF_PBKDF2_MIN_ITERATIONS, (double)UINT32_MAX);
+        break;
+    case KDF_ARGON2ID: {
+        params.lanes = std::clamp(std::thread::hardware_concurrency(), 1u, (unsigned int)KDF_ARGON2_MAX_LANES);
+        params.timeCost = KDF_ARGON2_PASSES;
+        params.memoryCost = KDF_ARGON2_MIN_MEMORY;
+        while ((elapsed = timeDerivation(params)) < KDF_CALIBRATION_MIN_MS && params.memoryCost < KDF_ARGON2_MAX_MEMORY) {
+            params.memoryCost *= 2;
+        }
+        // The cost grows faster than the memory once it no longer fits in the caches, so the memory
+        // is scaled a second time from a run of about the target's length:
+        for (int round = 0; round < 2; ++round) {
+            double memoryCost = (uint64_t)params.memoryCost * unlockMillis / elapsed;
+            params.memoryCost = (uint32_t)std::clamp(memoryCost, (double)KDF_ARGON2_MIN_MEMORY, (double)KDF_ARGON2_MAX_MEMORY);
+            elapsed = timeDerivation(params);
+        }
+        if (params.memoryCost == KDF_ARGON2_MAX_MEMORY && elapsed < unlockMillis) {
+            params.timeCost = (uint32_t)std::min((uint64_t)params.timeCost * unlockMillis / elapsed, (double)UINT32_MAX);
+        }
+        break;
+    }
+    }
+    return params;
+}
+
+/**
+    Returns the parameters of vaults created before keys were derived with a KDF, whose key is sha256(vaultKey).
+*/
+KdfParams Kdf::legacyParams() {
+    return KdfParams { KDF_SHA256, 0, 0, 0 };
+}
+
+/**
+    Returns true if keys can be derived with the given parameters (as read from the meta file).
+*/
+bool Kdf::isValid(const KdfParams &params) {
+    switch (params.algorithm) {
+    case KDF_SHA256:
+        return true;
+    case KDF_PBKDF2_SHA256:
+        return params.timeCost > 0 && params.timeCost <= INT32_MAX;
+    case KDF_ARGON2ID:
+        return params.timeCost > 0 && params.lanes > 0 && params.lanes <= KDF_ARGON2_MAX_LANES
+            && params.memoryCost <= KDF_ARGON2_MAX_MEMORY;
+    }
+    return false;
+}
+
+/**
+    Returns the algorithm with which new vault keys are derived.
+*/
+KdfAlgorithm Kdf::defaultAlgorithm() {
+    return KDF_ARGON2ID;
+}
+
+/**
+    Returns the selectable algorithm with the given name, or std::nullopt if there is none.
+*/
+std::optional<KdfAlgorithm> Kdf::findAlgorithm(const std::string &name) {
+    for (const KdfAlgorithmInfo &info : kdfAlgorithms) {
+        if (name == info.name) {
+            return info.algorithm;
+        }
+    }
+    return std::nullopt;
+}
+
+const char *Kdf::algorithmName(KdfAlgorithm algorithm) {
+    for (const KdfAlgorithmInfo &info : kdfAlgorithms) {
+        if (info.algorithm == algorithm) {
+            return info.name;
+        }
+    }
+    return "sha256";
+}
+
+/**
+    Returns the names of all selectable algorithms, separated by commas.
+*/
+std::string Kdf::algorithmNames() {
+    std::string names;
+    for (const KdfAlgorithmInfo &info : kdfAlgorithms) {
+        names += (names.empty() ? "" : ", ") + std::string(info.name);
+    }
+    return names;
+}
@@ -0,0 +1,55 @@
+#ifndef KDF_H
+#define KDF_H
+
+#include <string>
+#include <optional>
+#include <cstdint>
+
+#define KDF_DEFAULT_UNLOCK_MS 250 // unlock time that the parameters of new vault keys are calibrated to
+#define KDF_UNLOCK_MS_ENV "CLAM_UNLOCK_MS" // environment variable that overrides KDF_DEFAULT_UNLOCK_MS
+#define KDF_CALIBRATION_MIN_MS 20 // calibration runs are repeated with a higher cost until they take this long
+
+#define KDF_PBKDF2_MIN_ITERATIONS 1000
+#define KDF_ARGON2_VERSION 0x13
+#define KDF_ARGON2_PASSES 3 // passes over memory, which is only raised once memory reaches its maximum
+#define KDF_ARGON2_MIN_MEMORY 1024 // in KiB
+#define KDF_ARGON2_MAX_MEMORY (1024 * 1024) // in KiB
+#define KDF_ARGON2_MAX_LANES 4 // lanes are filled in parallel, so at most one per core is used
+
+// Functions by which a key is derived from a vault key (the values are stored in the meta file):
+enum KdfAlgorithm : uint32_t {
+    KDF_SHA256 = 0, // key = sha256(vaultKey); unsalted and uncalibrated, used only by vaults created before the KDF stage
+    KDF_PBKDF2_SHA256 = 1,
+    KDF_ARGON2ID = 2,
+};
+
+// Variants of Argon2 (the values are those that RFC 9106 hashes into the initial hash):
+enum Argon2Type : uint32_t {
+    ARGON2_D = 0, // data-dependent addressing throughout, as KeePass uses by default
+    ARGON2_ID = 2,
+};
+
+// The algorithm and cost parameters with which one vault's key is derived:
+struct KdfParams {
+    KdfAlgorithm algorithm;
+    uint32_t timeCost; // PBKDF2 iterations or Argon2 passes
+    uint32_t memoryCost; // Argon2 memory (in KiB)
+    uint32_t lanes; // Argon2 lanes, which are filled in parallel
+};
+
+class Kdf {
+public:
+    static bool deriveKey(const std::string &vaultKey, const unsigned char *salt, const KdfParams &params, unsigned char *key);
+    static KdfParams calibrate(KdfAlgorithm algorithm, uint32_t unlockMillis);
+    static KdfParams legacyParams();
+    static bool isValid(const KdfParams &params);
+    static KdfAlgorithm defaultAlgorithm();
+    static std::optional<KdfAlgorithm> findAlgorithm(const std::string &name);
+    static const char *algorithmName(KdfAlgorithm algorithm);
+    static std::string algorithmNames();
+    static void argon2(Argon2Type type, uint32_t version, const unsigned char *password, uint32_t passwordSize,
+        const unsigned char *salt, uint32_t saltSize, uint32_t passes, uint32_t memoryCost, uint32_t lanes,
+        unsigned char *out, uint32_t outSize);
+};
+
+#endif
@@ -0,0 +1,100 @@
+#include "SecureArena.h"
+#include "Utils.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstring>
+#include <new>
+#include <algorithm>
+
+SecureArena::SecureArena()
+: current(0) {
+
+}
+
+/**
+    Wipes every byte that was allocated from this arena and unmaps its chunks.
+*/
+SecureArena::~SecureArena() {
+    for (Chunk &chunk : chunks) {
+        explicit_bzero(chunk.data, chunk.used);
+        Utils::unlockMemory(chunk.data, chunk.size);
+        munmap(chunk.data, chunk.size);
+    }
+}
+
+/**
+    Returns 'size' zero-filled bytes at the given alignment (which must be a power of two no larger
+    than a page), valid until the arena is destroyed or rewound past them. Throws std::bad_alloc if
+    no memory can be mapped.
+*/
+unsigned char *SecureArena::allocate(size_t size, size_t alignment) {
+    for (; current < chunks.size(); ++current) {
+        Chunk &chunk = chunks[current];
+        size_t offset = (chunk.used + alignment - 1) & ~(alignment - 1);
+        if (offset <= chunk.size && chunk.size - offset >= size) {
+            chunk.used = offset + size;
+            return chunk.data + offset;
+        }
+    }
+
+    // Chunks are page aligned, so the start of a new chunk satisfies any alignment:
+    addChunk(size);
+    chunks[current].used = size;
+    return chunks[current].data;
+}
+
+/**
+    Copies the given text into the arena, and returns a view of the copy.
+*/
+std::string_view SecureArena::copy(std::string_view text) {
+    unsigned char *data = allocate(text.size());
+    std::memcpy(data, text.data(), text.size());
+    return std::string_view((const char *)data, text.size());
+}
+
+/**
+    Returns the current position of the arena, to which rewind releases everything allocated after it.
+*/
+SecureArena::Mark SecureArena::mark() const {
+    return Mark { current, chunks.empty() ? 0 : chunks[current].used };
+}
+
+/**
+    Wipes and releases everything that was allocated since the given mark, so that the space can be
+    allocated again. Marks must be rewound to in the reverse order in which they were taken.
+*/
+void SecureArena::rewind(const Mark &mark) {
+    if (chunks.empty()) {
+        return;
+    }
+
+    // Every chunk after the current one is unused, so only the chunks up to it need to be wiped:
+    for (size_t i = current; i > mark.chunk; --i) {
+        explicit_bzero(chunks[i].data, chunks[i].used);
+        chunks[i].used = 0;
+    }
+    Chunk &chunk = chunks[mark.chunk];
+    explicit_bzero(chunk.data + mark.used, chunk.used - mark.used);
+    chunk.used = mark.used;
+    current = mark.chunk;
+}
+
+/**
+    Maps a new chunk of at least minSize bytes, locks it into memory and excludes it from core dumps,
+    and makes it the current chunk. Chunks grow geometrically, so that an arena holding n bytes has
+    O(log n) chunks.
+*/
+void SecureArena::addChunk(size_t minSize) {
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = chunks.empty() ? ARENA_INITIAL_CHUNK_SIZE : std::min(chunks.back().size * 2, (size_t)ARENA_MAX_CHUNK_SIZE);
+    size = std::max(size, (minSize + pageSize - 1) / pageSize * pageSize);
+
+    void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    Utils::lockMemory(data, size);
+    chunks.push_back(Chunk { (unsigned char *)data, size, 0 });
+    current = chunks.size() - 1;
+}
@@ -0,0 +1,51 @@
+#ifndef SECURE_ARENA_H
+#define SECURE_ARENA_H
+
+#include <string_view>
+#include <vector>
+#include <cstddef>
+
+#define ARENA_INITIAL_CHUNK_SIZE (16 * 1024) // size of the first chunk (in bytes); each later chunk doubles it...
+#define ARENA_MAX_CHUNK_SIZE (16 * 1024 * 1024) // ...up to this size, unless a single allocation needs more
+
+/**
+    A bump allocator for secrets (decrypted accounts, derived keys and the plaintext buffers they are
+    serialized into). Its memory is taken from anonymous mappings that are locked into memory (best
+    effort) and excluded from core dumps, and nothing in it is freed individually: the whole arena is
+    wiped and unmapped at once when it is destroyed, so teardown costs one wipe of the bytes in use
+    and one munmap per chunk, however many secrets it holds. Allocations never move, and are always
+    zero-filled.
+
+    Short-lived buffers (e.g. a serialized account that is about to be encrypted) are allocated after
+    a mark, and released (and wiped) by rewinding to it, so that scratch space is reused.
+*/
+class SecureArena {
+public:
+    // A position in the arena, to which it can be rewound:
+    struct Mark {
+        size_t chunk;
+        size_t used;
+    };
+
+    SecureArena();
+    ~SecureArena();
+    SecureArena(const SecureArena &) = delete;
+    SecureArena &operator=(const SecureArena &) = delete;
+    unsigned char *allocate(size_t size, size_t alignment = 1);
+    std::string_view copy(std::string_view text);
+    Mark mark() const;
+    void rewind(const Mark &mark);
+private:
+    // One mapping from which allocations are bumped:
+    struct Chunk {
+        unsigned char *data;
+        size_t size;
+        size_t used;
+    };
+
+    void addChunk(size_t minSize);
+    std::vector<Chunk> chunks;
+    size_t current; // index of the chunk that allocations are bumped from
+};
+
+#endif
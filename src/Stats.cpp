@@ -0,0 +1,108 @@
+#include "Stats.h"
+
+#include <iomanip>
+
+// The name of each phase in text and in JSON stats:
+struct PhaseInfo {
+    StatsPhase phase;
+    const char *name;
+    const char *jsonName;
+};
+
+static const PhaseInfo phases[] = {
+    { STATS_META_READ, "meta read", "meta_read" },
+    { STATS_KDF, "key derivation", "kdf" },
+    { STATS_FILE_READ, "file read", "file_read" },
+    { STATS_DECRYPT, "decrypt", "decrypt" },
+    { STATS_PARSE, "parse", "parse" },
+    { STATS_LOOKUP, "lookup", "lookup" },
+    { STATS_SERIALIZE, "serialize", "serialize" },
+    { STATS_ENCRYPT, "encrypt", "encrypt" },
+    { STATS_WRITE, "write", "write" },
+    { STATS_FSYNC, "fsync", "fsync" },
+    { STATS_CLIPBOARD, "clipboard", "clipboard" },
+};
+
+bool Stats::enabled = false;
+std::chrono::steady_clock::time_point Stats::enabledTime;
+std::atomic<uint64_t> Stats::phaseNanos[STATS_PHASE_COUNT];
+std::atomic<uint64_t> Stats::phaseCalls[STATS_PHASE_COUNT];
+std::atomic<uint64_t> Stats::counters[STATS_COUNTER_COUNT];
+thread_local ScopedTimer *ScopedTimer::current = nullptr;
+
+static uint64_t nanosBetween(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+/**
+    Starts measuring phases and counting events. The total time reported by print is measured
+    from here, so this should be called before the command starts.
+*/
+void Stats::enable() {
+    enabledTime = std::chrono::steady_clock::now();
+    enabled = true;
+}
+
+/**
+    Prints the time and number of calls of each phase, the time not attributed to any phase,
+    and the counters, either as a table or as a JSON object (with times in milliseconds).
+*/
+void Stats::print(std::ostream &outputStream, StatsFormat format) {
+    const uint64_t totalNanos = nanosBetween(enabledTime, std::chrono::steady_clock::now());
+    uint64_t phasesNanos = 0;
+    for (const PhaseInfo &info : phases) {
+        phasesNanos += phaseNanos[info.phase];
+    }
+    const uint64_t otherNanos = totalNanos > phasesNanos ? totalNanos - phasesNanos : 0;
+
+    outputStream << std::fixed << std::setprecision(3);
+    if (format == STATS_FORMAT_JSON) {
+        outputStream << "{\"phases\":{";
+        for (const PhaseInfo &info : phases) {
+            outputStream << (info.phase == phases[0].phase ? "" : ",") << "\"" << info.jsonName << "\":{\"calls\":"
+                << phaseCalls[info.phase] << ",\"ms\":" << phaseNanos[info.phase] / 1e6 << "}";
+        }
+        outputStream << "},\"other_ms\":" << otherNanos / 1e6 << ",\"total_ms\":" << totalNanos / 1e6
+            << ",\"allocations\":" << counters[STATS_ALLOCATIONS]
+            << ",\"allocated_bytes\":" << counters[STATS_ALLOCATED_BYTES]
+            << ",\"plaintext_copied_bytes\":" << counters[STATS_PLAINTEXT_COPIED] << "}" << std::endl;
+        return;
+    }
+
+    outputStream << std::left << std::setw(16) << "phase" << std::right << std::setw(8) << "calls" << std::setw(12) << "ms" << std::endl;
+    for (const PhaseInfo &info : phases) {
+        outputStream << std::left << std::setw(16) << info.name << std::right << std::setw(8) << phaseCalls[info.phase]
+            << std::setw(12) << phaseNanos[info.phase] / 1e6 << std::endl;
+    }
+    outputStream << std::left << std::setw(24) << "other" << std::right << std::setw(12) << otherNanos / 1e6 << std::endl;
+    outputStream << std::left << std::setw(24) << "total" << std::right << std::setw(12) << totalNanos / 1e6 << std::endl;
+    outputStream << "heap allocations: " << counters[STATS_ALLOCATIONS] << " (" << counters[STATS_ALLOCATED_BYTES] << " bytes)" << std::endl;
+    outputStream << "plaintext copied: " << counters[STATS_PLAINTEXT_COPIED] << " bytes" << std::endl;
+}
+
+/**
+    Pauses the enclosing timer of this thread, if any, and starts measuring this timer's phase.
+*/
+void ScopedTimer::start() {
+    startTime = std::chrono::steady_clock::now();
+    enclosing = current;
+    if (enclosing != nullptr) {
+        Stats::phaseNanos[enclosing->phase].fetch_add(nanosBetween(enclosing->startTime, startTime), std::memory_order_relaxed);
+    }
+    current = this;
+    running = true;
+}
+
+/**
+    Attributes the time since this timer (re)started to its phase, and resumes the enclosing timer.
+*/
+void ScopedTimer::stop() {
+    std::chrono::steady_clock::time_point stopTime = std::chrono::steady_clock::now();
+    Stats::phaseNanos[phase].fetch_add(nanosBetween(startTime, stopTime), std::memory_order_relaxed);
+    Stats::phaseCalls[phase].fetch_add(1, std::memory_order_relaxed);
+    current = enclosing;
+    if (enclosing != nullptr) {
+        enclosing->startTime = stopTime;
+    }
+    running = false;
+}
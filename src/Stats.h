@@ -0,0 +1,91 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+#define STATS_ENV "CLAM_STATS" // set to 1 (or json) to print stats as if --stats (or --stats=json) were given
+
+// The phases of a command whose time is measured while stats are enabled:
+enum StatsPhase {
+    STATS_META_READ,
+    STATS_KDF, // key derivation and verification
+    STATS_FILE_READ,
+    STATS_DECRYPT,
+    STATS_PARSE,
+    STATS_LOOKUP,
+    STATS_SERIALIZE,
+    STATS_ENCRYPT,
+    STATS_WRITE,
+    STATS_FSYNC, // waiting for written files and directories to reach the disk
+    STATS_CLIPBOARD,
+    STATS_PHASE_COUNT,
+};
+
+// The events that are counted while stats are enabled:
+enum StatsCounter {
+    STATS_ALLOCATIONS, // heap allocations (only counted by the clam executable)
+    STATS_ALLOCATED_BYTES,
+    STATS_PLAINTEXT_COPIED, // bytes of plaintext account data copied
+    STATS_COUNTER_COUNT,
+};
+
+enum StatsFormat {
+    STATS_FORMAT_TEXT,
+    STATS_FORMAT_JSON,
+};
+
+/**
+    Process-wide timings and counters of the phases of a command. Until enable is called, timers
+    and counters only test a flag, so the instrumentation may be left in hot paths.
+*/
+class Stats {
+public:
+    static void enable();
+    static bool isEnabled() { return enabled; }
+    static void count(StatsCounter counter, uint64_t amount) {
+        if (enabled) {
+            counters[counter].fetch_add(amount, std::memory_order_relaxed);
+        }
+    }
+    static void print(std::ostream &outputStream, StatsFormat format);
+private:
+    friend class ScopedTimer;
+    static bool enabled;
+    static std::chrono::steady_clock::time_point enabledTime;
+    static std::atomic<uint64_t> phaseNanos[STATS_PHASE_COUNT];
+    static std::atomic<uint64_t> phaseCalls[STATS_PHASE_COUNT];
+    static std::atomic<uint64_t> counters[STATS_COUNTER_COUNT];
+};
+
+/**
+    Attributes the time until it is destroyed to a phase. Timers nest: while an inner timer runs,
+    the time of the enclosing timer is paused, so that the phases add up to the time measured.
+*/
+class ScopedTimer {
+public:
+    explicit ScopedTimer(StatsPhase phase) : phase(phase), running(false) {
+        if (Stats::enabled) {
+            start();
+        }
+    }
+    ~ScopedTimer() {
+        if (running) {
+            stop();
+        }
+    }
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+private:
+    void start();
+    void stop();
+    static thread_local ScopedTimer *current; // the innermost running timer of this thread
+    StatsPhase phase;
+    bool running;
+    ScopedTimer *enclosing;
+    std::chrono::steady_clock::time_point startTime; // when this timer last (re)started measuring
+};
+
+#endif
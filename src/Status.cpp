@@ -0,0 +1,46 @@
+#include "Status.h"
+
+// The registry of status messages:
+struct StatusInfo {
+    ClamStatus status;
+    const char *message;
+};
+
+static const StatusInfo statuses[] = {
+    { CLAM_OK, "Success." },
+    { CLAM_ERROR_NO_VAULTS, "No vault exists." },
+    { CLAM_ERROR_WRONG_KEY, "The provided vault key is incorrect." },
+    { CLAM_ERROR_VAULT_NOT_FOUND, "No vault with the given name exists." },
+    { CLAM_ERROR_VAULT_EXISTS, "A vault with the given name already exists." },
+    { CLAM_ERROR_INVALID_VAULT_NAME, "Vault names must be 1 to 255 bytes long, and may not begin with '.'." },
+    { CLAM_ERROR_ALREADY_ACTIVE, "The vault is already the active vault." },
+    { CLAM_ERROR_VAULT_ACTIVE, "You cannot delete a vault that is currently active." },
+    { CLAM_ERROR_ACCOUNT_NOT_FOUND, "The specified account does not exist." },
+    { CLAM_ERROR_ACCOUNT_EXISTS, "There already exists an account with the specified name." },
+    { CLAM_ERROR_INVALID_ARGUMENT, "Invalid argument." },
+    { CLAM_ERROR_LOCK_TIMEOUT, "Timed out waiting for another process to finish writing to the vaults." },
+    { CLAM_ERROR_VAULT_CHANGED, "The vault was changed by another process while this command ran. Run the command again." },
+    { CLAM_ERROR_WRITE_CONFLICT, "Another process changed the same account while this command ran, so no change was written." },
+    { CLAM_ERROR_READ, "Failed to read the vault file." },
+    { CLAM_ERROR_WRITE, "Failed to write the vault file." },
+    { CLAM_ERROR_JOURNAL_WRITE, "Failed to write to the vault journal." },
+    { CLAM_ERROR_CORRUPT, "The vault file is corrupt." },
+    { CLAM_ERROR_UNSUPPORTED_VERSION, "The vault was written by an unsupported version of this program." },
+    { CLAM_ERROR_META_WRITE, "Failed to write the meta file." },
+    { CLAM_ERROR_META_CORRUPT, "The meta file is corrupt." },
+    { CLAM_ERROR_META_UNSUPPORTED_VERSION, "The meta file was written by an unsupported version of this program." },
+    { CLAM_ERROR_CRYPTO, "A cryptographic operation failed." },
+    { CLAM_ERROR_OUT_OF_MEMORY, "Failed to allocate memory." },
+};
+
+/**
+    Returns the message that describes the given status.
+*/
+const char *clam_status_message(enum ClamStatus status) {
+    for (const StatusInfo &info : statuses) {
+        if (info.status == status) {
+            return info.message;
+        }
+    }
+    return "Unknown error.";
+}
@@ -0,0 +1,81 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+/*
+    The outcome of a libclam operation. This header is also part of the C ABI (see clam.h), so
+    everything outside of the __cplusplus section must remain valid C.
+*/
+
+// Statuses of libclam operations (the values are part of the C ABI):
+enum ClamStatus {
+    CLAM_OK = 0,
+
+    // Errors caused by the request, after which the vault and meta file are unchanged:
+    CLAM_ERROR_NO_VAULTS = 1,
+    CLAM_ERROR_WRONG_KEY = 2,
+    CLAM_ERROR_VAULT_NOT_FOUND = 3,
+    CLAM_ERROR_VAULT_EXISTS = 4,
+    CLAM_ERROR_INVALID_VAULT_NAME = 5,
+    CLAM_ERROR_ALREADY_ACTIVE = 6, // the vault to switch to is already the active vault
+    CLAM_ERROR_VAULT_ACTIVE = 7, // the vault to delete is the active vault
+    CLAM_ERROR_ACCOUNT_NOT_FOUND = 8,
+    CLAM_ERROR_ACCOUNT_EXISTS = 9,
+    CLAM_ERROR_INVALID_ARGUMENT = 10,
+    CLAM_ERROR_LOCK_TIMEOUT = 11, // another process held the write lock for too long
+    CLAM_ERROR_VAULT_CHANGED = 12, // another process wrote the vault after it was loaded (or changed its key)
+    CLAM_ERROR_WRITE_CONFLICT = 13, // another process changed the same account fields after the vault was loaded
+
+    // Errors in reading or writing the vaults themselves (CLAM_ERROR_FIRST_FAILURE and above):
+    CLAM_ERROR_READ = 64,
+    CLAM_ERROR_WRITE = 65,
+    CLAM_ERROR_JOURNAL_WRITE = 66,
+    CLAM_ERROR_CORRUPT = 67,
+    CLAM_ERROR_UNSUPPORTED_VERSION = 68,
+    CLAM_ERROR_META_WRITE = 69,
+    CLAM_ERROR_META_CORRUPT = 70,
+    CLAM_ERROR_META_UNSUPPORTED_VERSION = 71,
+    CLAM_ERROR_CRYPTO = 72,
+    CLAM_ERROR_OUT_OF_MEMORY = 73,
+};
+
+#define CLAM_ERROR_FIRST_FAILURE CLAM_ERROR_READ
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const char *clam_status_message(enum ClamStatus status);
+
+#ifdef __cplusplus
+}
+
+#include <optional>
+#include <utility>
+
+/**
+    Either the value produced by an operation or the status (other than CLAM_OK) that explains why
+    there is none, in the manner of C++23's std::expected<T, ClamStatus>.
+*/
+template <typename T>
+class Result {
+public:
+    Result(const T &value) : contents(value), status(CLAM_OK) {}
+    Result(T &&value) : contents(std::move(value)), status(CLAM_OK) {}
+    Result(ClamStatus status) : status(status) {}
+    bool has_value() const { return contents.has_value(); }
+    explicit operator bool() const { return contents.has_value(); }
+    T &value() { return contents.value(); }
+    const T &value() const { return contents.value(); }
+    T &operator*() { return *contents; }
+    const T &operator*() const { return *contents; }
+    T *operator->() { return &*contents; }
+    const T *operator->() const { return &*contents; }
+    ClamStatus error() const { return status; }
+private:
+    std::optional<T> contents;
+    ClamStatus status;
+};
+
+#endif
+
+#endif
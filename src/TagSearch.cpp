@@ -0,0 +1,150 @@
+#include "TagSearch.h"
+
+#include <algorithm>
+
+/**
+    Returns the given character in (ASCII) lowercase, so that tags are searched case-insensitively.
+*/
+static char fold(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+/**
+    Returns true if tag1 sorts before tag2 when compared case-insensitively.
+*/
+static bool lessFolded(std::string_view tag1, std::string_view tag2) {
+    return std::lexicographical_compare(tag1.begin(), tag1.end(), tag2.begin(), tag2.end(),
+        [](char c1, char c2) { return fold(c1) < fold(c2); });
+}
+
+/**
+    Returns the length of the longest common (case-insensitive) prefix of the given tags.
+*/
+static size_t commonPrefixSize(std::string_view tag1, std::string_view tag2) {
+    size_t size = 0;
+    while (size < tag1.size() && size < tag2.size() && fold(tag1[size]) == fold(tag2[size])) {
+        ++size;
+    }
+    return size;
+}
+
+/**
+    Builds a search index over the given tags, which must outlive it.
+*/
+TagSearch::TagSearch(std::vector<std::string_view> tags)
+: sortedTags(std::move(tags)), maxTagSize(0) {
+    std::sort(sortedTags.begin(), sortedTags.end(), lessFolded);
+    for (std::string_view tag : sortedTags) {
+        maxTagSize = std::max(maxTagSize, tag.size());
+    }
+}
+
+/**
+    Returns up to 'limit' tags that begin with the given pattern, or that begin with a string
+    within a few edits (insertions, deletions, substitutions or transpositions of adjacent characters) of it, ranked by edit distance,
+    then by length, and then alphabetically. Matching is case-insensitive.
+*/
+std::vector<TagMatch> TagSearch::search(std::string_view pattern, size_t limit) const {
+    std::vector<TagMatch> matches;
+    if (pattern.size() <= SEARCH_EXACT_PATTERN_LENGTH) {
+        searchPrefix(pattern, matches);
+    } else {
+        searchFuzzy(pattern, pattern.size() <= SEARCH_ONE_EDIT_PATTERN_LENGTH ? 1 : 2, matches);
+    }
+
+    auto rank = [](const TagMatch &match1, const TagMatch &match2) {
+        if (match1.distance != match2.distance) {
+            return match1.distance < match2.distance;
+        }
+        if (match1.tag.size() != match2.tag.size()) {
+            return match1.tag.size() < match2.tag.size();
+        }
+        return lessFolded(match1.tag, match2.tag);
+    };
+    size_t numResults = std::min(limit, matches.size());
+    std::partial_sort(matches.begin(), matches.begin() + numResults, matches.end(), rank);
+    matches.resize(numResults);
+    return matches;
+}
+
+/**
+    Appends every tag that begins with the given pattern to 'matches'. Since the tags are sorted,
+    these form one contiguous range, which is found by binary search.
+*/
+void TagSearch::searchPrefix(std::string_view pattern, std::vector<TagMatch> &matches) const {
+    auto first = std::lower_bound(sortedTags.begin(), sortedTags.end(), pattern, lessFolded);
+    for (auto tagIter = first; tagIter != sortedTags.end() && commonPrefixSize(*tagIter, pattern) == pattern.size(); ++tagIter) {
+        matches.push_back(TagMatch { *tagIter, 0 });
+    }
+}
+
+/**
+    Appends every tag that begins with a string within 'maxEdits' edits of the given pattern to
+    'matches'. The edit distance table is computed one row per tag character, so since the tags are
+    sorted, the rows for the prefix a tag shares with the previous tag are reused rather than
+    recomputed, as if the tags were walked as a trie. Once every entry of a row exceeds 'maxEdits',
+    no longer prefix can come any closer, so the tags sharing that prefix are not examined any further.
+*/
+void TagSearch::searchFuzzy(std::string_view pattern, uint32_t maxEdits, std::vector<TagMatch> &matches) const {
+    const size_t rowSize = pattern.size() + 1;
+
+    // rows[j * rowSize + i] = edit distance between the first i pattern characters and the first j tag characters;
+    // closest[j] = smallest edit distance between the whole pattern and any of the first j + 1 prefixes of the tag
+    std::vector<uint32_t> rows((maxTagSize + 1) * rowSize);
+    std::vector<uint32_t> closest(maxTagSize + 1);
+    for (size_t i = 0; i < rowSize; ++i) {
+        rows[i] = (uint32_t)i;
+    }
+    closest[0] = (uint32_t)pattern.size();
+
+    std::string_view previousTag;
+    size_t validRows = 0; // number of rows (after row 0) that are valid for previousTag
+    auto tagIter = sortedTags.begin();
+    while (tagIter != sortedTags.end()) {
+        std::string_view tag = *tagIter;
+        size_t row = std::min(validRows, commonPrefixSize(previousTag, tag));
+
+        bool pruned = false;
+        while (row < tag.size()) {
+            const uint32_t *above = &rows[row * rowSize];
+            uint32_t *current = &rows[(row + 1) * rowSize];
+            current[0] = (uint32_t)row + 1;
+            uint32_t rowMin = current[0];
+            for (size_t i = 1; i < rowSize; ++i) {
+                uint32_t substitution = above[i - 1] + (fold(pattern[i - 1]) == fold(tag[row]) ? 0 : 1);
+                current[i] = std::min({ above[i] + 1, current[i - 1] + 1, substitution });
+                if (i > 1 && row > 0 && fold(pattern[i - 1]) == fold(tag[row - 1]) && fold(pattern[i - 2]) == fold(tag[row])) {
+                    current[i] = std::min(current[i], rows[(row - 1) * rowSize + i - 2] + 1); // transposition
+                }
+                rowMin = std::min(rowMin, current[i]);
+            }
+            closest[row + 1] = std::min(closest[row], current[rowSize - 1]);
+            ++row;
+
+            if (rowMin > maxEdits) {
+                pruned = true;
+                break;
+            }
+        }
+        previousTag = tag;
+        validRows = row;
+
+        if (closest[row] <= maxEdits) {
+            matches.push_back(TagMatch { tag, closest[row] });
+        }
+        ++tagIter;
+
+        if (pruned) {
+            // Every following tag that shares the pruned prefix is as close to the pattern as this one:
+            std::string_view prunedPrefix = tag.substr(0, row);
+            auto prunedEnd = std::partition_point(tagIter, sortedTags.end(),
+                [&](std::string_view nextTag) { return commonPrefixSize(nextTag, prunedPrefix) == prunedPrefix.size(); });
+            if (closest[row] <= maxEdits) {
+                for (; tagIter != prunedEnd; ++tagIter) {
+                    matches.push_back(TagMatch { *tagIter, closest[row] });
+                }
+            }
+            tagIter = prunedEnd;
+        }
+    }
+}
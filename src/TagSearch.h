@@ -0,0 +1,29 @@
+#ifndef TAG_SEARCH_H
+#define TAG_SEARCH_H
+
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+#define SEARCH_DEFAULT_LIMIT 20 // default maximum number of search results
+#define SEARCH_EXACT_PATTERN_LENGTH 3 // patterns up to this length only match as exact prefixes...
+#define SEARCH_ONE_EDIT_PATTERN_LENGTH 7 // ...patterns up to this length may contain one typo, and longer ones two
+
+// One tag matched by a search, ranked by its distance from the search pattern:
+struct TagMatch {
+    std::string_view tag;
+    uint32_t distance; // edit distance between the pattern and the closest prefix of the tag (0 for prefix matches)
+};
+
+class TagSearch {
+public:
+    TagSearch(std::vector<std::string_view> tags);
+    std::vector<TagMatch> search(std::string_view pattern, size_t limit) const;
+private:
+    void searchPrefix(std::string_view pattern, std::vector<TagMatch> &matches) const;
+    void searchFuzzy(std::string_view pattern, uint32_t maxEdits, std::vector<TagMatch> &matches) const;
+    std::vector<std::string_view> sortedTags; // case-insensitively sorted views of the searchable tags
+    size_t maxTagSize;
+};
+
+#endif
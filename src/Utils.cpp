@@ -2,25 +2,33 @@
 
 #include <tomcrypt.h>
 #include <sys/types.h>
-#include <random>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
 #include <cstring>
 
-bool Utils::debug = true;
+bool Utils::debug = false;
 
 /**
-  Uses the mersenne twister algorithm to generate a 'size'-byte random
-  number and stores the result in the 'result' buffer. Assumes that
-  'size' is some multiple of 4-bytes and that 'result' is large enough
-  to hold the result.
+  Fills the 'result' buffer with 'size' bytes from the kernel's CSPRNG (getrandom(2)), which is suitable
+  for keys, salts and nonces. Returns false if the kernel cannot provide them.
 */
-void Utils::genRand(unsigned char *result, uint32_t size) {
-    std::random_device rd;
-    std::mt19937 mt(rd());
-    std::uniform_int_distribution<uint32_t> dist(0, 0xFFFFFFFF);
-    uint32_t *resultWriter = (uint32_t *)result;
-    for (uint32_t i = 0; i < size / 4; ++i) {
-        resultWriter[i] = dist(mt);
+bool Utils::genRand(unsigned char *result, uint32_t size) {
+    uint32_t filled = 0;
+    while (filled < size) {
+        ssize_t chunkSize = getrandom(result + filled, size - filled, 0);
+        if (chunkSize < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            explicit_bzero(result, size);
+            return false;
+        }
+        filled += (uint32_t)chunkSize;
     }
+    return true;
 }
 
 /**
@@ -37,12 +45,38 @@ bool Utils::contentsEqual(const unsigned char *buffer1, const unsigned char *buf
 }
 
 /**
-  Sets the contents of the given string to 0.
+  Sets the contents of the given string to 0, in a way that the compiler cannot optimize away.
 */
 void Utils::clearString(std::string &str) {
-    for (size_t i = 0; i < str.size(); ++i) {
-        str[i] = (char)0;
+    explicit_bzero(&str[0], str.size());
+}
+
+/**
+  Locks the pages spanning the given buffer into memory so that they are never swapped to disk,
+  and excludes them from core dumps. This is best effort: locking fails silently if it would
+  exceed the process's RLIMIT_MEMLOCK.
+*/
+void Utils::lockMemory(void *buffer, size_t size) {
+    if (size == 0) {
+        return;
+    }
+    uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t pageStart = (uintptr_t)buffer & ~(pageSize - 1);
+    size_t lockSize = (uintptr_t)buffer + size - pageStart;
+    mlock((void *)pageStart, lockSize);
+    madvise((void *)pageStart, lockSize, MADV_DONTDUMP);
+}
+
+/**
+  Unlocks the pages spanning the given buffer, which were locked by lockMemory.
+*/
+void Utils::unlockMemory(void *buffer, size_t size) {
+    if (size == 0) {
+        return;
     }
+    uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t pageStart = (uintptr_t)buffer & ~(pageSize - 1);
+    munlock((void *)pageStart, (uintptr_t)buffer + size - pageStart);
 }
 
 /**
@@ -55,99 +89,80 @@ void Utils::sha256(unsigned char *result, const unsigned char *input, unsigned l
     sha256_done(&md, result);
 }
 
-void Utils::concatArr(const unsigned char *buffer1, const unsigned char *buffer2, int len1, int len2, unsigned char *output) {
-    std::memcpy(output, buffer1, len1);
-    std::memcpy(output + len1, buffer2, len2);
-}
-
 /**
-  Encrypts the contents of the 'plaintext' array of size 'plaintextSize' using the symmetric key
-  'skey' of size 'skeySize' and stores the result in 'ciphertext.' Generates and stores the nonce/IV
-  used to encrypt the plaintext in the 'iv' array. Assumes that 'iv' and 'skey' are of the same size
-  and that the 'ciphertext' array is the same size as the 'plaintext' array. Uses the CTR block cipher
-  mode of encryption.
+  Computes an HMAC-SHA256 of the input using the given key and stores the 32-byte result in result.
+  Returns false if libtomcrypt fails to compute it.
 */
-void Utils::ctrEncrypt(const unsigned char *plaintext, unsigned char *ciphertext, int plaintextSize, unsigned char *iv, const unsigned char *skey, int skeySize) {
-    // Generate an IV for the cipher:
-    Utils::genRand(iv, skeySize);
-
-    // Register twofish cipher:
-    if (register_cipher(&twofish_desc) == -1) {
-        std::cout << "Error registering cipher.\n" << std::endl;
-        exit(1);
+bool Utils::hmacSha256(unsigned char *result, const unsigned char *key, unsigned long keySize, const unsigned char *input, unsigned long inputSize) {
+    // Register sha256 hash:
+    if (register_hash(&sha256_desc) == -1) {
+        return false;
     }
 
-    // Initialize CTR cipher:
     int err;
-    symmetric_CTR ctr;
-    if ((err = ctr_start(
-        find_cipher("twofish"), /* index of desired cipher */
-        iv, /* the initial vector */
-        skey, /* the secret key */
-        skeySize, /* length of secret key (16 bytes) */
-        0, /* 0 == default # of rounds */
-        CTR_COUNTER_LITTLE_ENDIAN, /* Little endian counter */
-        &ctr) /* where to store the CTR state */
-        ) != CRYPT_OK) {
-            std::cout << "ctr_start error: " << error_to_string(err) << std::endl;
-            exit(1);
+    unsigned long resultSize = 32;
+    if ((err = hmac_memory(find_hash("sha256"), key, keySize, input, inputSize, result, &resultSize)) != CRYPT_OK) {
+        return false;
     }
-
-    // Encrypt plaintext using CTR cipher:
-    if ((err = ctr_encrypt(plaintext, /* plaintext */
-        ciphertext, /* ciphertext */
-        plaintextSize, /* length of plaintext pt */
-        &ctr) /* CTR state */
-        ) != CRYPT_OK) {
-            std::cout << "ctr_encrypt error: " << error_to_string(err) << std::endl;
-            exit(1);
-    }
-
-    ctr_done(&ctr);
-    zeromem(&ctr, sizeof(ctr));
+    return true;
 }
 
 /**
-  Decrypts the contents of the 'ciphertext' array of size 'ciphertextSize' using the symmetric key
-  'skey' of size 'skeySize' and the provided nonce/IV and stores the result in 'plaintext.'Assumes
-  that the 'plaintext' array is the same size as the 'ciphertext' array. Uses the CTR block cipher
-  mode of decryption.
+  Computes a 64-bit keyed hash (BLAKE2b-64 keyed with the given key, of at most 64 bytes) of the input.
+  The result is unpredictable without the key, which makes it suitable for indexing secret values.
 */
-void Utils::ctrDecrypt(const unsigned char *ciphertext, unsigned char *plaintext, int ciphertextSize, const unsigned char *iv, const unsigned char *skey, int skeySize) {
-    // Register twofish cipher:
-    if (register_cipher(&twofish_desc) == -1) {
-        std::cout << "Error registering cipher.\n" << std::endl;
-        exit(1);
-    }
+uint64_t Utils::keyedHash64(const unsigned char *key, unsigned long keySize, const unsigned char *input, unsigned long inputSize) {
+    hash_state md;
+    unsigned char result[sizeof(uint64_t)];
+    blake2b_init(&md, sizeof(result), key, keySize);
+    blake2b_process(&md, input, inputSize);
+    blake2b_done(&md, result);
+    std::memset(&md, 0, sizeof(md));
+
+    uint64_t hash;
+    std::memcpy(&hash, result, sizeof(hash));
+    return hash;
+}
 
-    // Initialize CTR cipher:
-    int err;
-    symmetric_CTR ctr;
-    if ((err = ctr_start(
-        find_cipher("twofish"), /* index of desired cipher */
-        iv, /* the initial vector */
-        skey, /* the secret key */
-        skeySize, /* length of secret key (16 bytes) */
-        0, /* 0 == default # of rounds */
-        CTR_COUNTER_LITTLE_ENDIAN, /* Little endian counter */
-        &ctr) /* where to store the CTR state */
-        ) != CRYPT_OK) {
-            std::cout << "ctr_start error: " << error_to_string(err) << std::endl;
-            exit(1);
+/**
+  Writes all of the given bytes at the given offset of the file, and returns whether they were written.
+*/
+bool Utils::writeAt(int fd, const void *data, size_t size, off_t offset) {
+    const unsigned char *dataIter = (const unsigned char *)data;
+    while (size > 0) {
+        ssize_t written = pwrite(fd, dataIter, size, offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        dataIter += written;
+        size -= (size_t)written;
+        offset += written;
     }
+    return true;
+}
 
-    // Decrypt plaintext using CTR cipher:
-    if ((err = ctr_decrypt(ciphertext, /* ciphertext */
-        plaintext, /* plaintext */
-        ciphertextSize, /* length of plaintext pt */
-        &ctr) /* CTR state */
-        ) != CRYPT_OK) {
-            std::cout << "ctr_decrypt error: " << error_to_string(err) << std::endl;
-            exit(1);
+/**
+  Syncs the directory holding the file at the given path, so that a file created or moved into
+  place there survives a crash.
+*/
+bool Utils::syncParentDirectory(const std::string &path) {
+    size_t separator = path.find_last_of('/');
+    std::string directory = separator == std::string::npos ? "." : path.substr(0, separator + 1);
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        return false;
     }
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+}
 
-    ctr_done(&ctr);
-    zeromem(&ctr, sizeof(ctr));
+void Utils::concatArr(const unsigned char *buffer1, const unsigned char *buffer2, int len1, int len2, unsigned char *output) {
+    std::memcpy(output, buffer1, len1);
+    std::memcpy(output + len1, buffer2, len2);
 }
 
 void Utils::debugEnable() {
@@ -163,16 +178,3 @@ void Utils::debugPrint(std::ostream &outputStream, const std::string& str) {
         outputStream << str;
     }
 }
-
-bool Utils::verifyKey(std::string vaultKey, const unsigned char *salt, const unsigned char *correctHash, int keySize) {
-    unsigned char providedKeyHash[keySize];
-    unsigned char unsaltedKeyHash[keySize];
-    unsigned char concatBuffer[keySize * 2];
-    Utils::debugPrint(std::cout, std::to_string(salt[0]) + " using salt \n");
-    Utils::sha256(unsaltedKeyHash, (unsigned char *)vaultKey.c_str(), vaultKey.size());
-    Utils::concatArr(unsaltedKeyHash, salt, keySize, keySize, concatBuffer);
-    Utils::sha256(providedKeyHash, concatBuffer, keySize * 2);
-
-    bool success = Utils::contentsEqual(providedKeyHash, correctHash, keySize);
-    return success;
-}
@@ -3,20 +3,24 @@
 
 #include <string>
 #include <iostream>
+#include <sys/types.h>
 
 class Utils {
  public:
-    static void genRand(unsigned char *result, uint32_t size);
+    static bool genRand(unsigned char *result, uint32_t size);
     static bool contentsEqual(const unsigned char *buffer1, const unsigned char *buffer2, uint32_t size);
     static void clearString(std::string &str);
+    static void lockMemory(void *buffer, size_t size);
+    static void unlockMemory(void *buffer, size_t size);
     static void sha256(unsigned char *result, const unsigned char *input, unsigned long inputSize);
+    static bool hmacSha256(unsigned char *result, const unsigned char *key, unsigned long keySize, const unsigned char *input, unsigned long inputSize);
+    static uint64_t keyedHash64(const unsigned char *key, unsigned long keySize, const unsigned char *input, unsigned long inputSize);
+    static bool writeAt(int fd, const void *data, size_t size, off_t offset);
+    static bool syncParentDirectory(const std::string &path);
     static void concatArr(const unsigned char *buffer1, const unsigned char *buffer2, int len1, int len2, unsigned char *output);
-    static void ctrEncrypt(const unsigned char *plaintext, unsigned char *ciphertext, int plaintextSize, unsigned char *iv, const unsigned char *skey, int skeySize);
-    static void ctrDecrypt(const unsigned char *ciphertext, unsigned char *plaintext, int ciphertextSize, const unsigned char *iv, const unsigned char *skey, int skeySize);
     static void debugEnable();
     static void debugDisable();
     static void debugPrint(std::ostream &outputStream, const std::string& str);
-    static bool verifyKey(std::string vaultKey, const unsigned char *salt, const unsigned char *correctHash, int keySize);
 private:
     static bool debug;
 };
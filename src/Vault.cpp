@@ -1,221 +1,1339 @@
 #include "Vault.h"
 #include "Utils.h"
+#include "Stats.h"
+
+#include <tomcrypt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
 
-#include <fstream>
 #include <random>
 #include <cstring>
+#include <cstdio>
 #include <algorithm>
 
 /**
-    Decrypts and loads into memory the vault located at vaultDir/vaultName, if such a vault exists.
+    Returns the inode number of the file at the given path, or 0 if there is no such file. If size is
+    given, the size of the file (or 0) is stored in it.
 */
-Vault::Vault(const std::string &vaultDir, const std::string &vaultName, const std::string &vaultKey)
-: vaultName(vaultName), vaultKey(vaultKey), vaultFilePath(vaultDir + vaultName) {
-    std::ifstream fileStream(vaultFilePath);
-    
-    // Attempt to load the vault with the given name:
-    fileStream.seekg(0, fileStream.end);
-    std::streamoff fileSize = fileStream.tellg();
-    fileStream.seekg(0, fileStream.beg);
-    if (fileSize <= 0) {
-        // Do not try to decrypt and load accounts from an empty vault:
-        return;
+static uint64_t fileInode(const std::string &path, size_t *size = nullptr) {
+    struct stat info;
+    bool exists = stat(path.c_str(), &info) == 0;
+    if (size != nullptr) {
+        *size = exists ? (size_t)info.st_size : 0;
     }
+    return exists ? (uint64_t)info.st_ino : 0;
+}
 
-    // Compute sha512(vaultKey) (skey):
-    unsigned char skey[SKEY_LENGTH];
-    Utils::sha256(skey, (unsigned char *)vaultKey.c_str(), (unsigned long)vaultKey.size());
+/**
+    Returns the generation in the header of the vault file at the given path (see writeSnapshot), or 0
+    if there is no such file or it has no generation (i.e. it was written before version 4).
+*/
+static uint64_t fileGeneration(const std::string &path) {
+    unsigned char header[VAULT_MAGIC_LENGTH + sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint64_t)];
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    bool hasHeader = pread(fd, header, sizeof(header), 0) == (ssize_t)sizeof(header);
+    close(fd);
 
-    // Load 32-byte iv
-    unsigned char iv[SKEY_LENGTH];
-    fileStream.read((char *)iv, SKEY_LENGTH);
+    uint32_t version;
+    uint64_t generation;
+    std::memcpy(&version, header + VAULT_MAGIC_LENGTH, sizeof(version));
+    std::memcpy(&generation, header + VAULT_MAGIC_LENGTH + sizeof(version) + sizeof(uint32_t), sizeof(generation));
+    bool hasGeneration = hasHeader && std::memcmp(header, VAULT_MAGIC, VAULT_MAGIC_LENGTH) == 0 && version == VAULT_FORMAT_VERSION;
+    return hasGeneration ? generation : 0;
+}
 
-    // Load remaining bytes (until EOF) into a byte array
-    std::streamoff ciphertextSize = fileSize - SKEY_LENGTH;
-    unsigned char *ciphertext = new unsigned char[ciphertextSize];
-    fileStream.read((char *)ciphertext, ciphertextSize);
+// The fields of an account that merge applies independently of each other:
+static std::string_view AccountView::* const mergedFields[] = {
+    &AccountView::username,
+    &AccountView::password,
+    &AccountView::note,
+};
 
-    // Allocate a plaintext buffer in which to store the decrypted plaintext:
-    unsigned char *plaintext = new unsigned char[ciphertextSize];
+Vault::Vault(const std::string &vaultDir, const std::string &vaultName, std::unique_ptr<CryptoContext> crypto, const std::string &lockFilePath)
+: vaultName(vaultName), crypto(std::move(crypto)), tagIndexKey(nullptr), journalKey(nullptr), vaultFileData(nullptr), vaultFileSize(0), indexOffset(0), recordSectionOffset(0), recordOverhead(0),
+    snapshotRequired(false), journalEntries(0), journalSize(0), cipherSuiteChanged(false), vaultFileInode(0), generation(0), journalInode(0),
+    vaultDir(vaultDir), vaultFilePath(vaultDir + vaultName), journalFilePath(vaultDir + JOURNAL_DIR + vaultName), lockFilePath(lockFilePath) {
+    tagIndexKey = arena.allocate(SKEY_LENGTH);
+    journalKey = arena.allocate(SKEY_LENGTH);
+    deriveSubkey(TAG_INDEX_KEY_LABEL, tagIndexKey);
+    deriveSubkey(JOURNAL_MAC_LABEL, journalKey);
+    changesMark = arena.mark();
+}
 
-    // Use sha(vaultKey) and iv to decrypt account list byte array
-    Utils::ctrDecrypt(ciphertext, plaintext, (int)ciphertextSize, iv, skey, SKEY_LENGTH);
-    
-    // Load one account at a time from the decrypted byte array:
-    unsigned char *plaintextIter = plaintext;
-    unsigned char *plaintextEnd = plaintext + ciphertextSize;
-    while (plaintextIter != plaintextEnd) {
-        accounts.push_back(Account(&plaintextIter));
+/**
+    Decrypts and loads into memory the vault located at vaultDir/vaultName, if such a vault exists,
+    using the given (unlocked) context. Changes to the vault are written while holding the lock of the
+    given lock file (see writeVault). Returns an error if the vault cannot be read.
+
+    Loading does not take the lock: if another process replaces the vault file while it is being loaded,
+    the journal that was read may belong to the new file, so the vault is loaded again (up to
+    VAULT_LOAD_ATTEMPTS times), and every vault that is returned is a consistent snapshot.
+*/
+Result<std::unique_ptr<Vault>> Vault::open(const std::string &vaultDir, const std::string &vaultName, std::unique_ptr<CryptoContext> crypto,
+    const std::string &lockFilePath) {
+    const CipherSuite suite = crypto->getCipherSuite();
+    for (int attempt = 1; ; ++attempt) {
+        std::unique_ptr<Vault> vault(new Vault(vaultDir, vaultName, std::move(crypto), lockFilePath));
+        ClamStatus status = vault->load();
+        if (status == CLAM_OK) {
+            return vault;
+        }
+        if (status != CLAM_ERROR_VAULT_CHANGED || attempt == VAULT_LOAD_ATTEMPTS) {
+            return status;
+        }
+        crypto = std::move(vault->crypto);
+        crypto->setCipherSuite(suite);
     }
+}
 
-    // Clean up memory:
-    std::memset(skey, 0, SKEY_LENGTH);
-    std::memset(plaintext, 0, ciphertextSize);
-    delete[] plaintext;
-    delete[] ciphertext;
+/**
+    For versioned vaults, only the encrypted tag index is decrypted here; individual account
+    records are decrypted on demand by getAccountView. Legacy (version 1) vaults are
+    decrypted and loaded in full, and are migrated to the current format (and the default cipher
+    suite) the next time the vault is written. Any changes recorded in the vault's journal are then replayed on top of the vault.
+*/
+ClamStatus Vault::load() {
+    // Attempt to map the vault with the given name:
+    ClamStatus status = mapVaultFile();
+    if (status != CLAM_OK) {
+        return status;
+    }
 
-    fileStream.close();
+    if (vaultFileData == nullptr) {
+        // There is no vault file yet, so the first write must create one (with the default cipher suite):
+        snapshotRequired = true;
+    } else if (hasVersionHeader()) {
+        status = loadRecordIndex();
+    } else {
+        // Every account of a legacy vault is re-encrypted when it is migrated, so it may as well
+        // be migrated to the default cipher suite:
+        status = crypto->setCipherSuite(CIPHER_SUITE_TWOFISH_CTR) ? loadLegacyVault() : CLAM_ERROR_CRYPTO;
+        unmapVaultFile();
+        if (status == CLAM_OK && !crypto->setCipherSuite(CryptoContext::defaultCipherSuite())) {
+            status = CLAM_ERROR_CRYPTO;
+        }
+        snapshotRequired = true;
+    }
+    if (status != CLAM_OK) {
+        return status;
+    }
+
+    status = replayJournal();
+    if (status != CLAM_OK) {
+        return status;
+    }
+
+    // The journal belongs to the mapped vault file only if that file was not replaced before the journal was read:
+    return isLoadedVersion(false) ? CLAM_OK : CLAM_ERROR_VAULT_CHANGED;
 }
 
 /**
-    Clears all sensitive account data from memory before destroying this object.
+    Discards the accounts and any changes that have not been written, and loads the vault on disk again
+    (see load). The copies kept for the changes remain in the arena until clearChanges is called. Any
+    views of accounts are invalid afterwards.
 */
-Vault::~Vault() {
-    // Clear all sensitive account data from memory:
-    memset((unsigned char *)vaultKey.c_str(), 0, vaultKey.size());
-    for (size_t i = 0; i < accounts.size(); ++i) {
-        accounts[i].wipeSensitiveData();
+ClamStatus Vault::reload() {
+    unmapVaultFile();
+    changes.clear();
+    cipherSuiteChanged = false;
+    std::memset(tagIndex.data(), 0, tagIndex.size() * sizeof(uint32_t));
+    tagIndex.clear();
+    tagSearch.reset();
+    accounts.clear();
+    indexOffset = 0;
+    recordSectionOffset = 0;
+    recordOverhead = 0;
+    snapshotRequired = false;
+    journalEntries = 0;
+    journalSize = 0;
+    vaultFileInode = 0;
+    generation = 0;
+    journalInode = 0;
+    return load();
+}
+
+/**
+    Returns whether the vault file (and, if includingJournal, the journal) on disk are still the ones
+    from which this vault was loaded, or that it last wrote, i.e. whether no other process has written
+    the vault since. Every write either appends to the journal or replaces the vault file with one of
+    the next generation, so the generation of the vault file and the size of its journal identify the
+    version of the vault (the inodes also identify the versions of files that have no generation).
+*/
+bool Vault::isLoadedVersion(bool includingJournal) const {
+    if (fileInode(vaultFilePath) != vaultFileInode || fileGeneration(vaultFilePath) != generation) {
+        return false;
     }
+    size_t currentJournalSize = 0;
+    return !includingJournal || (fileInode(journalFilePath, &currentJournalSize) == journalInode && currentJournalSize == journalSize);
+}
+
+/**
+    Clears all sensitive account data from memory before destroying this object. The accounts and
+    keys held by the arena are wiped all at once when it is destroyed.
+*/
+Vault::~Vault() {
+    std::memset(tagIndex.data(), 0, tagIndex.size() * sizeof(uint32_t));
+    unmapVaultFile();
 }
 
 /**
     Print all Account tags, separated by newlines, to the output stream.
+    Tags are served from the decrypted tag index when the records themselves have not been loaded.
 */
 void Vault::printTags(std::ostream &outputStream) const {
-    for (size_t i = 0; i < accounts.size(); ++i) {
-        outputStream << accounts[i].getTag() << '\n';
+    for (size_t row = 0; row < accounts.size(); ++row) {
+        if (!accounts.isRemoved(row)) {
+            outputStream << accounts.tag(row) << '\n';
+        }
     }
 }
 
 /**
     Print all nicely formatted Account info to the output stream.
+    Records that have not been loaded are decrypted (in place) and printed without being copied.
+    Returns an error (after printing the accounts before it) if a record is corrupt.
+*/
+ClamStatus Vault::printInfo(std::ostream &outputStream) {
+    size_t i = 0;
+    return forEachAccount([&](const AccountView &account) {
+        outputStream << "Account " << i << " tag: " << account.tag << '\n'
+            << "Account " << i << " username: " << account.username << '\n'
+            << "Account " << i << " password: " << account.password << '\n'
+            << "Account " << i << " note: " << account.note << '\n';
+        ++i;
+    });
+}
+
+/**
+    Calls the visitor with a view of each Account, in listing order. Records that have not been
+    loaded are decrypted in place without being copied. The view is only valid during the call.
+    Stops and returns an error at the first record that is corrupt.
 */
-void Vault::printInfo(std::ostream &outputStream) const {
-    for (size_t i = 0; i < accounts.size(); ++i) {
-        outputStream << "Account " << i << " tag: " << accounts[i].getTag() << '\n'
-            << "Account " << i << " username: " << accounts[i].getUsername() << '\n'
-            << "Account " << i << " password: " << accounts[i].getPassword() << '\n'
-            << "Account " << i << " note: " << accounts[i].getNote() << '\n';
+ClamStatus Vault::forEachAccount(const std::function<void(const AccountView &)> &visitor) {
+    for (size_t row = 0; row < accounts.size(); ++row) {
+        if (!accounts.isRemoved(row)) {
+            Result<AccountView> view = rowView(row);
+            if (!view) {
+                return view.error();
+            }
+            visitor(*view);
+        }
     }
+    return CLAM_OK;
 }
 
 /**
-    Returns a reference to the Account labeled 'tag,' or returns
-    std::nullopt if an account with the given tag does not exist.
+    Returns a read-only view of the Account labeled 'tag,' or returns CLAM_ERROR_ACCOUNT_NOT_FOUND
+    if an account with the given tag does not exist. No field is copied: the view points directly
+    into the decrypted record (or the account table), and is valid until the account is changed or
+    removed, or the vault is written or destroyed.
 */
-std::optional<Account *> Vault::getAccount(const std::string &tag) {
-    for (size_t i = 0; i < accounts.size(); ++i) {
-        if (accounts[i].getTag() == tag) {
-            return &accounts[i];
+Result<AccountView> Vault::getAccountView(const std::string &tag) {
+    std::optional<size_t> row = findRow(tag);
+    if (!row.has_value()) {
+        return CLAM_ERROR_ACCOUNT_NOT_FOUND;
+    }
+
+    return rowView(row.value());
+}
+
+/**
+    Replaces the username, password and note of the account with the given account's tag, or returns
+    CLAM_ERROR_ACCOUNT_NOT_FOUND if it does not exist. The account is copied into the account table,
+    and is written by the next writeVault.
+*/
+ClamStatus Vault::updateAccount(const AccountView &account) {
+    std::optional<size_t> row = findRow(account.tag);
+    if (!row.has_value()) {
+        return CLAM_ERROR_ACCOUNT_NOT_FOUND;
+    }
+
+    ClamStatus status = recordChange(row.value(), false);
+    if (status != CLAM_OK) {
+        return status;
+    }
+    accounts.setAccount(row.value(), account);
+    accounts.setModified(row.value(), true);
+    return CLAM_OK;
+}
+
+/**
+    Returns whether the vault has an account with the given tag.
+*/
+bool Vault::containsAccount(const std::string &tag) const {
+    return findRow(tag).has_value();
+}
+
+/**
+    Returns up to 'limit' tags that begin with, or nearly begin with, the given pattern, ranked
+    by how closely they match it (see TagSearch::search). Only the decrypted tag index is searched;
+    no account records are decrypted.
+*/
+std::vector<TagMatch> Vault::searchTags(const std::string &pattern, size_t limit) {
+    if (!tagSearch.has_value()) {
+        std::vector<std::string_view> tags;
+        tags.reserve(accounts.size());
+        for (size_t row = 0; row < accounts.size(); ++row) {
+            if (!accounts.isRemoved(row)) {
+                tags.push_back(accounts.tag(row));
+            }
         }
+        tagSearch.emplace(std::move(tags));
     }
 
-    notExistsError();
-    return std::nullopt;
+    return tagSearch->search(pattern, limit);
 }
 
 /**
-    Adds the given Account to the vault, or prints an error
-    if an account with the given tag already exists.
+    Adds the given Account to the vault, or returns CLAM_ERROR_ACCOUNT_EXISTS
+    if an account with the given tag already exists. The account is copied into the account table.
 */
-void Vault::addAccount(Account account) {
-    if (accounts.end() != 
-            std::find_if(accounts.begin(),
-            accounts.end(),
-            [account](const Account& a) { return a.getTag() == account.getTag(); })) {
-        existsError();
-    } else {
-        accounts.push_back(account);
+ClamStatus Vault::addAccount(const AccountView &account) {
+    if (findRow(account.tag).has_value()) {
+        return CLAM_ERROR_ACCOUNT_EXISTS;
     }
+
+    size_t row = accounts.appendAccount(account);
+    recordChange(row, true);
+    accounts.setModified(row, true);
+    addToTagIndex(row);
+    return CLAM_OK;
 }
 
 /**
-    Removes the account with the given tag from the
-    vault, or prints an error if it does not exist.
+    Removes the account with the given tag from the vault, or
+    returns CLAM_ERROR_ACCOUNT_NOT_FOUND if it does not exist.
 */
-void Vault::removeAccount(const std::string& tag) {
-    auto it = std::remove_if(
-                       accounts.begin(),
-                       accounts.end(),
-                       [tag](Account a) { return a.getTag() == tag; });
+ClamStatus Vault::removeAccount(const std::string& tag) {
+    std::optional<size_t> row = findRow(tag);
+    if (!row.has_value()) {
+        return CLAM_ERROR_ACCOUNT_NOT_FOUND;
+    }
 
-    if (it == accounts.end()) {
-        notExistsError();
-    } else {
-        accounts.erase(it);
+    ClamStatus status = recordChange(row.value(), false);
+    if (status != CLAM_OK) {
+        return status;
     }
+    accounts.setRemoved(row.value());
+    tagSearch.reset();
+    accounts.setModified(row.value(), true);
+    return CLAM_OK;
 }
 
 /**
-    Encrypts and writes all Accounts in this Vault to disk at vaultFilePath.
+    Persists all changes made to this Vault since it was loaded. Changes are normally appended to
+    the vault's journal, so that the cost of a write is proportional to the size of the change;
+    the journal is folded into the vault file (see writeSnapshot) once it grows past the compaction
+    thresholds, or when the vault file itself must be rewritten (e.g. after a cipher suite change).
+    Writers only hold the write lock while they write (waiting up to WRITE_LOCK_TIMEOUT_MS for it), so
+    if another process has written the vault since it was loaded, its changes are merged into the
+    version on disk first (see merge). Returns an error if the changes could not be written, or
+    CLAM_ERROR_WRITE_CONFLICT (leaving the vault on disk unchanged) if they conflict with that version.
+    Views of accounts are invalid afterwards.
 */
-void Vault::writeVault() const {
-    if (accounts.empty()) {
-        return;
+ClamStatus Vault::writeVault() {
+    Result<FileLock> lock = FileLock::acquire(lockFilePath, WRITE_LOCK_TIMEOUT_MS);
+    if (!lock) {
+        return lock.error();
+    }
+    if (!isLoadedVersion(true)) {
+        ClamStatus status = merge();
+        if (status != CLAM_OK) {
+            return status;
+        }
+    }
+
+    if (snapshotRequired) {
+        return writeSnapshot();
+    }
+
+    ClamStatus status = appendJournal();
+    if (status != CLAM_OK) {
+        return status;
+    }
+
+    if (journalEntries >= JOURNAL_COMPACTION_ENTRIES || journalSize >= JOURNAL_COMPACTION_SIZE) {
+        return writeSnapshot();
+    }
+    return CLAM_OK;
+}
+
+/**
+    Folds the journal (and any other changes) into a new vault file (see writeSnapshot), holding the
+    write lock and merging the changes like writeVault.
+*/
+ClamStatus Vault::compact() {
+    Result<FileLock> lock = FileLock::acquire(lockFilePath, WRITE_LOCK_TIMEOUT_MS);
+    if (!lock) {
+        return lock.error();
+    }
+    if (!isLoadedVersion(true)) {
+        ClamStatus status = merge();
+        if (status != CLAM_OK) {
+            return status;
+        }
     }
+    return writeSnapshot();
+}
+
+/**
+    Applies the changes made since the vault was last written (see recordChange) to the version on disk,
+    which another process has written since: the vault is loaded again, and each change is made again to
+    the account as it now is, so that changes to different accounts, or to different fields of one
+    account, are all kept. A change conflicts with the other process's if
+
+    - it adds an account whose tag was added in the meantime (with other fields),
+    - it changes a field (the username, password or note) that was changed to another value in the
+      meantime, or an account that was removed in the meantime, or
+    - it removes an account that was changed in the meantime.
+
+    If any change conflicts, the vault holds the version on disk without any of the changes, and
+    CLAM_ERROR_WRITE_CONFLICT is returned. The write lock must be held. Views of accounts are invalid
+    afterwards.
+*/
+ClamStatus Vault::merge() {
+    if (vaultFileInode != 0 && fileInode(vaultFilePath) == 0) {
+        // The vault was deleted (see VaultManager::deleteVault), and must not be created again:
+        return CLAM_ERROR_VAULT_NOT_FOUND;
+    }
+
+    // The changed accounts are copied out of the account table (after the bases of the changes), since
+    // loading clears it. They are only wiped once the merged changes are written, like the bases:
+    struct PendingChange {
+        std::optional<AccountView> base;
+        std::optional<AccountView> account; // the account after the change, unless it was removed
+    };
+    std::vector<PendingChange> pendingChanges;
+    for (const AccountChange &change : changes) {
+        if (!accounts.isRemoved(change.row)) {
+            pendingChanges.push_back(PendingChange { change.base, copyToArena(accounts.account(change.row)) });
+        } else if (change.base.has_value()) {
+            pendingChanges.push_back(PendingChange { change.base, std::nullopt });
+        }
+    }
+    const bool changesCipherSuite = cipherSuiteChanged;
+    const CipherSuite suite = crypto->getCipherSuite();
+
+    ClamStatus status = reload();
+    if (status == CLAM_OK && changesCipherSuite) {
+        status = updateCipherSuite(suite);
+    }
+    for (size_t i = 0; i < pendingChanges.size() && status == CLAM_OK; ++i) {
+        status = mergeChange(pendingChanges[i].base, pendingChanges[i].account);
+    }
+
+    if (status == CLAM_ERROR_WRITE_CONFLICT) {
+        // Discard the changes that were merged before the conflict:
+        clearChanges();
+        ClamStatus reloadStatus = reload();
+        return reloadStatus == CLAM_OK ? status : reloadStatus;
+    }
+    return status;
+}
+
+/**
+    Makes one change (see merge) to the account with its tag as it is now, given the account before the
+    change (or nullopt if it was added) and after it (or nullopt if it was removed). Returns
+    CLAM_ERROR_WRITE_CONFLICT if the account has changed in a way that conflicts with the change.
+*/
+ClamStatus Vault::mergeChange(const std::optional<AccountView> &base, const std::optional<AccountView> &account) {
+    std::string_view tag = account.has_value() ? account->tag : base->tag;
+    std::optional<size_t> row = findRow(tag);
+    if (!row.has_value()) {
+        if (!account.has_value()) {
+            return CLAM_OK; // it was removed in the meantime too
+        }
+        return base.has_value() ? CLAM_ERROR_WRITE_CONFLICT : addAccount(account.value());
+    }
+
+    Result<AccountView> current = rowView(row.value());
+    if (!current) {
+        return current.error();
+    }
+    if (!base.has_value()) {
+        return *current == account.value() ? CLAM_OK : CLAM_ERROR_WRITE_CONFLICT;
+    }
+    if (!account.has_value()) {
+        return *current == base.value() ? removeAccount(std::string(tag)) : CLAM_ERROR_WRITE_CONFLICT;
+    }
+
+    // Fields that the change left as they were keep their current values:
+    AccountView merged = *current;
+    for (std::string_view AccountView::*field : mergedFields) {
+        if (account.value().*field == base.value().*field) {
+            continue;
+        }
+        if (merged.*field != base.value().*field && merged.*field != account.value().*field) {
+            return CLAM_ERROR_WRITE_CONFLICT;
+        }
+        merged.*field = account.value().*field;
+    }
+    return merged == *current ? CLAM_OK : updateAccount(merged);
+}
+
+/**
+    Records that the account in the given row is about to be changed (or, if added, that it was just
+    added), unless it was already changed since the vault was last written. Unless it was added, a copy
+    of the account before the change is kept in the arena (as the change's base), so that the change
+    can be merged. Returns an error if the account's record is corrupt.
+*/
+ClamStatus Vault::recordChange(size_t row, bool added) {
+    if (accounts.isModified(row)) {
+        return CLAM_OK;
+    }
+
+    std::optional<AccountView> base;
+    if (!added) {
+        Result<AccountView> view = rowView(row);
+        if (!view) {
+            return view.error();
+        }
+        base = copyToArena(view.value());
+    }
+    changes.push_back(AccountChange { row, base });
+    return CLAM_OK;
+}
+
+/**
+    Marks every change as written, and wipes the copies of accounts kept for them. The account table
+    is compacted if the changes left it holding mostly superseded fields (see AccountTable::compact).
+*/
+void Vault::clearChanges() {
+    for (const AccountChange &change : changes) {
+        accounts.setModified(change.row, false);
+    }
+    changes.clear();
+    arena.rewind(changesMark);
+    cipherSuiteChanged = false;
+    if (accounts.compact()) {
+        tagSearch.reset(); // it holds views of the tags
+    }
+}
+
+/**
+    Copies the fields of the given account into the arena, and returns a view of the copy.
+*/
+AccountView Vault::copyToArena(const AccountView &account) {
+    Stats::count(STATS_PLAINTEXT_COPIED, account.serializedSize());
+    return AccountView { arena.copy(account.tag), arena.copy(account.username), arena.copy(account.password), arena.copy(account.note) };
+}
+
+/**
+    Encrypts and writes all Accounts in this Vault to a new vault file, which then atomically
+    replaces the vault file at vaultFilePath, and discards the journal. Records that have not
+    been decrypted are copied to the new file as they are, without being re-encrypted.
+    The vault is written in the following (version 4) format:
+
+    4 bytes: magic = "CLAM"
+    uint32: version = 4
+    uint32: cipher suite (see CipherSuite) with which the tag index and records are encrypted
+    uint64: generation = the generation of the vault file that this one replaces, plus 1
+    32 bytes: iv used to encrypt the tag index
+    uint32: s = size of the encrypted tag index (in bytes)
+    s bytes: encrypted tag index
+
+    <repeated once per account>:
+        32 bytes: iv used to encrypt this account's record
+        r bytes: encrypted serialized account
 
-    // Create a byte array from list of accounts:
-    std::vector<uint8_t> serializedAccountList;
-    std::vector<uint8_t> serializedAccount;
-    for (size_t i = 0; i < accounts.size(); ++i) {
-        serializedAccount = accounts[i].serialize();
-        serializedAccountList.insert(serializedAccountList.end(),
-                                     serializedAccount.data(),
-                                     serializedAccount.data() + serializedAccount.size());
+    Encrypted data includes the authentication tag of authenticated cipher suites. Version 3
+    vaults have the same format without the generation, and version 2 vaults have neither the
+    generation nor the cipher suite, and are encrypted with Twofish CTR.
+
+    The decrypted tag index is of the following format:
+
+    uint32: n = number of accounts
+    <repeated n times>:
+        uint32: t = size of the account's tag (in bytes)
+        t bytes: tag = account's tag
+        uint64: offset of the account's record from the end of the encrypted tag index
+        uint32: r = size of the account's encrypted record (excluding its iv)
+
+    Readers that have mapped the old vault file keep reading it, so they see the vault as it was.
+    The write lock must be held. Returns an error if the vault file could not be written, in which
+    case it is unchanged.
+*/
+ClamStatus Vault::writeSnapshot() {
+    Result<std::string> newVaultFilePath = writeSnapshotFile();
+    if (!newVaultFilePath) {
+        return newVaultFilePath.error();
+    }
+    if (std::rename(newVaultFilePath->c_str(), vaultFilePath.c_str()) != 0) {
+        std::remove(newVaultFilePath->c_str());
+        return CLAM_ERROR_WRITE;
+    }
+    // The rename is only durable once the directory is synced (the new vault file itself already is):
+    {
+        ScopedTimer syncTimer(STATS_FSYNC);
+        Utils::syncParentDirectory(vaultFilePath);
     }
 
-    size_t plaintextSize = serializedAccountList.size();
-    unsigned char *plaintext = (unsigned char *)serializedAccountList.data();
+    // Every change is now part of the vault file, so the journal can be discarded (until it is, readers ignore it, see replayJournal):
+    std::remove(journalFilePath.c_str());
+    vaultFileInode = fileInode(vaultFilePath);
+    generation++;
+    journalInode = 0;
+    clearChanges();
+    snapshotRequired = false;
+    journalEntries = 0;
+    journalSize = 0;
+    return CLAM_OK;
+}
 
-    // Allocate buffer in which to store the ciphertext:
-    unsigned char *ciphertext = new unsigned char[plaintextSize];
+/**
+    Writes the new vault file of writeSnapshot to a temporary file in vaultDir, which is synced, and
+    returns its path, so that the caller can move it into place. The vault itself is unchanged.
+*/
+Result<std::string> Vault::writeSnapshotFile() {
+    ScopedTimer timer(STATS_WRITE);
+    const size_t overhead = crypto->getOverhead();
 
-    // Compute sha512(vaultKey) (skey):
-    unsigned char skey[SKEY_LENGTH];
-    Utils::sha256(skey, (unsigned char *)vaultKey.c_str(), (unsigned long)vaultKey.size());
+    // The tag index is built in the arena, so it is sized up front:
+    size_t plainIndexSize = sizeof(uint32_t);
+    for (size_t row = 0; row < accounts.size(); ++row) {
+        if (!accounts.isRemoved(row)) {
+            plainIndexSize += sizeof(uint32_t) + accounts.tag(row).size() + sizeof(uint64_t) + sizeof(uint32_t);
+        }
+    }
+    SecureArena::Mark indexMark = arena.mark();
+    unsigned char *index = arena.allocate(plainIndexSize);
+    unsigned char *indexIter = index + sizeof(uint32_t);
 
-    // Allocate array in which to store IV/nonce:
+    // Encrypt each account as an independent record, and build the tag index as we go:
+    std::vector<uint8_t> records;
+    uint32_t numAccounts = 0;
     unsigned char iv[SKEY_LENGTH];
+    for (size_t row = 0; row < accounts.size(); ++row) {
+        if (accounts.isRemoved(row)) {
+            continue;
+        }
 
-    // Use sha256(vaultKey) as skey to encrypt byte array:
-    Utils::ctrEncrypt(plaintext, ciphertext, (int)plaintextSize, iv, skey, SKEY_LENGTH);
+        uint64_t recordOffset = records.size();
+        uint32_t recordSize;
+        if (!accounts.hasAccount(row) && !accounts.isDecrypted(row)) {
+            // The record is unchanged and still encrypted, so copy it (and its iv) as it is:
+            const unsigned char *record = vaultFileData + recordSectionOffset + accounts.recordOffset(row);
+            recordSize = accounts.recordSize(row);
+            records.insert(records.end(), record, record + SKEY_LENGTH + recordSize);
+        } else {
+            Result<AccountView> view = rowView(row);
+            if (!view) {
+                arena.rewind(indexMark);
+                return view.error();
+            }
 
-    // write sha(sha(vaultKey)), iv, and encrypted byte array to disk under vaults/vaultName
-    std::ofstream fileStream(vaultFilePath);
-    fileStream.write((char *)iv, SKEY_LENGTH);
-    fileStream.write((char *)ciphertext, plaintextSize);
-    fileStream.close();
+            // Serialize the account into the arena, and encrypt it from there:
+            SecureArena::Mark recordMark = arena.mark();
+            size_t serializedSize = view->serializedSize();
+            unsigned char *serializedAccount = arena.allocate(serializedSize);
+            view->serializeTo(serializedAccount);
+            recordSize = (uint32_t)(serializedSize + overhead);
 
-    // Clean up memory:
-    std::memset(skey, 0, SKEY_LENGTH);
-    delete[] ciphertext;
+            records.resize(records.size() + SKEY_LENGTH + recordSize);
+            unsigned char *record = records.data() + recordOffset;
+            bool encrypted = crypto->encrypt(serializedAccount, record + SKEY_LENGTH, serializedSize, iv);
+            std::memcpy(record, iv, SKEY_LENGTH);
+            arena.rewind(recordMark);
+            if (!encrypted) {
+                arena.rewind(indexMark);
+                return CLAM_ERROR_CRYPTO;
+            }
+        }
+
+        std::string_view tag = accounts.tag(row);
+        uint32_t tagSize = (uint32_t)tag.size();
+        std::memcpy(indexIter, &tagSize, sizeof(tagSize));
+        indexIter += sizeof(tagSize);
+        std::memcpy(indexIter, tag.data(), tagSize);
+        indexIter += tagSize;
+        std::memcpy(indexIter, &recordOffset, sizeof(recordOffset));
+        indexIter += sizeof(recordOffset);
+        std::memcpy(indexIter, &recordSize, sizeof(recordSize));
+        indexIter += sizeof(recordSize);
+        ++numAccounts;
+    }
+    std::memcpy(index, &numAccounts, sizeof(numAccounts));
+
+    // Encrypt the tag index:
+    uint32_t indexSize = (uint32_t)(plainIndexSize + overhead);
+    std::vector<uint8_t> encryptedIndex(indexSize);
+    bool encrypted = crypto->encrypt(index, encryptedIndex.data(), plainIndexSize, iv);
+    arena.rewind(indexMark);
+    if (!encrypted) {
+        return CLAM_ERROR_CRYPTO;
+    }
+
+    // Write the header, encrypted tag index, and encrypted records to a new file, through the descriptor that created it:
+    std::string newVaultFilePath = vaultDir + COMPACTION_FILE_TEMPLATE;
+    int fd = mkstemp(&newVaultFilePath[0]);
+    if (fd < 0) {
+        return CLAM_ERROR_WRITE;
+    }
+    uint32_t version = VAULT_FORMAT_VERSION;
+    uint32_t suite = crypto->getCipherSuite();
+    uint64_t newGeneration = generation + 1;
+    std::vector<uint8_t> header(VAULT_MAGIC, VAULT_MAGIC + VAULT_MAGIC_LENGTH);
+    header.insert(header.end(), (uint8_t *)&version, (uint8_t *)&version + sizeof(version));
+    header.insert(header.end(), (uint8_t *)&suite, (uint8_t *)&suite + sizeof(suite));
+    header.insert(header.end(), (uint8_t *)&newGeneration, (uint8_t *)&newGeneration + sizeof(newGeneration));
+    header.insert(header.end(), iv, iv + SKEY_LENGTH);
+    header.insert(header.end(), (uint8_t *)&indexSize, (uint8_t *)&indexSize + sizeof(indexSize));
+    bool written = Utils::writeAt(fd, header.data(), header.size(), 0)
+        && Utils::writeAt(fd, encryptedIndex.data(), indexSize, (off_t)header.size())
+        && Utils::writeAt(fd, records.data(), records.size(), (off_t)(header.size() + indexSize));
+    if (written) {
+        ScopedTimer syncTimer(STATS_FSYNC);
+        written = fsync(fd) == 0;
+    }
+    close(fd);
+    if (!written) {
+        std::remove(newVaultFilePath.c_str());
+        return CLAM_ERROR_WRITE;
+    }
+    return newVaultFilePath;
+}
+
+/**
+    Replaces the cipher suite used to encrypt this vault. All accounts are first decrypted
+    using the old suite, since their records cannot be read once the suite has changed.
+    Returns an error, leaving the suite unchanged, if any account cannot be decrypted.
+*/
+ClamStatus Vault::updateCipherSuite(CipherSuite suite) {
+    ClamStatus status = decryptAll();
+    if (status != CLAM_OK) {
+        return status;
+    }
+    CipherSuite oldSuite = crypto->getCipherSuite();
+    if (!crypto->setCipherSuite(suite)) {
+        crypto->setCipherSuite(oldSuite);
+        return CLAM_ERROR_CRYPTO;
+    }
+    snapshotRequired = true;
+    cipherSuiteChanged = true;
+    return CLAM_OK;
+}
+
+/**
+    Replaces the key with which this vault is encrypted (e.g. by a new data key), keeping its cipher
+    suite. All accounts are first decrypted with the old key, and the whole vault must then be written
+    again (e.g. by writeSnapshotFile). Returns an error, leaving the key unchanged, if any account cannot
+    be decrypted.
+*/
+ClamStatus Vault::rekey(std::unique_ptr<CryptoContext> newCrypto) {
+    ClamStatus status = decryptAll();
+    if (status != CLAM_OK) {
+        return status;
+    }
+    if (!newCrypto->setCipherSuite(crypto->getCipherSuite())) {
+        return CLAM_ERROR_CRYPTO;
+    }
+    crypto = std::move(newCrypto);
+
+    // The subkeys are derived from the key, and the tag index is probed by a hash keyed by one of them:
+    deriveSubkey(TAG_INDEX_KEY_LABEL, tagIndexKey);
+    deriveSubkey(JOURNAL_MAC_LABEL, journalKey);
+    std::fill(tagIndex.begin(), tagIndex.end(), 0);
+    for (size_t row = 0; row < accounts.size(); ++row) {
+        indexRow(row);
+    }
+    snapshotRequired = true;
+    return CLAM_OK;
 }
 
-void Vault::updateKey(const std::string &newKey) {
-    vaultKey = newKey;
+CipherSuite Vault::getCipherSuite() const {
+    return crypto->getCipherSuite();
 }
 
 std::string Vault::getVaultName() const {
     return vaultName;
 }
 
-std::string Vault::getVaultKey() const {
-    return vaultKey;
+/**
+    Decrypts (in place) the record of every account that has not been removed, so that every account
+    can still be read (and re-encrypted by compact) once the cipher suite has changed.
+*/
+ClamStatus Vault::decryptAll() {
+    for (size_t row = 0; row < accounts.size(); ++row) {
+        if (!accounts.isRemoved(row)) {
+            Result<AccountView> view = rowView(row);
+            if (!view) {
+                return view.error();
+            }
+        }
+    }
+    return CLAM_OK;
+}
+
+/**
+    Maps the vault file into memory as a private, copy-on-write mapping, so that its contents can
+    be decrypted in place without copying the file into separate ciphertext and plaintext buffers.
+    The mapping is locked into memory (best effort) so that decrypted pages are never swapped out.
+    Nothing is mapped (and vaultFileData remains nullptr) if the vault file does not exist or is empty.
+*/
+ClamStatus Vault::mapVaultFile() {
+    ScopedTimer timer(STATS_FILE_READ);
+    int fd = ::open(vaultFilePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return CLAM_OK;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return CLAM_ERROR_READ;
+    }
+    vaultFileInode = (uint64_t)info.st_ino;
+    if (info.st_size <= 0) {
+        close(fd);
+        return CLAM_OK;
+    }
+
+    void *data = mmap(nullptr, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return CLAM_ERROR_READ;
+    }
+
+    vaultFileData = (unsigned char *)data;
+    vaultFileSize = (size_t)info.st_size;
+    Utils::lockMemory(vaultFileData, vaultFileSize);
+    return CLAM_OK;
+}
+
+/**
+    Wipes every decrypted region of the mapping created by mapVaultFile, if any, and releases it.
+    Any AccountViews into the mapping are invalid afterwards.
+*/
+void Vault::unmapVaultFile() {
+    if (vaultFileData == nullptr) {
+        return;
+    }
+
+    // Wipe the decrypted tag index and records:
+    if (recordSectionOffset > 0) {
+        std::memset(vaultFileData + indexOffset, 0, recordSectionOffset - indexOffset);
+    }
+    for (size_t row = 0; row < accounts.size(); ++row) {
+        if (accounts.hasRecord(row) && accounts.isDecrypted(row)) {
+            std::memset(vaultFileData + recordSectionOffset + accounts.recordOffset(row), 0, SKEY_LENGTH + accounts.recordSize(row));
+        }
+    }
+
+    Utils::unlockMemory(vaultFileData, vaultFileSize);
+    munmap(vaultFileData, vaultFileSize);
+    vaultFileData = nullptr;
+    vaultFileSize = 0;
+}
+
+/**
+    Decrypts and loads every account from a legacy (version 1) vault file, which consists of a
+    32-byte iv followed by the serialized account list encrypted as one single ciphertext.
+    The ciphertext is decrypted into arena scratch space, from which the accounts are copied into
+    the account table.
+*/
+ClamStatus Vault::loadLegacyVault() {
+    ScopedTimer timer(STATS_PARSE);
+    if (vaultFileSize < SKEY_LENGTH) {
+        return CLAM_ERROR_CORRUPT;
+    }
+
+    // The 32-byte iv is followed by the ciphertext (until EOF):
+    const unsigned char *iv = vaultFileData;
+    const unsigned char *ciphertext = vaultFileData + SKEY_LENGTH;
+    size_t plaintextSize = vaultFileSize - SKEY_LENGTH;
+    SecureArena::Mark mark = arena.mark();
+    unsigned char *plaintext = arena.allocate(plaintextSize);
+
+    // Use sha(vaultKey) and iv to decrypt account list byte array:
+    if (!crypto->decrypt(ciphertext, plaintext, plaintextSize, iv)) {
+        arena.rewind(mark);
+        return CLAM_ERROR_CRYPTO;
+    }
+
+    // Load one account at a time from the decrypted byte array:
+    const unsigned char *plaintextIter = plaintext;
+    const unsigned char *plaintextEnd = plaintext + plaintextSize;
+    AccountView view;
+    ClamStatus status = CLAM_OK;
+    while (plaintextIter != plaintextEnd) {
+        if (!AccountView::parse(&plaintextIter, plaintextEnd, view)) {
+            status = CLAM_ERROR_CORRUPT;
+            break;
+        }
+        addToTagIndex(accounts.appendAccount(view));
+    }
+
+    // Clean up memory:
+    arena.rewind(mark);
+    return status;
+}
+
+/**
+    Returns true if the mapped vault file starts with a version header (i.e. it is not a legacy vault).
+*/
+bool Vault::hasVersionHeader() const {
+    return vaultFileSize >= VAULT_V2_HEADER_SIZE && std::memcmp(vaultFileData, VAULT_MAGIC, VAULT_MAGIC_LENGTH) == 0;
+}
+
+/**
+    Reads the header of a versioned vault file (see hasVersionHeader) and decrypts its tag index
+    (in place), creating one row of the account table per record. Returns an error if the vault was written by an
+    unsupported version or is malformed.
+*/
+ClamStatus Vault::loadRecordIndex() {
+    ScopedTimer timer(STATS_PARSE);
+    const unsigned char *headerIter = vaultFileData + VAULT_MAGIC_LENGTH;
+    uint32_t version;
+    std::memcpy(&version, headerIter, sizeof(version));
+    headerIter += sizeof(version);
+
+    uint32_t suite = CIPHER_SUITE_TWOFISH_CTR;
+    size_t headerSize = VAULT_V2_HEADER_SIZE;
+    if (version == VAULT_FORMAT_VERSION) {
+        headerSize = VAULT_HEADER_SIZE;
+    } else if (version == 3) {
+        headerSize = VAULT_V3_HEADER_SIZE;
+    } else if (version != 2) {
+        return CLAM_ERROR_UNSUPPORTED_VERSION;
+    }
+    if (vaultFileSize < headerSize) {
+        return CLAM_ERROR_CORRUPT;
+    }
+
+    if (version >= 3) {
+        std::memcpy(&suite, headerIter, sizeof(suite));
+        headerIter += sizeof(suite);
+    }
+    if (version >= 4) {
+        std::memcpy(&generation, headerIter, sizeof(generation));
+        headerIter += sizeof(generation);
+    }
+    if (!CryptoContext::isCipherSuite(suite)) {
+        return CLAM_ERROR_UNSUPPORTED_VERSION;
+    }
+    if (!crypto->setCipherSuite((CipherSuite)suite)) {
+        return CLAM_ERROR_CRYPTO;
+    }
+    const unsigned char *iv = headerIter;
+    headerIter += SKEY_LENGTH;
+    uint32_t indexSize;
+    std::memcpy(&indexSize, headerIter, sizeof(indexSize));
+    if (indexSize < sizeof(uint32_t) + crypto->getOverhead() || indexSize > vaultFileSize - headerSize) {
+        return CLAM_ERROR_CORRUPT;
+    }
+
+    unsigned char *index = vaultFileData + headerSize;
+    if (!crypto->decrypt(index, index, indexSize, iv)) {
+        return CLAM_ERROR_CORRUPT;
+    }
+
+    indexOffset = headerSize;
+    recordSectionOffset = headerSize + indexSize;
+    recordOverhead = crypto->getOverhead();
+    uint64_t recordSectionSize = vaultFileSize - recordSectionOffset;
+
+    // Parse the decrypted tag index, verifying that every entry lies within the index and file:
+    const uint8_t *indexIter = index;
+    const uint8_t *indexEnd = index + indexSize - crypto->getOverhead();
+    uint32_t numAccounts;
+    std::memcpy(&numAccounts, indexIter, sizeof(numAccounts));
+    indexIter += sizeof(numAccounts);
+    accounts.reserve(std::min((size_t)numAccounts, (size_t)(indexEnd - indexIter) / (sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t))));
+    for (uint32_t i = 0; i < numAccounts; ++i) {
+        uint32_t tagSize;
+        uint64_t recordOffset;
+        uint32_t recordSize;
+        if ((size_t)(indexEnd - indexIter) < sizeof(tagSize)) {
+            break;
+        }
+        std::memcpy(&tagSize, indexIter, sizeof(tagSize));
+        indexIter += sizeof(tagSize);
+        if ((size_t)(indexEnd - indexIter) < tagSize + sizeof(recordOffset) + sizeof(recordSize)) {
+            break;
+        }
+        std::string_view tag((const char *)indexIter, tagSize);
+        indexIter += tagSize;
+        std::memcpy(&recordOffset, indexIter, sizeof(recordOffset));
+        indexIter += sizeof(recordOffset);
+        std::memcpy(&recordSize, indexIter, sizeof(recordSize));
+        indexIter += sizeof(recordSize);
+        if (recordOffset > recordSectionSize || SKEY_LENGTH + (uint64_t)recordSize > recordSectionSize - recordOffset
+            || recordSize < recordOverhead) {
+            break;
+        }
+        addToTagIndex(accounts.appendRecord(tag, recordOffset, recordSize));
+    }
+
+    if (accounts.size() != numAccounts) {
+        return CLAM_ERROR_CORRUPT;
+    }
+
+    return CLAM_OK;
+}
+
+/**
+    Replays the changes recorded in this vault's journal, if it has one, on top of the accounts
+    loaded from the vault file. The journal consists of entries of the following format:
+
+    uint32: s = size of the encrypted delta (in bytes)
+    32 bytes: iv used to encrypt the delta
+    s bytes: encrypted delta
+    32 bytes: hmac-sha256(journal key, uint64 generation || uint64 entry number || iv || encrypted delta)
+
+    where the decrypted delta is a JournalEntryType byte followed by either a serialized
+    account (JOURNAL_PUT) or a uint32 tag size and tag (JOURNAL_DELETE), and the generation is
+    that of the vault file to which the journal belongs. Replay stops at the first entry that is
+    incomplete or fails authentication (e.g. an interrupted append), and the next write then
+    rewrites the vault file so that the damaged journal is discarded. Since a new vault file has
+    a new generation, the journal of the file that it replaced (which writeSnapshot only removes
+    once the new file is in place) fails authentication too, so it is never replayed onto the new
+    file, whose contents already include it.
+
+    The journal is read under a shared flock of it, which appendJournal excludes while it appends,
+    so that the entries of one write are read either all or not at all.
+*/
+ClamStatus Vault::replayJournal() {
+    std::vector<uint8_t> journal;
+    {
+        ScopedTimer readTimer(STATS_FILE_READ);
+        int fd = ::open(journalFilePath.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return CLAM_OK;
+        }
+        struct stat info;
+        if (flock(fd, LOCK_SH) != 0 || fstat(fd, &info) != 0) {
+            close(fd);
+            return CLAM_ERROR_READ;
+        }
+        journalInode = (uint64_t)info.st_ino;
+        journal.resize((size_t)info.st_size);
+        size_t readSize = 0;
+        ssize_t chunkSize;
+        while (readSize < journal.size() && (chunkSize = read(fd, journal.data() + readSize, journal.size() - readSize)) > 0) {
+            readSize += (size_t)chunkSize;
+        }
+        close(fd);
+        journal.resize(readSize);
+    }
+    ScopedTimer timer(STATS_PARSE);
+
+    const uint8_t *journalIter = journal.data();
+    const uint8_t *journalEnd = journal.data() + journal.size();
+    std::vector<uint8_t> macInput;
+    unsigned char mac[SKEY_LENGTH];
+    while (journalIter != journalEnd) {
+        // Verify that the entry is complete and authentic:
+        uint32_t deltaSize;
+        if ((size_t)(journalEnd - journalIter) < sizeof(deltaSize)) {
+            break;
+        }
+        std::memcpy(&deltaSize, journalIter, sizeof(deltaSize));
+        if (deltaSize <= crypto->getOverhead() || (size_t)(journalEnd - journalIter) < sizeof(deltaSize) + SKEY_LENGTH + (size_t)deltaSize + SKEY_LENGTH) {
+            break;
+        }
+        const uint8_t *iv = journalIter + sizeof(deltaSize);
+        const uint8_t *encryptedDelta = iv + SKEY_LENGTH;
+        const uint8_t *entryMac = encryptedDelta + deltaSize;
+
+        uint64_t entryNumber = journalEntries;
+        macInput.assign((uint8_t *)&generation, (uint8_t *)&generation + sizeof(generation));
+        macInput.insert(macInput.end(), (uint8_t *)&entryNumber, (uint8_t *)&entryNumber + sizeof(entryNumber));
+        macInput.insert(macInput.end(), iv, entryMac);
+        if (!Utils::hmacSha256(mac, journalKey, SKEY_LENGTH, macInput.data(), macInput.size())) {
+            // The entry cannot be verified, and must not be discarded as if it were damaged:
+            return CLAM_ERROR_CRYPTO;
+        }
+        if (mem_neq(mac, entryMac, SKEY_LENGTH) != 0) {
+            break;
+        }
+
+        // Decrypt the delta into arena scratch space, and apply it:
+        size_t plainDeltaSize = deltaSize - crypto->getOverhead();
+        SecureArena::Mark deltaMark = arena.mark();
+        unsigned char *delta = arena.allocate(plainDeltaSize);
+        if (!crypto->decrypt(encryptedDelta, delta, deltaSize, iv)) {
+            arena.rewind(deltaMark);
+            break;
+        }
+        bool applied = applyJournalDelta(delta, plainDeltaSize);
+        arena.rewind(deltaMark);
+        if (!applied) {
+            break;
+        }
+
+        journalIter = entryMac + SKEY_LENGTH;
+        ++journalEntries;
+    }
+    journalSize = journal.size();
+
+    if (journalIter != journalEnd) {
+        // Discard the unreadable remainder of the journal by rewriting the vault file on the next write:
+        snapshotRequired = true;
+    }
+
+    return CLAM_OK;
+}
+
+/**
+    Applies one decrypted journal delta (see replayJournal) to the account table, copying the account
+    it puts, if any. Returns false if the delta is malformed.
+*/
+bool Vault::applyJournalDelta(const unsigned char *delta, size_t deltaSize) {
+    const unsigned char *deltaIter = delta + 1;
+    const unsigned char *deltaEnd = delta + deltaSize;
+    if (delta[0] == JOURNAL_PUT) {
+        AccountView view;
+        if (!AccountView::parse(&deltaIter, deltaEnd, view)) {
+            return false;
+        }
+        std::optional<size_t> row = findRow(view.tag);
+        if (row.has_value()) {
+            accounts.setAccount(row.value(), view);
+        } else {
+            addToTagIndex(accounts.appendAccount(view));
+        }
+    } else if (delta[0] == JOURNAL_DELETE) {
+        uint32_t tagSize;
+        if ((size_t)(deltaEnd - deltaIter) < sizeof(tagSize)) {
+            return false;
+        }
+        std::memcpy(&tagSize, deltaIter, sizeof(tagSize));
+        deltaIter += sizeof(tagSize);
+        if ((size_t)(deltaEnd - deltaIter) < tagSize) {
+            return false;
+        }
+        std::optional<size_t> row = findRow(std::string_view((const char *)deltaIter, tagSize));
+        if (row.has_value()) {
+            accounts.setRemoved(row.value());
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+    Appends one encrypted, authenticated journal entry (see replayJournal) for each account that
+    was added, modified or removed since the vault was last written. Returns an error if the
+    entries could not be written.
+*/
+ClamStatus Vault::appendJournal() {
+    ScopedTimer timer(STATS_WRITE);
+    std::vector<uint8_t> entries;
+    std::vector<uint8_t> macInput;
+    unsigned char iv[SKEY_LENGTH];
+    unsigned char mac[SKEY_LENGTH];
+    ClamStatus status = CLAM_OK;
+    size_t numEntries = 0;
+    for (size_t row = 0; row < accounts.size(); ++row) {
+        if (!accounts.isModified(row)) {
+            continue;
+        }
+
+        // Build the delta in the arena:
+        SecureArena::Mark deltaMark = arena.mark();
+        unsigned char *delta;
+        size_t plainDeltaSize;
+        if (accounts.isRemoved(row)) {
+            std::string_view tag = accounts.tag(row);
+            uint32_t tagSize = (uint32_t)tag.size();
+            plainDeltaSize = 1 + sizeof(tagSize) + tagSize;
+            delta = arena.allocate(plainDeltaSize);
+            delta[0] = JOURNAL_DELETE;
+            std::memcpy(delta + 1, &tagSize, sizeof(tagSize));
+            std::memcpy(delta + 1 + sizeof(tagSize), tag.data(), tagSize);
+        } else {
+            Result<AccountView> view = rowView(row);
+            if (!view) {
+                status = view.error();
+                break;
+            }
+            plainDeltaSize = 1 + view->serializedSize();
+            delta = arena.allocate(plainDeltaSize);
+            delta[0] = JOURNAL_PUT;
+            view->serializeTo(delta + 1);
+        }
+
+        // Encrypt and authenticate the delta:
+        uint32_t deltaSize = (uint32_t)(plainDeltaSize + crypto->getOverhead());
+        size_t entryOffset = entries.size();
+        entries.resize(entryOffset + sizeof(deltaSize) + SKEY_LENGTH + deltaSize);
+        unsigned char *entry = entries.data() + entryOffset;
+        bool encrypted = crypto->encrypt(delta, entry + sizeof(deltaSize) + SKEY_LENGTH, plainDeltaSize, iv);
+        std::memcpy(entry, &deltaSize, sizeof(deltaSize));
+        std::memcpy(entry + sizeof(deltaSize), iv, SKEY_LENGTH);
+        arena.rewind(deltaMark);
+
+        uint64_t entryNumber = journalEntries + numEntries;
+        macInput.assign((uint8_t *)&generation, (uint8_t *)&generation + sizeof(generation));
+        macInput.insert(macInput.end(), (uint8_t *)&entryNumber, (uint8_t *)&entryNumber + sizeof(entryNumber));
+        macInput.insert(macInput.end(), entries.begin() + entryOffset + sizeof(deltaSize), entries.end());
+        if (!encrypted || !Utils::hmacSha256(mac, journalKey, SKEY_LENGTH, macInput.data(), macInput.size())) {
+            status = CLAM_ERROR_CRYPTO;
+            break;
+        }
+        entries.insert(entries.end(), mac, mac + SKEY_LENGTH);
+        ++numEntries;
+    }
+
+    // Append all of the entries to the journal with a single write:
+    if (status == CLAM_OK && !entries.empty()) {
+        mkdir((vaultDir + JOURNAL_DIR).c_str(), 0700);
+        int fd = ::open(journalFilePath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+        if (fd < 0 || flock(fd, LOCK_EX) != 0 || write(fd, entries.data(), entries.size()) != (ssize_t)entries.size()) {
+            // A partially written entry fails authentication, so it (and everything after it) is
+            // discarded by the next replay, and the next write must rewrite the vault file instead:
+            snapshotRequired = true;
+            status = CLAM_ERROR_JOURNAL_WRITE;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        journalInode = fileInode(journalFilePath);
+        if (status != CLAM_OK) {
+            // Whatever was appended was appended by this vault (which holds the write lock), so it is still the loaded version:
+            fileInode(journalFilePath, &journalSize);
+        }
+    }
+
+    // Only once the entries are written are the changes no longer pending:
+    if (status == CLAM_OK) {
+        clearChanges();
+        journalEntries += numEntries;
+        journalSize += entries.size();
+    }
+
+    return status;
+}
+
+/**
+    Derives a key for one specific purpose (e.g. authenticating journal entries) from the vault's
+    symmetric key: subkey = sha256(skey || label).
+*/
+void Vault::deriveSubkey(const char *label, unsigned char *subkey) {
+    const size_t labelSize = std::strlen(label);
+    SecureArena::Mark mark = arena.mark();
+    unsigned char *concatBuffer = arena.allocate(SKEY_LENGTH + labelSize);
+    Utils::concatArr(crypto->getSkey(), (const unsigned char *)label, SKEY_LENGTH, (int)labelSize, concatBuffer);
+    Utils::sha256(subkey, concatBuffer, (unsigned long)(SKEY_LENGTH + labelSize));
+    arena.rewind(mark);
 }
 
 /**
-    Returns true if an Account with the given tag exists and false otherwise.
+    Returns a view of the record of the account in the given row, decrypting the record in place
+    within the vault file mapping the first time it is accessed. Returns CLAM_ERROR_CORRUPT if the
+    record is malformed or is not the record of the row's tag, and on every later access as well:
+    authenticated suites write the plaintext before they check the record's tag, so the bytes left
+    in place by a record that failed are never trusted (or re-encrypted by writeSnapshotFile).
 */
-bool Vault::exists(const std::string &tag) const {
-    for (size_t i = 0; i < accounts.size(); ++i) {
-        if (accounts[i].getTag() == tag) {
-            return true;
+Result<AccountView> Vault::recordView(size_t row) {
+    ScopedTimer timer(STATS_PARSE);
+    unsigned char *record = vaultFileData + recordSectionOffset + accounts.recordOffset(row);
+    const unsigned char *iv = record;
+    unsigned char *plaintext = record + SKEY_LENGTH;
+
+    const bool firstAccess = !accounts.isDecrypted(row);
+    if (firstAccess) {
+        // Marked first, so that whatever is written in place is wiped when the vault is closed:
+        accounts.setDecrypted(row);
+        if (!crypto->decrypt(plaintext, plaintext, accounts.recordSize(row), iv)) {
+            return CLAM_ERROR_CORRUPT;
         }
+    } else if (!accounts.isVerified(row)) {
+        return CLAM_ERROR_CORRUPT;
+    }
+
+    // The record may have been decrypted with a cipher suite that the vault no longer uses:
+    const unsigned char *plaintextIter = plaintext;
+    const size_t plaintextSize = accounts.recordSize(row) - recordOverhead;
+    AccountView view;
+    if (!AccountView::parse(&plaintextIter, plaintext + plaintextSize, view)) {
+        return CLAM_ERROR_CORRUPT;
+    }
+    // Lookups go by the tags of the index, so a record holding another account's tag is rejected:
+    if (view.tag != accounts.tag(row)) {
+        return CLAM_ERROR_CORRUPT;
     }
 
-    return false;
+    if (firstAccess) {
+        accounts.setVerified(row);
+    }
+    return view;
 }
 
 /**
-    Prints an error to the console indicating that a specified account does not exist.
+    Returns a view of the account in the given row, which is either held by the account table
+    or its (decrypted) record.
 */
-void Vault::notExistsError() const {
-    std::cout << "Error: The specified account does not exist. You may create an account using the -a option." << std::endl;
+Result<AccountView> Vault::rowView(size_t row) {
+    if (accounts.hasAccount(row)) {
+        return accounts.account(row);
+    }
+    return recordView(row);
+}
+
+/**
+    Returns the row of the (not removed) account with the given tag, if there is one.
+    Removed rows remain in the tag index, so probing continues past them until an empty bucket.
+*/
+std::optional<size_t> Vault::findRow(std::string_view tag) const {
+    ScopedTimer timer(STATS_LOOKUP);
+    if (tagIndex.empty()) {
+        return std::nullopt;
+    }
+
+    const size_t mask = tagIndex.size() - 1;
+    for (size_t bucket = tagHash(tag) & mask; tagIndex[bucket] != 0; bucket = (bucket + 1) & mask) {
+        size_t row = tagIndex[bucket] - 1;
+        if (!accounts.isRemoved(row) && accounts.tag(row) == tag) {
+            return row;
+        }
+    }
+
+    return std::nullopt;
+}
+
+/**
+    Adds the given (newly appended) row of the account table to the tag index, doubling (and
+    rebuilding) the index first if it would become more than half full.
+*/
+void Vault::addToTagIndex(size_t row) {
+    tagSearch.reset();
+
+    if (accounts.size() * 2 > tagIndex.size()) {
+        size_t capacity = std::max((size_t)TAG_INDEX_MIN_CAPACITY, tagIndex.size() * 2);
+        std::memset(tagIndex.data(), 0, tagIndex.size() * sizeof(uint32_t));
+        tagIndex.assign(capacity, 0);
+        for (size_t i = 0; i < accounts.size(); ++i) {
+            indexRow(i);
+        }
+    } else {
+        indexRow(row);
+    }
+}
+
+/**
+    Inserts the given row into the first empty bucket of its tag's probe sequence.
+*/
+void Vault::indexRow(size_t row) {
+    const size_t mask = tagIndex.size() - 1;
+    size_t bucket = tagHash(accounts.tag(row)) & mask;
+    while (tagIndex[bucket] != 0) {
+        bucket = (bucket + 1) & mask;
+    }
+    tagIndex[bucket] = (uint32_t)(row + 1);
 }
 
 /**
-    Prints an error to the console indicating that a specified account already exists.
+    Returns the keyed hash of the given tag, so that the layout of the tag index reveals nothing
+    about the tags to anyone who does not know the vault key.
 */
-void Vault::existsError() const {
-    std::cout << "Error: There already exists an account with the specified name." << std::endl;
+uint64_t Vault::tagHash(std::string_view tag) const {
+    return Utils::keyedHash64(tagIndexKey, SKEY_LENGTH, (const unsigned char *)tag.data(), (unsigned long)tag.size());
 }
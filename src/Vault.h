@@ -2,37 +2,135 @@
 #define VAULT_H
 
 #include "Account.h"
+#include "AccountTable.h"
+#include "CryptoContext.h"
+#include "Status.h"
+#include "SecureArena.h"
+#include "TagSearch.h"
+#include "FileLock.h"
 
 #include <string>
 #include <vector>
 #include <iostream>
 #include <optional>
+#include <memory>
+#include <functional>
 
-#define SKEY_LENGTH 32 // symmetric key length in bytes (256 bits)
+#define VAULT_MAGIC "CLAM" // identifies a versioned (non-legacy) vault file
+#define VAULT_MAGIC_LENGTH 4
+#define VAULT_FORMAT_VERSION 4 // version 1 is the legacy single-blob format, which has no header
+#define VAULT_HEADER_SIZE (VAULT_MAGIC_LENGTH + 4 + 4 + 8 + SKEY_LENGTH + 4) // magic, version, cipher suite, generation, index iv, index size
+#define VAULT_V3_HEADER_SIZE (VAULT_MAGIC_LENGTH + 4 + 4 + SKEY_LENGTH + 4) // version 3 has no generation
+#define VAULT_V2_HEADER_SIZE (VAULT_MAGIC_LENGTH + 4 + SKEY_LENGTH + 4) // version 2 has no cipher suite (it is always Twofish)
+
+#define JOURNAL_DIR ".journal/" // the journal of vault 'name' is stored as '.journal/name' in the vault file's directory
+#define COMPACTION_FILE_TEMPLATE ".compact.XXXXXX" // compacted vault files are written to a temporary file first
+#define JOURNAL_MAC_LABEL "clam-journal-mac"
+#define JOURNAL_COMPACTION_ENTRIES 1024 // fold the journal into the vault file once it has this many entries...
+#define JOURNAL_COMPACTION_SIZE (1 << 20) // ...or once it is this large (in bytes)
+#define VAULT_LOAD_ATTEMPTS 16 // times a vault is loaded again when its file is replaced while it is loaded
+
+#define TAG_INDEX_KEY_LABEL "clam-tag-index"
+#define TAG_INDEX_MIN_CAPACITY 16 // must be a power of two
 
 class Vault {
 public:
-    Vault(const std::string &vaultDir, const std::string &vaultName, const std::string &vaultKey);
+    static Result<std::unique_ptr<Vault>> open(const std::string &vaultDir, const std::string &vaultName, std::unique_ptr<CryptoContext> crypto,
+        const std::string &lockFilePath);
     ~Vault();
+    Vault(const Vault &) = delete;
+    Vault &operator=(const Vault &) = delete;
     void printTags(std::ostream &outputStream) const;
-    void printInfo(std::ostream &outputStream) const;
-    std::optional<Account *> getAccount(const std::string &tag);
-    void addAccount(Account account);
-    void removeAccount(const std::string& tag);
-    void writeVault() const;
-    void updateKey(const std::string &newKey);
+    ClamStatus printInfo(std::ostream &outputStream);
+    ClamStatus forEachAccount(const std::function<void(const AccountView &)> &visitor);
+    Result<AccountView> getAccountView(const std::string &tag);
+    bool containsAccount(const std::string &tag) const;
+    std::vector<TagMatch> searchTags(const std::string &pattern, size_t limit);
+    ClamStatus addAccount(const AccountView &account);
+    ClamStatus updateAccount(const AccountView &account);
+    ClamStatus removeAccount(const std::string& tag);
+    ClamStatus writeVault();
+    ClamStatus compact();
+    ClamStatus updateCipherSuite(CipherSuite suite);
+    ClamStatus rekey(std::unique_ptr<CryptoContext> newCrypto);
+    Result<std::string> writeSnapshotFile();
+    CipherSuite getCipherSuite() const;
     std::string getVaultName() const;
-    std::string getVaultKey() const;
 private:
-    bool exists(const std::string &tag) const;
-    void notExistsError() const;
-    void existsError() const;
+    // Types of the deltas stored in the journal:
+    enum JournalEntryType : uint8_t {
+        JOURNAL_PUT = 1, // add or replace an account
+        JOURNAL_DELETE = 2, // delete an account
+    };
+
+    // A change to the account in one row since the vault was last written (see recordChange):
+    struct AccountChange {
+        size_t row;
+        std::optional<AccountView> base; // the account before the change (held by the arena), unless it was added
+    };
+
+    Vault(const std::string &vaultDir, const std::string &vaultName, std::unique_ptr<CryptoContext> crypto, const std::string &lockFilePath);
+    ClamStatus load();
+    ClamStatus reload();
+    bool isLoadedVersion(bool includingJournal) const;
+    ClamStatus recordChange(size_t row, bool added);
+    void clearChanges();
+    ClamStatus merge();
+    ClamStatus mergeChange(const std::optional<AccountView> &base, const std::optional<AccountView> &account);
+    AccountView copyToArena(const AccountView &account);
+    ClamStatus writeSnapshot();
+    ClamStatus decryptAll();
+    ClamStatus mapVaultFile();
+    void unmapVaultFile();
+    bool hasVersionHeader() const;
+    ClamStatus loadLegacyVault();
+    ClamStatus loadRecordIndex();
+    ClamStatus replayJournal();
+    bool applyJournalDelta(const unsigned char *delta, size_t deltaSize);
+    ClamStatus appendJournal();
+    void deriveSubkey(const char *label, unsigned char *subkey);
+    Result<AccountView> recordView(size_t row);
+    Result<AccountView> rowView(size_t row);
+    std::optional<size_t> findRow(std::string_view tag) const;
+    void addToTagIndex(size_t row);
+    void indexRow(size_t row);
+    uint64_t tagHash(std::string_view tag) const;
     std::string vaultName;
-    std::string vaultKey;
+    std::unique_ptr<CryptoContext> crypto;
+    SecureArena arena; // holds the derived keys, then the copies kept by recordChange, then plaintext scratch buffers
+
+    // Do not store Accounts as a map keyed by (plaintext) tag for security reasons...
+    AccountTable accounts; // accounts, in listing order, either still encrypted in the vault file or decrypted
+    std::vector<uint32_t> tagIndex; // open-addressing table of (row + 1), 0 marking an empty bucket,
+                                    // which is probed by the keyed hash of the row's tag
+    unsigned char *tagIndexKey; // allocated from the arena, like the journal key
+    unsigned char *journalKey;
+    std::optional<TagSearch> tagSearch; // sorted tag index, built by the first search and discarded when the tags change
+    unsigned char *vaultFileData; // private copy-on-write mapping of the vault file (decrypted in place, and
+                                  // backing the views of the tag index and of records that have not been superseded)
+    size_t vaultFileSize;
+    size_t indexOffset;
+    size_t recordSectionOffset;
+    size_t recordOverhead; // overhead of the cipher suite with which the records in the vault file are encrypted
+    bool snapshotRequired; // whether the next write must rewrite the vault file rather than append to the journal
+    size_t journalEntries;
+    size_t journalSize;
+
+    // The changes that writeVault has yet to write, in the order in which their rows were first changed:
+    std::vector<AccountChange> changes;
+    SecureArena::Mark changesMark; // the end of the keys in the arena, where the copies kept by recordChange begin
+    bool cipherSuiteChanged; // whether updateCipherSuite has been called since the vault was last written
+
+    // The version of the vault on disk that this vault was loaded from (or last wrote), which other
+    // processes replace by renaming a new vault file into place, or change by appending to the journal:
+    uint64_t vaultFileInode; // 0 if there is no vault file
+    uint64_t generation; // of the vault file, which each new vault file increments (0 if it has none)
+    uint64_t journalInode; // 0 if there is no journal
 
-    // Do not store Accounts as a map for security reasons...
-    std::vector<Account> accounts; // decrypted accounts
+    const std::string vaultDir;
     const std::string vaultFilePath;
+    const std::string journalFilePath;
+    const std::string lockFilePath; // of the lock that writers hold (see FileLock)
 };
 
 #endif
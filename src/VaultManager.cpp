@@ -1,289 +1,1342 @@
 #include <algorithm>
 #include <fstream>
 #include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstddef>
+#include <iterator>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <thread>
 
 #include "VaultManager.h"
 #include "Utils.h"
+#include "Stats.h"
 
-VaultManager::VaultManager(const std::string &metadataFilePath, const std::string &vaultDir)
-: metadataFilePath(metadataFilePath), vaultDir(vaultDir) {
-    readVaultMetaData();
+// The first block of a (version 4) meta file:
+struct VaultManager::MetaHeader {
+    char magic[META_MAGIC_LENGTH];
+    uint32_t version;
+    uint32_t capacity; // number of slots (a power of two); the name index has twice as many buckets
+    uint32_t numVaults; // slots 0 to numVaults - 1 hold vaults, and the rest are zeroed
+    uint32_t activeSlot;
+    unsigned char indexKey[META_INDEX_KEY_LENGTH]; // key of the hash by which the name index is probed
+    uint32_t generation; // odd while a writer changes the file in place (see replayMetaLog)
+};
+
+// The metadata of one vault, as stored in its slot (see VaultInfo):
+struct VaultManager::MetaSlot {
+    uint32_t nameSize;
+    char name[VAULT_NAME_MAX_LENGTH + 1];
+    unsigned char skeyHash[SKEY_LENGTH];
+    unsigned char skeySalt[SKEY_LENGTH];
+    uint32_t kdfAlgorithm;
+    uint32_t kdfTimeCost;
+    uint32_t kdfMemoryCost;
+    uint32_t kdfLanes;
+    uint32_t hasDataKey;
+    unsigned char dataKeyIv[SKEY_LENGTH];
+    unsigned char wrappedDataKey[WRAPPED_KEY_LENGTH];
+};
+
+/**
+    Returns the size of a meta file with the given number of slots: the header block, the name index
+    (whose 2 * capacity uint32 buckets fill whole blocks, since the capacity is at least META_MIN_CAPACITY),
+    and the slots.
+*/
+static size_t metaFileSizeFor(uint32_t capacity) {
+    return META_BLOCK_SIZE + (size_t)capacity * 2 * sizeof(uint32_t) + (size_t)capacity * META_SLOT_SIZE;
+}
+
+/**
+    Returns whether the two snapshots of a vault's metadata are of the same vault with the same key, so
+    that a vault key verified with one of them is still correct.
+*/
+static bool isSameVaultKey(const VaultInfo &vaultInfo, const VaultInfo &otherVaultInfo) {
+    return vaultInfo.vaultName == otherVaultInfo.vaultName && vaultInfo.hasDataKey == otherVaultInfo.hasDataKey
+        && std::memcmp(vaultInfo.vaultSkeyHash, otherVaultInfo.vaultSkeyHash, SKEY_LENGTH) == 0
+        && std::memcmp(vaultInfo.vaultSkeySalt, otherVaultInfo.vaultSkeySalt, SKEY_LENGTH) == 0
+        && std::memcmp(&vaultInfo.kdfParams, &otherVaultInfo.kdfParams, sizeof(KdfParams)) == 0
+        && (!vaultInfo.hasDataKey || (std::memcmp(vaultInfo.dataKeyIv, otherVaultInfo.dataKeyIv, SKEY_LENGTH) == 0
+            && std::memcmp(vaultInfo.wrappedDataKey, otherVaultInfo.wrappedDataKey, WRAPPED_KEY_LENGTH) == 0));
+}
+
+VaultManager::VaultManager(const std::string &metadataFilePath, const std::string &vaultDir, uint32_t unlockMillis)
+: metaFileData(nullptr), metaFileSize(0), metaFileInode(0), metaFileWritable(false), metadataFilePath(metadataFilePath),
+    lockFilePath(metadataFilePath + META_LOCK_FILE_SUFFIX), logFilePath(metadataFilePath + META_LOG_FILE_SUFFIX), vaultDir(vaultDir),
+    unlockMillis(unlockMillis) {
+}
+
+VaultManager::VaultManager(VaultManager &&other)
+: metaFileData(other.metaFileData), metaFileSize(other.metaFileSize), metaFileInode(other.metaFileInode), metaFileWritable(other.metaFileWritable),
+    touchedMetaBlocks(std::move(other.touchedMetaBlocks)), metadataFilePath(other.metadataFilePath), lockFilePath(other.lockFilePath),
+    logFilePath(other.logFilePath), vaultDir(other.vaultDir), unlockMillis(other.unlockMillis) {
+    other.metaFileData = nullptr;
+    other.metaFileSize = 0;
+}
+
+VaultManager::~VaultManager() {
+    unmapMetaFile();
+}
+
+/**
+    Calls 'read' (which reads the mapped meta file) until it runs without another process changing the
+    file in the meantime, and returns its result, so that readers, which do not take the write lock, always
+    see a consistent snapshot of the file, however its slots and index are changed in place (a seqlock).
+    A reader that finds a change in progress waits for it, unless its writer died before finishing it
+    (in which case the next writer finishes it, see recoverMetaFile). A meta file that a writer replaces (see writeVaultMetaData) is no longer changed, so readers that
+    have mapped it see the snapshot from before the replacement.
+*/
+template <typename Reader>
+auto VaultManager::readMetaSnapshot(Reader read) const -> decltype(read()) {
+    const uint32_t *generation = &header().generation;
+    while (true) {
+        uint32_t startGeneration = __atomic_load_n(generation, __ATOMIC_ACQUIRE);
+        if (startGeneration % 2 == 1 && FileLock::isHeld(lockFilePath)) {
+            std::this_thread::yield();
+            continue;
+        }
+        auto result = read();
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(generation, __ATOMIC_RELAXED) == startGeneration) {
+            return result;
+        }
+    }
+}
+
+/**
+    Starts a change to the meta file, which is made to the writer's private mapping of it (see lockMetaFile)
+    and written to the file by endMetaWrite. The write lock must be held.
+*/
+void VaultManager::beginMetaWrite() {
+    touchedMetaBlocks.clear();
+}
+
+/**
+    Records that the given bytes of the mapped meta file were changed, so that endMetaWrite writes the
+    blocks that hold them to the file.
+*/
+void VaultManager::touchMeta(const void *data, size_t size) {
+    size_t offset = (size_t)((const unsigned char *)data - metaFileData);
+    for (size_t block = offset / META_BLOCK_SIZE; block <= (offset + size - 1) / META_BLOCK_SIZE; ++block) {
+        touchedMetaBlocks.push_back((uint32_t)block);
+    }
+}
+
+/**
+    Appends the given uint32 size followed by the given bytes to a meta log (see endMetaWrite).
+*/
+static void appendToLog(std::vector<uint8_t> &log, const void *data, uint32_t size) {
+    log.insert(log.end(), (const uint8_t *)&size, (const uint8_t *)&size + sizeof(size));
+    log.insert(log.end(), (const uint8_t *)data, (const uint8_t *)data + size);
+}
+
+/**
+    Reads a uint32 size and that many bytes, appended by appendToLog, from a meta log, and advances logIter
+    past them. Returns false if the log ends first.
+*/
+static bool readFromLog(const uint8_t **logIter, const uint8_t *logEnd, const uint8_t **data, uint32_t *size) {
+    if ((size_t)(logEnd - *logIter) < sizeof(*size)) {
+        return false;
+    }
+    std::memcpy(size, *logIter, sizeof(*size));
+    *logIter += sizeof(*size);
+    if ((size_t)(logEnd - *logIter) < *size) {
+        return false;
+    }
+    *data = *logIter;
+    *logIter += *size;
+    return true;
+}
+
+/**
+    Writes the blocks changed since beginMetaWrite to the meta file, and makes the given moves of other
+    files (e.g. of a new vault file into place), so that a crash at any point leaves either everything as
+    it was or the change as a whole: the change is written to the meta log (at logFilePath) and synced
+    first, and only then made (see replayMetaLog). The synced log is the point at which the change is made:
+    a writer that dies before leaves an incomplete log, which is discarded, and one that dies after leaves
+    a complete log, which the next writer replays (see recoverMetaFile). The header block is always
+    written, since its generation changes. The log is emptied once it is replayed, and has the following
+    format:
+
+    uint64: inode of the meta file that the log changes
+    uint32: n = number of blocks
+    <repeated n times>:
+        uint64: offset of the block in the meta file
+        uint32: s = size of the block (in bytes)
+        s bytes: contents of the block
+    <repeated once per file move, until the checksum>:
+        uint32: p = size of the path of the file to move (in bytes)
+        p bytes: path
+        uint32: q = size of the path to move the file to, or 0 to remove the file
+        q bytes: path
+    32 bytes: sha256 of the above
+
+    The meta file is mapped read-only again afterwards. Returns an error if the change could not be
+    written, in which case it is either not made (and the files to be moved into place are removed), or
+    (if it was logged) made by the next writer.
+*/
+ClamStatus VaultManager::endMetaWrite(const std::vector<FileMove> &fileMoves) {
+    touchedMetaBlocks.push_back(0);
+    std::sort(touchedMetaBlocks.begin(), touchedMetaBlocks.end());
+    touchedMetaBlocks.erase(std::unique(touchedMetaBlocks.begin(), touchedMetaBlocks.end()), touchedMetaBlocks.end());
+    std::vector<uint8_t> log((uint8_t *)&metaFileInode, (uint8_t *)&metaFileInode + sizeof(metaFileInode));
+    uint32_t numBlocks = (uint32_t)touchedMetaBlocks.size();
+    log.insert(log.end(), (uint8_t *)&numBlocks, (uint8_t *)&numBlocks + sizeof(numBlocks));
+    for (uint32_t block : touchedMetaBlocks) {
+        uint64_t offset = (uint64_t)block * META_BLOCK_SIZE;
+        log.insert(log.end(), (uint8_t *)&offset, (uint8_t *)&offset + sizeof(offset));
+        appendToLog(log, metaFileData + offset, META_BLOCK_SIZE);
+    }
+    touchedMetaBlocks.clear();
+    for (const FileMove &fileMove : fileMoves) {
+        appendToLog(log, fileMove.path.data(), (uint32_t)fileMove.path.size());
+        appendToLog(log, fileMove.newPath.data(), (uint32_t)fileMove.newPath.size());
+    }
+    unsigned char checksum[SKEY_LENGTH];
+    Utils::sha256(checksum, log.data(), (unsigned long)log.size());
+    log.insert(log.end(), checksum, checksum + SKEY_LENGTH);
+
+    // The log is kept (empty) between changes, so its directory entry is only synced when it is created:
+    bool created = access(logFilePath.c_str(), F_OK) != 0;
+    int fd = ::open(logFilePath.c_str(), O_WRONLY | O_CREAT, 0600);
+    bool logged = fd >= 0 && ftruncate(fd, 0) == 0 && Utils::writeAt(fd, log.data(), log.size(), 0);
+    if (logged) {
+        ScopedTimer syncTimer(STATS_FSYNC);
+        logged = fdatasync(fd) == 0 && (!created || Utils::syncParentDirectory(logFilePath));
+    }
+    ClamStatus status = logged ? replayMetaLog(log) : CLAM_ERROR_META_WRITE;
+    if (fd >= 0 && (!logged || status == CLAM_OK)) {
+        ftruncate(fd, 0);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (!logged) {
+        for (const FileMove &fileMove : fileMoves) {
+            if (!fileMove.newPath.empty()) {
+                std::remove(fileMove.path.c_str());
+            }
+        }
+    }
+
+    unmapMetaFile();
+    ClamStatus mapStatus = mapMetaFile();
+    return status != CLAM_OK ? status : mapStatus;
+}
+
+/**
+    Writes the blocks of the given meta log (see endMetaWrite) to the meta file and makes its file moves,
+    and syncs them. Readers do not use the meta file until then, since the header's generation is odd in
+    the meantime (see readMetaSnapshot). Replaying a log again has no further effect (a file that was
+    already moved is no longer there), so a replay that was interrupted is simply replayed again. Returns
+    CLAM_ERROR_META_CORRUPT, without changing anything, if the log is incomplete or belongs to a meta file
+    that has since been replaced, and an error if the change could not be made. The write lock must be held.
+*/
+ClamStatus VaultManager::replayMetaLog(const std::vector<uint8_t> &log) const {
+    unsigned char checksum[SKEY_LENGTH];
+    uint64_t inode;
+    uint32_t numBlocks;
+    if (log.size() < sizeof(inode) + sizeof(numBlocks) + SKEY_LENGTH) {
+        return CLAM_ERROR_META_CORRUPT;
+    }
+    const uint8_t *logEnd = log.data() + log.size() - SKEY_LENGTH;
+    Utils::sha256(checksum, log.data(), (unsigned long)(logEnd - log.data()));
+    if (!Utils::contentsEqual(checksum, logEnd, SKEY_LENGTH)) {
+        return CLAM_ERROR_META_CORRUPT;
+    }
+
+    int fd = ::open(metadataFilePath.c_str(), O_RDWR);
+    struct stat fileInfo;
+    if (fd < 0 || fstat(fd, &fileInfo) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return fd < 0 && errno == ENOENT ? CLAM_ERROR_META_CORRUPT : CLAM_ERROR_META_WRITE;
+    }
+    std::memcpy(&inode, log.data(), sizeof(inode));
+    std::memcpy(&numBlocks, log.data() + sizeof(inode), sizeof(numBlocks));
+
+    // Every block must lie within the meta file, which is checked before anything is changed:
+    struct Block {
+        uint64_t offset;
+        uint32_t size;
+        const uint8_t *data;
+    };
+    std::vector<Block> blocks;
+    std::vector<FileMove> fileMoves;
+    bool valid = inode == (uint64_t)fileInfo.st_ino;
+    const uint8_t *logIter = log.data() + sizeof(inode) + sizeof(numBlocks);
+    for (uint32_t i = 0; i < numBlocks && valid; ++i) {
+        Block block;
+        valid = (size_t)(logEnd - logIter) >= sizeof(block.offset);
+        if (valid) {
+            std::memcpy(&block.offset, logIter, sizeof(block.offset));
+            logIter += sizeof(block.offset);
+            valid = readFromLog(&logIter, logEnd, &block.data, &block.size) && block.offset <= (uint64_t)fileInfo.st_size
+                && block.size <= (uint64_t)fileInfo.st_size - block.offset;
+        }
+        blocks.push_back(block);
+    }
+    while (valid && logIter != logEnd) {
+        const uint8_t *path;
+        const uint8_t *newPath;
+        uint32_t pathSize;
+        uint32_t newPathSize;
+        valid = readFromLog(&logIter, logEnd, &path, &pathSize) && readFromLog(&logIter, logEnd, &newPath, &newPathSize) && pathSize > 0;
+        if (valid) {
+            fileMoves.push_back(FileMove { std::string((const char *)path, pathSize), std::string((const char *)newPath, newPathSize) });
+        }
+    }
+    if (!valid) {
+        close(fd);
+        return CLAM_ERROR_META_CORRUPT;
+    }
+
+    // The generation is odd until everything is changed, including while the header block that holds it is written:
+    const off_t generationOffset = offsetof(MetaHeader, generation);
+    uint32_t generation = 0;
+    bool written = pread(fd, &generation, sizeof(generation), generationOffset) == (ssize_t)sizeof(generation);
+    generation = (generation + 1) | 1;
+    written = written && Utils::writeAt(fd, &generation, sizeof(generation), generationOffset);
+    std::vector<uint8_t> blockData;
+    for (size_t i = 0; i < blocks.size() && written; ++i) {
+        blockData.assign(blocks[i].data, blocks[i].data + blocks[i].size);
+        if (blocks[i].offset <= (uint64_t)generationOffset && generationOffset + sizeof(generation) <= blocks[i].offset + blocks[i].size) {
+            std::memcpy(blockData.data() + (generationOffset - blocks[i].offset), &generation, sizeof(generation));
+        }
+        written = Utils::writeAt(fd, blockData.data(), blockData.size(), (off_t)blocks[i].offset);
+    }
+    for (size_t i = 0; i < fileMoves.size() && written; ++i) {
+        const FileMove &fileMove = fileMoves[i];
+        if (fileMove.newPath.empty()) {
+            written = std::remove(fileMove.path.c_str()) == 0 || errno == ENOENT;
+        } else {
+            written = std::rename(fileMove.path.c_str(), fileMove.newPath.c_str()) == 0 || errno == ENOENT;
+            if (written) {
+                ScopedTimer syncTimer(STATS_FSYNC);
+                written = Utils::syncParentDirectory(fileMove.newPath);
+            }
+        }
+    }
+    ++generation;
+    written = written && Utils::writeAt(fd, &generation, sizeof(generation), generationOffset);
+    if (written) {
+        ScopedTimer syncTimer(STATS_FSYNC);
+        written = fdatasync(fd) == 0;
+    }
+    close(fd);
+    return written ? CLAM_OK : CLAM_ERROR_META_WRITE;
+}
+
+/**
+    Finishes the change of a writer that died once its meta log was complete (see endMetaWrite), and
+    discards the log of one that died before. Returns CLAM_ERROR_META_CORRUPT if the meta file was left
+    half-changed without a log to finish the change with. The write lock must be held.
+*/
+ClamStatus VaultManager::recoverMetaFile() {
+    std::ifstream logStream(logFilePath, std::ios::binary);
+    if (logStream.is_open()) {
+        std::vector<uint8_t> log((std::istreambuf_iterator<char>(logStream)), std::istreambuf_iterator<char>());
+        logStream.close();
+        if (!log.empty()) {
+            ClamStatus status = replayMetaLog(log);
+            if (status != CLAM_OK && status != CLAM_ERROR_META_CORRUPT) {
+                return status;
+            }
+            truncate(logFilePath.c_str(), 0);
+        }
+    }
+
+    int fd = ::open(metadataFilePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return CLAM_OK;
+    }
+    MetaHeader fileHeader;
+    bool halfChanged = pread(fd, &fileHeader, sizeof(fileHeader), 0) == (ssize_t)sizeof(fileHeader)
+        && std::memcmp(fileHeader.magic, META_MAGIC, META_MAGIC_LENGTH) == 0 && fileHeader.version == META_FORMAT_VERSION
+        && fileHeader.generation % 2 == 1;
+    close(fd);
+    return halfChanged ? CLAM_ERROR_META_CORRUPT : CLAM_OK;
+}
+
+/**
+    Takes the write lock, waiting up to WRITE_LOCK_TIMEOUT_MS for other writers to finish, and finishes
+    the change of any writer that died (see recoverMetaFile). Since another process may have created,
+    or replaced the meta file since it was mapped (e.g. by growing it), the current meta file is then
+    mapped (again) writable, for the changes that endMetaWrite writes to it.
+*/
+Result<FileLock> VaultManager::lockMetaFile() {
+    Result<FileLock> lock = FileLock::acquire(lockFilePath, WRITE_LOCK_TIMEOUT_MS);
+    if (!lock) {
+        return lock;
+    }
+    ClamStatus status = recoverMetaFile();
+    if (status != CLAM_OK) {
+        return status;
+    }
+
+    struct stat fileInfo;
+    bool exists = stat(metadataFilePath.c_str(), &fileInfo) == 0;
+    if (exists ? metaFileData == nullptr || !metaFileWritable || (uint64_t)fileInfo.st_ino != metaFileInode : metaFileData != nullptr) {
+        unmapMetaFile();
+        status = exists ? mapMetaFile(true) : CLAM_OK;
+        if (status != CLAM_OK) {
+            return status;
+        }
+    }
+    return lock;
+}
+
+/**
+    Maps the meta file at metadataFilePath, which holds the metadata of the vaults stored in vaultDir
+    (there are no vaults if it does not exist), or returns an error if it cannot be read. A meta file in
+    an older format is migrated first. New vault keys are derived with KDF parameters calibrated to take
+    unlockMillis milliseconds on this machine.
+*/
+Result<VaultManager> VaultManager::open(const std::string &metadataFilePath, const std::string &vaultDir, uint32_t unlockMillis) {
+    VaultManager vaultManager(metadataFilePath, vaultDir, unlockMillis);
+    ClamStatus status = vaultManager.readVaultMetaData();
+    if (status != CLAM_OK) {
+        return status;
+    }
+    return vaultManager;
 }
 
 const std::string& VaultManager::getVaultDir() const {
     return vaultDir;
 }
 
+/**
+    Returns the directory in which the file (and journal) of the given vault are stored: the
+    subdirectory of vaultDir named by the first VAULT_DIR_FAN_OUT_DIGITS hex digits of sha256(vaultName).
+*/
+std::string VaultManager::getVaultFileDir(const std::string &vaultName) const {
+    static const char hexDigits[] = "0123456789abcdef";
+    unsigned char nameHash[SKEY_LENGTH];
+    Utils::sha256(nameHash, (const unsigned char *)vaultName.data(), (unsigned long)vaultName.size());
+    std::string fileDir = vaultDir;
+    for (int i = 0; i < VAULT_DIR_FAN_OUT_DIGITS; ++i) {
+        fileDir += hexDigits[(nameHash[i / 2] >> (i % 2 == 0 ? 4 : 0)) & 0xF];
+    }
+    return fileDir + "/";
+}
+
 bool VaultManager::empty() const {
-    return vaultMetaData.empty();
+    return size() == 0;
 }
 
 size_t VaultManager::size() const {
-    return vaultMetaData.size();
+    return metaFileData == nullptr ? 0 : __atomic_load_n(&header().numVaults, __ATOMIC_RELAXED);
+}
+
+/**
+    Returns the metadata of the active vault, of which there must be at least one.
+*/
+VaultInfo VaultManager::activeVaultInfo() const {
+    Result<VaultInfo> vaultInfo = readActiveSlot();
+    return vaultInfo ? *vaultInfo : VaultInfo();
+}
+
+/**
+    Returns the names of all vaults, starting with the active vault.
+*/
+std::vector<std::string> VaultManager::getVaultNames() const {
+    if (empty()) {
+        return std::vector<std::string>();
+    }
+    return readMetaSnapshot([&]() {
+        std::vector<std::string> vaultNames;
+        const uint32_t numVaults = std::min(header().numVaults, header().capacity);
+        const uint32_t activeSlot = header().activeSlot;
+        if (activeSlot < numVaults) {
+            vaultNames.emplace_back(slotName(activeSlot));
+        }
+        for (uint32_t slotNumber = 0; slotNumber < numVaults; ++slotNumber) {
+            if (slotNumber != activeSlot) {
+                vaultNames.emplace_back(slotName(slotNumber));
+            }
+        }
+        return vaultNames;
+    });
+}
+
+/**
+    Returns a snapshot of the metadata of the active vault (see readMetaSnapshot), or CLAM_ERROR_NO_VAULTS
+    if there are no vaults.
+*/
+Result<VaultInfo> VaultManager::readActiveSlot() const {
+    if (empty()) {
+        return CLAM_ERROR_NO_VAULTS;
+    }
+    return readMetaSnapshot([&]() -> Result<VaultInfo> {
+        const uint32_t activeSlot = header().activeSlot;
+        if (activeSlot >= header().numVaults || activeSlot >= header().capacity) {
+            return CLAM_ERROR_META_CORRUPT;
+        }
+        return readSlot(activeSlot);
+    });
 }
 
-VaultInfo& VaultManager::activeVaultInfo() {
-    return vaultMetaData[0];
+/**
+    Returns a snapshot of the metadata of the vault with the given name (see readMetaSnapshot), or
+    CLAM_ERROR_NO_VAULTS or CLAM_ERROR_VAULT_NOT_FOUND if there is no such vault. If activeOut is given,
+    whether the vault is the active vault is stored in it.
+*/
+Result<VaultInfo> VaultManager::readSlotOf(const std::string &vaultName, bool *activeOut) const {
+    if (empty()) {
+        return CLAM_ERROR_NO_VAULTS;
+    }
+    return readMetaSnapshot([&]() -> Result<VaultInfo> {
+        std::optional<uint32_t> slotNumber = findSlot(vaultName);
+        if (!slotNumber) {
+            return CLAM_ERROR_VAULT_NOT_FOUND;
+        }
+        if (activeOut != nullptr) {
+            *activeOut = *slotNumber == header().activeSlot;
+        }
+        return readSlot(*slotNumber);
+    });
 }
 
-void VaultManager::addVault(const std::string &vaultName, const std::string &vaultKey) {
+/**
+    Creates a new vault, encrypted with a random data key. The data key is wrapped by a key derived from
+    the given vault key with the given algorithm, using parameters calibrated to take unlockMillis
+    milliseconds on this machine. The first vault becomes the active vault. The keys are derived before
+    the write lock is taken, so that other writers do not wait for the KDF.
+*/
+ClamStatus VaultManager::addVault(const std::string &vaultName, const std::string &vaultKey, KdfAlgorithm kdfAlgorithm) {
     VaultInfo newVaultInfo;
     newVaultInfo.vaultName = vaultName;
 
-    // Error if the vault already exists:
-    for (size_t i = 1; i < vaultMetaData.size(); i++) {
-        if (vaultMetaData[i].vaultName == newVaultInfo.vaultName) {
-            std::cout << "Error: A vault with the given name already exists." << std::endl;
-            return;
-        }
+    // Error if the vault name does not fit in a slot, or is reserved for the vaults directory's own files (e.g. journals):
+    if (vaultName.empty() || vaultName.size() > VAULT_NAME_MAX_LENGTH || vaultName[0] == '.') {
+        return CLAM_ERROR_INVALID_VAULT_NAME;
+    }
+
+    // Error if the vault already exists (which is checked again once the lock is held):
+    if (!empty() && readMetaSnapshot([&]() { return findSlot(vaultName).has_value(); })) {
+        return CLAM_ERROR_VAULT_EXISTS;
+    }
+
+    // Derive the key that wraps the data key from the vault key:
+    Result<std::unique_ptr<CryptoContext>> keyEncryptionKey = createKeyEncryptionKey(newVaultInfo, vaultKey, kdfAlgorithm);
+    if (!keyEncryptionKey) {
+        return keyEncryptionKey.error();
+    }
+
+    // Generate the data key, and wrap it:
+    Result<std::unique_ptr<CryptoContext>> dataKey = CryptoContext::generate();
+    if (!dataKey) {
+        return dataKey.error();
+    }
+    if (!(*keyEncryptionKey)->wrapKey(**dataKey, newVaultInfo.dataKeyIv, newVaultInfo.wrappedDataKey)) {
+        return CLAM_ERROR_CRYPTO;
     }
-    
-    // Generate pw hash and salt for the new vault
+    newVaultInfo.hasDataKey = true;
 
-    // Compute random salt:
-    Utils::genRand(newVaultInfo.vaultSkeySalt, SKEY_LENGTH);
+    Result<FileLock> lock = lockMetaFile();
+    if (!lock) {
+        return lock.error();
+    }
+    if (findSlot(vaultName)) {
+        return CLAM_ERROR_VAULT_EXISTS;
+    }
 
-    // Generate pw hash
-    unsigned char newVaultSkey[SKEY_LENGTH];
-    unsigned char concatBuffer[SKEY_LENGTH * 2];
-    Utils::sha256(newVaultSkey, (unsigned char *)vaultKey.c_str(), (unsigned long)vaultKey.size());
-    Utils::concatArr(newVaultSkey, newVaultInfo.vaultSkeySalt, SKEY_LENGTH, SKEY_LENGTH, concatBuffer);
-    Utils::sha256(newVaultInfo.vaultSkeyHash, concatBuffer, SKEY_LENGTH * 2);
+    // Create the directory of the vault's file:
+    if (mkdir(getVaultFileDir(vaultName).c_str(), 0700) != 0 && errno != EEXIST) {
+        return CLAM_ERROR_WRITE;
+    }
 
-    // Add new vault metadata to vector of vault metadatam:
-    vaultMetaData.push_back(newVaultInfo);
+    // Make room for the new vault (which rewrites the meta file only when it is full):
+    if (metaFileData == nullptr || header().numVaults == header().capacity) {
+        ClamStatus status = grow();
+        if (status != CLAM_OK) {
+            return status;
+        }
+    }
 
-    Utils::debugPrint(std::cout, newVaultInfo.vaultName + " new vault name \n");
-    Utils::debugPrint(std::cout, "creating new vault using key = " + vaultKey + "\n");
-    Utils::debugPrint(std::cout, std::to_string(newVaultInfo.vaultSkeyHash[0]) + " new vault hash \n");
-    Utils::debugPrint(std::cout, std::to_string(newVaultInfo.vaultSkeySalt[0]) + " new vault salt \n");
+    // Fill the first free slot before indexing it, and count it last:
+    beginMetaWrite();
+    uint32_t slotNumber = header().numVaults;
+    writeSlot(slotNumber, newVaultInfo);
+    indexSlot(slotNumber);
+    header().numVaults++;
+    return endMetaWrite();
+}
 
-    // Write the updated vault metadata to disk:
-    writeVaultMetaData();
+/**
+    Returns a context for the active vault if the given vault key is correct, and returns an error otherwise.
+*/
+Result<std::unique_ptr<CryptoContext>> VaultManager::unlockActiveVault(const std::string &vaultKey) const {
+    Result<VaultInfo> vaultInfo = readActiveSlot();
+    if (!vaultInfo) {
+        return vaultInfo.error();
+    }
+    return unlock(*vaultInfo, vaultKey);
 }
 
-void VaultManager::updateActiveVaultKey(const std::string &oldVaultKey, const std::string &newVaultKey) {
-    if (checkIfEmpty()) {
-        return;
+/**
+    Unlocks and loads the active vault if the given vault key is correct, and returns an error otherwise.
+    A vault whose key changes while it is loaded (which may re-encrypt it, see updateActiveVaultKey) is
+    unlocked and loaded again, up to VAULT_LOAD_ATTEMPTS times.
+*/
+Result<std::unique_ptr<Vault>> VaultManager::openActiveVault(const std::string &vaultKey) const {
+    for (int attempt = 1; ; ++attempt) {
+        Result<VaultInfo> vaultInfo = readActiveSlot();
+        if (!vaultInfo) {
+            return vaultInfo.error();
+        }
+        Result<std::unique_ptr<CryptoContext>> crypto = unlock(*vaultInfo, vaultKey);
+        if (!crypto) {
+            return crypto.error();
+        }
+        Result<std::unique_ptr<Vault>> vault = Vault::open(getVaultFileDir(vaultInfo->vaultName), vaultInfo->vaultName, std::move(*crypto), lockFilePath);
+        Result<VaultInfo> currentVaultInfo = readActiveSlot();
+        if (vault || attempt == VAULT_LOAD_ATTEMPTS || !currentVaultInfo || isSameVaultKey(*vaultInfo, *currentVaultInfo)) {
+            return vault;
+        }
     }
+}
 
-    const unsigned char* activeVaultHash = vaultMetaData[0].vaultSkeyHash;
-    unsigned char* activeVaultSalt = vaultMetaData[0].vaultSkeySalt;
-    std::string activeVaultName = vaultMetaData[0].vaultName;
+/**
+    Changes the key of the active vault. The new key is derived with the given algorithm using freshly
+    calibrated parameters, which also upgrades vaults created with an older KDF. Only the vault's data key
+    is rewrapped, so the vault itself is not rewritten, and only the vault's slot of the meta file changes.
+    The keys are derived before the write lock is taken, and CLAM_ERROR_VAULT_CHANGED is returned if
+    another process changed the active vault or its key in the meantime.
 
-    // Verify that vaultKey is correct and report error and exit if not:
-    if (!validateKey(oldVaultKey, activeVaultSalt, activeVaultHash)) {
-        return;
+    A vault created before data keys is encrypted with the key derived from the old vault key itself (for
+    KDF_SHA256, the unsalted sha256 of the old vault key), which must not remain in use. Such a vault is
+    given a new random data key instead, and re-encrypted with it as a whole: the new vault file replaces
+    the old one (and its journal, which is folded into it) along with the change of its slot, so that a
+    crash never leaves the vault encrypted with a key that its slot does not hold.
+*/
+ClamStatus VaultManager::updateActiveVaultKey(const std::string &oldVaultKey, const std::string &newVaultKey, KdfAlgorithm kdfAlgorithm) {
+    Result<VaultInfo> vaultInfo = readActiveSlot();
+    if (!vaultInfo) {
+        return vaultInfo.error();
     }
 
-    // Compute and store new random salt:
-    unsigned char newSalt[SKEY_LENGTH];
-    Utils::genRand(newSalt, SKEY_LENGTH);
-    std::memcpy(activeVaultSalt, newSalt, SKEY_LENGTH);
-    
-    // Re-encrypt active Vault with new key:
-    Vault activeVault(vaultDir, activeVaultName, oldVaultKey);
-    activeVault.updateKey(newVaultKey);
-    activeVault.writeVault();
+    // Verify that the old vault key is correct, and unwrap the data key (or generate one for a vault that has none):
+    Result<std::unique_ptr<CryptoContext>> dataKey = unlock(*vaultInfo, oldVaultKey);
+    if (!dataKey) {
+        return dataKey.error();
+    }
+    std::unique_ptr<CryptoContext> legacyKey;
+    if (!vaultInfo->hasDataKey) {
+        legacyKey = std::move(*dataKey);
+        dataKey = CryptoContext::generate();
+        if (!dataKey) {
+            return dataKey.error();
+        }
+    }
+
+    // Derive the new key, and rewrap the data key with it:
+    VaultInfo updatedVaultInfo;
+    updatedVaultInfo.vaultName = vaultInfo->vaultName;
+    Result<std::unique_ptr<CryptoContext>> keyEncryptionKey = createKeyEncryptionKey(updatedVaultInfo, newVaultKey, kdfAlgorithm);
+    if (!keyEncryptionKey) {
+        return keyEncryptionKey.error();
+    }
+    if (!(*keyEncryptionKey)->wrapKey(**dataKey, updatedVaultInfo.dataKeyIv, updatedVaultInfo.wrappedDataKey)) {
+        return CLAM_ERROR_CRYPTO;
+    }
+    updatedVaultInfo.hasDataKey = true;
 
-    // fixed: added changes to metadata after updating vault key
-    VaultInfo upadatedVaultInfo;
-    upadatedVaultInfo.vaultName = activeVaultName;
-    std::memcpy(upadatedVaultInfo.vaultSkeySalt, newSalt, SKEY_LENGTH);
+    Result<FileLock> lock = lockMetaFile();
+    if (!lock) {
+        return lock.error();
+    }
+    Result<VaultInfo> currentVaultInfo = readActiveSlot();
+    if (!currentVaultInfo) {
+        return currentVaultInfo.error();
+    }
+    if (!isSameVaultKey(*vaultInfo, *currentVaultInfo)) {
+        return CLAM_ERROR_VAULT_CHANGED;
+    }
 
-    // calcuate new hash for updated metadata and fill upadatedVaultInfo.vaultSkeyHash
-    unsigned char concatBuffer[SKEY_LENGTH * 2];
-    Utils::sha256(upadatedVaultInfo.vaultSkeyHash, (unsigned char *)newVaultKey.c_str(), (unsigned long)newVaultKey.size());
-    Utils::concatArr(upadatedVaultInfo.vaultSkeyHash, newSalt, SKEY_LENGTH, SKEY_LENGTH, concatBuffer);
-    Utils::sha256(upadatedVaultInfo.vaultSkeyHash, concatBuffer, SKEY_LENGTH * 2);
+    // Re-encrypt a vault that had no data key with its new one (loading it while the lock is held, so that it is current):
+    std::vector<FileMove> fileMoves;
+    if (legacyKey != nullptr) {
+        const std::string vaultFileDir = getVaultFileDir(vaultInfo->vaultName);
+        Result<std::unique_ptr<Vault>> vault = Vault::open(vaultFileDir, vaultInfo->vaultName, std::move(legacyKey), lockFilePath);
+        if (!vault) {
+            return vault.error();
+        }
+        ClamStatus status = (*vault)->rekey(std::move(*dataKey));
+        if (status != CLAM_OK) {
+            return status;
+        }
+        Result<std::string> newVaultFilePath = (*vault)->writeSnapshotFile();
+        if (!newVaultFilePath) {
+            return newVaultFilePath.error();
+        }
+        fileMoves.push_back(FileMove { *newVaultFilePath, vaultFileDir + vaultInfo->vaultName });
+        fileMoves.push_back(FileMove { vaultFileDir + JOURNAL_DIR + vaultInfo->vaultName, "" });
+    }
 
-    updateVaultInfo(upadatedVaultInfo);
+    // The name is unchanged, so the slot stays where it is indexed:
+    beginMetaWrite();
+    writeSlot(header().activeSlot, updatedVaultInfo);
+    return endMetaWrite(fileMoves);
 }
 
-void VaultManager::switchActiveVault(const std::string &vaultKey, const std::string &vaultToSwitchToName) {
-    if (checkIfEmpty()) {
-        return;
+/**
+    Re-encrypts the active vault with the given cipher suite. The vault key is unchanged.
+*/
+ClamStatus VaultManager::updateActiveVaultCipherSuite(const std::string &vaultKey, CipherSuite suite) {
+    // Verify that vaultKey is correct and load the active vault:
+    Result<std::unique_ptr<Vault>> activeVault = openActiveVault(vaultKey);
+    if (!activeVault) {
+        return activeVault.error();
     }
-    if (vaultMetaData[0].vaultName == vaultToSwitchToName) {
-        std::cout << "Error: " + vaultToSwitchToName + " is already the active vault." << std::endl;
-        return;
+
+    ClamStatus status = (*activeVault)->updateCipherSuite(suite);
+    if (status != CLAM_OK) {
+        return status;
     }
+    return (*activeVault)->writeVault();
+}
 
-    for (size_t i = 1; i < vaultMetaData.size(); ++i) {
-        // Find the vault to switch to
-        if (vaultMetaData[i].vaultName == vaultToSwitchToName) {
-            // Validate key
-            if (!validateKey(vaultKey, vaultMetaData[i].vaultSkeySalt, vaultMetaData[i].vaultSkeyHash)) {
-                return;
-            }
-            // Swap positions of current active vault and desired active vault
-            std::swap(vaultMetaData[0], vaultMetaData[i]);
+/**
+    Makes the given vault the active vault if the given vault key is correct for it, which only
+    changes the active slot number in the meta file's header.
+*/
+ClamStatus VaultManager::switchActiveVault(const std::string &vaultKey, const std::string &vaultToSwitchToName) {
+    // Validate the key before the write lock is taken, since the KDF is slow:
+    bool active = false;
+    Result<VaultInfo> vaultInfo = readSlotOf(vaultToSwitchToName, &active);
+    if (!vaultInfo) {
+        return vaultInfo.error();
+    }
+    if (active) {
+        return CLAM_ERROR_ALREADY_ACTIVE;
+    }
+    Result<std::unique_ptr<CryptoContext>> crypto = unlock(*vaultInfo, vaultKey);
+    if (!crypto) {
+        return crypto.error();
+    }
 
-            // Write updates to the VaultInfo vector to disk:
-            writeVaultMetaData();
-            std::cout << "Switched to vault " + vaultMetaData[0].vaultName + "." << std::endl;
-            return;
-        }
+    Result<FileLock> lock = lockMetaFile();
+    if (!lock) {
+        return lock.error();
+    }
+    if (empty()) {
+        return CLAM_ERROR_NO_VAULTS;
+    }
+
+    // Find the vault to switch to, which must still have the key that was validated:
+    std::optional<uint32_t> slotNumber = findSlot(vaultToSwitchToName);
+    if (!slotNumber) {
+        return CLAM_ERROR_VAULT_NOT_FOUND;
+    }
+    if (*slotNumber == header().activeSlot) {
+        return CLAM_ERROR_ALREADY_ACTIVE;
+    }
+    Result<VaultInfo> currentVaultInfo = readSlot(*slotNumber);
+    if (!currentVaultInfo) {
+        return currentVaultInfo.error();
+    }
+    if (!isSameVaultKey(*vaultInfo, *currentVaultInfo)) {
+        return CLAM_ERROR_VAULT_CHANGED;
     }
 
-    // No match found, no vault with name equal to vaultToSwitchToName exist in meta file
-    std::cout << "Error: No vault with the name of \"" + vaultToSwitchToName + "\" exist" << std::endl;
+    beginMetaWrite();
+    header().activeSlot = *slotNumber;
+    return endMetaWrite();
 }
 
-void VaultManager::deleteVault(const std::string &vaultKey, const std::string &vaultToDeleteName) {
-    if (checkIfEmpty()) {
-        return;
+/**
+    Deletes the given vault (which must not be the active vault) if the given vault key is correct for it.
+    The last slot is moved into the deleted vault's slot, so that the slots in use stay contiguous.
+*/
+ClamStatus VaultManager::deleteVault(const std::string &vaultKey, const std::string &vaultToDeleteName) {
+    // Verify that vaultKey is correct (before the write lock is taken, since the KDF is slow) and report error if not:
+    bool active = false;
+    Result<VaultInfo> vaultInfo = readSlotOf(vaultToDeleteName, &active);
+    if (!vaultInfo) {
+        return vaultInfo.error();
+    }
+    if (active) {
+        return CLAM_ERROR_VAULT_ACTIVE;
+    }
+    Result<std::unique_ptr<CryptoContext>> crypto = unlock(*vaultInfo, vaultKey);
+    if (!crypto) {
+        return crypto.error();
+    }
+
+    Result<FileLock> lock = lockMetaFile();
+    if (!lock) {
+        return lock.error();
     }
-    std::string activeVaultName = vaultMetaData[0].vaultName;
-    if (vaultToDeleteName == activeVaultName) {
-        std::cout << "Error: You cannot delete a vault that is currently active." << std::endl;
-        return;
+    if (empty()) {
+        return CLAM_ERROR_NO_VAULTS;
     }
 
-    std::string filePathToRemove = vaultDir + vaultToDeleteName;
+    // Find the vault to delete, which must still have the key that was verified:
+    size_t bucket = 0;
+    std::optional<uint32_t> slotNumber = findSlot(vaultToDeleteName, &bucket);
+    if (!slotNumber) {
+        return CLAM_ERROR_VAULT_NOT_FOUND;
+    }
+    if (*slotNumber == header().activeSlot) {
+        return CLAM_ERROR_VAULT_ACTIVE;
+    }
+    Result<VaultInfo> currentVaultInfo = readSlot(*slotNumber);
+    if (!currentVaultInfo) {
+        return currentVaultInfo.error();
+    }
+    if (!isSameVaultKey(*vaultInfo, *currentVaultInfo)) {
+        return CLAM_ERROR_VAULT_CHANGED;
+    }
 
-    // Search in vaultMetaData for VaultInfo to delete
-    for (size_t i = 1; i < vaultMetaData.size(); i++) {
-        if (vaultMetaData[i].vaultName == vaultToDeleteName) {
-            // Verify that vaultKey is correct and report error and exit if not
-            if (!validateKey(vaultKey, vaultMetaData[i].vaultSkeySalt, vaultMetaData[i].vaultSkeyHash)) {
-                return;
-            } 
-            // Remove the vault to delete's name from the meta/meta file
-            vaultMetaData.erase(vaultMetaData.begin() + i);
-            // Update vault metadata file:
-            writeVaultMetaData();
-            // Remove the vault file in the 'vaults' directory:
-            std::remove(filePathToRemove.c_str());
-            std::cout << vaultToDeleteName + " has been deleted."<< std::endl;
-            return;
+    // Remove the vault from the index, and move the last slot into its slot:
+    beginMetaWrite();
+    unindexBucket(bucket);
+    uint32_t lastSlotNumber = header().numVaults - 1;
+    if (*slotNumber != lastSlotNumber) {
+        size_t lastBucket = 0;
+        findSlot(slotName(lastSlotNumber), &lastBucket);
+        std::memcpy(&slot(*slotNumber), &slot(lastSlotNumber), sizeof(MetaSlot));
+        touchMeta(&slot(*slotNumber), META_SLOT_SIZE);
+        nameIndex()[lastBucket] = *slotNumber + 1;
+        touchMeta(&nameIndex()[lastBucket], sizeof(uint32_t));
+        if (header().activeSlot == lastSlotNumber) {
+            header().activeSlot = *slotNumber;
         }
     }
-    
-    // No match found, no vault with name equal to vaultToDeleteName exist in meta file
-    std::cout << "Error: No vault with the name of \"" + vaultToDeleteName + "\" exist" << std::endl;
-    return;
+    header().numVaults--;
+    std::memset(&slot(lastSlotNumber), 0, META_SLOT_SIZE);
+    touchMeta(&slot(lastSlotNumber), META_SLOT_SIZE);
+    ClamStatus status = endMetaWrite();
+    if (status != CLAM_OK) {
+        return status;
+    }
+
+    // Remove the vault file and its journal:
+    const std::string vaultFileDir = getVaultFileDir(vaultToDeleteName);
+    std::remove((vaultFileDir + vaultToDeleteName).c_str());
+    std::remove((vaultFileDir + JOURNAL_DIR + vaultToDeleteName).c_str());
+    return CLAM_OK;
 }
 
-void VaultManager::listVaultNames() const {
-    if (checkIfEmpty()) {
-        return;
-    }
-    for (size_t i = 0; i < vaultMetaData.size(); i++) {
-        std::cout << vaultMetaData[i].vaultName << std::endl;
+/**
+    Returns a context for the key with which the given vault is encrypted if the provided vault key is
+    correct: its data key, unwrapped with the key derived from the vault key, or (for a vault created
+    before data keys) the derived key itself. Returns CLAM_ERROR_WRONG_KEY if the vault key is incorrect.
+*/
+Result<std::unique_ptr<CryptoContext>> VaultManager::unlock(const VaultInfo &vaultInfo, const std::string &vaultKey) {
+    Result<std::unique_ptr<CryptoContext>> keyEncryptionKey = unlockKeyEncryptionKey(vaultInfo, vaultKey);
+    if (!keyEncryptionKey || !vaultInfo.hasDataKey) {
+        return keyEncryptionKey;
     }
+    return (*keyEncryptionKey)->unwrapKey(vaultInfo.dataKeyIv, vaultInfo.wrappedDataKey);
 }
 
 /**
-    Returns true if the provided vaultKey verifies using the given salt and salted hash values.
-    Returns False and reports an error otherwise.
+    Derives the key of the given vault from the provided vault key, and returns a context for it if
+    the key verifies using the vault's salt and salted hash. Returns CLAM_ERROR_WRONG_KEY otherwise.
 */
-bool VaultManager::validateKey(std::string key, const unsigned char *salt, const unsigned char *hash) {
-    if (!Utils::verifyKey(key, salt, hash, SKEY_LENGTH)) {
-        std::cout << "Error: The provided vault key is incorrect." << std::endl;
-        return false;
+Result<std::unique_ptr<CryptoContext>> VaultManager::unlockKeyEncryptionKey(const VaultInfo &vaultInfo, const std::string &vaultKey) {
+    Result<std::unique_ptr<CryptoContext>> crypto = CryptoContext::create(vaultKey, vaultInfo.vaultSkeySalt, vaultInfo.kdfParams);
+    if (crypto && !(*crypto)->verifyKey(vaultInfo.vaultSkeySalt, vaultInfo.vaultSkeyHash)) {
+        return CLAM_ERROR_WRONG_KEY;
     }
-    return true;
+    return crypto;
 }
 
 /**
-    Prints an error message and returns true if no vaults exist, and returns false otherwise.
+    Derives a key from the given vault key with a new random salt and the given algorithm, using
+    parameters calibrated to take unlockMillis milliseconds on this machine, and stores the salt,
+    parameters and salted hash in vaultInfo. Returns a context for the derived key.
 */
-bool VaultManager::checkIfEmpty() const {
-    if (vaultMetaData.empty()) {
-        std::cout << "Error: You must first create a vault using the -v add command." << std::endl;
-        return true;
+Result<std::unique_ptr<CryptoContext>> VaultManager::createKeyEncryptionKey(VaultInfo &vaultInfo, const std::string &vaultKey, KdfAlgorithm kdfAlgorithm) const {
+    if (!Utils::genRand(vaultInfo.vaultSkeySalt, SKEY_LENGTH)) {
+        return CLAM_ERROR_CRYPTO;
+    }
+    vaultInfo.kdfParams = Kdf::calibrate(kdfAlgorithm, unlockMillis);
+    Result<std::unique_ptr<CryptoContext>> crypto = CryptoContext::create(vaultKey, vaultInfo.vaultSkeySalt, vaultInfo.kdfParams);
+    if (crypto) {
+        (*crypto)->computeKeyHash(vaultInfo.vaultSkeySalt, vaultInfo.vaultSkeyHash);
     }
-    return false;
+    return crypto;
 }
 
 /**
-    Read all of the vault metadata into the in-memory vaultMetaData vector.
-    The metadata in the meta file is of the following format:
+    Maps the meta file, if there is one. A meta file in an older format (which is read as a whole) is
+    migrated to the current format, along with the vault files, which are moved into their fan-out
+    directories. Since a migration writes, it takes the write lock (if writeLock is not given) and reads
+    the meta file again, which another process may have migrated in the meantime. Returns an error if
+    the meta file cannot be read or migrated.
+*/
+ClamStatus VaultManager::readVaultMetaData(const FileLock *writeLock) {
+    ScopedTimer timer(STATS_META_READ);
+
+    std::ifstream fileStream(metadataFilePath);
+    if (!fileStream.is_open()) {
+        return CLAM_OK;
+    }
+
+    char magic[META_MAGIC_LENGTH];
+    uint32_t version = 1;
+    if (fileStream.read(magic, META_MAGIC_LENGTH) && std::memcmp(magic, META_MAGIC, META_MAGIC_LENGTH) == 0) {
+        fileStream.read((char *)&version, sizeof(version));
+    } else {
+        // Legacy meta files start with the number of vaults:
+        fileStream.clear();
+        fileStream.seekg(0);
+    }
+    if (version > META_FORMAT_VERSION) {
+        return CLAM_ERROR_META_UNSUPPORTED_VERSION;
+    }
+    if (version == META_FORMAT_VERSION) {
+        fileStream.close();
+        // A meta log that is not empty may be left by a writer that died (see recoverMetaFile), which is
+        // finished by whoever can take the write lock (readers that cannot read the file as it is):
+        struct stat logInfo;
+        if (writeLock == nullptr && stat(logFilePath.c_str(), &logInfo) == 0 && logInfo.st_size > 0) {
+            Result<FileLock> lock = FileLock::acquire(lockFilePath, WRITE_LOCK_TIMEOUT_MS);
+            if (lock) {
+                return readVaultMetaData(&*lock);
+            }
+        }
+        ClamStatus status = writeLock != nullptr ? recoverMetaFile() : CLAM_OK;
+        return status == CLAM_OK ? mapMetaFile() : status;
+    }
+    if (writeLock == nullptr) {
+        fileStream.close();
+        Result<FileLock> lock = FileLock::acquire(lockFilePath, WRITE_LOCK_TIMEOUT_MS);
+        return lock ? readVaultMetaData(&*lock) : lock.error();
+    }
+
+    std::vector<VaultInfo> vaultInfos;
+    ClamStatus status = readLegacyVaultMetaData(fileStream, version, vaultInfos);
+    fileStream.close();
+    if (status != CLAM_OK || vaultInfos.empty()) {
+        return status;
+    }
+
+    // The vault files are moved first, so that a migration that is interrupted is completed by the next one:
+    status = migrateVaultFiles(vaultInfos);
+    if (status != CLAM_OK) {
+        return status;
+    }
+    uint32_t capacity = META_MIN_CAPACITY;
+    while (capacity < vaultInfos.size()) {
+        capacity *= 2;
+    }
+    return writeVaultMetaData(vaultInfos, 0, capacity);
+}
 
-    uint32: n = number of vaults
-    
-    uint32: s = size of the active vault's name (in bytes)
-    s bytes: name = active vault's name
-    32 bytes: active vault's hash = sha256(sha256(vaultKey) || salt)
-    32 bytes: active vault's salt = some random 32-byte value
+/**
+    Reads the metadata of every vault from a meta file in an older format, starting with the active vault:
+    version 2 or 3, or the legacy (version 1) format, which has no magic or version and whose vaults have
+    no KDF parameters (their keys are derived with KDF_SHA256). The vaults of version 1 and 2 meta files
+    have no data keys. The file stream must be positioned after the version, if there is one.
 
-    <repeated n-1 times>:
+    Each vault is stored as:
         uint32: s = size of the vault's name (in bytes)
         s bytes: name = vault's name
-        32 bytes: hash = sha256(sha256(vaultKey) || salt)
+        32 bytes: hash = sha256(KDF(vaultKey, salt) || salt)
         32 bytes: salt = some random 32-byte value
+        <version 2 and above>:
+            uint32: KDF algorithm (see KdfAlgorithm)
+            uint32: KDF time cost (PBKDF2 iterations or Argon2 passes)
+            uint32: KDF memory cost (in KiB)
+            uint32: KDF lanes
+        <version 3>:
+            uint32: 1 if the vault is encrypted with a data key, 0 if it is encrypted with KDF(vaultKey, salt) itself
+            <if the vault has a data key>:
+                32 bytes: iv = nonce with which the data key is wrapped
+                48 bytes: wrapped data key = ChaCha20-Poly1305(KDF(vaultKey, salt), iv, data key), followed by its tag
 */
-void VaultManager::readVaultMetaData() {
-    Utils::debugPrint(std::cout, "Entered readVaultMetaData\n");
-
-    std::ifstream fileStream(metadataFilePath);
-
-    uint32_t numVaults;
+ClamStatus VaultManager::readLegacyVaultMetaData(std::istream &fileStream, uint32_t version, std::vector<VaultInfo> &vaultInfos) const {
+    uint32_t numVaults = 0;
     fileStream.read((char *)&numVaults, sizeof(numVaults));
 
     VaultInfo vaultInfo;
     uint32_t vaultNameSize;
     for (size_t i = 0; i < numVaults; ++i) {
         fileStream.read((char *)&vaultNameSize, sizeof(vaultNameSize)); // read vault name's size
+        if (!fileStream || vaultNameSize > VAULT_NAME_MAX_LENGTH) {
+            return CLAM_ERROR_META_CORRUPT;
+        }
         vaultInfo.vaultName.resize(vaultNameSize); // reserve vaultNameSize bytes
         fileStream.read((char *)&vaultInfo.vaultName[0], vaultNameSize); // read vaultName from file
         fileStream.read((char *)vaultInfo.vaultSkeyHash, SKEY_LENGTH);
         fileStream.read((char *)vaultInfo.vaultSkeySalt, SKEY_LENGTH);
-        vaultMetaData.push_back(vaultInfo);
+        vaultInfo.kdfParams = Kdf::legacyParams();
+        if (version >= 2) {
+            fileStream.read((char *)&vaultInfo.kdfParams.algorithm, sizeof(vaultInfo.kdfParams.algorithm));
+            fileStream.read((char *)&vaultInfo.kdfParams.timeCost, sizeof(vaultInfo.kdfParams.timeCost));
+            fileStream.read((char *)&vaultInfo.kdfParams.memoryCost, sizeof(vaultInfo.kdfParams.memoryCost));
+            fileStream.read((char *)&vaultInfo.kdfParams.lanes, sizeof(vaultInfo.kdfParams.lanes));
+        }
+        uint32_t hasDataKey = 0;
+        if (version >= 3) {
+            fileStream.read((char *)&hasDataKey, sizeof(hasDataKey));
+            if (hasDataKey == 1) {
+                fileStream.read((char *)vaultInfo.dataKeyIv, SKEY_LENGTH);
+                fileStream.read((char *)vaultInfo.wrappedDataKey, WRAPPED_KEY_LENGTH);
+            }
+        }
+        vaultInfo.hasDataKey = hasDataKey == 1;
+        if (!fileStream || !Kdf::isValid(vaultInfo.kdfParams) || hasDataKey > 1) {
+            return CLAM_ERROR_META_CORRUPT;
+        }
+        vaultInfos.push_back(vaultInfo);
     }
-    fileStream.close();
+    return CLAM_OK;
 }
 
 /**
-    Write all of the vaultMetaData vector to the vault metadata file.
-    The vault metadata is written to the file in the following format:
+    Moves the files of the given vaults, which older versions stored directly in vaultDir (and their
+    journals, in vaultDir/.journal), into their fan-out directories. Every vault file is first moved out
+    of the way into a migration directory, since a vault's name may be that of a fan-out directory.
+    Files that are already gone were moved by an earlier, interrupted migration.
+*/
+ClamStatus VaultManager::migrateVaultFiles(const std::vector<VaultInfo> &vaultInfos) const {
+    const std::string migrationDir = vaultDir + VAULT_MIGRATION_DIR;
+    if (mkdir(migrationDir.c_str(), 0700) != 0 && errno != EEXIST) {
+        return CLAM_ERROR_WRITE;
+    }
+    for (const VaultInfo &vaultInfo : vaultInfos) {
+        if (std::rename((vaultDir + vaultInfo.vaultName).c_str(), (migrationDir + vaultInfo.vaultName).c_str()) != 0 && errno != ENOENT) {
+            return CLAM_ERROR_WRITE;
+        }
+    }
 
-    uint32: n = number of vaults
-    
-    uint32: s = size of the active vault's name (in bytes)
-    s bytes: name = active vault's name
-    32 bytes: active vault's hash = sha256(sha256(vaultKey) || salt)
-    32 bytes: active vault's salt = some random 32-byte value
+    for (const VaultInfo &vaultInfo : vaultInfos) {
+        const std::string vaultFileDir = getVaultFileDir(vaultInfo.vaultName);
+        if ((mkdir(vaultFileDir.c_str(), 0700) != 0 && errno != EEXIST)
+            || (std::rename((migrationDir + vaultInfo.vaultName).c_str(), (vaultFileDir + vaultInfo.vaultName).c_str()) != 0 && errno != ENOENT)) {
+            return CLAM_ERROR_WRITE;
+        }
+        const std::string journalFilePath = vaultDir + JOURNAL_DIR + vaultInfo.vaultName;
+        if (access(journalFilePath.c_str(), F_OK) == 0) {
+            if ((mkdir((vaultFileDir + JOURNAL_DIR).c_str(), 0700) != 0 && errno != EEXIST)
+                || std::rename(journalFilePath.c_str(), (vaultFileDir + JOURNAL_DIR + vaultInfo.vaultName).c_str()) != 0) {
+                return CLAM_ERROR_WRITE;
+            }
+        }
+    }
+    rmdir(migrationDir.c_str());
+    rmdir((vaultDir + JOURNAL_DIR).c_str());
+    return CLAM_OK;
+}
 
-    <repeated n-1 times>:
-        uint32: s = size of the vault's name (in bytes)
-        s bytes: name = vault's name
-        32 bytes: hash = sha256(sha256(vaultKey) || salt)
+/**
+    Writes a new meta file holding the given vaults (in slot order) with the given capacity, and maps it
+    (writable) in place of the current one. The file is filled through a mapping of a temporary file, which
+    is synced and then moved into place, so that the meta file is replaced atomically, even by a crash; the
+    current mapping is kept if this fails.
+    The meta file is written in the following (version 4) format:
+
+    Header (one META_BLOCK_SIZE block, zero-padded):
+        4 bytes: magic = "CLAM"
+        uint32: version = 4
+        uint32: c = capacity (number of slots), a power of two and at least META_MIN_CAPACITY
+        uint32: n = number of vaults, which are held by slots 0 to n - 1
+        uint32: number of the active vault's slot
+        16 bytes: key of the name index's hash (random)
+        uint32: generation, which is odd while a writer changes the file in place (see readMetaSnapshot)
+
+    Name index (2 * c uint32 buckets):
+        An open-addressing table of (slot number + 1), 0 marking an empty bucket, in which the slot of
+        vault 'name' is found by linear probing from bucket keyedHash64(key, name) mod 2c.
+
+    Slots (c META_SLOT_SIZE blocks, zero-padded; unused slots are all zeroes):
+        uint32: s = size of the vault's name (in bytes, at most VAULT_NAME_MAX_LENGTH)
+        256 bytes: name = vault's name, zero-padded
+        32 bytes: hash = sha256(KDF(vaultKey, salt) || salt)
         32 bytes: salt = some random 32-byte value
+        uint32: KDF algorithm (see KdfAlgorithm)
+        uint32: KDF time cost (PBKDF2 iterations or Argon2 passes)
+        uint32: KDF memory cost (in KiB)
+        uint32: KDF lanes
+        uint32: 1 if the vault is encrypted with a data key, 0 if it is encrypted with KDF(vaultKey, salt) itself
+        32 bytes: iv = nonce with which the data key is wrapped (if it has one)
+        48 bytes: wrapped data key = ChaCha20-Poly1305(KDF(vaultKey, salt), iv, data key), followed by its tag
+
+    Returns an error if the meta file could not be written.
+*/
+ClamStatus VaultManager::writeVaultMetaData(const std::vector<VaultInfo> &vaultInfos, uint32_t activeSlot, uint32_t capacity) {
+    ScopedTimer timer(STATS_WRITE);
+    static_assert(sizeof(MetaHeader) <= META_BLOCK_SIZE && sizeof(MetaSlot) <= META_SLOT_SIZE, "meta file block overflow");
+
+    unsigned char indexKey[META_INDEX_KEY_LENGTH];
+    if (!Utils::genRand(indexKey, META_INDEX_KEY_LENGTH)) {
+        return CLAM_ERROR_CRYPTO;
+    }
+    std::string newMetadataFilePath = metadataFilePath + META_TEMP_FILE_SUFFIX;
+    int fd = mkstemp(&newMetadataFilePath[0]);
+    if (fd < 0) {
+        return CLAM_ERROR_META_WRITE;
+    }
+    size_t newMetaFileSize = metaFileSizeFor(capacity);
+    void *newMetaFileData = MAP_FAILED;
+    struct stat fileInfo;
+    if (ftruncate(fd, (off_t)newMetaFileSize) == 0 && fstat(fd, &fileInfo) == 0) {
+        newMetaFileData = mmap(nullptr, newMetaFileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (newMetaFileData == MAP_FAILED) {
+        close(fd);
+        std::remove(newMetadataFilePath.c_str());
+        return CLAM_ERROR_META_WRITE;
+    }
+
+    // Fill the new file through its mapping (the file is zeroed, so unused slots and buckets already are):
+    unsigned char *oldMetaFileData = metaFileData;
+    size_t oldMetaFileSize = metaFileSize;
+    uint64_t oldMetaFileInode = metaFileInode;
+    bool oldMetaFileWritable = metaFileWritable;
+    metaFileData = (unsigned char *)newMetaFileData;
+    metaFileSize = newMetaFileSize;
+    metaFileInode = (uint64_t)fileInfo.st_ino;
+    metaFileWritable = true;
+    MetaHeader &newHeader = header();
+    std::memcpy(newHeader.magic, META_MAGIC, META_MAGIC_LENGTH);
+    newHeader.version = META_FORMAT_VERSION;
+    newHeader.capacity = capacity;
+    newHeader.numVaults = (uint32_t)vaultInfos.size();
+    newHeader.activeSlot = activeSlot;
+    std::memcpy(newHeader.indexKey, indexKey, META_INDEX_KEY_LENGTH);
+    for (uint32_t slotNumber = 0; slotNumber < vaultInfos.size(); ++slotNumber) {
+        writeSlot(slotNumber, vaultInfos[slotNumber]);
+        indexSlot(slotNumber);
+    }
+
+    bool synced;
+    {
+        ScopedTimer syncTimer(STATS_FSYNC);
+        synced = msync(metaFileData, metaFileSize, MS_SYNC) == 0 && fsync(fd) == 0;
+    }
+    close(fd);
+    if (!synced || std::rename(newMetadataFilePath.c_str(), metadataFilePath.c_str()) != 0) {
+        std::remove(newMetadataFilePath.c_str());
+        unmapMetaFile();
+        metaFileData = oldMetaFileData;
+        metaFileSize = oldMetaFileSize;
+        metaFileInode = oldMetaFileInode;
+        metaFileWritable = oldMetaFileWritable;
+        return CLAM_ERROR_META_WRITE;
+    }
+    if (oldMetaFileData != nullptr) {
+        munmap(oldMetaFileData, oldMetaFileSize);
+    }
+    // A meta log of the replaced file is never replayed onto this one (see replayMetaLog), so this only makes the replacement durable:
+    {
+        ScopedTimer syncTimer(STATS_FSYNC);
+        Utils::syncParentDirectory(metadataFilePath);
+    }
+
+    // Further changes are written through the meta log (see endMetaWrite), so the file is mapped privately:
+    unmapMetaFile();
+    return mapMetaFile(true);
+}
+
+/**
+    Maps the (version 4) meta file, shared and read-only unless 'writable', in which case it is mapped
+    privately (copy-on-write), so that changes are only written to the file by endMetaWrite. Returns an
+    error if it cannot be mapped, or if its header is not that of a version 4 file of its size.
 */
-void VaultManager::writeVaultMetaData() {
-    Utils::debugPrint(std::cout, "Entered writeVaultMetaData\n");
+ClamStatus VaultManager::mapMetaFile(bool writable) {
+    int fd = ::open(metadataFilePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return CLAM_ERROR_READ;
+    }
+    struct stat fileInfo;
+    if (fstat(fd, &fileInfo) != 0) {
+        close(fd);
+        return CLAM_ERROR_READ;
+    }
+    if ((size_t)fileInfo.st_size < META_BLOCK_SIZE) {
+        close(fd);
+        return CLAM_ERROR_META_CORRUPT;
+    }
+    void *data = mmap(nullptr, (size_t)fileInfo.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, writable ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return CLAM_ERROR_READ;
+    }
+    metaFileData = (unsigned char *)data;
+    metaFileSize = (size_t)fileInfo.st_size;
+    metaFileInode = (uint64_t)fileInfo.st_ino;
+    metaFileWritable = writable;
 
-    std::ofstream fileStream(metadataFilePath);
+    // The capacity is never changed in place, but the number of vaults and the active slot may be:
+    const MetaHeader &mappedHeader = header();
+    const uint32_t capacity = mappedHeader.capacity;
+    bool valid = std::memcmp(mappedHeader.magic, META_MAGIC, META_MAGIC_LENGTH) == 0 && mappedHeader.version == META_FORMAT_VERSION
+        && capacity >= META_MIN_CAPACITY && (capacity & (capacity - 1)) == 0 && metaFileSize == metaFileSizeFor(capacity)
+        && readMetaSnapshot([&]() {
+            return mappedHeader.numVaults <= capacity && (mappedHeader.numVaults == 0 || mappedHeader.activeSlot < mappedHeader.numVaults);
+        });
+    if (!valid) {
+        unmapMetaFile();
+        return CLAM_ERROR_META_CORRUPT;
+    }
+    return CLAM_OK;
+}
 
-    uint32_t numVaults = (uint32_t)vaultMetaData.size();
-    fileStream.write((char *)&numVaults, sizeof(numVaults));
+void VaultManager::unmapMetaFile() {
+    if (metaFileData != nullptr) {
+        munmap(metaFileData, metaFileSize);
+        metaFileData = nullptr;
+        metaFileSize = 0;
+        metaFileInode = 0;
+        metaFileWritable = false;
+    }
+}
 
+/**
+    Rewrites the meta file with twice as many slots (or creates it), keeping every vault in its slot.
+    Since the capacity doubles, the cost of growing is amortized over the vaults that fill it.
+*/
+ClamStatus VaultManager::grow() {
+    std::vector<VaultInfo> vaultInfos;
+    uint32_t activeSlot = 0;
+    uint32_t capacity = META_MIN_CAPACITY;
+    if (metaFileData != nullptr) {
+        for (uint32_t slotNumber = 0; slotNumber < header().numVaults; ++slotNumber) {
+            Result<VaultInfo> vaultInfo = readSlot(slotNumber);
+            if (!vaultInfo) {
+                return vaultInfo.error();
+            }
+            vaultInfos.push_back(*vaultInfo);
+        }
+        activeSlot = header().activeSlot;
+        capacity = header().capacity * 2;
+    }
+    return writeVaultMetaData(vaultInfos, activeSlot, capacity);
+}
+
+VaultManager::MetaHeader &VaultManager::header() const {
+    return *(MetaHeader *)metaFileData;
+}
+
+uint32_t *VaultManager::nameIndex() const {
+    return (uint32_t *)(metaFileData + META_BLOCK_SIZE);
+}
+
+uint32_t VaultManager::nameIndexCapacity() const {
+    return header().capacity * 2;
+}
+
+VaultManager::MetaSlot &VaultManager::slot(uint32_t slotNumber) const {
+    size_t slotsOffset = META_BLOCK_SIZE + (size_t)nameIndexCapacity() * sizeof(uint32_t);
+    return *(MetaSlot *)(metaFileData + slotsOffset + (size_t)slotNumber * META_SLOT_SIZE);
+}
+
+std::string_view VaultManager::slotName(uint32_t slotNumber) const {
+    const MetaSlot &vaultSlot = slot(slotNumber);
+    return std::string_view(vaultSlot.name, std::min(vaultSlot.nameSize, (uint32_t)VAULT_NAME_MAX_LENGTH));
+}
+
+/**
+    Returns the metadata of the vault in the given slot, or CLAM_ERROR_META_CORRUPT if it is invalid.
+*/
+Result<VaultInfo> VaultManager::readSlot(uint32_t slotNumber) const {
+    const MetaSlot &vaultSlot = slot(slotNumber);
     VaultInfo vaultInfo;
-    uint32_t vaultNameSize;
-    for (size_t i = 0; i < numVaults; ++i) {
-        vaultInfo = vaultMetaData[i];
-        vaultNameSize = (uint32_t)vaultInfo.vaultName.size();
-        fileStream.write((char *)&vaultNameSize, sizeof(vaultNameSize)); // write vault name's size
-        fileStream.write((char *)vaultInfo.vaultName.c_str(), vaultNameSize); // write vaultName to file
-        fileStream.write((char *)vaultInfo.vaultSkeyHash, SKEY_LENGTH);
-        fileStream.write((char *)vaultInfo.vaultSkeySalt, SKEY_LENGTH);
+    vaultInfo.vaultName = std::string(slotName(slotNumber));
+    std::memcpy(vaultInfo.vaultSkeyHash, vaultSlot.skeyHash, SKEY_LENGTH);
+    std::memcpy(vaultInfo.vaultSkeySalt, vaultSlot.skeySalt, SKEY_LENGTH);
+    vaultInfo.kdfParams = KdfParams { (KdfAlgorithm)vaultSlot.kdfAlgorithm, vaultSlot.kdfTimeCost, vaultSlot.kdfMemoryCost, vaultSlot.kdfLanes };
+    vaultInfo.hasDataKey = vaultSlot.hasDataKey == 1;
+    std::memcpy(vaultInfo.dataKeyIv, vaultSlot.dataKeyIv, SKEY_LENGTH);
+    std::memcpy(vaultInfo.wrappedDataKey, vaultSlot.wrappedDataKey, WRAPPED_KEY_LENGTH);
+    if (vaultSlot.nameSize == 0 || vaultSlot.nameSize > VAULT_NAME_MAX_LENGTH || !Kdf::isValid(vaultInfo.kdfParams) || vaultSlot.hasDataKey > 1) {
+        return CLAM_ERROR_META_CORRUPT;
     }
-    fileStream.close();
+    return vaultInfo;
 }
 
-void VaultManager::updateVaultInfo(VaultInfo &updatedVaultInfo) {
-    // Search in vaultMetaData for VaultInfo to update
-    for (size_t i = 0; i < vaultMetaData.size(); i++) {
-        if (vaultMetaData[i].vaultName == updatedVaultInfo.vaultName) {
-            // overwrite the metadata of the corresponding vault:
-            vaultMetaData[i] = updatedVaultInfo;
-            break;
+/**
+    Overwrites the given slot with the given vault's metadata.
+*/
+void VaultManager::writeSlot(uint32_t slotNumber, const VaultInfo &vaultInfo) {
+    MetaSlot &vaultSlot = slot(slotNumber);
+    std::memset(&vaultSlot, 0, META_SLOT_SIZE);
+    vaultSlot.nameSize = (uint32_t)vaultInfo.vaultName.size();
+    std::memcpy(vaultSlot.name, vaultInfo.vaultName.data(), vaultInfo.vaultName.size());
+    std::memcpy(vaultSlot.skeyHash, vaultInfo.vaultSkeyHash, SKEY_LENGTH);
+    std::memcpy(vaultSlot.skeySalt, vaultInfo.vaultSkeySalt, SKEY_LENGTH);
+    vaultSlot.kdfAlgorithm = vaultInfo.kdfParams.algorithm;
+    vaultSlot.kdfTimeCost = vaultInfo.kdfParams.timeCost;
+    vaultSlot.kdfMemoryCost = vaultInfo.kdfParams.memoryCost;
+    vaultSlot.kdfLanes = vaultInfo.kdfParams.lanes;
+    vaultSlot.hasDataKey = vaultInfo.hasDataKey ? 1 : 0;
+    if (vaultInfo.hasDataKey) {
+        std::memcpy(vaultSlot.dataKeyIv, vaultInfo.dataKeyIv, SKEY_LENGTH);
+        std::memcpy(vaultSlot.wrappedDataKey, vaultInfo.wrappedDataKey, WRAPPED_KEY_LENGTH);
+    }
+    touchMeta(&vaultSlot, META_SLOT_SIZE);
+}
+
+/**
+    Returns the slot of the vault with the given name, or std::nullopt if there is none. If bucketOut is
+    given, the bucket of the name index that points to the slot is stored in it.
+*/
+std::optional<uint32_t> VaultManager::findSlot(std::string_view vaultName, size_t *bucketOut) const {
+    if (metaFileData == nullptr) {
+        return std::nullopt;
+    }
+    const uint32_t *index = nameIndex();
+    const size_t mask = nameIndexCapacity() - 1;
+    size_t bucket = nameHash(vaultName) & mask;
+    // The index is never more than half full, but a corrupt one might be, so probing stops after every bucket:
+    for (size_t probes = 0; probes <= mask && index[bucket] != 0; ++probes, bucket = (bucket + 1) & mask) {
+        uint32_t slotNumber = index[bucket] - 1;
+        if (slotNumber < header().numVaults && slotName(slotNumber) == vaultName) {
+            if (bucketOut != nullptr) {
+                *bucketOut = bucket;
+            }
+            return slotNumber;
         }
     }
+    return std::nullopt;
+}
+
+/**
+    Inserts the given slot into the first empty bucket of its name's probe sequence.
+*/
+void VaultManager::indexSlot(uint32_t slotNumber) {
+    uint32_t *index = nameIndex();
+    const size_t mask = nameIndexCapacity() - 1;
+    size_t bucket = nameHash(slotName(slotNumber)) & mask;
+    while (index[bucket] != 0) {
+        bucket = (bucket + 1) & mask;
+    }
+    index[bucket] = slotNumber + 1;
+    touchMeta(&index[bucket], sizeof(uint32_t));
+}
+
+/**
+    Empties the given bucket of the name index, moving back each later entry of the same run that would
+    otherwise no longer be reachable from its home bucket (so that no tombstones are needed).
+*/
+void VaultManager::unindexBucket(size_t bucket) {
+    uint32_t *index = nameIndex();
+    const size_t mask = nameIndexCapacity() - 1;
+    size_t hole = bucket;
+    for (size_t next = (hole + 1) & mask; index[next] != 0; next = (next + 1) & mask) {
+        size_t home = nameHash(slotName(index[next] - 1)) & mask;
+        // The entry may fill the hole if the hole lies on its probe sequence, between its home and itself:
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            index[hole] = index[next];
+            touchMeta(&index[hole], sizeof(uint32_t));
+            hole = next;
+        }
+    }
+    index[hole] = 0;
+    touchMeta(&index[hole], sizeof(uint32_t));
+}
 
-    // Update vault metadata file:
-    writeVaultMetaData();
-    std::cout << "Successfully updated key for vault " + vaultMetaData[0].vaultName << std::endl;
+uint64_t VaultManager::nameHash(std::string_view vaultName) const {
+    return Utils::keyedHash64(header().indexKey, META_INDEX_KEY_LENGTH, (const unsigned char *)vaultName.data(), (unsigned long)vaultName.size());
 }
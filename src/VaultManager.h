@@ -3,38 +3,127 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
+#include <optional>
 
 #include "Vault.h"
+#include "Kdf.h"
+#include "Status.h"
+#include "FileLock.h"
+
+#define DATA_DIR_ENV "CLAM_HOME" // directory holding the meta file and the vaults directory, unless --data-dir is given
+
+#define META_MAGIC "CLAM" // identifies a versioned meta file
+#define META_MAGIC_LENGTH 4
+#define META_FORMAT_VERSION 4 // version 1 has no header, and derives every vault's key with KDF_SHA256; versions
+                              // 1 to 3 store one variable-size entry per vault, and are migrated when opened
+#define META_TEMP_FILE_SUFFIX ".XXXXXX" // the meta file is written to a temporary file first
+#define META_LOCK_FILE_SUFFIX ".lock" // processes that write to the meta file or a vault hold the lock of this file
+#define META_LOG_FILE_SUFFIX ".log" // changes to the meta file are written to this file first (see endMetaWrite)
+#define META_BLOCK_SIZE 512 // the header, the name index and every slot start on a multiple of this
+#define META_SLOT_SIZE META_BLOCK_SIZE // size of the slot holding one vault's metadata
+#define META_MIN_CAPACITY 64 // slots of a new meta file; must be a power of two
+#define META_INDEX_KEY_LENGTH 16
+
+#define VAULT_NAME_MAX_LENGTH 255 // in bytes
+#define VAULT_MIGRATION_DIR ".migrate/" // vault files are moved here first when they are migrated to the fan-out
+#define VAULT_DIR_FAN_OUT_DIGITS 2 // the file of vault 'name' is stored as 'vaults/xx/name', where xx are the
+                                   // first hex digits of sha256(name), so that no directory holds too many vaults
 
 struct VaultInfo {
-    unsigned char vaultSkeyHash[SKEY_LENGTH]; // vaultSkeyHash = sha256(sha256(skey) + vaultSkeySalt)
-    unsigned char vaultSkeySalt[SKEY_LENGTH];
+    unsigned char vaultSkeyHash[SKEY_LENGTH]; // vaultSkeyHash = sha256(skey + vaultSkeySalt)
+    unsigned char vaultSkeySalt[SKEY_LENGTH]; // salt of both the KDF and the hash
+    KdfParams kdfParams; // skey = KDF(vaultKey, vaultSkeySalt)
+    bool hasDataKey; // whether the vault is encrypted with a data key wrapped by skey, rather than with skey itself
+    unsigned char dataKeyIv[SKEY_LENGTH];
+    unsigned char wrappedDataKey[WRAPPED_KEY_LENGTH];
     std::string vaultName;
 };
 
+/**
+    Manages the vaults in a data directory through its meta file, which is mapped into memory. The meta
+    file holds one fixed-size slot per vault, an index of the slots by the keyed hash of their vault's
+    name, and the number of the active vault's slot, so that finding, adding, switching to, updating or
+    deleting a vault touches only a few slots, however many vaults there are.
+
+    Writers (of the meta file or a vault) take turns by holding the write lock (see FileLock) of the
+    meta file's lock file. Readers never take it: the slots they read are guarded by a generation
+    number in the header (see readMetaSnapshot), so that they never see a vault half-written. Changes
+    are written to a log before they are made to the meta file (see endMetaWrite), so that a writer
+    that crashes never leaves a vault half-written either.
+*/
 class VaultManager {
 public:
-    VaultManager(const std::string &metadataFilePath, const std::string &vaultDir);
+    static Result<VaultManager> open(const std::string &metadataFilePath, const std::string &vaultDir, uint32_t unlockMillis);
+    VaultManager(VaultManager &&other);
+    ~VaultManager();
+    VaultManager(const VaultManager &) = delete;
+    VaultManager &operator=(const VaultManager &) = delete;
     const std::string& getVaultDir() const;
+    std::string getVaultFileDir(const std::string &vaultName) const;
     bool empty() const;
     size_t size() const;
-    VaultInfo& activeVaultInfo();
-    void addVault(const std::string &vaultName, const std::string &vaultKey);
-    void updateActiveVaultKey(const std::string &oldVaultKey, const std::string &newVaultKey);
-    void switchActiveVault(const std::string &vaultKey, const std::string &vaultToSwitchToName);
-    void deleteVault(const std::string &vaultKey, const std::string &vaultToDeleteName);
-    void listVaultNames() const;
-    static bool validateKey(std::string key, const unsigned char *salt, const unsigned char *hash);
+    VaultInfo activeVaultInfo() const;
+    std::vector<std::string> getVaultNames() const;
+    ClamStatus addVault(const std::string &vaultName, const std::string &vaultKey, KdfAlgorithm kdfAlgorithm);
+    Result<std::unique_ptr<CryptoContext>> unlockActiveVault(const std::string &vaultKey) const;
+    Result<std::unique_ptr<Vault>> openActiveVault(const std::string &vaultKey) const;
+    ClamStatus updateActiveVaultKey(const std::string &oldVaultKey, const std::string &newVaultKey, KdfAlgorithm kdfAlgorithm);
+    ClamStatus updateActiveVaultCipherSuite(const std::string &vaultKey, CipherSuite suite);
+    ClamStatus switchActiveVault(const std::string &vaultKey, const std::string &vaultToSwitchToName);
+    ClamStatus deleteVault(const std::string &vaultKey, const std::string &vaultToDeleteName);
 private:
-    bool checkIfEmpty() const;
-    void initialize();
-    void readVaultMetaData();
-    void writeVaultMetaData();
-    void updateVaultInfo(VaultInfo &updatedVaultInfo);
+    struct MetaHeader; // defined with the rest of the meta file format in VaultManager.cpp
+    struct MetaSlot;
+
+    // A file that a change to the meta file moves into place, or removes, along with it (see endMetaWrite):
+    struct FileMove {
+        std::string path;
+        std::string newPath; // empty if the file is removed
+    };
+
+    VaultManager(const std::string &metadataFilePath, const std::string &vaultDir, uint32_t unlockMillis);
+    Result<FileLock> lockMetaFile();
+    ClamStatus recoverMetaFile();
+    void beginMetaWrite();
+    void touchMeta(const void *data, size_t size);
+    ClamStatus endMetaWrite(const std::vector<FileMove> &fileMoves = {});
+    ClamStatus replayMetaLog(const std::vector<uint8_t> &log) const;
+    template <typename Reader> auto readMetaSnapshot(Reader read) const -> decltype(read());
+    Result<VaultInfo> readActiveSlot() const;
+    Result<VaultInfo> readSlotOf(const std::string &vaultName, bool *activeOut = nullptr) const;
+    static Result<std::unique_ptr<CryptoContext>> unlock(const VaultInfo &vaultInfo, const std::string &vaultKey);
+    static Result<std::unique_ptr<CryptoContext>> unlockKeyEncryptionKey(const VaultInfo &vaultInfo, const std::string &vaultKey);
+    Result<std::unique_ptr<CryptoContext>> createKeyEncryptionKey(VaultInfo &vaultInfo, const std::string &vaultKey, KdfAlgorithm kdfAlgorithm) const;
+    ClamStatus readVaultMetaData(const FileLock *writeLock = nullptr);
+    ClamStatus readLegacyVaultMetaData(std::istream &fileStream, uint32_t version, std::vector<VaultInfo> &vaultInfos) const;
+    ClamStatus migrateVaultFiles(const std::vector<VaultInfo> &vaultInfos) const;
+    ClamStatus writeVaultMetaData(const std::vector<VaultInfo> &vaultInfos, uint32_t activeSlot, uint32_t capacity);
+    ClamStatus mapMetaFile(bool writable = false);
+    void unmapMetaFile();
+    ClamStatus grow();
+    MetaHeader &header() const;
+    uint32_t *nameIndex() const;
+    uint32_t nameIndexCapacity() const;
+    MetaSlot &slot(uint32_t slotNumber) const;
+    std::string_view slotName(uint32_t slotNumber) const;
+    Result<VaultInfo> readSlot(uint32_t slotNumber) const;
+    void writeSlot(uint32_t slotNumber, const VaultInfo &vaultInfo);
+    std::optional<uint32_t> findSlot(std::string_view vaultName, size_t *bucketOut = nullptr) const;
+    void indexSlot(uint32_t slotNumber);
+    void unindexBucket(size_t bucket);
+    uint64_t nameHash(std::string_view vaultName) const;
 
-    std::vector<VaultInfo> vaultMetaData;
+    unsigned char *metaFileData; // mapping of the meta file (see mapMetaFile), or nullptr if there is no meta file yet
+    size_t metaFileSize;
+    uint64_t metaFileInode; // of the mapped meta file, which other processes may have replaced since
+    bool metaFileWritable; // whether the meta file is mapped writable, which only writers (see lockMetaFile) need
+    std::vector<uint32_t> touchedMetaBlocks; // blocks of the meta file changed since beginMetaWrite
     const std::string metadataFilePath;
+    const std::string lockFilePath;
+    const std::string logFilePath;
     const std::string vaultDir;
+    const uint32_t unlockMillis; // unlock time that the KDF parameters of new vault keys are calibrated to
 };
 
 #endif
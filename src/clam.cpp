@@ -0,0 +1,203 @@
+#include "clam.h"
+#include "VaultManager.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+struct clam_store {
+    VaultManager vaultManager;
+};
+
+struct clam_vault {
+    std::unique_ptr<Vault> vault;
+};
+
+/**
+    Returns a copy of the given string, allocated with malloc, or nullptr if it cannot be allocated.
+*/
+static char *copyString(std::string_view str) {
+    char *copy = (char *)std::malloc(str.size() + 1);
+    if (copy != nullptr) {
+        std::memcpy(copy, str.data(), str.size());
+        copy[str.size()] = '\0';
+    }
+    return copy;
+}
+
+/**
+    Wipes and frees a string returned by copyString.
+*/
+static void freeString(char *str) {
+    if (str != nullptr) {
+        std::memset(str, 0, std::strlen(str));
+        std::free(str);
+    }
+}
+
+/**
+    Returns the given string, or an empty string if it is NULL.
+*/
+static const char *orEmpty(const char *str) {
+    return str == nullptr ? "" : str;
+}
+
+/**
+    Runs the given operation, and returns CLAM_ERROR_OUT_OF_MEMORY instead of letting std::bad_alloc
+    propagate through the C ABI.
+*/
+template <typename Operation>
+static ClamStatus guard(Operation operation) {
+    try {
+        return operation();
+    } catch (const std::bad_alloc &) {
+        return CLAM_ERROR_OUT_OF_MEMORY;
+    }
+}
+
+/**
+    Reads the metadata of the vaults in the given data directory, which holds the meta file and the
+    vaults directory, and stores a handle to them in 'store.'
+*/
+enum ClamStatus clam_store_open(const char *dataDir, clam_store **store) {
+    if (dataDir == nullptr || store == nullptr) {
+        return CLAM_ERROR_INVALID_ARGUMENT;
+    }
+    return guard([&]() {
+        const std::string programDataDir = std::string(dataDir) + "/";
+        Result<VaultManager> vaultManager = VaultManager::open(programDataDir + "meta", programDataDir + "vaults/", KDF_DEFAULT_UNLOCK_MS);
+        if (!vaultManager) {
+            return vaultManager.error();
+        }
+        *store = new clam_store { std::move(*vaultManager) };
+        return CLAM_OK;
+    });
+}
+
+void clam_store_close(clam_store *store) {
+    delete store;
+}
+
+/**
+    Unlocks and loads the active vault of the store with the given vault key, and stores a handle
+    to it in 'vault.' The store may be closed while the vault remains open.
+*/
+enum ClamStatus clam_vault_open(const clam_store *store, const char *vaultKey, clam_vault **vault) {
+    if (store == nullptr || vaultKey == nullptr || vault == nullptr) {
+        return CLAM_ERROR_INVALID_ARGUMENT;
+    }
+    return guard([&]() {
+        Result<std::unique_ptr<Vault>> activeVault = store->vaultManager.openActiveVault(vaultKey);
+        if (!activeVault) {
+            return activeVault.error();
+        }
+        *vault = new clam_vault { std::move(*activeVault) };
+        return CLAM_OK;
+    });
+}
+
+/**
+    Persists all changes made to the vault since it was opened (or last written), merging them into
+    the changes that other processes wrote in the meantime. Returns CLAM_ERROR_WRITE_CONFLICT, writing
+    nothing, if they changed the same account fields, after which the vault holds their version.
+*/
+enum ClamStatus clam_vault_write(clam_vault *vault) {
+    if (vault == nullptr) {
+        return CLAM_ERROR_INVALID_ARGUMENT;
+    }
+    return guard([&]() {
+        return vault->vault->writeVault();
+    });
+}
+
+/**
+    Wipes the decrypted accounts of the vault from memory and closes it. Changes that have not
+    been written with clam_vault_write are discarded.
+*/
+void clam_vault_close(clam_vault *vault) {
+    delete vault;
+}
+
+/**
+    Stores a copy of the account with the given tag in 'account,' which must be released with
+    clam_account_free.
+*/
+enum ClamStatus clam_account_get(clam_vault *vault, const char *tag, clam_account *account) {
+    if (vault == nullptr || tag == nullptr || account == nullptr) {
+        return CLAM_ERROR_INVALID_ARGUMENT;
+    }
+    return guard([&]() {
+        Result<AccountView> view = vault->vault->getAccountView(tag);
+        if (!view) {
+            return view.error();
+        }
+        account->tag = copyString(view->tag);
+        account->username = copyString(view->username);
+        account->password = copyString(view->password);
+        account->note = copyString(view->note);
+        if (account->tag == nullptr || account->username == nullptr || account->password == nullptr || account->note == nullptr) {
+            clam_account_free(account);
+            return CLAM_ERROR_OUT_OF_MEMORY;
+        }
+        return CLAM_OK;
+    });
+}
+
+/**
+    Adds the given account to the vault (NULL fields are empty). The change is persisted by clam_vault_write.
+*/
+enum ClamStatus clam_account_add(clam_vault *vault, const clam_account *account) {
+    if (vault == nullptr || account == nullptr || account->tag == nullptr) {
+        return CLAM_ERROR_INVALID_ARGUMENT;
+    }
+    return guard([&]() {
+        Account newAccount(account->tag, orEmpty(account->username), orEmpty(account->password));
+        newAccount.setNote(orEmpty(account->note));
+        ClamStatus status = vault->vault->addAccount(newAccount.view());
+        newAccount.wipeSensitiveData();
+        return status;
+    });
+}
+
+/**
+    Replaces the username, password and note of the account with the given account's tag (NULL fields
+    are empty). The change is persisted by clam_vault_write.
+*/
+enum ClamStatus clam_account_update(clam_vault *vault, const clam_account *account) {
+    if (vault == nullptr || account == nullptr || account->tag == nullptr) {
+        return CLAM_ERROR_INVALID_ARGUMENT;
+    }
+    return guard([&]() {
+        Account updatedAccount(account->tag, orEmpty(account->username), orEmpty(account->password));
+        updatedAccount.setNote(orEmpty(account->note));
+        ClamStatus status = vault->vault->updateAccount(updatedAccount.view());
+        updatedAccount.wipeSensitiveData();
+        return status;
+    });
+}
+
+/**
+    Removes the account with the given tag from the vault. The change is persisted by clam_vault_write.
+*/
+enum ClamStatus clam_account_remove(clam_vault *vault, const char *tag) {
+    if (vault == nullptr || tag == nullptr) {
+        return CLAM_ERROR_INVALID_ARGUMENT;
+    }
+    return guard([&]() {
+        return vault->vault->removeAccount(tag);
+    });
+}
+
+/**
+    Wipes and frees the strings of an account returned by clam_account_get.
+*/
+void clam_account_free(clam_account *account) {
+    if (account == nullptr) {
+        return;
+    }
+    freeString(account->tag);
+    freeString(account->username);
+    freeString(account->password);
+    freeString(account->note);
+    account->tag = account->username = account->password = account->note = nullptr;
+}
@@ -0,0 +1,44 @@
+#ifndef CLAM_H
+#define CLAM_H
+
+#include "Status.h"
+
+/*
+    The C ABI of libclam, through which other programs can unlock a vault once and then read and change
+    its accounts in process, rather than spawning clam for every command. A data directory holds the
+    meta file and vaults of one user (the clam program uses ~/.clam/). Every function that can fail
+    returns a ClamStatus (see clam_status_message); handles are not safe to share between threads, but
+    any number of processes may use the same data directory at once.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct clam_store clam_store; // the vaults of one data directory
+typedef struct clam_vault clam_vault; // one unlocked vault
+
+// An account whose strings are owned by the caller once returned by clam_account_get:
+typedef struct clam_account {
+    char *tag;
+    char *username;
+    char *password;
+    char *note;
+} clam_account;
+
+enum ClamStatus clam_store_open(const char *dataDir, clam_store **store);
+void clam_store_close(clam_store *store);
+enum ClamStatus clam_vault_open(const clam_store *store, const char *vaultKey, clam_vault **vault);
+enum ClamStatus clam_vault_write(clam_vault *vault);
+void clam_vault_close(clam_vault *vault);
+enum ClamStatus clam_account_get(clam_vault *vault, const char *tag, clam_account *account);
+enum ClamStatus clam_account_add(clam_vault *vault, const clam_account *account);
+enum ClamStatus clam_account_update(clam_vault *vault, const clam_account *account);
+enum ClamStatus clam_account_remove(clam_vault *vault, const char *tag);
+void clam_account_free(clam_account *account);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
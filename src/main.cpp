@@ -3,53 +3,102 @@
 #include <pwd.h>
 #include <unistd.h>
 
+#include <cerrno>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <cstdio>
 #include <vector>
+#include <fstream>
 
 #include "CommandLineParser.h"
 #include "Vault.h"
 #include "Utils.h"
+#include "Stats.h"
 #include "VaultManager.h"
+#include "Agent.h"
+#include "AgentClient.h"
+#include "Batch.h"
+#include "AccountStream.h"
+#include "Kdbx.h"
 
 #include "clip/clip.h"
 
 const std::string getProgramName(char *argv[]);
 const std::string getUserHomeDir();
+const std::string getProgramDataDir(const CommandLineParser &commandOpts, const std::string &programName);
+uint32_t getUnlockMillis();
+void initStats(const CommandLineParser &commandOpts);
+void printStats();
 void initDataDirs(const std::string &programDataDir, const std::string &vaultDir);
 const std::string getVaultKey(const CommandLineParser &commandOpts);
+const char *getAgentSocket(const CommandLineParser &commandOpts);
 const std::string getAccountName(const CommandLineParser &commandOpts, CommandLineOptions nameOpt);
+KdfAlgorithm getKdfAlgorithm(const CommandLineParser &commandOpts);
+AccountFormat getAccountFormat(const CommandLineParser &commandOpts, const std::string &filePath);
+void reportError(ClamStatus status);
+void addDefaultVault(VaultManager &vaultManager, const std::string &vaultKey);
+std::unique_ptr<Vault> openActiveVault(VaultManager &vaultManager, const std::string &vaultKey);
+void copyToClipboard(std::string_view text);
 
 void handleInvalidCommand(const std::string &errorDetails);
 void processVaultCommand(const CommandLineParser &commandOpts, VaultManager &vaultManager);
 void processHelpCommand();
+void processAgentCommand(const CommandLineParser &commandOpts, VaultManager &vaultManager);
+void processBatchCommand(const CommandLineParser &commandOpts, VaultManager &vaultManager);
+void processImportCommand(const CommandLineParser &commandOpts, VaultManager &vaultManager);
+void processExportCommand(const CommandLineParser &commandOpts, VaultManager &vaultManager);
+void processImportKdbxCommand(const CommandLineParser &commandOpts, VaultManager &vaultManager);
 void processAccountCommand(const CommandLineParser &commandOpts, VaultManager &vaultManager);
-void processAccountPrintCommand(const CommandLineParser &commandOpts, Vault &activeVault);
-void processAccountClipCommand(const CommandLineParser &commandOpts, Vault &activeVault);
-void processAccountUpdateCommand(const CommandLineParser &commandOpts, Vault &activeVault);
-void processAccountAddCommand(const CommandLineParser &commandOpts, Vault &activeVault);
+
+// Account commands run either on the unlocked Vault or on an AgentClient:
+template <typename VaultType> void runAccountCommand(const CommandLineParser &commandOpts, VaultType &activeVault);
+template <typename VaultType> void commitVault(VaultType &activeVault);
+template <typename VaultType> void processAccountPrintCommand(const CommandLineParser &commandOpts, VaultType &activeVault);
+template <typename VaultType> void processAccountClipCommand(const CommandLineParser &commandOpts, VaultType &activeVault);
+template <typename VaultType> void processAccountUpdateCommand(const CommandLineParser &commandOpts, VaultType &activeVault);
+template <typename VaultType> void processAccountAddCommand(const CommandLineParser &commandOpts, VaultType &activeVault);
+template <typename VaultType> void processAccountSearchCommand(const CommandLineParser &commandOpts, VaultType &activeVault);
+
+// The format in which stats are printed on exit, if they are enabled:
+static StatsFormat statsFormat = STATS_FORMAT_TEXT;
 
 int main(int argc, char *argv[]) {
     Utils::debugDisable();
     Utils::debugPrint(std::cout, "Entered main\n");
 
     const std::string programName = getProgramName(argv);
-    const std::string userHomeDir = getUserHomeDir();
-    const std::string programDataDir = std::string(userHomeDir) + "/." + programName + "/";
+
+    CommandLineParser commandOpts(argc, argv);
+    initStats(commandOpts);
+
+    const std::string programDataDir = getProgramDataDir(commandOpts, programName);
     const std::string metadataFilePath = programDataDir + "meta";
     const std::string vaultDir = programDataDir + "vaults/";
 
     initDataDirs(programDataDir, vaultDir);
 
-    VaultManager vaultManager(metadataFilePath, vaultDir);
+    Result<VaultManager> openedVaultManager = VaultManager::open(metadataFilePath, vaultDir, getUnlockMillis());
+    if (!openedVaultManager) {
+        reportError(openedVaultManager.error());
+    }
+    VaultManager &vaultManager = *openedVaultManager;
 
-    CommandLineParser commandOpts(argc, argv);
     if (commandOpts.containsOpt(CommandLineOptions::VAULT_OPTION)) {
         // This is a vault command
         processVaultCommand(commandOpts, vaultManager);
     } else if (commandOpts.containsOpt(CommandLineOptions::HELP_OPTION)) {
         processHelpCommand();
+    } else if (commandOpts.containsOpt(CommandLineOptions::AGENT_OPTION)) {
+        processAgentCommand(commandOpts, vaultManager);
+    } else if (commandOpts.containsOpt(CommandLineOptions::BATCH_OPTION)) {
+        processBatchCommand(commandOpts, vaultManager);
+    } else if (commandOpts.containsOpt(CommandLineOptions::IMPORT_OPTION)) {
+        processImportCommand(commandOpts, vaultManager);
+    } else if (commandOpts.containsOpt(CommandLineOptions::EXPORT_OPTION)) {
+        processExportCommand(commandOpts, vaultManager);
+    } else if (commandOpts.containsOpt(CommandLineOptions::IMPORT_KDBX_OPTION)) {
+        processImportKdbxCommand(commandOpts, vaultManager);
     } else {
         // This is a command that pertains to some account (or accounts) in the currently active vault
         processAccountCommand(commandOpts, vaultManager);
@@ -84,19 +133,95 @@ const std::string getUserHomeDir() {
 }
 
 /**
-    Creates the program data directory and vaults subdirectory if either one does not yet exist.
+    Returns the directory that holds the meta file and the vaults directory, which is the DATA_DIR_OPTION
+    parameter if it is given, or else the DATA_DIR_ENV variable if it is set, or else ~/.<program name>.
+    The returned path always ends with a '/'.
+*/
+const std::string getProgramDataDir(const CommandLineParser &commandOpts, const std::string &programName) {
+    std::string dataDir;
+    const char *dataDirEnv = getenv(DATA_DIR_ENV);
+    if (commandOpts.containsOpt(CommandLineOptions::DATA_DIR_OPTION)) {
+        dataDir = commandOpts.getOpt(CommandLineOptions::DATA_DIR_OPTION);
+        if (dataDir == "") {
+            handleInvalidCommand("No data directory provided.");
+        }
+    } else if (dataDirEnv != NULL && std::string(dataDirEnv) != "") {
+        dataDir = dataDirEnv;
+    } else {
+        dataDir = getUserHomeDir() + "/." + programName;
+    }
+
+    return dataDir.back() == '/' ? dataDir : dataDir + "/";
+}
+
+/**
+    Returns the unlock time (in milliseconds) that the KDF parameters of new vault keys are
+    calibrated to, which is KDF_DEFAULT_UNLOCK_MS unless the KDF_UNLOCK_MS_ENV variable is set.
+*/
+uint32_t getUnlockMillis() {
+    const char *unlockMillis = getenv(KDF_UNLOCK_MS_ENV);
+    if (unlockMillis == NULL) {
+        return KDF_DEFAULT_UNLOCK_MS;
+    }
+    try {
+        unsigned long millis = std::stoul(unlockMillis);
+        if (millis > 0 && millis <= UINT32_MAX) {
+            return (uint32_t)millis;
+        }
+    } catch (const std::exception &) {
+    }
+    std::cout << "Error: " << KDF_UNLOCK_MS_ENV << " must be a positive number of milliseconds." << std::endl;
+    exit(1);
+}
+
+/**
+    Enables stats if the --stats option is given (or else the STATS_ENV variable is set to anything
+    but 0), in which case they are printed to stderr when the program exits. The format is given by
+    the option's argument or the variable's value: text (the default, also selected by 1) or json.
+*/
+void initStats(const CommandLineParser &commandOpts) {
+    std::string format;
+    if (commandOpts.containsOpt(CommandLineOptions::STATS_OPTION)) {
+        format = commandOpts.getOpt(CommandLineOptions::STATS_OPTION);
+    } else {
+        const char *statsEnv = getenv(STATS_ENV);
+        if (statsEnv == NULL || std::string(statsEnv) == "" || std::string(statsEnv) == "0") {
+            return;
+        }
+        format = statsEnv;
+    }
+
+    if (format == "" || format == "1" || format == "text") {
+        statsFormat = STATS_FORMAT_TEXT;
+    } else if (format == "json") {
+        statsFormat = STATS_FORMAT_JSON;
+    } else {
+        std::cout << "Error: Invalid stats format. The supported formats are text and json." << std::endl;
+        exit(1);
+    }
+    Stats::enable();
+    atexit(printStats);
+}
+
+/**
+    Prints the stats of this run of the program to stderr.
+*/
+void printStats() {
+    Stats::print(std::cerr, statsFormat);
+}
+
+/**
+    Creates the program data directory and vaults subdirectory if either one does not yet exist
+    (though not the data directory's parent), and exits with an error if either cannot be created.
 */
 void initDataDirs(const std::string &programDataDir, const std::string &vaultDir) {
     Utils::debugPrint(std::cout, "Entered initialize\n");
 
-    struct stat info;
-    if (((stat(programDataDir.c_str(), &info) != 0)) ||
-        ((stat(vaultDir.c_str(), &info) != 0))) {
-        // program data or vaults directories do not exist:
-        
-        // Create empty program data and vaults directories:
-        system(("mkdir " + programDataDir).c_str());
-        system(("mkdir " + vaultDir).c_str());
+    for (const std::string &dir : { programDataDir, vaultDir }) {
+        if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+            std::cout << "Error: Failed to create the directory " << dir << " (" << std::strerror(errno) << ")." << std::endl;
+            exit(1);
+        }
     }
 }
 
@@ -112,6 +237,18 @@ const std::string getVaultKey(const CommandLineParser &commandOpts) {
     return vaultKey;
 }
 
+/**
+    Returns the socket path of the agent that serves the command, which is the one named by
+    AGENT_SOCKET_ENV unless the command gives a vault key (which may be for another vault than the
+    agent's), or NULL if the command is not served by an agent.
+*/
+const char *getAgentSocket(const CommandLineParser &commandOpts) {
+    if (commandOpts.containsOpt(CommandLineOptions::KEY_OPTION)) {
+        return NULL;
+    }
+    return getenv(AGENT_SOCKET_ENV);
+}
+
 /**
     Attempts to retrieve the name parameter from the command options and
     reports a generic error if the option does not exist.
@@ -124,6 +261,85 @@ const std::string getAccountName(const CommandLineParser &commandOpts, CommandLi
     return name;
 }
 
+/**
+    Returns the KDF selected by the KDF_OPTION parameter, or the default KDF if the option
+    does not exist, and reports a generic error if the option names no KDF.
+*/
+KdfAlgorithm getKdfAlgorithm(const CommandLineParser &commandOpts) {
+    if (!commandOpts.containsOpt(CommandLineOptions::KDF_OPTION)) {
+        return Kdf::defaultAlgorithm();
+    }
+    std::optional<KdfAlgorithm> algorithm = Kdf::findAlgorithm(commandOpts.getOpt(CommandLineOptions::KDF_OPTION));
+    if (!algorithm.has_value()) {
+        handleInvalidCommand("Invalid KDF (options are: " + Kdf::algorithmNames() + ").");
+    }
+    return *algorithm;
+}
+
+/**
+    Returns the format selected by the FORMAT_OPTION parameter, or else the format implied by the
+    extension of the given file (CSV unless it is .json), and reports a generic error if the option
+    names no format.
+*/
+AccountFormat getAccountFormat(const CommandLineParser &commandOpts, const std::string &filePath) {
+    if (!commandOpts.containsOpt(CommandLineOptions::FORMAT_OPTION)) {
+        const std::string jsonExtension = ".json";
+        bool isJson = filePath.size() >= jsonExtension.size()
+            && filePath.compare(filePath.size() - jsonExtension.size(), jsonExtension.size(), jsonExtension) == 0;
+        return isJson ? FORMAT_JSON : FORMAT_CSV;
+    }
+    std::optional<AccountFormat> format = AccountReader::findFormat(commandOpts.getOpt(CommandLineOptions::FORMAT_OPTION));
+    if (!format.has_value()) {
+        handleInvalidCommand("Invalid format (options are: csv or json).");
+    }
+    return *format;
+}
+
+/**
+    Prints the error message of the given status, which must not be CLAM_OK. Errors in which a vault or
+    the meta file could not be read or written (CLAM_ERROR_FIRST_FAILURE and above) also exit the program.
+*/
+void reportError(ClamStatus status) {
+    std::cout << "Error: ";
+    if (status == CLAM_ERROR_NO_VAULTS) {
+        std::cout << "You must first create a vault using the -v add command.";
+    } else if (status == CLAM_ERROR_ACCOUNT_NOT_FOUND) {
+        std::cout << clam_status_message(status) << " You may create an account using the -a option.";
+    } else {
+        std::cout << clam_status_message(status);
+    }
+    std::cout << std::endl;
+
+    if (status >= CLAM_ERROR_FIRST_FAILURE) {
+        exit(1);
+    }
+}
+
+/**
+    Creates a "default" vault whose key is the given vault key, so that accounts can be added without
+    first explicitly creating a vault. Reports an error and exits if the vault cannot be created.
+*/
+void addDefaultVault(VaultManager &vaultManager, const std::string &vaultKey) {
+    ClamStatus status = vaultManager.addVault("default_vault", vaultKey, Kdf::defaultAlgorithm());
+    if (status != CLAM_OK) {
+        reportError(status);
+        exit(1);
+    }
+}
+
+/**
+    Unlocks and loads the active vault, or reports an error and returns nullptr if the vault key is
+    incorrect (or there is no vault). Exits if the vault cannot be read.
+*/
+std::unique_ptr<Vault> openActiveVault(VaultManager &vaultManager, const std::string &vaultKey) {
+    Result<std::unique_ptr<Vault>> activeVault = vaultManager.openActiveVault(vaultKey);
+    if (!activeVault) {
+        reportError(activeVault.error());
+        return nullptr;
+    }
+    return std::move(*activeVault);
+}
+
 /**
     Called when a parse error is encountered. Calls the processHelpCommand
     function to inform user of proper command syntax and exits the program.
@@ -147,8 +363,27 @@ void processVaultCommand(const CommandLineParser &commandOpts, VaultManager &vau
     const std::string listOption = "list";
 
     const std::string metaCommand = commandOpts.getOpt(CommandLineOptions::VAULT_OPTION);
+    const char *agentSocket = getAgentSocket(commandOpts);
+    if (metaCommand == listOption && agentSocket != NULL) {
+        // List the accounts of the vault held by the agent, without unlocking it again:
+        AgentClient agent(agentSocket);
+        if (commandOpts.containsOpt(CommandLineOptions::INFO_OPTION)) {
+            ClamStatus status = agent.printInfo(std::cout);
+            if (status != CLAM_OK) {
+                reportError(status);
+            }
+        } else {
+            agent.printTags(std::cout);
+        }
+        return;
+    }
     if (metaCommand == listOption && !commandOpts.containsOpt(CommandLineOptions::KEY_OPTION)) {
-        vaultManager.listVaultNames();
+        if (vaultManager.empty()) {
+            reportError(CLAM_ERROR_NO_VAULTS);
+        }
+        for (const std::string &vaultName : vaultManager.getVaultNames()) {
+            std::cout << vaultName << std::endl;
+        }
         return;
     }
 
@@ -160,37 +395,78 @@ void processVaultCommand(const CommandLineParser &commandOpts, VaultManager &vau
         if (newVaultName == "") {
             handleInvalidCommand("Name of vault to add not provided.");
         }
-        vaultManager.addVault(newVaultName, vaultKey);
+        ClamStatus status = vaultManager.addVault(newVaultName, vaultKey, getKdfAlgorithm(commandOpts));
+        if (status != CLAM_OK) {
+            reportError(status);
+        }
+    } else if (metaCommand == updateOption && commandOpts.containsOpt(CommandLineOptions::CIPHER_OPTION)) {
+        // Re-encrypt the active vault with another cipher suite:
+        if (commandOpts.containsOpt(CommandLineOptions::NEWKEY_OPTION)) {
+            handleInvalidCommand("Update the vault key and cipher suite with separate commands.");
+        }
+        std::optional<CipherSuite> suite = CryptoContext::findCipherSuite(commandOpts.getOpt(CommandLineOptions::CIPHER_OPTION));
+        if (!suite.has_value()) {
+            handleInvalidCommand("Invalid cipher suite (options are: " + CryptoContext::cipherSuiteNames() + ").");
+        }
+        ClamStatus status = vaultManager.updateActiveVaultCipherSuite(vaultKey, *suite);
+        if (status != CLAM_OK) {
+            reportError(status);
+            return;
+        }
+        std::cout << "The active vault is now encrypted with " << CryptoContext::cipherSuiteName(*suite) << "." << std::endl;
     } else if (metaCommand == updateOption) {
         // Verify that vaultKey is correct and report error and exit if not
         const std::string newVaultKey = commandOpts.getOpt(CommandLineOptions::NEWKEY_OPTION);
         if (newVaultKey == "") {
             handleInvalidCommand("New vault key not provided.");
         }
-        vaultManager.updateActiveVaultKey(vaultKey, newVaultKey);
+        ClamStatus status = vaultManager.updateActiveVaultKey(vaultKey, newVaultKey, getKdfAlgorithm(commandOpts));
+        if (status != CLAM_OK) {
+            reportError(status);
+            return;
+        }
+        std::cout << "Successfully updated key for vault " + vaultManager.activeVaultInfo().vaultName << std::endl;
     } else if (metaCommand == switchOption) {
         const std::string vaultToSwitchToName = commandOpts.getOpt(CommandLineOptions::NAME_OPTION);
         if (vaultToSwitchToName == "") {
             handleInvalidCommand("Name of vault to switch to not provided.");
         }
-        vaultManager.switchActiveVault(vaultKey, vaultToSwitchToName);     
+        ClamStatus status = vaultManager.switchActiveVault(vaultKey, vaultToSwitchToName);
+        if (status == CLAM_ERROR_ALREADY_ACTIVE) {
+            std::cout << "Error: " + vaultToSwitchToName + " is already the active vault." << std::endl;
+        } else if (status == CLAM_ERROR_VAULT_NOT_FOUND) {
+            std::cout << "Error: No vault with the name of \"" + vaultToSwitchToName + "\" exist" << std::endl;
+        } else if (status != CLAM_OK) {
+            reportError(status);
+        } else {
+            std::cout << "Switched to vault " + vaultManager.activeVaultInfo().vaultName + "." << std::endl;
+        }
     } else if (metaCommand == deleteOption) {
         const std::string vaultToDeleteName = commandOpts.getOpt(CommandLineOptions::NAME_OPTION);
         if (vaultToDeleteName == "") {
             handleInvalidCommand("Name of vault to delete not provided.");
         }
-        vaultManager.deleteVault(vaultKey, vaultToDeleteName);
-
+        ClamStatus status = vaultManager.deleteVault(vaultKey, vaultToDeleteName);
+        if (status == CLAM_ERROR_VAULT_NOT_FOUND) {
+            std::cout << "Error: No vault with the name of \"" + vaultToDeleteName + "\" exist" << std::endl;
+        } else if (status != CLAM_OK) {
+            reportError(status);
+        } else {
+            std::cout << vaultToDeleteName + " has been deleted."<< std::endl;
+        }
     } else if (metaCommand == listOption) {
-        if (!VaultManager::validateKey(vaultKey, vaultManager.activeVaultInfo().vaultSkeySalt, vaultManager.activeVaultInfo().vaultSkeyHash)) {
+        std::unique_ptr<Vault> activeVault = openActiveVault(vaultManager, vaultKey);
+        if (!activeVault) {
             return;
         }
-        Vault activeVault(vaultManager.getVaultDir(), vaultManager.activeVaultInfo().vaultName, vaultKey);
 
         if (commandOpts.containsOpt(CommandLineOptions::INFO_OPTION)) {
-            activeVault.printInfo(std::cout);
+            ClamStatus status = activeVault->printInfo(std::cout);
+            if (status != CLAM_OK) {
+                reportError(status);
+            }
         } else {
-            activeVault.printTags(std::cout);
+            activeVault->printTags(std::cout);
         }
     } else {
         handleInvalidCommand("Invalid vault command.");
@@ -202,8 +478,8 @@ void processVaultCommand(const CommandLineParser &commandOpts, VaultManager &vau
     Standard format taken from: http://docopt.org/
 
     Usage:
-        clam --vault (add --name <vault-name> --key <vault-key>
-            | update --key <vault-key> --knew <new-key>
+        clam --vault (add --name <vault-name> --key <vault-key> [--kdf <kdf>]
+            | update --key <vault-key> (--knew <new-key> [--kdf <kdf>] | --cipher <cipher-suite>)
             | switch --name <vault-name> --key <vault-key>
             | delete --name <vault-name> --key <vault-key>
             | list [--key <vault-key> [--info]])
@@ -211,11 +487,18 @@ void processVaultCommand(const CommandLineParser &commandOpts, VaultManager &vau
         clam --clip <account-name> --key <vault-key> --username | --password
         clam --update <account-name> --key <vault-key> (--username <username> | --password <password> | --note <note> | --file <file-path> | --delete)
         clam --add <account-name> --key <vault-key> [--file <file-path> | --username <username> --password <password>]
+        clam --search <pattern> --key <vault-key> [--limit <n>]
+        clam --agent --key <vault-key> [--timeout <seconds>]
+        clam --batch --key <vault-key> [--file <batch-file-path>]
+        clam --import <file-path> --key <vault-key> [--format <format>]
+        clam --export --key <vault-key> [--format <format>]
+        clam --import-kdbx <kdbx-file-path> --kdbx-key <kdbx-password> --key <vault-key>
+        (any of the above) [--stats[=<format>]] [--data-dir <dir>]
 
     Options:
         -v, --vault=vault-opt           vault command (options are: add, update, switch, delete, or list)
                                             add: Create a new vault
-                                            update: Update the key for the active vault.
+                                            update: Update the key or cipher suite for the active vault.
                                             switch: Switch to a different vault.
                                             delete: Delete a vault (cannot be the active vault).
                                             list: List vault names or account names/info (for the active vault).
@@ -228,18 +511,40 @@ void processVaultCommand(const CommandLineParser &commandOpts, VaultManager &vau
         -p, --print                     Print some account information to the console.
         -u, --update                    Update some information for some account in the active vault.
         --knew, --newkey=new-key        new vault key input                 
+        --cipher=cipher-suite           cipher suite used to encrypt the active vault
+                                            (options are: twofish-ctr, aes-256-gcm, or chacha20-poly1305)
+        --kdf=kdf                       KDF from which a new vault key is derived (options are: pbkdf2-sha256 or argon2id)
         -f, --file=acct-filepath        Path to the file containing unencrypted account data to load.
         -f, --delete                    Delete an account from the active vault.
         -a, --add                       Add a new account to the active vault.
         -i, --info                      List info for all accounts in the active vault.
+        -s, --search=pattern            List the account names that begin with (or nearly begin with) the pattern.
+        --limit=n                       Maximum number of search results (default: 20).
+        --agent                         Unlock the active vault once and serve account commands from a background agent.
+                                            Evaluate the printed commands (eval "$(clam --agent ...)") so that later account
+                                            commands (and vault list) use the agent through CLAM_AGENT_SOCK. Commands
+                                            given a --key do not use the agent.
+        --timeout=seconds               Seconds without a request after which the agent exits (default: 900).
+        --batch                         Apply the account commands read from stdin (or the --file) to the active vault,
+                                            writing it once if all of them succeed (see Batch.h for the format).
+        --import=file-path              Add the accounts in the CSV or JSON file (or stdin if it is -) to the active vault.
+        --export                        Print all accounts in the active vault as CSV or JSON.
+        --format=format                 format of imported or exported accounts (options are: csv or json)
+        --import-kdbx=kdbx-file-path    Add the entries of a KeePass (KDBX 4) database to the active vault, named by their
+                                            group path and title (e.g. Email/Work/Gmail).
+        --kdbx-key=kdbx-password        password of the KeePass database to import
+        --stats[=format]                Print the time spent in each phase of the command, heap allocations and bytes of
+                                            plaintext copied to stderr (options are: text or json; also enabled by CLAM_STATS).
+        --data-dir=dir                  directory holding the meta file and vaults (default: the CLAM_HOME environment
+                                            variable if it is set, or else ~/.clam)
         -h, --help                      Display usage and options for this program.
 
     Additional documentation and source code can be found at: https://github.com/Kylefc64/pw-manager-lite
 */
 void processHelpCommand() {
     std::cout << "Usage:\n"
-        << "    clam --vault (add --name <vault-name> --key <vault-key>\n"
-        << "        | update --key <vault-key> --knew <new-key>\n"
+        << "    clam --vault (add --name <vault-name> --key <vault-key> [--kdf <kdf>]\n"
+        << "        | update --key <vault-key> (--knew <new-key> [--kdf <kdf>] | --cipher <cipher-suite>)\n"
         << "        | switch --name <vault-name> --key <vault-key>\n"
         << "        | delete --name <vault-name> --key <vault-key>\n"
         << "        | list [--key <vault-key> [--info]])\n"
@@ -251,12 +556,19 @@ void processHelpCommand() {
         << "                                                  | --file <file-path>\n"
         << "                                                  | --delete)\n"
         << "    clam --add <account-name> --key <vault-key> [--file <file-path>\n"
-        << "                                               | --username <username> --password <password>]\n\n"
+        << "                                               | --username <username> --password <password>]\n"
+        << "    clam --search <pattern> --key <vault-key> [--limit <n>]\n"
+        << "    clam --agent --key <vault-key> [--timeout <seconds>]\n"
+        << "    clam --batch --key <vault-key> [--file <batch-file-path>]\n"
+        << "    clam --import <file-path> --key <vault-key> [--format <format>]\n"
+        << "    clam --export --key <vault-key> [--format <format>]\n"
+        << "    clam --import-kdbx <kdbx-file-path> --kdbx-key <kdbx-password> --key <vault-key>\n"
+        << "    (any of the above) [--stats[=<format>]] [--data-dir <dir>]\n\n"
 
     << "Options:\n"
     << "-v, --vault=vault-opt           vault command (options are: add, update, switch, delete, or list)\n"
     << "                                    add: Create a new vault\n"
-    << "                                    update: Update the key for the active vault.\n"
+    << "                                    update: Update the key or cipher suite for the active vault.\n"
     << "                                    switch: Switch to a different vault.\n"
     << "                                    delete: Delete a vault (cannot be the active vault).\n"
     << "                                    list: List vault names or account names/info (for the active vault).\n"
@@ -269,23 +581,252 @@ void processHelpCommand() {
     << "-p, --print                     Print some account information to the console.\n"
     << "-u, --update                    Update some information for some account in the active vault.\n"
     << "--knew, --newkey=new-key        new vault key input\n"
+    << "--cipher=cipher-suite           cipher suite used to encrypt the active vault\n"
+    << "                                    (options are: " << CryptoContext::cipherSuiteNames() << ")\n"
+    << "--kdf=kdf                       KDF from which a new vault key is derived\n"
+    << "                                    (options are: " << Kdf::algorithmNames() << ")\n"
     << "-f, --file=acct-filepath        Path to the file containing unencrypted account data to load.\n"
     << "-f, --delete                    Delete an account from the active vault.\n"
     << "-a, --add                       Add a new account to the active vault.\n"
     << "-i, --info                      List info for all accounts in the active vault.\n"
+    << "-s, --search=pattern            List the account names that begin with (or nearly begin with) the pattern.\n"
+    << "--limit=n                       Maximum number of search results (default: " << SEARCH_DEFAULT_LIMIT << ").\n"
+    << "--agent                         Unlock the active vault once and serve account commands from a background agent.\n"
+    << "                                    Evaluate the printed commands (eval \"$(clam --agent ...)\") so that later account\n"
+    << "                                    commands (and vault list) use the agent through " << AGENT_SOCKET_ENV << ". Commands\n"
+    << "                                    given a --key do not use the agent.\n"
+    << "--timeout=seconds               Seconds without a request after which the agent exits (default: " << AGENT_DEFAULT_TIMEOUT << ").\n"
+    << "--batch                         Apply the account commands read from stdin (or the --file) to the active vault,\n"
+    << "                                    writing it once if all of them succeed.\n"
+    << "--import=file-path              Add the accounts in the CSV or JSON file (or stdin if it is -) to the active vault.\n"
+    << "--export                        Print all accounts in the active vault as CSV or JSON.\n"
+    << "--format=format                 format of imported or exported accounts (options are: csv or json)\n"
+    << "--import-kdbx=kdbx-file-path    Add the entries of a KeePass (KDBX 4) database to the active vault, named by their\n"
+    << "                                    group path and title (e.g. Email/Work/Gmail).\n"
+    << "--kdbx-key=kdbx-password        password of the KeePass database to import\n"
+    << "--stats[=format]                Print the time spent in each phase of the command, heap allocations and bytes of\n"
+    << "                                    plaintext copied to stderr (options are: text or json; also enabled by " << STATS_ENV << ").\n"
+    << "--data-dir=dir                  directory holding the meta file and vaults (default: the " << DATA_DIR_ENV << " environment\n"
+    << "                                    variable if it is set, or else ~/.clam)\n"
     << "-h, --help                      Display usage and options for this program.\n\n"
 
     << "Additional documentation and source code can be found at:\n"
         << "    https://github.com/Kylefc64/pw-manager-lite" << std::endl;
 }
 
+/**
+    Processes an agent command: unlocks the active vault and hands it to a background Agent,
+    printing the shell commands that point later account commands at it.
+*/
+void processAgentCommand(const CommandLineParser &commandOpts, VaultManager &vaultManager) {
+    Utils::debugPrint(std::cout, "Entered processAgentCommand\n");
+
+    unsigned int timeoutSeconds = AGENT_DEFAULT_TIMEOUT;
+    if (commandOpts.containsOpt(CommandLineOptions::TIMEOUT_OPTION)) {
+        const std::string timeoutOpt = commandOpts.getOpt(CommandLineOptions::TIMEOUT_OPTION);
+        if (timeoutOpt.empty() || timeoutOpt.size() > 7 || timeoutOpt.find_first_not_of("0123456789") != std::string::npos
+            || std::stoul(timeoutOpt) == 0) {
+            handleInvalidCommand("Invalid agent timeout.");
+        }
+        timeoutSeconds = (unsigned int)std::stoul(timeoutOpt);
+    }
+
+    const std::string vaultKey = getVaultKey(commandOpts);
+    std::unique_ptr<Vault> activeVault = openActiveVault(vaultManager, vaultKey);
+    if (!activeVault) {
+        return;
+    }
+
+    Agent agent(*activeVault, timeoutSeconds);
+    agent.run();
+}
+
+/**
+    Processes a batch command: applies a batch of account commands (see Batch.h), read from the
+    file given by the FILE_OPTION parameter or else from stdin, to the active vault in one unlock.
+    The vault is written once, and only if every command in the batch succeeded.
+*/
+void processBatchCommand(const CommandLineParser &commandOpts, VaultManager &vaultManager) {
+    Utils::debugPrint(std::cout, "Entered processBatchCommand\n");
+
+    const std::string vaultKey = getVaultKey(commandOpts);
+    if (vaultManager.empty()) {
+        // Create a "default" vault, as the add command does:
+        addDefaultVault(vaultManager, vaultKey);
+    }
+
+    std::unique_ptr<Vault> activeVault = openActiveVault(vaultManager, vaultKey);
+    if (!activeVault) {
+        return;
+    }
+
+    Batch batch(*activeVault);
+    bool applied;
+    if (commandOpts.containsOpt(CommandLineOptions::FILE_OPTION)) {
+        std::ifstream batchFile(commandOpts.getOpt(CommandLineOptions::FILE_OPTION), std::ios::binary);
+        if (!batchFile) {
+            std::cout << "Error: Failed to read the batch file." << std::endl;
+            exit(1);
+        }
+        applied = batch.run(batchFile, std::cout);
+    } else {
+        applied = batch.run(std::cin, std::cout);
+    }
+
+    if (!applied) {
+        exit(1); // no changes are written
+    }
+    commitVault(*activeVault);
+}
+
+/**
+    Processes an import command: adds the accounts parsed from the given CSV or JSON file to the
+    active vault, skipping those whose tags already exist. Accounts are parsed one at a time, and
+    the vault is written once, and only if the whole file was parsed.
+*/
+void processImportCommand(const CommandLineParser &commandOpts, VaultManager &vaultManager) {
+    Utils::debugPrint(std::cout, "Entered processImportCommand\n");
+
+    const std::string filePath = commandOpts.getOpt(CommandLineOptions::IMPORT_OPTION);
+    const AccountFormat format = getAccountFormat(commandOpts, filePath);
+    const std::string vaultKey = getVaultKey(commandOpts);
+    if (vaultManager.empty()) {
+        // Create a "default" vault, as the add command does:
+        addDefaultVault(vaultManager, vaultKey);
+    }
+
+    std::unique_ptr<Vault> activeVault = openActiveVault(vaultManager, vaultKey);
+    if (!activeVault) {
+        return;
+    }
+
+    std::ifstream importFile;
+    if (filePath != "-") {
+        importFile.open(filePath, std::ios::binary);
+        if (!importFile) {
+            std::cout << "Error: Failed to read the import file." << std::endl;
+            exit(1);
+        }
+    }
+
+    AccountReader reader(filePath == "-" ? std::cin : importFile, format);
+    size_t imported = 0;
+    size_t duplicates = 0;
+    for (std::optional<Account> account = reader.next(); account.has_value(); account = reader.next()) {
+        if (activeVault->containsAccount(account->getTag())) {
+            ++duplicates;
+        } else {
+            activeVault->addAccount(account->view());
+            ++imported;
+        }
+        account->wipeSensitiveData();
+    }
+
+    if (reader.failed()) {
+        std::cout << "Error: " << reader.getError() << " No accounts were imported." << std::endl;
+        exit(1);
+    }
+    commitVault(*activeVault);
+    std::cout << "Imported " << imported << " accounts";
+    if (duplicates > 0) {
+        std::cout << " (skipped " << duplicates << " whose names already exist)";
+    }
+    std::cout << '.' << std::endl;
+}
+
+/**
+    Processes an export command: prints every account in the active vault as CSV or JSON.
+*/
+void processExportCommand(const CommandLineParser &commandOpts, VaultManager &vaultManager) {
+    Utils::debugPrint(std::cout, "Entered processExportCommand\n");
+
+    const AccountFormat format = getAccountFormat(commandOpts, "");
+    const std::string vaultKey = getVaultKey(commandOpts);
+    std::unique_ptr<Vault> activeVault = openActiveVault(vaultManager, vaultKey);
+    if (!activeVault) {
+        return;
+    }
+
+    AccountWriter writer(std::cout, format);
+    ClamStatus status = activeVault->forEachAccount([&](const AccountView &account) {
+        writer.write(account);
+    });
+    if (status != CLAM_OK) {
+        reportError(status);
+    }
+    writer.finish();
+}
+
+/**
+    Processes a KDBX import command: decrypts the given KeePass database with the KDBX_KEY_OPTION
+    password and adds its entries to the active vault, skipping those whose tags already exist.
+    Entries are decrypted and parsed one at a time, and the vault is written once, and only if
+    the whole database was read.
+*/
+void processImportKdbxCommand(const CommandLineParser &commandOpts, VaultManager &vaultManager) {
+    Utils::debugPrint(std::cout, "Entered processImportKdbxCommand\n");
+
+    if (!commandOpts.containsOpt(CommandLineOptions::KDBX_KEY_OPTION)) {
+        handleInvalidCommand("No KeePass database password provided.");
+    }
+    const std::string vaultKey = getVaultKey(commandOpts);
+    if (vaultManager.empty()) {
+        // Create a "default" vault, as the add command does:
+        addDefaultVault(vaultManager, vaultKey);
+    }
+
+    std::unique_ptr<Vault> activeVault = openActiveVault(vaultManager, vaultKey);
+    if (!activeVault) {
+        return;
+    }
+
+    std::ifstream kdbxFile(commandOpts.getOpt(CommandLineOptions::IMPORT_KDBX_OPTION), std::ios::binary);
+    if (!kdbxFile) {
+        std::cout << "Error: Failed to read the KeePass database." << std::endl;
+        exit(1);
+    }
+
+    KdbxReader reader(kdbxFile, commandOpts.getOpt(CommandLineOptions::KDBX_KEY_OPTION));
+    size_t imported = 0;
+    size_t duplicates = 0;
+    for (std::optional<Account> account = reader.next(); account.has_value(); account = reader.next()) {
+        if (activeVault->containsAccount(account->getTag())) {
+            ++duplicates;
+        } else {
+            activeVault->addAccount(account->view());
+            ++imported;
+        }
+        account->wipeSensitiveData();
+    }
+
+    if (reader.failed()) {
+        std::cout << "Error: " << reader.getError() << " No accounts were imported." << std::endl;
+        exit(1);
+    }
+    commitVault(*activeVault);
+    std::cout << "Imported " << imported << " accounts";
+    if (duplicates > 0) {
+        std::cout << " (skipped " << duplicates << " whose names already exist)";
+    }
+    std::cout << '.' << std::endl;
+}
+
 /**
     Processes a command that pertains to some account in the currently active vault.
+    The command is served by the agent named by AGENT_SOCKET_ENV if it is set and no vault key is given.
 */
 void processAccountCommand(const CommandLineParser &commandOpts, VaultManager &vaultManager) {
     Utils::debugPrint(std::cout, "Entered processAccountCommand\n");
 
-    std::string vaultKey = getVaultKey(commandOpts);
+    const char *agentSocket = getAgentSocket(commandOpts);
+    if (agentSocket != NULL) {
+        // An agent holds the unlocked vault, so no vault key is needed:
+        AgentClient agent(agentSocket);
+        runAccountCommand(commandOpts, agent);
+        return;
+    }
+
+    const std::string vaultKey = getVaultKey(commandOpts);
 
     if (vaultManager.empty()) {
         if (commandOpts.containsOpt(CommandLineOptions::ADD_OPTION)) {
@@ -293,20 +834,26 @@ void processAccountCommand(const CommandLineParser &commandOpts, VaultManager &v
             // creating a vault. The default vault's password is the password provided to the
             // add account command.
 
-            vaultManager.addVault("default_vault", vaultKey);
+            addDefaultVault(vaultManager, vaultKey);
         } else {
-            std::cout << "Error: You must first create a vault using the -v add command." << std::endl;
+            reportError(CLAM_ERROR_NO_VAULTS);
             return;
         }
     }
 
-    // Verify that vaultKey is correct and report error and exit if not:
-    if (!VaultManager::validateKey(vaultKey, vaultManager.activeVaultInfo().vaultSkeySalt, vaultManager.activeVaultInfo().vaultSkeyHash)) {
+    // Verify that vaultKey is correct and attempt to load and decrypt vault:
+    std::unique_ptr<Vault> activeVault = openActiveVault(vaultManager, vaultKey);
+    if (!activeVault) {
         return;
     }
+    runAccountCommand(commandOpts, *activeVault);
+}
 
-    // Attempt to load and decrypt vault:
-    Vault activeVault(vaultManager.getVaultDir(), vaultManager.activeVaultInfo().vaultName, vaultKey);
+/**
+    Runs the account command on the given unlocked vault (a Vault or an AgentClient).
+*/
+template <typename VaultType>
+void runAccountCommand(const CommandLineParser &commandOpts, VaultType &activeVault) {
     if (commandOpts.containsOpt(CommandLineOptions::PRINT_OPTION)) {
         processAccountPrintCommand(commandOpts, activeVault);
     } else if (commandOpts.containsOpt(CommandLineOptions::CLIP_OPTION)) {
@@ -315,36 +862,52 @@ void processAccountCommand(const CommandLineParser &commandOpts, VaultManager &v
         processAccountUpdateCommand(commandOpts, activeVault);
     } else if (commandOpts.containsOpt(CommandLineOptions::ADD_OPTION)) {
         processAccountAddCommand(commandOpts, activeVault);
+    } else if (commandOpts.containsOpt(CommandLineOptions::SEARCH_OPTION)) {
+        processAccountSearchCommand(commandOpts, activeVault);
     } else {
         handleInvalidCommand("Invalid account command.");
     }
 }
 
+/**
+    Writes the changes made to the given vault (a Vault or an AgentClient), or reports an error
+    if they could not be written.
+*/
+template <typename VaultType>
+void commitVault(VaultType &activeVault) {
+    ClamStatus status = activeVault.writeVault();
+    if (status != CLAM_OK) {
+        reportError(status);
+    }
+}
+
 /**
     Processes a print command. Assumes the active vault has successfully been decrypted.
 */
-void processAccountPrintCommand(const CommandLineParser &commandOpts, Vault &activeVault) {
+template <typename VaultType>
+void processAccountPrintCommand(const CommandLineParser &commandOpts, VaultType &activeVault) {
     Utils::debugPrint(std::cout, "Entered processAccountPrintCommand\n");
 
     std::string accountName = getAccountName(commandOpts, CommandLineOptions::PRINT_OPTION);
     
-    std::optional<Account *> optAccount = activeVault.getAccount(accountName);
+    Result<AccountView> optAccount = activeVault.getAccountView(accountName);
     if (!optAccount.has_value()) {
+        reportError(optAccount.error());
         return;
     }
 
-    Account *account = optAccount.value();
+    const AccountView &account = optAccount.value();
 
     if (commandOpts.containsOpt(CommandLineOptions::USERNAME_OPTION)) {
-        std::cout << account->getUsername() << std::endl;
+        std::cout << account.username << std::endl;
     } else if (commandOpts.containsOpt(CommandLineOptions::PASSWORD_OPTION)) {
-        std::cout << account->getPassword() << std::endl;
+        std::cout << account.password << std::endl;
     } else if (commandOpts.containsOpt(CommandLineOptions::NOTE_OPTION)) {
-        std::cout << account->getNote() << std::endl;
+        std::cout << account.note << std::endl;
     } else {
-        std::cout << "un=" << account->getUsername() << '\n'
-            << "pw=" << account->getPassword() << '\n'
-            << "note=" << account->getNote() << std::endl;
+        std::cout << "un=" << account.username << '\n'
+            << "pw=" << account.password << '\n'
+            << "note=" << account.note << std::endl;
     }
 }
 
@@ -356,97 +919,156 @@ void processAccountPrintCommand(const CommandLineParser &commandOpts, Vault &act
         https://stackoverflow.com/questions/40436045/in-qt-how-can-i-register-a-qstring-to-my-systems-clipboard-both-quoted-and-no/40437290#40437290
         https://linoxide.com/linux-how-to/copy-paste-commands-output-xclip-linux/
 */
-void processAccountClipCommand(const CommandLineParser &commandOpts, Vault &activeVault) {
+template <typename VaultType>
+void processAccountClipCommand(const CommandLineParser &commandOpts, VaultType &activeVault) {
     Utils::debugPrint(std::cout, "Entered processAccountClipCommand\n");
 
     std::string accountName = getAccountName(commandOpts, CommandLineOptions::CLIP_OPTION);
     
-    std::optional<Account *> optAccount = activeVault.getAccount(accountName);
+    Result<AccountView> optAccount = activeVault.getAccountView(accountName);
     if (!optAccount.has_value()) {
+        reportError(optAccount.error());
         return;
     }
 
-    Account *account = optAccount.value();
+    const AccountView &account = optAccount.value();
 
     if (commandOpts.containsOpt(CommandLineOptions::USERNAME_OPTION)) {
-        clip::set_text(account->getUsername());
+        copyToClipboard(account.username);
     } else if (commandOpts.containsOpt(CommandLineOptions::PASSWORD_OPTION)) {
-        clip::set_text(account->getPassword());
+        copyToClipboard(account.password);
     } else {
         handleInvalidCommand("Invalid clip option.");
     }
     return;
 }
 
+/**
+    Copies the given text to the clipboard.
+*/
+void copyToClipboard(std::string_view text) {
+    ScopedTimer timer(STATS_CLIPBOARD);
+    Stats::count(STATS_PLAINTEXT_COPIED, text.size());
+    clip::set_text(std::string(text));
+}
+
 /**
     Processes an update command. Assumes the active vault has successfully been decrypted.
 */
-void processAccountUpdateCommand(const CommandLineParser &commandOpts, Vault &activeVault) {
+template <typename VaultType>
+void processAccountUpdateCommand(const CommandLineParser &commandOpts, VaultType &activeVault) {
     Utils::debugPrint(std::cout, "Entered processAccountUpdateCommand\n");
 
     std::string accountName = getAccountName(commandOpts, CommandLineOptions::UPDATE_OPTION);
     
-    std::optional<Account *> optAccount = activeVault.getAccount(accountName);
-    if (!optAccount.has_value()) {
+    Result<AccountView> view = activeVault.getAccountView(accountName);
+    if (!view.has_value()) {
+        reportError(view.error());
         return;
     }
 
-    Account *account = optAccount.value();
+    // Changes are made to a copy of the account, which then replaces the vault's:
+    Account account(view.value());
+    ClamStatus status = CLAM_OK;
 
     if (commandOpts.containsOpt(CommandLineOptions::USERNAME_OPTION)) {
         std::string username = commandOpts.getOpt(CommandLineOptions::USERNAME_OPTION);
         // Update the username of the given account
-        account->setUsername(username);
+        account.setUsername(username);
+        status = activeVault.updateAccount(account.view());
     } else if (commandOpts.containsOpt(CommandLineOptions::PASSWORD_OPTION)) {
         std::string password = commandOpts.getOpt(CommandLineOptions::PASSWORD_OPTION);
         // Update the password of the given account
-        account->setPassword(password);
+        account.setPassword(password);
+        status = activeVault.updateAccount(account.view());
     } else if (commandOpts.containsOpt(CommandLineOptions::NOTE_OPTION)) {
         std::string note = commandOpts.getOpt(CommandLineOptions::NOTE_OPTION);
         // Update the note of the given account
-        account->setNote(note);
+        account.setNote(note);
+        status = activeVault.updateAccount(account.view());
     } else if (commandOpts.containsOpt(CommandLineOptions::FILE_OPTION)) {
         std::string filePath = commandOpts.getOpt(CommandLineOptions::FILE_OPTION);
         // Update all details of the given account
         Account newAccount(accountName);
-        if (newAccount.loadFromFile(filePath)) {
-            *account = newAccount;
+        if (newAccount.loadFromFile(filePath) == CLAM_OK) {
+            status = activeVault.updateAccount(newAccount.view());
+        } else {
+            std::cout << "Error: Failed to load account from file." << std::endl;
         }
+        newAccount.wipeSensitiveData();
     } else if (commandOpts.containsOpt(CommandLineOptions::DELETE_OPTION)) {
-        activeVault.removeAccount(accountName);
+        status = activeVault.removeAccount(accountName);
     } else {
         handleInvalidCommand("Invalid account update option.");
     }
+    account.wipeSensitiveData();
+    if (status != CLAM_OK) {
+        reportError(status);
+    }
 
-    activeVault.writeVault();
+    commitVault(activeVault);
 }
 
 /**
     Processes an add command. Assumes the active vault has successfully been decrypted.
 */
-void processAccountAddCommand(const CommandLineParser &commandOpts, Vault &activeVault) {
+template <typename VaultType>
+void processAccountAddCommand(const CommandLineParser &commandOpts, VaultType &activeVault) {
     Utils::debugPrint(std::cout, "Entered processAccountAddCommand\n");
 
     std::string accountName = getAccountName(commandOpts, CommandLineOptions::ADD_OPTION);
 
+    ClamStatus status = CLAM_OK;
     if (commandOpts.containsOpt(CommandLineOptions::FILE_OPTION)) {
         std::string filePath = commandOpts.getOpt(CommandLineOptions::FILE_OPTION);
         // Read the new account from the specified file
         Account account(accountName);
-        if (account.loadFromFile(filePath)) {
-            activeVault.addAccount(account);
+        if (account.loadFromFile(filePath) == CLAM_OK) {
+            status = activeVault.addAccount(account.view());
+        } else {
+            std::cout << "Error: Failed to load account from file." << std::endl;
         }
+        account.wipeSensitiveData();
     } else if (commandOpts.containsOpt(CommandLineOptions::USERNAME_OPTION) && commandOpts.containsOpt(CommandLineOptions::PASSWORD_OPTION)) {
         std::string username = commandOpts.getOpt(CommandLineOptions::USERNAME_OPTION);
         std::string password = commandOpts.getOpt(CommandLineOptions::PASSWORD_OPTION);
         // Create a new account with the given username and password
         Account account(accountName, username, password);
-        activeVault.addAccount(account);
+        status = activeVault.addAccount(account.view());
+        account.wipeSensitiveData();
     } else {
         // Create a new account with no details
         Account account(accountName);
-        activeVault.addAccount(account);
+        status = activeVault.addAccount(account.view());
+    }
+    if (status != CLAM_OK) {
+        reportError(status);
+    }
+
+    commitVault(activeVault);
+}
+
+/**
+    Processes a search command. Assumes the active vault has successfully been decrypted.
+    Prints the names of the best matching accounts, best match first, separated by newlines.
+*/
+template <typename VaultType>
+void processAccountSearchCommand(const CommandLineParser &commandOpts, VaultType &activeVault) {
+    Utils::debugPrint(std::cout, "Entered processAccountSearchCommand\n");
+
+    std::string pattern = getAccountName(commandOpts, CommandLineOptions::SEARCH_OPTION);
+
+    size_t limit = SEARCH_DEFAULT_LIMIT;
+    if (commandOpts.containsOpt(CommandLineOptions::LIMIT_OPTION)) {
+        const std::string limitOpt = commandOpts.getOpt(CommandLineOptions::LIMIT_OPTION);
+        if (limitOpt.empty() || limitOpt.size() > 9 || limitOpt.find_first_not_of("0123456789") != std::string::npos) {
+            handleInvalidCommand("Invalid search result limit.");
+        }
+        limit = std::stoul(limitOpt);
     }
 
-    activeVault.writeVault();
+    for (const TagMatch &match : activeVault.searchTags(pattern, limit)) {
+        std::cout << match.tag << '\n';
+    }
+    std::cout << std::flush;
 }
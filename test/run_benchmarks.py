@@ -0,0 +1,225 @@
+# -*- coding: UTF-8 -*-
+"""
+    Measures the wall-clock latency of real clam invocations (print, clip, add, update, list and switch)
+    against generated vaults of several sizes, and reports the p50/p90/p99/max latency and the throughput
+    of each command with a warm and a cold page cache. Every run uses its own data directory (in a temporary
+    directory named by CLAM_HOME), so the user's vaults are never touched, and runs may proceed in parallel.
+
+    Usage: python3 test/run_benchmarks.py [--sizes 10,1000,100000] [--iterations 1000] [--jobs 1] [--json results.json]
+"""
+import argparse
+import concurrent.futures
+import csv
+import json
+import os
+import random
+import shutil
+import string
+import subprocess
+import tempfile
+import time
+
+VAULT_KEY = 'bench-key'
+VAULT_NAME = 'bench'
+OTHER_VAULT_NAME = 'other'
+SEED = 64
+
+"""
+    Returns the given percentile of the sorted samples (by the nearest-rank method).
+"""
+def percentile(sorted_samples, p):
+    rank = max(1, -(-len(sorted_samples) * p // 100))
+    return sorted_samples[int(rank) - 1]
+
+"""
+    Generates an account with a realistic distribution of field sizes: most usernames are shared emails,
+    passwords have 12 to 32 printable characters, and most accounts have no note.
+"""
+def generate_account(rng, number, shared_usernames):
+    tag = rng.choice(['', 'Email/', 'Work/', 'Work/Infra/', 'Banking/']) + rng.choice(['gmail', 'github', 'aws', 'slack', 'chase']) + '-' + str(number)
+    username = rng.choice(shared_usernames) if rng.randrange(100) < 60 else gen_email(rng)
+    password = ''.join(rng.choice(string.ascii_letters + string.digits + '!@#$%^&*()-_=+') for _ in range(rng.randint(12, 32)))
+    note_kind = rng.randrange(100)
+    note = ''
+    if note_kind < 5:
+        note = ''.join(rng.choice(string.ascii_lowercase + '   ') for _ in range(rng.randint(200, 2000)))
+    elif note_kind < 30:
+        note = ''.join(rng.choice(string.ascii_lowercase + '   ') for _ in range(rng.randint(10, 80)))
+    return [tag, username, password, note]
+
+def gen_email(rng):
+    return ''.join(rng.choice(string.ascii_lowercase) for _ in range(rng.randint(4, 16))) + '@' + rng.choice(['gmail.com', 'example.com'])
+
+class Runner:
+    def __init__(self, exec, data_home, unlock_ms):
+        self.exec = os.path.abspath(exec)
+        self.env = dict(os.environ)
+        self.data_dir = os.path.join(data_home, '.clam')
+        self.env['CLAM_HOME'] = self.data_dir
+        self.env['HOME'] = data_home # for clam executables that predate CLAM_HOME
+        self.env['CLAM_UNLOCK_MS'] = str(unlock_ms)
+        self.env.pop('CLAM_AGENT_SOCK', None) # commands must unlock the vault themselves
+
+    def run(self, args, check=True):
+        process = subprocess.run([self.exec] + args, env=self.env, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+        output = process.stdout.decode('UTF-8')
+        if check and (process.returncode != 0 or output.startswith('Error')):
+            raise RuntimeError('clam ' + ' '.join(args) + ' failed: ' + output.strip())
+        return output
+
+    """
+        Evicts the vaults, the meta file and the clam executable from the page cache, so that the next
+        invocation reads them from disk. Pages that are not dirty can be evicted without root privileges.
+    """
+    def drop_caches(self):
+        paths = [self.exec]
+        for dir_path, _, file_names in os.walk(self.data_dir):
+            paths += [os.path.join(dir_path, file_name) for file_name in file_names]
+        for path in paths:
+            fd = os.open(path, os.O_RDONLY)
+            try:
+                os.fsync(fd)
+                os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_DONTNEED)
+            finally:
+                os.close(fd)
+
+"""
+    Creates the benchmark vault with the given number of generated accounts (imported in one unlock),
+    and a second, empty vault to switch to. Returns the tags of the generated accounts.
+"""
+def generate_vaults(runner, size, work_dir):
+    rng = random.Random(SEED)
+    shared_usernames = [gen_email(rng) for _ in range(200)]
+    csv_path = os.path.join(work_dir, 'accounts.csv')
+    tags = []
+    with open(csv_path, 'w', newline='') as csv_file:
+        writer = csv.writer(csv_file)
+        writer.writerow(['tag', 'username', 'password', 'note'])
+        for number in range(size):
+            account = generate_account(rng, number, shared_usernames)
+            tags.append(account[0])
+            writer.writerow(account)
+
+    # The first vault added is the active one:
+    runner.run(['-v', 'add', '-n', VAULT_NAME, '-k', VAULT_KEY])
+    runner.run(['-v', 'add', '-n', OTHER_VAULT_NAME, '-k', VAULT_KEY])
+    runner.run(['--import', csv_path, '-k', VAULT_KEY])
+    os.remove(csv_path)
+    return tags
+
+"""
+    Returns the commands to measure, each as a name and a function from the iteration number to the
+    arguments of that iteration. Switch alternates between the two vaults, so it must be measured last
+    (with an even number of iterations) for the benchmark vault to stay active.
+"""
+def commands(tags, clip):
+    rng = random.Random(SEED)
+    shuffled_tags = tags[:]
+    rng.shuffle(shuffled_tags)
+    pick = lambda i: shuffled_tags[i % len(shuffled_tags)]
+    measured = [
+        ('print', lambda i: ['-p', pick(i), '-k', VAULT_KEY, '--pw']),
+        ('add', lambda i: ['-a', 'bench-added-' + str(i), '-k', VAULT_KEY, '--un', 'user' + str(i), '--pw', 'pw' + str(i)]),
+        ('update', lambda i: ['-u', pick(i), '-k', VAULT_KEY, '--pw', 'updated-pw-' + str(i)]),
+        ('list', lambda i: ['-v', 'list', '-k', VAULT_KEY]),
+        ('switch', lambda i: ['-v', 'switch', '-n', OTHER_VAULT_NAME if i % 2 == 0 else VAULT_NAME, '-k', VAULT_KEY]),
+    ]
+    if clip:
+        measured.insert(1, ('clip', lambda i: ['-c', pick(i), '-k', VAULT_KEY, '--pw']))
+    return measured
+
+"""
+    Runs the command the given number of times (after two unmeasured warm-up runs, for a warm cache)
+    and returns its latency statistics in milliseconds.
+"""
+def measure(runner, args_of, iterations, cold):
+    if not cold:
+        # An even number of warm-up runs, so that switch ends on the vault on which it started:
+        for i in range(2):
+            runner.run(args_of(iterations + i))
+
+    latencies = []
+    elapsed = 0.0
+    for i in range(iterations):
+        if cold:
+            runner.drop_caches()
+        start = time.perf_counter()
+        runner.run(args_of(i))
+        latency = time.perf_counter() - start
+        latencies.append(latency * 1000)
+        elapsed += latency
+    latencies.sort()
+    return {
+        'iterations': iterations,
+        'p50_ms': percentile(latencies, 50),
+        'p90_ms': percentile(latencies, 90),
+        'p99_ms': percentile(latencies, 99),
+        'max_ms': latencies[-1],
+        'commands_per_second': iterations / elapsed,
+    }
+
+"""
+    Measures every command against freshly generated vaults of the given size, in a data directory of
+    its own, and returns the results, each of which is also passed to 'report' as soon as it is measured.
+"""
+def run_benchmark(options, size, cold, clip, report):
+    results = []
+    data_home = tempfile.mkdtemp(prefix='clam_bench.')
+    try:
+        runner = Runner(options.exec, data_home, options.unlock_ms)
+        tags = generate_vaults(runner, size, data_home)
+        for name, args_of in commands(tags, clip):
+            result = measure(runner, args_of, options.iterations, cold)
+            result.update({'command': name, 'accounts': size, 'cache': 'cold' if cold else 'warm'})
+            results.append(result)
+            report(result)
+    finally:
+        shutil.rmtree(data_home)
+    return results
+
+def print_result(result):
+    print('{:<8} {:>9} {:<6} {:>9.2f} {:>9.2f} {:>9.2f} {:>9.2f} {:>10.1f}'.format(result['command'], result['accounts'], result['cache'],
+        result['p50_ms'], result['p90_ms'], result['p99_ms'], result['max_ms'], result['commands_per_second']), flush=True)
+
+def main():
+    parser = argparse.ArgumentParser(description='Measures the latency of clam commands against generated vaults.')
+    parser.add_argument('--exec', default='./bin/clam', help='clam executable to measure (default: ./bin/clam)')
+    parser.add_argument('--sizes', default='10,1000,100000', help='comma-separated numbers of accounts in the generated vaults')
+    parser.add_argument('--iterations', type=int, default=1000, help='invocations of each command per vault size and cache state')
+    parser.add_argument('--unlock-ms', type=int, default=1,
+        help='unlock time that the KDF of the vaults is calibrated to (default: 1, which selects the cheapest parameters '
+            + 'the KDF allows, so that it hides as little of the rest of each command as possible)')
+    parser.add_argument('--jobs', type=int, default=1,
+        help='number of vault sizes and cache states measured at a time (default: 1); concurrent runs compete for the '
+            + 'same cores and disk, so only compare results measured with the same number of jobs')
+    parser.add_argument('--json', help='also write the results to this file as JSON')
+    options = parser.parse_args()
+    if options.iterations % 2 != 0:
+        parser.error('--iterations must be even, so that switching ends on the benchmark vault')
+
+    clip = bool(os.environ.get('DISPLAY'))
+    if not clip:
+        print('DISPLAY is not set, so clip is not measured.')
+
+    # Each vault size and cache state starts from freshly generated vaults in a data directory of its own:
+    runs = [(int(size), cold) for size in options.sizes.split(',') for cold in [False, True]]
+    results = []
+    print('{:<8} {:>9} {:<6} {:>9} {:>9} {:>9} {:>9} {:>10}'.format('command', 'accounts', 'cache', 'p50 ms', 'p90 ms', 'p99 ms', 'max ms', 'cmds/s'))
+    if options.jobs > 1:
+        # The results of parallel runs are printed once each run has finished, in the order of the runs:
+        with concurrent.futures.ThreadPoolExecutor(max_workers=options.jobs) as executor:
+            futures = [executor.submit(run_benchmark, options, size, cold, clip, lambda result: None) for size, cold in runs]
+            for future in futures:
+                for result in future.result():
+                    print_result(result)
+                    results.append(result)
+    else:
+        for size, cold in runs:
+            results += run_benchmark(options, size, cold, clip, print_result)
+
+    if options.json:
+        with open(options.json, 'w') as json_file:
+            json.dump({'results': results}, json_file, indent=2)
+
+if __name__ == "__main__":
+    main()
@@ -4,8 +4,31 @@ import string
 import random
 import subprocess
 import os
+import struct
+import signal
+import time
+import ctypes
+import json
+import hashlib
+import tempfile
+import shutil
+import atexit
+import argparse
+import concurrent.futures
+import threading
+import fcntl
 from pathlib import Path
 
+# Every command derives its vault's key, so calibrate the KDF of the test vaults to a short unlock time:
+os.environ['CLAM_UNLOCK_MS'] = '1'
+
+# Each run of the tests keeps its data directory (named by CLAM_HOME) and the output of its commands in a
+# work directory of its own, so that it never touches the user's ~/.clam, and runs can proceed in parallel:
+WORK_DIR = tempfile.mkdtemp(prefix='clam_tests.')
+atexit.register(shutil.rmtree, WORK_DIR, ignore_errors=True)
+os.environ['CLAM_HOME'] = WORK_DIR + '/data'
+OUTPUT_FILE_PATH = WORK_DIR + '/output'
+
 class CommandLineOptions():
     VAULT_OPTION = '-v'
     KEY_OPTION = '-k'
@@ -21,6 +44,20 @@ class CommandLineOptions():
     DELETE_OPTION = '-d'
     ADD_OPTION = '-a'
     INFO_OPTION = '-i'
+    SEARCH_OPTION = '-s'
+    LIMIT_OPTION = '--limit'
+    CIPHER_OPTION = '--cipher'
+    KDF_OPTION = '--kdf'
+    AGENT_OPTION = '--agent'
+    TIMEOUT_OPTION = '--timeout'
+    BATCH_OPTION = '--batch'
+    IMPORT_OPTION = '--import'
+    EXPORT_OPTION = '--export'
+    FORMAT_OPTION = '--format'
+    IMPORT_KDBX_OPTION = '--import-kdbx'
+    KDBX_KEY_OPTION = '--kdbx-key'
+    STATS_OPTION = '--stats'
+    DATA_DIR_OPTION = '--data-dir'
 
 class TestSuite:
     def __init__(self, test_name):
@@ -57,7 +94,7 @@ def program_name():
     Returns the location where program data is stored.
 """
 def program_data_dir():
-    return str(Path.home()) + '/.' + program_name() + '/'
+    return os.environ['CLAM_HOME'] + '/'
 
 """
     Given the expected lines, builds a string containing all of those lines separated by newlines.
@@ -74,12 +111,12 @@ def exec_cmd(cmd):
     # https://thraxil.org/users/anders/posts/2008/03/13/Subprocess-Hanging-PIPE-is-your-enemy/
 
     # return subprocess.Popen(cmd, shell=True, stdout=subprocess.PIPE).stdout.read().decode('UTF-8').rstrip('\t\n ')
-    tempfile = open('tmp34783487543857', 'w+')
-    process = subprocess.Popen(cmd, shell=True, stdout=tempfile)
+    output_file = open(OUTPUT_FILE_PATH, 'w+')
+    process = subprocess.Popen(cmd, shell=True, stdout=output_file)
     process.wait()
-    tempfile.seek(0)
-    exec_output = tempfile.read().rstrip('\t\n ')
-    tempfile.close()
+    output_file.seek(0)
+    exec_output = output_file.read().rstrip('\t\n ')
+    output_file.close()
     return exec_output
 
 def construct_cmd(*args):
@@ -87,7 +124,7 @@ def construct_cmd(*args):
 
 def clean_dir():
     exec_cmd(construct_cmd('rm', '-rf', program_data_dir()))
-    os.remove('tmp34783487543857')
+    os.remove(OUTPUT_FILE_PATH)
 
 def test_vault(exec):
     # tests vault commands
@@ -149,29 +186,60 @@ def test_vault(exec):
     switch_vault_command(exec, vault1_name, vault1_key)
     test_suite.assert_equals(build_console_output(vault1_acct1_tag, vault1_acct2_tag, vault1_acct3_tag), list_command(exec, vault1_key))
 
+    # More vaults than the meta file initially has slots for, every third of which is deleted (moving others between slots):
+    many_vault_names = ['many' + str(i) for i in range(70)]
+    for many_vault_name in many_vault_names:
+        add_vault_command(exec, many_vault_name, vault1_key)
+    for many_vault_name in many_vault_names[::3]:
+        delete_vault_command(exec, many_vault_name, vault1_key)
+    remaining_vault_names = [name for i, name in enumerate(many_vault_names) if i % 3 != 0]
+    vault_names = list_command(exec).split('\n')
+    test_suite.assert_equals(vault1_name, vault_names[0])
+    test_suite.assert_equals(sorted([vault1_name, vault3_name] + remaining_vault_names), sorted(vault_names))
+    switch_vault_command(exec, remaining_vault_names[-1], vault1_key)
+    test_suite.assert_equals(remaining_vault_names[-1], list_command(exec).split('\n')[0])
+    switch_vault_command(exec, vault1_name, vault1_key)
+    test_suite.assert_equals(build_console_output(vault1_acct1_tag, vault1_acct2_tag, vault1_acct3_tag), list_command(exec, vault1_key))
+
     test_suite.finish()
 
     clean_dir()
 
-def add_vault_command(exec, new_vault_name, new_vault_key):
-    return exec_cmd(construct_cmd(
+def add_vault_command(exec, new_vault_name, new_vault_key, kdf=None):
+    cmd = construct_cmd(
         exec,
         CommandLineOptions.VAULT_OPTION,
         'add',
         CommandLineOptions.NAME_OPTION,
         new_vault_name,
         CommandLineOptions.KEY_OPTION,
-        new_vault_key))
+        new_vault_key)
+    if kdf is not None:
+        cmd = construct_cmd(cmd, CommandLineOptions.KDF_OPTION, kdf)
+    return exec_cmd(cmd)
 
-def update_vault_command(exec, old_key, new_key):
-    return exec_cmd(construct_cmd(
+def update_vault_command(exec, old_key, new_key, kdf=None):
+    cmd = construct_cmd(
         exec,
         CommandLineOptions.VAULT_OPTION,
         'update',
         CommandLineOptions.KEY_OPTION,
         old_key,
         CommandLineOptions.NEWKEY_OPTION,
-        new_key))
+        new_key)
+    if kdf is not None:
+        cmd = construct_cmd(cmd, CommandLineOptions.KDF_OPTION, kdf)
+    return exec_cmd(cmd)
+
+def update_cipher_command(exec, vault_key, cipher_suite):
+    return exec_cmd(construct_cmd(
+        exec,
+        CommandLineOptions.VAULT_OPTION,
+        'update',
+        CommandLineOptions.KEY_OPTION,
+        vault_key,
+        CommandLineOptions.CIPHER_OPTION,
+        cipher_suite))
 
 def switch_vault_command(exec, vault_name, vault_key):
     return exec_cmd(construct_cmd(
@@ -216,6 +284,50 @@ def list_command(exec, vault_key=None, info=False):
             'list')
     return exec_cmd(cmd)
 
+def test_meta_migration(exec):
+    # tests migrating a legacy (version 1) meta file, whose vault keys are derived with a single sha256
+    clean_dir()
+
+    test_suite = TestSuite('test_meta_migration')
+
+    vault_names, vault_key = ['legacy1', 'ab'], 'legacy-key'
+    skey = hashlib.sha256(vault_key.encode()).digest()
+    meta = struct.pack('<I', len(vault_names))
+    for vault_name in vault_names:
+        salt = os.urandom(32)
+        meta += struct.pack('<I', len(vault_name)) + vault_name.encode() + hashlib.sha256(skey + salt).digest() + salt
+    os.makedirs(program_data_dir() + 'vaults', exist_ok=True)
+    with open(program_data_dir() + 'meta', 'wb') as meta_file:
+        meta_file.write(meta)
+
+    test_suite.assert_equals(build_console_output(*vault_names), list_command(exec))
+    test_suite.assert_equals(4, int.from_bytes(read_raw_data(program_data_dir() + 'meta')[4:8], 'little'))
+    add_command(exec, 'acct1', vault_key, 'un1', 'pw1')
+    test_suite.assert_equals(True, os.path.exists(get_vault_filepath(vault_names[0])))
+    test_suite.assert_equals('Error: The provided vault key is incorrect.', switch_vault_command(exec, vault_names[1], 'wrong-key'))
+    switch_vault_command(exec, vault_names[1], vault_key)
+    add_command(exec, 'acct2', vault_key, 'un2', 'pw2')
+    test_suite.assert_equals(build_console_output('acct2'), list_command(exec, vault_key))
+    switch_vault_command(exec, vault_names[0], vault_key)
+    test_suite.assert_equals(build_console_output('un=un1', 'pw=pw1', 'note='), print_command(exec, 'acct1', vault_key))
+
+    # Updating the key of a vault that has no data key gives it a new one, with which the vault (and its journal) is re-encrypted:
+    add_command(exec, 'acct3', vault_key, 'un3', 'pw3')
+    journal_filepath = os.path.join(os.path.dirname(get_vault_filepath(vault_names[0])), '.journal', vault_names[0])
+    vault_data = read_raw_vault_data(vault_names[0])
+    test_suite.assert_equals('Successfully updated key for vault ' + vault_names[0], update_vault_command(exec, vault_key, 'new-key'))
+    meta = read_raw_data(program_data_dir() + 'meta')
+    has_data_key_offset = 512 + int.from_bytes(meta[8:12], 'little') * 2 * 4 + 4 + 256 + 32 + 32 + 4 * 4
+    test_suite.assert_equals(1, int.from_bytes(meta[has_data_key_offset:has_data_key_offset + 4], 'little'))
+    test_suite.assert_equals((True, False), (vault_data != read_raw_vault_data(vault_names[0]), os.path.exists(journal_filepath)))
+    test_suite.assert_equals('Error: The provided vault key is incorrect.', print_command(exec, 'acct1', vault_key))
+    test_suite.assert_equals(build_console_output('un=un1', 'pw=pw1', 'note=', 'un=un3', 'pw=pw3', 'note='),
+        build_console_output(print_command(exec, 'acct1', 'new-key'), print_command(exec, 'acct3', 'new-key')))
+
+    test_suite.finish()
+
+    clean_dir()
+
 def test_print(exec):
     # tests print commands
     clean_dir()
@@ -457,11 +569,716 @@ def add_command(exec, account_name, vault_key, un=None, pw=None, file_path=None)
 
     return exec_cmd(cmd)
 
-def gen_rand_str(n=random.randint(1, 1024)):
+def test_search(exec):
+    # tests search commands
+    clean_dir()
+
+    vault_key = 'key1'
+    acct_tags = ['github-work', 'github-home', 'gitlab', 'google', 'bank']
+
+    test_suite = TestSuite('test_search')
+
+    for acct_tag in acct_tags:
+        add_command(exec, acct_tag, vault_key)
+
+    # Prefix matches, shortest first:
+    test_suite.assert_equals(build_console_output('gitlab', 'github-home', 'github-work'), search_command(exec, 'git', vault_key))
+    test_suite.assert_equals(build_console_output('gitlab'), search_command(exec, 'git', vault_key, 1))
+    test_suite.assert_equals(build_console_output('bank'), search_command(exec, 'BA', vault_key))
+    # Typo-tolerant matches, closest first:
+    test_suite.assert_equals(build_console_output('github-home', 'github-work'), search_command(exec, 'githbu', vault_key))
+    test_suite.assert_equals(build_console_output('github-work'), search_command(exec, 'gihtub-wrk', vault_key))
+    test_suite.assert_equals(build_console_output('google'), search_command(exec, 'gogle', vault_key))
+    test_suite.assert_equals('', search_command(exec, 'xyz', vault_key))
+    # A limit too large to parse is rejected like any other invalid limit:
+    test_suite.assert_equals(True, search_command(exec, 'git', vault_key, '9' * 23).startswith('Error: Invalid search result limit.'))
+
+    # Removed accounts are no longer found:
+    update_command(exec, 'gitlab', vault_key, CommandLineOptions.DELETE_OPTION)
+    test_suite.assert_equals(build_console_output('github-home', 'github-work'), search_command(exec, 'git', vault_key))
+
+    test_suite.finish()
+
+    clean_dir()
+
+def search_command(exec, pattern, vault_key, limit=None):
+    cmd = construct_cmd(
+        exec,
+        CommandLineOptions.SEARCH_OPTION,
+        pattern,
+        CommandLineOptions.KEY_OPTION,
+        vault_key)
+    if limit is not None:
+        cmd = construct_cmd(cmd, CommandLineOptions.LIMIT_OPTION, str(limit))
+    return exec_cmd(cmd)
+
+def test_cipher(exec):
+    # tests re-encrypting the active vault with each cipher suite
+    clean_dir()
+
+    vault_key = 'key1'
+    cipher_suites = { 'twofish-ctr': 1, 'aes-256-gcm': 2, 'chacha20-poly1305': 3 }
+
+    test_suite = TestSuite('test_cipher')
+
+    add_command(exec, 'acct1', vault_key, 'un1', 'pw1')
+    add_command(exec, 'acct2', vault_key, 'un2', 'pw2')
+    update_command(exec, 'acct2', vault_key, CommandLineOptions.NOTE_OPTION, 'note2')
+    for cipher_suite, suite_id in cipher_suites.items():
+        test_suite.assert_equals(build_console_output('The active vault is now encrypted with ' + cipher_suite + '.'),
+            update_cipher_command(exec, vault_key, cipher_suite))
+        test_suite.assert_equals(suite_id, int.from_bytes(read_raw_data(get_vault_filepath('default_vault'))[8:12], 'little'))
+        test_suite.assert_equals(build_console_output('un=un2', 'pw=pw2', 'note=note2'), print_command(exec, 'acct2', vault_key))
+        # Accounts added after the change are encrypted with the new suite as well:
+        add_command(exec, 'acct-' + cipher_suite, vault_key, 'un', 'pw')
+        test_suite.assert_equals(build_console_output('un=un', 'pw=pw', 'note='), print_command(exec, 'acct-' + cipher_suite, vault_key))
+
+    test_suite.assert_equals(True, update_cipher_command(exec, vault_key, 'rot13').startswith('Error: Invalid cipher suite'))
+
+    test_suite.finish()
+
+    clean_dir()
+
+def test_kdf(exec):
+    # tests deriving vault keys with each KDF
+    clean_dir()
+
+    vault_name, vault_key, vault_newkey = 'vault1', 'key1', 'key1new'
+
+    test_suite = TestSuite('test_kdf')
+
+    add_vault_command(exec, vault_name, vault_key, 'pbkdf2-sha256')
+    test_suite.assert_equals(1, read_kdf_algorithm(vault_name))
+    add_command(exec, 'acct1', vault_key, 'un1', 'pw1')
+    test_suite.assert_equals(build_console_output('un=un1', 'pw=pw1', 'note='), print_command(exec, 'acct1', vault_key))
+    test_suite.assert_equals('Error: The provided vault key is incorrect.', print_command(exec, 'acct1', vault_newkey))
+
+    # Updating the key re-derives it with freshly calibrated parameters of the selected KDF, and only
+    # rewraps the vault's data key, so the vault itself is not rewritten:
+    vault_data = read_raw_vault_data(vault_name)
+    update_vault_command(exec, vault_key, vault_newkey, 'argon2id')
+    test_suite.assert_equals(2, read_kdf_algorithm(vault_name))
+    test_suite.assert_equals(vault_data, read_raw_vault_data(vault_name))
+    test_suite.assert_equals('Error: The provided vault key is incorrect.', print_command(exec, 'acct1', vault_key))
+    test_suite.assert_equals(build_console_output('un=un1', 'pw=pw1', 'note='), print_command(exec, 'acct1', vault_newkey))
+
+    # A key update that is interrupted before its meta log is complete leaves the old slot (and key) in place:
+    meta_filepath = program_data_dir() + 'meta'
+    meta_before = read_raw_data(meta_filepath)
+    update_vault_command(exec, vault_newkey, vault_key)
+    meta_after = read_raw_data(meta_filepath)
+    slot_offset = 512 + int.from_bytes(meta_after[8:12], 'little') * 2 * 4
+    log = meta_log([0, slot_offset], meta_after)
+    write_meta_file(meta_before)
+    with open(meta_filepath + '.log', 'wb') as log_file:
+        log_file.write(log[:len(log) // 2])
+    test_suite.assert_equals(build_console_output('un=un1', 'pw=pw1', 'note='), print_command(exec, 'acct1', vault_newkey))
+    test_suite.assert_equals((meta_before, 0), (read_raw_data(meta_filepath), os.path.getsize(meta_filepath + '.log')))
+
+    # One that is interrupted while it writes the slot, once the log is complete, is finished by the next command:
+    generation = int.from_bytes(meta_before[36:40], 'little')
+    write_meta_file(meta_before[:36] + (generation + 1).to_bytes(4, 'little') + meta_before[40:slot_offset]
+        + meta_after[slot_offset:slot_offset + 256] + meta_before[slot_offset + 256:])
+    with open(meta_filepath + '.log', 'wb') as log_file:
+        log_file.write(log)
+    test_suite.assert_equals(build_console_output('un=un1', 'pw=pw1', 'note='), print_command(exec, 'acct1', vault_key))
+    test_suite.assert_equals('Error: The provided vault key is incorrect.', print_command(exec, 'acct1', vault_newkey))
+    test_suite.assert_equals(0, os.path.getsize(meta_filepath + '.log'))
+
+    test_suite.assert_equals(True, add_vault_command(exec, 'vault2', vault_key, 'md5').startswith('Error: Invalid KDF'))
+
+    test_suite.finish()
+
+    clean_dir()
+
+def test_agent(exec):
+    # tests serving account commands from an agent
+    clean_dir()
+
+    vault_key = 'key1'
+
+    test_suite = TestSuite('test_agent')
+
+    add_command(exec, 'acct1', vault_key, 'un1', 'pw1')
+    add_command(exec, 'acct2', vault_key)
+    agent_env = start_agent(exec, vault_key)
+    os.environ.update(agent_env)
+    try:
+        # Account commands (and vault list) without a vault key are served by the agent:
+        def agent_command(*args):
+            return exec_cmd(construct_cmd(exec, *args))
+        test_suite.assert_equals(build_console_output('un=un1', 'pw=pw1', 'note='), agent_command(CommandLineOptions.PRINT_OPTION, 'acct1'))
+        test_suite.assert_equals(build_console_output('acct1', 'acct2'), agent_command(CommandLineOptions.VAULT_OPTION, 'list'))
+        test_suite.assert_equals(build_console_output('acct1', 'acct2'), agent_command(CommandLineOptions.SEARCH_OPTION, 'acc'))
+        agent_command(CommandLineOptions.UPDATE_OPTION, 'acct1', CommandLineOptions.NOTE_OPTION, 'note1')
+        agent_command(CommandLineOptions.UPDATE_OPTION, 'acct2', CommandLineOptions.DELETE_OPTION)
+        agent_command(CommandLineOptions.ADD_OPTION, 'acct3', CommandLineOptions.USERNAME_OPTION, 'un3', CommandLineOptions.PASSWORD_OPTION, 'pw3')
+        test_suite.assert_equals(build_console_output('un=un1', 'pw=pw1', 'note=note1'), agent_command(CommandLineOptions.PRINT_OPTION, 'acct1'))
+        test_suite.assert_equals(build_console_output('acct1', 'acct3'), agent_command(CommandLineOptions.VAULT_OPTION, 'list'))
+        test_suite.assert_equals(True, agent_command(CommandLineOptions.PRINT_OPTION, 'acct2').startswith('Error: The specified account does not exist.'))
+
+        # Accounts changed over and over (which the agent compacts its account table for) keep their latest fields:
+        for i in range(12):
+            agent_command(CommandLineOptions.UPDATE_OPTION, 'acct1', CommandLineOptions.NOTE_OPTION, str(i) * (3000 + i))
+            agent_command(CommandLineOptions.UPDATE_OPTION, 'acct3', CommandLineOptions.USERNAME_OPTION, 'un' + str(i))
+        agent_command(CommandLineOptions.ADD_OPTION, 'acct4', CommandLineOptions.USERNAME_OPTION, 'un11', CommandLineOptions.PASSWORD_OPTION, 'pw4')
+        agent_command(CommandLineOptions.UPDATE_OPTION, 'acct4', CommandLineOptions.DELETE_OPTION)
+        agent_command(CommandLineOptions.UPDATE_OPTION, 'acct1', CommandLineOptions.PASSWORD_OPTION, 'pw')
+        test_suite.assert_equals(build_console_output('un=un1', 'pw=pw', 'note=' + '11' * 3011), agent_command(CommandLineOptions.PRINT_OPTION, 'acct1'))
+        test_suite.assert_equals(build_console_output('un=un11', 'pw=pw3', 'note='), agent_command(CommandLineOptions.PRINT_OPTION, 'acct3'))
+        test_suite.assert_equals(build_console_output('acct1', 'acct3'), agent_command(CommandLineOptions.SEARCH_OPTION, 'acc'))
+
+        # Commands given a vault key unlock the vault themselves instead of using the agent:
+        test_suite.assert_equals(build_console_output('acct1', 'acct3'), list_command(exec, vault_key))
+        test_suite.assert_equals(True, print_command(exec, 'acct1', 'wrong').startswith('Error: The provided vault key is incorrect.'))
+        test_suite.assert_equals(True, list_command(exec, 'wrong').startswith('Error: The provided vault key is incorrect.'))
+    finally:
+        os.kill(int(agent_env['CLAM_AGENT_PID']), signal.SIGTERM)
+        for name in agent_env:
+            del os.environ[name]
+
+    # The agent wrote its changes to the vault, and removes its socket once it stops:
+    test_suite.assert_equals(build_console_output('acct1', 'acct3'), list_command(exec, vault_key))
+    test_suite.assert_equals(build_console_output('un=un11', 'pw=pw3', 'note='), print_command(exec, 'acct3', vault_key))
+    for _ in range(50):
+        if not os.path.exists(agent_env['CLAM_AGENT_SOCK']):
+            break
+        time.sleep(0.1)
+    test_suite.assert_equals(False, os.path.exists(agent_env['CLAM_AGENT_SOCK']))
+
+    # An idle agent exits after its timeout:
+    agent_env = start_agent(exec, vault_key, 1)
+    time.sleep(2)
+    test_suite.assert_equals(False, os.path.exists(agent_env['CLAM_AGENT_SOCK']))
+
+    test_suite.finish()
+
+    clean_dir()
+
+def test_batch(exec):
+    # tests applying batches of account commands
+    clean_dir()
+
+    vault_key = 'key1'
+
+    test_suite = TestSuite('test_batch')
+
+    add_command(exec, 'acct1', vault_key, 'un1', 'pw1')
+    test_suite.assert_equals(build_console_output('ok', 'ok', 'ok', 'ok\t\tpw\\t2\tline1\\nline2', 'ok\tun1'), batch_command(exec, vault_key, [
+        ['add', 'acct2', '', 'pw\t2'],
+        ['update', 'acct2', 'note', 'line1\nline2'],
+        ['add', 'acct3'],
+        ['print', 'acct2'],
+        ['print', 'acct1', 'username']]))
+    test_suite.assert_equals(build_console_output('acct1', 'acct2', 'acct3'), list_command(exec, vault_key))
+    test_suite.assert_equals(build_console_output('line1', 'line2'), print_command(exec, 'acct2', vault_key, CommandLineOptions.NOTE_OPTION))
+
+    # A failing command discards the whole batch:
+    test_suite.assert_equals(build_console_output('ok', 'error\tCommand 2: The specified account does not exist.'), batch_command(exec, vault_key, [
+        ['delete', 'acct1'],
+        ['delete', 'acct4']]))
+    test_suite.assert_equals(build_console_output('acct1', 'acct2', 'acct3'), list_command(exec, vault_key))
+
+    # The binary form carries any bytes in its fields:
+    test_suite.assert_equals(binary_batch_record(['ok']) + binary_batch_record(['ok', 'pw\n4']),
+        batch_command(exec, vault_key, [['add', 'acct4', 'un4', 'pw\n4'], ['print', 'acct4', 'password']], True))
+    test_suite.assert_equals(build_console_output('pw', '4'), print_command(exec, 'acct4', vault_key, CommandLineOptions.PASSWORD_OPTION))
+
+    test_suite.finish()
+
+    clean_dir()
+
+def test_import_export(exec):
+    # tests importing and exporting accounts as CSV and JSON
+    clean_dir()
+
+    vault_key = 'key1'
+
+    test_suite = TestSuite('test_import_export')
+
+    add_command(exec, 'acct1', vault_key, 'un1', 'pw1')
+    csv_path = write_import_file('accounts.csv',
+        'Tag,Password,ignored,Username\r\nacct2,"pw,""2""\nx",,un2\n\nacct1,pw,,un\nacct3,pw3,,un3\n')
+    test_suite.assert_equals('Imported 2 accounts (skipped 1 whose names already exist).', import_command(exec, csv_path, vault_key))
+    test_suite.assert_equals(build_console_output('tag,username,password,note', 'acct1,un1,pw1,', 'acct2,un2,"pw,""2""', 'x",', 'acct3,un3,pw3,'),
+        export_command(exec, vault_key))
+
+    json_path = write_import_file('accounts.json',
+        '[{"tag": "acct4", "username": null, "id": 4, "tags": [{"a": true}], "note": "caf\\u00e9 \\"4\\""}]')
+    test_suite.assert_equals('Imported 1 accounts.', import_command(exec, json_path, vault_key))
+    test_suite.assert_equals(build_console_output('[',
+        '  {"tag": "acct1", "username": "un1", "password": "pw1", "note": ""},',
+        '  {"tag": "acct2", "username": "un2", "password": "pw,\\"2\\"\\nx", "note": ""},',
+        '  {"tag": "acct3", "username": "un3", "password": "pw3", "note": ""},',
+        '  {"tag": "acct4", "username": "", "password": "", "note": "café \\"4\\""}',
+        ']'), export_command(exec, vault_key, 'json'))
+
+    # A malformed file is not imported at all:
+    json_path = write_import_file('accounts.json', '[{"tag": "acct5"}, {"tag": 6}]')
+    test_suite.assert_equals('Error: The member tag of account 2 must be a string. No accounts were imported.', import_command(exec, json_path, vault_key))
+    test_suite.assert_equals(build_console_output('acct1', 'acct2', 'acct3', 'acct4'), list_command(exec, vault_key))
+
+    # Exported accounts import unchanged into a new vault:
+    csv_path = write_import_file('export.csv', export_command(exec, vault_key) + '\n')
+    add_vault_command(exec, 'vault2', 'key2')
+    switch_vault_command(exec, 'vault2', 'key2')
+    test_suite.assert_equals('Imported 4 accounts.', import_command(exec, csv_path, 'key2'))
+    test_suite.assert_equals(export_command(exec, 'key2'), read_raw_data(csv_path).decode().rstrip('\n'))
+
+    test_suite.finish()
+
+    clean_dir()
+
+def test_import_kdbx(exec):
+    # tests importing the entries of a KeePass database (test/import.kdbx: KDBX 4 with AES-256, Argon2d and gzip,
+    # whose recycle bin holds the entry 'deleted' and whose entry 'gmail' has an older version in its history)
+    clean_dir()
+
+    vault_key = 'key1'
+    kdbx_path = str(Path(__file__).parent / 'import.kdbx')
+
+    test_suite = TestSuite('test_import_kdbx')
+
+    test_suite.assert_equals('Error: The KDBX password is incorrect. No accounts were imported.',
+        import_kdbx_command(exec, kdbx_path, 'wrong-key', vault_key))
+    test_suite.assert_equals('', list_command(exec, vault_key))
+
+    add_command(exec, 'Email/gmail', vault_key, 'un1', 'pw1')
+    test_suite.assert_equals('Imported 2 accounts (skipped 1 whose names already exist).',
+        import_kdbx_command(exec, kdbx_path, 'kdbx-key', vault_key))
+    test_suite.assert_equals(build_console_output('Email/gmail', 'bank', 'Email/Work/outlook'), list_command(exec, vault_key))
+    test_suite.assert_equals(build_console_output('un=alice', 'pw=b4nk&<pw>', 'note=PIN in safe'), print_command(exec, 'bank', vault_key))
+    test_suite.assert_equals(build_console_output('un=alice@work.com', 'pw=w0rk', 'note='), print_command(exec, 'Email/Work/outlook', vault_key))
+
+    update_command(exec, 'Email/gmail', vault_key, CommandLineOptions.DELETE_OPTION)
+    test_suite.assert_equals('Imported 1 accounts (skipped 2 whose names already exist).',
+        import_kdbx_command(exec, kdbx_path, 'kdbx-key', vault_key))
+    test_suite.assert_equals(build_console_output('un=alice@gmail.com', 'pw=gmäil-pw', 'note=line 1', 'line 2'),
+        print_command(exec, 'Email/gmail', vault_key))
+
+    # A database whose blocks were tampered with is not imported at all:
+    kdbx_data = bytearray(read_raw_data(kdbx_path))
+    kdbx_data[-100] ^= 1
+    tampered_path = program_data_dir() + 'tampered.kdbx'
+    with open(tampered_path, 'wb') as file:
+        file.write(kdbx_data)
+    update_command(exec, 'bank', vault_key, CommandLineOptions.DELETE_OPTION)
+    test_suite.assert_equals('Error: Block 0 of the KDBX file is corrupt. No accounts were imported.',
+        import_kdbx_command(exec, tampered_path, 'kdbx-key', vault_key))
+    test_suite.assert_equals(build_console_output('Email/Work/outlook', 'Email/gmail'), list_command(exec, vault_key))
+
+    test_suite.finish()
+
+    clean_dir()
+
+def test_library(exec):
+    # tests reading and changing a vault created by clam through the C ABI of libclam
+    clean_dir()
+
+    vault_key = 'key1'
+    test_suite = TestSuite('test_library')
+
+    add_command(exec, 'gmail', vault_key, 'un1', 'pw1')
+    update_command(exec, 'gmail', vault_key, CommandLineOptions.NOTE_OPTION, 'note1')
+
+    libclam = load_libclam()
+    store = ctypes.c_void_p()
+    test_suite.assert_equals(0, libclam.clam_store_open(program_data_dir().encode(), ctypes.byref(store)))
+
+    vault = ctypes.c_void_p()
+    test_suite.assert_equals(2, libclam.clam_vault_open(store, b'wrong-key', ctypes.byref(vault)))
+    test_suite.assert_equals(b'The provided vault key is incorrect.', libclam.clam_status_message(2))
+    test_suite.assert_equals(0, libclam.clam_vault_open(store, vault_key.encode(), ctypes.byref(vault)))
+    libclam.clam_store_close(store)
+
+    account = ClamAccount()
+    test_suite.assert_equals(8, libclam.clam_account_get(vault, b'outlook', ctypes.byref(account)))
+    test_suite.assert_equals(0, libclam.clam_account_get(vault, b'gmail', ctypes.byref(account)))
+    test_suite.assert_equals([b'gmail', b'un1', b'pw1', b'note1'],
+        [account.tag, account.username, account.password, account.note])
+    libclam.clam_account_free(ctypes.byref(account))
+
+    test_suite.assert_equals(9, libclam.clam_account_add(vault, ctypes.byref(ClamAccount(b'gmail', b'un2', b'pw2', None))))
+    test_suite.assert_equals(0, libclam.clam_account_add(vault, ctypes.byref(ClamAccount(b'outlook', b'un2', b'pw2', None))))
+    test_suite.assert_equals(0, libclam.clam_account_update(vault, ctypes.byref(ClamAccount(b'gmail', b'un3', b'pw3', b'note3'))))
+    test_suite.assert_equals(8, libclam.clam_account_remove(vault, b'bank'))
+    test_suite.assert_equals(0, libclam.clam_vault_write(vault))
+    libclam.clam_vault_close(vault)
+
+    test_suite.assert_equals(build_console_output('gmail', 'outlook'), list_command(exec, vault_key))
+    test_suite.assert_equals(build_console_output('un=un3', 'pw=pw3', 'note=note3'), print_command(exec, 'gmail', vault_key))
+    test_suite.assert_equals(build_console_output('un=un2', 'pw=pw2', 'note='), print_command(exec, 'outlook', vault_key))
+
+    # A tampered record is rejected on every access (not only the first, which decrypts it in place), and is
+    # never re-encrypted under a valid tag. The cipher change writes every record to the vault file, outlook's last:
+    update_cipher_command(exec, vault_key, 'chacha20-poly1305')
+    vault_data = bytearray(read_raw_data(get_vault_filepath('default_vault')))
+    vault_data[-21] ^= 1 # the last character of its password
+    with open(get_vault_filepath('default_vault'), 'wb') as vault_file:
+        vault_file.write(vault_data)
+    test_suite.assert_equals(0, libclam.clam_store_open(program_data_dir().encode(), ctypes.byref(store)))
+    test_suite.assert_equals(0, libclam.clam_vault_open(store, vault_key.encode(), ctypes.byref(vault)))
+    libclam.clam_store_close(store)
+    test_suite.assert_equals(67, libclam.clam_account_get(vault, b'outlook', ctypes.byref(account)))
+    test_suite.assert_equals(67, libclam.clam_account_get(vault, b'outlook', ctypes.byref(account)))
+    test_suite.assert_equals(0, libclam.clam_account_get(vault, b'gmail', ctypes.byref(account)))
+    libclam.clam_account_free(ctypes.byref(account))
+    libclam.clam_vault_close(vault)
+    test_suite.assert_equals(build_console_output('Error: The vault file is corrupt.'), update_cipher_command(exec, vault_key, 'aes-256-gcm'))
+    test_suite.assert_equals(bytes(vault_data), read_raw_data(get_vault_filepath('default_vault')))
+
+    test_suite.finish()
+
+    clean_dir()
+
+def test_stats(exec):
+    # tests the per-phase stats printed to stderr by --stats and CLAM_STATS
+    clean_dir()
+
+    vault_key = 'key1'
+    test_suite = TestSuite('test_stats')
+
+    add_command(exec, 'acct1', vault_key, 'un1', 'pw1')
+
+    # The stats do not change the output of the command:
+    output, stats = stats_command(exec, [CommandLineOptions.PRINT_OPTION, 'acct1', CommandLineOptions.KEY_OPTION, vault_key], option='json')
+    test_suite.assert_equals(build_console_output('un=un1', 'pw=pw1', 'note='), output)
+    stats = json.loads(stats)
+    test_suite.assert_equals(True, stats['phases']['kdf']['calls'] > 0 and stats['phases']['decrypt']['calls'] > 0)
+    test_suite.assert_equals((1, 0), (stats['phases']['meta_read']['calls'], stats['phases']['write']['calls']))
+    test_suite.assert_equals(True, stats['allocations'] > 0 and stats['total_ms'] >= stats['phases']['kdf']['ms'])
+
+    output, stats = stats_command(exec, [CommandLineOptions.UPDATE_OPTION, 'acct1', CommandLineOptions.KEY_OPTION, vault_key,
+        CommandLineOptions.PASSWORD_OPTION, 'pw2'], env='json')
+    stats = json.loads(stats)
+    test_suite.assert_equals(True, stats['phases']['write']['calls'] > 0 and stats['phases']['encrypt']['calls'] > 0)
+    test_suite.assert_equals(0, stats['phases']['fsync']['calls']) # journal appends are not synced
+
+    # Rewriting the vault file (and its slot of the meta file) syncs both:
+    output, stats = stats_command(exec, [CommandLineOptions.VAULT_OPTION, 'update', CommandLineOptions.KEY_OPTION, vault_key,
+        CommandLineOptions.CIPHER_OPTION, 'chacha20-poly1305'], option='json')
+    stats = json.loads(stats)
+    test_suite.assert_equals(True, stats['phases']['fsync']['calls'] >= 2 and stats['phases']['write']['calls'] > 0)
+    test_suite.assert_equals(True, stats['plaintext_copied_bytes'] > 0)
+
+    output, stats = stats_command(exec, [CommandLineOptions.PRINT_OPTION, 'acct1', CommandLineOptions.KEY_OPTION, vault_key], env='1')
+    test_suite.assert_equals(build_console_output('un=un1', 'pw=pw2', 'note='), output)
+    test_suite.assert_equals(True, 'key derivation' in stats and 'total' in stats)
+
+    output, stats = stats_command(exec, [CommandLineOptions.PRINT_OPTION, 'acct1', CommandLineOptions.KEY_OPTION, vault_key], env='0')
+    test_suite.assert_equals('', stats)
+    test_suite.assert_equals('Error: Invalid stats format. The supported formats are text and json.',
+        stats_command(exec, [CommandLineOptions.PRINT_OPTION, 'acct1', CommandLineOptions.KEY_OPTION, vault_key], option='xml')[0])
+
+    test_suite.finish()
+
+    clean_dir()
+
+def test_data_dir(exec):
+    # tests that --data-dir and CLAM_HOME select the directory holding the meta file and vaults
+    clean_dir()
+
+    vault_key = 'key1'
+    test_suite = TestSuite('test_data_dir')
+
+    # The data directory is created, but its parent is not:
+    other_data_dir = WORK_DIR + '/other/data'
+    test_suite.assert_equals('Error: Failed to create the directory ' + other_data_dir + '/ (No such file or directory).',
+        exec_cmd(construct_cmd(exec, CommandLineOptions.DATA_DIR_OPTION, other_data_dir, CommandLineOptions.VAULT_OPTION, 'list')))
+    os.makedirs(WORK_DIR + '/other')
+
+    exec_cmd(construct_cmd(exec, CommandLineOptions.DATA_DIR_OPTION, other_data_dir, CommandLineOptions.ADD_OPTION, 'acct1',
+        CommandLineOptions.KEY_OPTION, vault_key, CommandLineOptions.USERNAME_OPTION, 'un1', CommandLineOptions.PASSWORD_OPTION, 'pw1'))
+    test_suite.assert_equals((True, True), (os.path.isfile(other_data_dir + '/meta'), os.path.isdir(other_data_dir + '/vaults')))
+    test_suite.assert_equals(False, os.path.exists(program_data_dir() + 'meta'))
+    test_suite.assert_equals(build_console_output('un=un1', 'pw=pw1', 'note='),
+        exec_cmd(construct_cmd(exec, CommandLineOptions.DATA_DIR_OPTION, other_data_dir + '/', CommandLineOptions.PRINT_OPTION, 'acct1',
+            CommandLineOptions.KEY_OPTION, vault_key)))
+
+    # CLAM_HOME selects the data directory of commands that are not given --data-dir:
+    test_suite.assert_equals(build_console_output('un=un1', 'pw=pw1', 'note='),
+        exec_cmd(construct_cmd('CLAM_HOME=' + other_data_dir, exec, CommandLineOptions.PRINT_OPTION, 'acct1', CommandLineOptions.KEY_OPTION, vault_key)))
+    exec_cmd(construct_cmd('CLAM_HOME=' + other_data_dir, exec, CommandLineOptions.DATA_DIR_OPTION, program_data_dir(), CommandLineOptions.ADD_OPTION,
+        'acct2', CommandLineOptions.KEY_OPTION, vault_key, CommandLineOptions.USERNAME_OPTION, 'un2', CommandLineOptions.PASSWORD_OPTION, 'pw2'))
+    test_suite.assert_equals(build_console_output('un=un2', 'pw=pw2', 'note='), print_command(exec, 'acct2', vault_key))
+    test_suite.assert_equals(build_console_output('acct1'),
+        exec_cmd(construct_cmd(exec, CommandLineOptions.DATA_DIR_OPTION, other_data_dir, CommandLineOptions.VAULT_OPTION, 'list',
+            CommandLineOptions.KEY_OPTION, vault_key)))
+
+    test_suite.finish()
+
+    shutil.rmtree(WORK_DIR + '/other')
+    clean_dir()
+
+def test_concurrency(exec):
+    # tests that commands that run at the same time never see a half-written vault, and that writers take turns
+    clean_dir()
+
+    vault_key = 'key1'
+    test_suite = TestSuite('test_concurrency')
+
+    add_command(exec, 'acct1', vault_key, 'un1', 'pw0')
+
+    # Readers print the account and list the vaults while a writer updates the password, rewrites the vault
+    # file (by changing its cipher suite) and adds enough vaults that the meta file is replaced as it grows:
+    num_updates, num_vaults = 40, 70
+    done = threading.Event()
+    failures = []
+    reads = [0]
+
+    def write():
+        for i in range(1, max(num_updates, num_vaults) + 1):
+            if i <= num_updates:
+                concurrent_command(exec, [CommandLineOptions.UPDATE_OPTION, 'acct1', CommandLineOptions.KEY_OPTION, vault_key,
+                    CommandLineOptions.PASSWORD_OPTION, 'pw' + str(i)])
+            if i % 10 == 0:
+                concurrent_command(exec, [CommandLineOptions.VAULT_OPTION, 'update', CommandLineOptions.KEY_OPTION, vault_key,
+                    CommandLineOptions.CIPHER_OPTION, 'aes-256-gcm' if i % 20 == 0 else 'chacha20-poly1305'])
+            if i <= num_vaults:
+                concurrent_command(exec, [CommandLineOptions.VAULT_OPTION, 'add', CommandLineOptions.NAME_OPTION, 'v' + str(i),
+                    CommandLineOptions.KEY_OPTION, vault_key])
+        done.set()
+
+    def read():
+        valid_accounts = set(build_console_output('un=un1', 'pw=pw' + str(i), 'note=') for i in range(num_updates + 1))
+        while not done.is_set():
+            account = concurrent_command(exec, [CommandLineOptions.PRINT_OPTION, 'acct1', CommandLineOptions.KEY_OPTION, vault_key])
+            vault_names = concurrent_command(exec, [CommandLineOptions.VAULT_OPTION, 'list']).split('\n')
+            if account not in valid_accounts:
+                failures.append(account)
+            if vault_names != ['default_vault'] + ['v' + str(i) for i in range(1, len(vault_names))]:
+                failures.append(vault_names)
+            reads[0] += 1
+
+    threads = [threading.Thread(target=write)] + [threading.Thread(target=read) for _ in range(3)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    test_suite.assert_equals([], failures[:3])
+    test_suite.assert_equals(True, reads[0] > 0)
+    test_suite.assert_equals(build_console_output('un=un1', 'pw=pw' + str(num_updates), 'note='), print_command(exec, 'acct1', vault_key))
+    test_suite.assert_equals(num_vaults + 1, len(list_command(exec).split('\n')))
+
+    # Writers that start at once all add their accounts:
+    num_writers = 24
+    processes = [subprocess.Popen([exec, CommandLineOptions.ADD_OPTION, 'acct-' + str(i), CommandLineOptions.KEY_OPTION, vault_key,
+        CommandLineOptions.USERNAME_OPTION, 'un', CommandLineOptions.PASSWORD_OPTION, 'pw' + str(i)], stdout=subprocess.PIPE) for i in range(num_writers)]
+    outputs = [process.communicate()[0].decode('UTF-8').rstrip('\t\n ') for process in processes]
+    test_suite.assert_equals([''] * num_writers, outputs)
+    test_suite.assert_equals([build_console_output('un=un', 'pw=pw' + str(i), 'note=') for i in range(num_writers)],
+        [print_command(exec, 'acct-' + str(i), vault_key) for i in range(num_writers)])
+
+    # A writer whose vault was written by another process since it was loaded merges its changes into that version,
+    # unless they change the same field (or remove an account that was changed):
+    libclam = load_libclam()
+    store = ctypes.c_void_p()
+    libclam.clam_store_open(program_data_dir().encode(), ctypes.byref(store))
+    vaults = [ctypes.c_void_p(), ctypes.c_void_p()]
+    for vault in vaults:
+        libclam.clam_vault_open(store, vault_key.encode(), ctypes.byref(vault))
+    libclam.clam_account_update(vaults[0], ctypes.byref(ClamAccount(b'acct-0', b'un-merged', b'pw0', None)))
+    libclam.clam_account_add(vaults[0], ctypes.byref(ClamAccount(b'merged-0', b'un', b'pw', None)))
+    libclam.clam_account_update(vaults[1], ctypes.byref(ClamAccount(b'acct-0', b'un', b'pw-merged', b'note-merged')))
+    libclam.clam_account_add(vaults[1], ctypes.byref(ClamAccount(b'merged-1', b'un', b'pw', None)))
+    libclam.clam_account_remove(vaults[1], b'acct-1')
+    test_suite.assert_equals([0, 0], [libclam.clam_vault_write(vault) for vault in vaults])
+    test_suite.assert_equals(build_console_output('un=un-merged', 'pw=pw-merged', 'note=note-merged'), print_command(exec, 'acct-0', vault_key))
+    test_suite.assert_equals((True, True, False), tuple(tag in list_command(exec, vault_key).split('\n') for tag in ['merged-0', 'merged-1', 'acct-1']))
+
+    libclam.clam_account_update(vaults[0], ctypes.byref(ClamAccount(b'acct-2', b'un', b'pw-first', None)))
+    libclam.clam_account_add(vaults[0], ctypes.byref(ClamAccount(b'conflict-0', b'un', b'pw', None)))
+    libclam.clam_account_update(vaults[1], ctypes.byref(ClamAccount(b'acct-2', b'un', b'pw-second', None)))
+    libclam.clam_account_add(vaults[1], ctypes.byref(ClamAccount(b'conflict-1', b'un', b'pw', None)))
+    test_suite.assert_equals([0, 13], [libclam.clam_vault_write(vault) for vault in vaults])
+    test_suite.assert_equals(b'Another process changed the same account while this command ran, so no change was written.',
+        libclam.clam_status_message(13))
+    test_suite.assert_equals((True, False), tuple(tag in list_command(exec, vault_key).split('\n') for tag in ['conflict-0', 'conflict-1']))
+    account = ClamAccount()
+    libclam.clam_account_get(vaults[1], b'acct-2', ctypes.byref(account))
+    test_suite.assert_equals(b'pw-first', account.password)
+    libclam.clam_account_free(ctypes.byref(account))
+
+    libclam.clam_account_update(vaults[0], ctypes.byref(ClamAccount(b'acct-3', b'un', b'pw-updated', None)))
+    libclam.clam_account_remove(vaults[1], b'acct-3')
+    test_suite.assert_equals([0, 13], [libclam.clam_vault_write(vault) for vault in vaults])
+    test_suite.assert_equals(build_console_output('un=un', 'pw=pw-updated', 'note='), print_command(exec, 'acct-3', vault_key))
+    for vault in vaults:
+        libclam.clam_vault_close(vault)
+    libclam.clam_store_close(store)
+
+    # A writer waits for the write lock while another process holds it:
+    with open(program_data_dir() + 'meta.lock', 'w') as lock_file:
+        fcntl.flock(lock_file, fcntl.LOCK_EX)
+        unlock_timer = threading.Timer(0.5, fcntl.flock, [lock_file, fcntl.LOCK_UN])
+        unlock_timer.start()
+        start = time.time()
+        test_suite.assert_equals('', update_command(exec, 'acct1', vault_key, CommandLineOptions.PASSWORD_OPTION, 'pw-locked'))
+        test_suite.assert_equals(True, time.time() - start >= 0.5)
+        unlock_timer.join()
+    test_suite.assert_equals(build_console_output('un=un1', 'pw=pw-locked', 'note='), print_command(exec, 'acct1', vault_key))
+
+    # A journal that is still next to the vault file that replaced its own (as readers may find it until the writer
+    # removes it) is not replayed onto the new file, which already holds its changes:
+    journal_filepath = os.path.join(os.path.dirname(get_vault_filepath('default_vault')), '.journal', 'default_vault')
+    update_cipher_command(exec, vault_key, 'chacha20-poly1305')
+    add_command(exec, 'stale', vault_key, 'un', 'pw')
+    stale_journal = read_raw_data(journal_filepath)
+    update_command(exec, 'stale', vault_key, CommandLineOptions.DELETE_OPTION)
+    update_cipher_command(exec, vault_key, 'chacha20-poly1305')
+    with open(journal_filepath, 'wb') as journal_file:
+        journal_file.write(stale_journal)
+    test_suite.assert_equals((False, True), tuple(tag in list_command(exec, vault_key).split('\n') for tag in ['stale', 'acct1']))
+
+    test_suite.finish()
+
+    clean_dir()
+
+"""
+    Runs clam with the given arguments, and returns its output void of trailing whitespace. Unlike exec_cmd,
+    it may be called by several threads at once.
+"""
+def concurrent_command(exec, args):
+    return subprocess.run([exec] + args, stdout=subprocess.PIPE).stdout.decode('UTF-8').rstrip('\t\n ')
+
+"""
+    Runs clam with the given arguments and stats enabled by the --stats option and/or the CLAM_STATS
+    variable, and returns its output and the stats it printed to stderr.
+"""
+def stats_command(exec, args, option=None, env=None):
+    cmd = [exec] + args
+    if option is not None:
+        cmd.append(CommandLineOptions.STATS_OPTION + '=' + option)
+    cmd_env = dict(os.environ)
+    if env is not None:
+        cmd_env['CLAM_STATS'] = env
+    process = subprocess.run(cmd, env=cmd_env, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    return process.stdout.decode('UTF-8').rstrip('\t\n '), process.stderr.decode('UTF-8')
+
+class ClamAccount(ctypes.Structure):
+    _fields_ = [('tag', ctypes.c_char_p), ('username', ctypes.c_char_p), ('password', ctypes.c_char_p), ('note', ctypes.c_char_p)]
+
+"""
+    Loads the shared library built alongside clam, and declares the signatures of its C ABI.
+"""
+def load_libclam():
+    libclam = ctypes.CDLL('./lib/' + program_name() + '/lib' + program_name() + '.so')
+    libclam.clam_store_open.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_void_p)]
+    libclam.clam_store_close.argtypes = [ctypes.c_void_p]
+    libclam.clam_vault_open.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.POINTER(ctypes.c_void_p)]
+    libclam.clam_vault_write.argtypes = [ctypes.c_void_p]
+    libclam.clam_vault_close.argtypes = [ctypes.c_void_p]
+    libclam.clam_account_get.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.POINTER(ClamAccount)]
+    libclam.clam_account_add.argtypes = [ctypes.c_void_p, ctypes.POINTER(ClamAccount)]
+    libclam.clam_account_update.argtypes = [ctypes.c_void_p, ctypes.POINTER(ClamAccount)]
+    libclam.clam_account_remove.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+    libclam.clam_account_free.argtypes = [ctypes.POINTER(ClamAccount)]
+    libclam.clam_status_message.argtypes = [ctypes.c_int]
+    libclam.clam_status_message.restype = ctypes.c_char_p
+    return libclam
+
+"""
+    Writes the given text to a file in the program data directory, and returns its path.
+"""
+def write_import_file(file_name, text):
+    file_path = program_data_dir() + file_name
+    with open(file_path, 'w', newline='') as file:
+        file.write(text)
+    return file_path
+
+def import_command(exec, file_path, vault_key):
+    return exec_cmd(construct_cmd(exec, CommandLineOptions.IMPORT_OPTION, file_path, CommandLineOptions.KEY_OPTION, vault_key))
+
+def export_command(exec, vault_key, format=None):
+    cmd = construct_cmd(exec, CommandLineOptions.EXPORT_OPTION, CommandLineOptions.KEY_OPTION, vault_key)
+    if format is not None:
+        cmd = construct_cmd(cmd, CommandLineOptions.FORMAT_OPTION, format)
+    return exec_cmd(cmd)
+
+def import_kdbx_command(exec, file_path, kdbx_key, vault_key):
+    return exec_cmd(construct_cmd(exec, CommandLineOptions.IMPORT_KDBX_OPTION, file_path,
+        CommandLineOptions.KDBX_KEY_OPTION, kdbx_key, CommandLineOptions.KEY_OPTION, vault_key))
+
+"""
+    Returns the given fields as one record of the binary batch form.
+"""
+def binary_batch_record(fields):
+    return struct.pack('<I', len(fields)) + b''.join(struct.pack('<I', len(field)) + field.encode() for field in fields)
+
+"""
+    Writes the given commands to a batch file, and returns its path.
+"""
+def batch_file(commands, binary=False):
+    file_path = program_data_dir() + 'batch'
+    with open(file_path, 'wb') as file:
+        if binary:
+            file.write(b'\0clam-batch' + b''.join(binary_batch_record(command) for command in commands))
+        else:
+            escape = lambda field: field.replace('\\', '\\\\').replace('\t', '\\t').replace('\n', '\\n')
+            file.write(''.join('\t'.join(escape(field) for field in command) + '\n' for command in commands).encode())
+    return file_path
+
+"""
+    Applies the given commands as one batch, and returns the replies (as bytes in the binary form).
+"""
+def batch_command(exec, vault_key, commands, binary=False):
+    cmd = construct_cmd(exec, CommandLineOptions.BATCH_OPTION, CommandLineOptions.KEY_OPTION, vault_key,
+        CommandLineOptions.FILE_OPTION, batch_file(commands, binary))
+    if binary:
+        return subprocess.run(cmd, shell=True, stdout=subprocess.PIPE).stdout
+    return exec_cmd(cmd)
+
+"""
+    Starts an agent for the active vault and returns the environment variables that point commands at it.
+"""
+def start_agent(exec, vault_key, timeout=None):
+    cmd = construct_cmd(exec, CommandLineOptions.AGENT_OPTION, CommandLineOptions.KEY_OPTION, vault_key)
+    if timeout is not None:
+        cmd = construct_cmd(cmd, CommandLineOptions.TIMEOUT_OPTION, str(timeout))
+    agent_env = {}
+    for line in exec_cmd(cmd).split('\n'):
+        if '; export ' in line:
+            name, value = line.split(';')[0].split('=', 1)
+            agent_env[name] = value
+    return agent_env
+
+"""
+    Returns the KDF algorithm of the given vault, which must be the only vault in the meta file (and so in its first slot).
+"""
+def read_kdf_algorithm(vault_name):
+    meta = read_raw_data(program_data_dir() + 'meta')
+    capacity = int.from_bytes(meta[8:12], 'little')
+    offset = 512 + capacity * 2 * 4 # header block, name index
+    offset += 4 + 256 + 32 + 32 # name size, name, hash, salt
+    return int.from_bytes(meta[offset:offset + 4], 'little')
+
+"""
+    Returns the meta log (see VaultManager::endMetaWrite) that writes the blocks at the given offsets of the given
+    contents to the meta file.
+"""
+def meta_log(block_offsets, meta):
+    log = struct.pack('<QI', os.stat(program_data_dir() + 'meta').st_ino, len(block_offsets))
+    for offset in block_offsets:
+        log += struct.pack('<QI', offset, 512) + meta[offset:offset + 512]
+    return log + hashlib.sha256(log).digest()
+
+"""
+    Overwrites the meta file in place (as a writer that crashed would have left it) with the given contents.
+"""
+def write_meta_file(meta):
+    with open(program_data_dir() + 'meta', 'r+b') as meta_file:
+        meta_file.write(meta)
+
+"""
+    Returns a random string of n characters, or of a random length between min_length and 1024 if n is not given.
+"""
+def gen_rand_str(n=None, min_length=1):
+    if n is None:
+        n = random.randint(min_length, 1024)
     return ''.join(random.SystemRandom().choice(string.ascii_uppercase + string.digits) for _ in range(n))
 
 def get_vault_filepath(vault_name):
-    return program_data_dir() + 'vaults/' + vault_name
+    return program_data_dir() + 'vaults/' + hashlib.sha256(vault_name.encode()).hexdigest()[:2] + '/' + vault_name
 
 def read_raw_data(file_path):
     file = open(file_path, "rb")
@@ -469,10 +1286,24 @@ def read_raw_data(file_path):
     file.close()
     return data
 
+"""
+    Returns the raw contents of the given vault's file followed by the raw contents of its journal, if it has one.
+"""
+def read_raw_vault_data(vault_name):
+    data = read_raw_data(get_vault_filepath(vault_name))
+    journal_filepath = os.path.join(os.path.dirname(get_vault_filepath(vault_name)), '.journal', vault_name)
+    if os.path.exists(journal_filepath):
+        data += read_raw_data(journal_filepath)
+    return data
+
+# Minimum length of the account data that test_crypto looks for in the encrypted vault (a shorter string would
+# occur in the random-looking ciphertext by chance once in a while):
+CRYPTO_TEST_MIN_PLAINTEXT_LENGTH = 16
+
 """
     Tests the cryptographic integrity of the application.
 """
-def test_crypto(exec):
+def test_crypto(exec, shard=0, num_shards=1):
     # For X iterations:
         # Generate a random value for a vault key and name
         # Execute an add vault command to create a vault using that key and name
@@ -481,20 +1312,21 @@ def test_crypto(exec):
         # For Y iterations:
             # Execute an add command to add these acct details to the vault
             # Execute a print command(s) and verify that these account details were correctly encrypted and decrypted
-            # Parse the vault file to verify that it does not contain a substring that is equal to the acct tag, username, password, or note
+            # Parse the vault file and journal to verify that it does not contain a substring that is equal to the acct tag, username, password, or note
             # Store the raw vault data in a set
             # Iterate through the set of raw vault data and assert that no entry in the set is equal to another
+    # The datasets are independent, so they may be split into shards (which run every num_shards-th dataset).
 
     clean_dir()
 
-    test_suite = TestSuite('test_crypto')
+    test_suite = TestSuite('test_crypto' if num_shards == 1 else 'test_crypto ' + str(shard + 1) + '/' + str(num_shards))
 
     # Number of random datasets to re-encrypt & number of times to re-encrypt each dataset:
     num_datasets, num_encryptions = 20, 100
 
     total_iterations = num_datasets * num_encryptions
 
-    for i in range(num_datasets):
+    for i in range(shard, num_datasets, num_shards):
 
         sys.stdout.write("\033[K") # clear line
         sys.stdout.write('Running test_crypto: ' + str(100 * (i * num_encryptions / total_iterations)) + '% complete...\r')
@@ -506,14 +1338,14 @@ def test_crypto(exec):
         add_vault_command(exec, vault_name, vault_key)
         switch_vault_command(exec, vault_name, vault_key)
 
-        # Generate random account data:
-        acct_tag = gen_rand_str()
+        # Generate random account data, long enough that the ciphertext is unlikely to contain it by chance:
+        acct_tag = gen_rand_str(min_length=CRYPTO_TEST_MIN_PLAINTEXT_LENGTH)
         acct_tag_bin = acct_tag.encode()
-        acct_username = gen_rand_str()
+        acct_username = gen_rand_str(min_length=CRYPTO_TEST_MIN_PLAINTEXT_LENGTH)
         acct_username_bin = acct_username.encode()
-        acct_password = gen_rand_str()
+        acct_password = gen_rand_str(min_length=CRYPTO_TEST_MIN_PLAINTEXT_LENGTH)
         acct_password_bin = acct_password.encode()
-        acct_note = gen_rand_str()
+        acct_note = gen_rand_str(min_length=CRYPTO_TEST_MIN_PLAINTEXT_LENGTH)
         acct_note_bin = acct_note.encode()
 
         encrypted_vault_data_set = set() # set of raw encrypted vault data for this plaintext dataset
@@ -524,7 +1356,7 @@ def test_crypto(exec):
             test_suite.assert_equals(build_console_output('un=' + acct_username, 'pw=' + acct_password, 'note=' + acct_note).encode(),
                                      print_command(exec, acct_tag, vault_key).encode())
 
-            encrypted_vault_data = read_raw_data(get_vault_filepath(vault_name))
+            encrypted_vault_data = read_raw_vault_data(vault_name)
 
             # Assert that the encrypted file contains no substrings equal to any of the raw plaintext input data:
             test_suite.assert_equals(True, acct_tag_bin not in encrypted_vault_data
@@ -545,11 +1377,53 @@ def test_crypto(exec):
     clean_dir()
 
 
+TEST_SUITES = [test_vault, test_meta_migration, test_print, test_clip, test_update, test_add, test_search, test_cipher, test_kdf,
+    test_agent, test_batch, test_import_export, test_import_kdbx, test_library, test_stats, test_data_dir, test_concurrency, test_crypto]
+
+"""
+    Runs the given test suite (e.g. test_print, or test_crypto:2/4 for the second of four shards of
+    test_crypto) in this process.
+"""
+def run_test_suite(exec, suite):
+    name, _, shard = suite.partition(':')
+    test = globals()[name]
+    if shard:
+        shard, num_shards = shard.split('/')
+        test(exec, int(shard) - 1, int(num_shards))
+    else:
+        test(exec)
+
+"""
+    Runs the given test suites in up to 'jobs' processes at a time, each of which has a data directory
+    of its own, and prints the output of the suites in the given order. test_crypto, which takes
+    longer than all the other suites together, is split into 'jobs' shards.
+"""
+def run_test_suites_in_parallel(suites, jobs):
+    sharded_suites = []
+    for suite in suites:
+        if suite == 'test_crypto':
+            sharded_suites += [suite + ':' + str(shard) + '/' + str(jobs) for shard in range(1, jobs + 1)]
+        else:
+            sharded_suites.append(suite)
+
+    def run_worker(suite):
+        return subprocess.run([sys.executable, __file__, suite], stdout=subprocess.PIPE, stderr=subprocess.STDOUT).stdout.decode('UTF-8')
+
+    with concurrent.futures.ThreadPoolExecutor(max_workers=jobs) as executor:
+        for output in executor.map(run_worker, sharded_suites):
+            sys.stdout.write(output)
+            sys.stdout.flush()
+
 if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description='Runs the tests of ' + program_name() + ' (./bin/' + program_name() + ').')
+    parser.add_argument('-j', '--jobs', type=int, default=1, help='number of test suites (or shards of test_crypto) to run at a time')
+    parser.add_argument('suites', nargs='*', default=[test.__name__ for test in TEST_SUITES],
+        help='test suites to run (default: all of them)')
+    args = parser.parse_args()
+
     exec = './bin/' + program_name()
-    test_vault(exec)
-    test_print(exec)
-    test_clip(exec)
-    test_update(exec)
-    test_add(exec)
-    test_crypto(exec)
+    if args.jobs > 1:
+        run_test_suites_in_parallel(args.suites, args.jobs)
+    else:
+        for suite in args.suites:
+            run_test_suite(exec, suite)